@@ -8,69 +8,76 @@
 #include "atfs.h"
 #include "atfs_util.h"
 #include "atfs_alloc.h"
+#include "atfs_dscan.h"
+#include "atfs_file.h"
+#include "atfs_hdir.h"
+#include "atfs_sdir.h"
 #include <assert.h>
 #include <ctype.h>
 #include <string.h>
 
 const u8 ATFS_SIGNATURE[4] = { 'A', 'T', 'F', 'S' };
 
+u64 atfs_op_calls[ATFS_OP_COUNT];
+
+_Static_assert(ATFS_OP_COUNT <= DEV_IO_TAG_COUNT,
+	"every operation needs its own I/O accounting tag");
+
 /* --- PRIVATE --- */
 static void _dir_entry_write(u8 *buf, ATFS_DirEntry *entry)
 {
 	atfs_write32(buf + ATFS_DIR_ENTRY_OFFSET_START, entry->StartBlock);
 	atfs_write32(buf + ATFS_DIR_ENTRY_OFFSET_SIZE, entry->SizeBlocks);
-	buf[ATFS_DIR_ENTRY_OFFSET_TYPE] = entry->Type;
+	buf[ATFS_DIR_ENTRY_OFFSET_TYPE] = entry->Type |
+		atfs_name_tag(entry->Name, strlen(entry->Name));
 	strncpy((char *)(buf + ATFS_DIR_ENTRY_OFFSET_NAME), entry->Name,
 		ATFS_MAX_FILE_NAME_LENGTH + 1);
 }
 
-static void _dir_entry_get(u8 *buf, ATFS_DirEntry *entry)
+static void _dir_entry_get(const u8 *buf, ATFS_DirEntry *entry)
 {
-	entry->Type = buf[ATFS_DIR_ENTRY_OFFSET_TYPE];
+	entry->Type = buf[ATFS_DIR_ENTRY_OFFSET_TYPE] & ATFS_TYPE_MASK;
 	entry->StartBlock = atfs_read32(buf + ATFS_DIR_ENTRY_OFFSET_START);
 	entry->SizeBlocks = atfs_read32(buf + ATFS_DIR_ENTRY_OFFSET_SIZE);
 	strncpy(entry->Name, (char *)(buf + ATFS_DIR_ENTRY_OFFSET_NAME),
 		ATFS_MAX_FILE_NAME_LENGTH + 1);
 }
 
-ATFS_Status _dir_entry_insert(BlockDevice *dev, u32 block,
-	ATFS_DirEntry *entry)
+ATFS_Status _dir_entry_insert(BlockDevice *dev, u32 block, u32 size,
+	ATFS_DirEntry *entry, u32 *entry_block, u32 *entry_offset)
 {
 	u8 buf[dev->BlockSize];
-	u32 i, cur, offset, insert_index, entry_type;
-	const char *entry_name;
+	u32 i, cur, offset, insert_index, max_entries;
+	size_t len;
+	u8 tag;
 
-	insert_index = ATFS_DIR_MAX_ENTRIES;
-	offset = dev->BlockSize;
-	cur = block;
-	for(i = 0; i < ATFS_DIR_MAX_ENTRIES; ++i)
+	/* The whole directory is checked for the name,
+		the entry goes into the first free slot */
+	max_entries = size << (dev->BlockSizePOT - ATFS_DIR_ENTRY_SIZE_POT);
+	insert_index = max_entries;
+	len = strlen(entry->Name);
+	tag = atfs_name_tag(entry->Name, len);
+	for(cur = block, i = 0; cur < block + size; ++cur)
 	{
-		if(offset == dev->BlockSize)
+		PROPAGATE(dev_read(dev, cur, 1, buf));
+		if(atfs_dscan_find(buf, dev->BlockSize, entry->Name, len, tag) <
+			dev->BlockSize)
 		{
-			offset = 0;
-			PROPAGATE(dev->Read(cur, 1, buf));
-			++cur;
+			return ATFS_STATUS_EXISTS;
 		}
 
-		entry_type = buf[offset + ATFS_DIR_ENTRY_OFFSET_TYPE];
-		entry_name = (const char *)(entry + ATFS_DIR_ENTRY_OFFSET_NAME);
-		if(entry_type == ATFS_TYPE_FREE)
+		for(offset = 0; offset < dev->BlockSize;
+			offset += ATFS_DIR_ENTRY_SIZE, ++i)
 		{
-			if(insert_index == ATFS_DIR_MAX_ENTRIES)
+			if(insert_index == max_entries &&
+				buf[offset + ATFS_DIR_ENTRY_OFFSET_TYPE] == ATFS_TYPE_FREE)
 			{
 				insert_index = i;
 			}
 		}
-		else if(!strcmp(entry_name, entry->Name))
-		{
-			insert_index = i;
-			break;
-		}
-
-		offset += ATFS_DIR_ENTRY_SIZE;
 	}
 
-	if(insert_index == ATFS_DIR_MAX_ENTRIES)
+	if(insert_index == max_entries)
 	{
 		return ATFS_STATUS_DIRECTORY_FULL;
 	}
@@ -79,9 +86,11 @@ ATFS_Status _dir_entry_insert(BlockDevice *dev, u32 block,
 	cur = block + (insert_index >> i);
 	offset = (insert_index & ((1 << i) - 1)) << ATFS_DIR_ENTRY_SIZE_POT;
 
-	PROPAGATE(dev->Read(cur, 1, buf));
+	PROPAGATE(dev_read(dev, cur, 1, buf));
 	_dir_entry_write(buf + offset, entry);
-	PROPAGATE(dev->Write(cur, 1, buf));
+	PROPAGATE(dev_write(dev, cur, 1, buf));
+	*entry_block = cur;
+	*entry_offset = offset;
 	return ATFS_STATUS_OK;
 }
 
@@ -97,6 +106,11 @@ const char *atfs_status_string(ATFS_Status status)
 		"Out of bounds file access",
 		"End of directory reached",
 		"Not implemented",
+		"Out of memory",
+		"Not an ATFS volume or corrupted",
+		"Volume not mounted",
+		"Invalid argument",
+		"File exists",
 	};
 
 	if(status < DEVICE_STATUS_COUNT)
@@ -109,50 +123,156 @@ const char *atfs_status_string(ATFS_Status status)
 	return status_str[status];
 }
 
-ATFS_Status atfs_dopen(BlockDevice *dev, const char *path, ATFS_Dir *dir)
+u32 atfs_op_enter(ATFS_Op op)
+{
+	u32 prev = dev_io_tag;
+	__atomic_fetch_add(&atfs_op_calls[op], 1, __ATOMIC_RELAXED);
+	dev_io_tag = op;
+	return prev;
+}
+
+void atfs_op_leave(u32 prev)
+{
+	dev_io_tag = prev;
+}
+
+const char *atfs_op_string(u32 op)
+{
+	static const char *op_str[] =
+	{
+		"other",
+		"format",
+		"create",
+		"open",
+		"read",
+		"write",
+		"dopen",
+		"dread",
+		"alloc",
+		"free",
+		"delete",
+		"move",
+		"defrag",
+		"statfs",
+		"close",
+		"resize",
+	};
+
+	assert(op < ARRLEN(op_str));
+	return op_str[op];
+}
+
+static ATFS_Status _dopen(BlockDevice *dev, const char *path, ATFS_Dir *dir)
 {
 	dir->Block = 0;
 	dir->Offset = 0;
+	dir->Overflow = 0;
+	PROPAGATE(atfs_dir_format(dev, &dir->Format));
 	return atfs_fopen(dev, path, &dir->InternalFile);
 }
 
-ATFS_Status atfs_dread(ATFS_Dir *dir, ATFS_DirEntry *entry)
+ATFS_Status atfs_dopen(BlockDevice *dev, const char *path, ATFS_Dir *dir)
 {
-	BlockDevice *dev = dir->InternalFile.Device;
-	u8 buf[dev->BlockSize];
+	ATFS_OP(ATFS_OP_DOPEN, _dopen(dev, path, dir));
+}
 
-	if(dir->Block >= dir->InternalFile.SizeBlocks)
+ATFS_Status atfs_dclose(ATFS_Dir *dir)
+{
+	return atfs_fclose(&dir->InternalFile);
+}
+
+/* Next entry of a block with fixed size entries,
+	ATFS_STATUS_DIR_END if there is none */
+static ATFS_Status _block_next(BlockDevice *dev, const u8 *data,
+	ATFS_Dir *dir, ATFS_DirEntry *entry)
+{
+	for(; dir->Offset < dev->BlockSize; dir->Offset += ATFS_DIR_ENTRY_SIZE)
+	{
+		if(data[dir->Offset + ATFS_DIR_ENTRY_OFFSET_TYPE] != ATFS_TYPE_FREE)
+		{
+			_dir_entry_get(data + dir->Offset, entry);
+			dir->Offset += ATFS_DIR_ENTRY_SIZE;
+			return ATFS_STATUS_OK;
+		}
+	}
+
+	return ATFS_STATUS_DIR_END;
+}
+
+/* Next entry of a sorted directory block in name order */
+static ATFS_Status _block_next_sorted(BlockDevice *dev, const u8 *data,
+	ATFS_Dir *dir, ATFS_DirEntry *entry)
+{
+	u32 count, offset;
+
+	PROPAGATE(atfs_sdir_count(dev, data, &count));
+	if(dir->Offset >= count)
 	{
 		return ATFS_STATUS_DIR_END;
 	}
 
-	PROPAGATE(atfs_fread(&dir->InternalFile, dir->Block, 1, buf));
-	for(;;)
+	PROPAGATE(atfs_sdir_entry(dev, data, dir->Offset++, &offset));
+	_dir_entry_get(data + offset, entry);
+	return ATFS_STATUS_OK;
+}
+
+static ATFS_Status _dread(ATFS_Dir *dir, ATFS_DirEntry *entry)
+{
+	ATFS_File *file = &dir->InternalFile;
+	BlockDevice *dev = file->Device;
+	u8 buf[dev->BlockSize];
+	const u8 *data;
+	u32 block, next;
+	ATFS_Status status;
+
+	while(dir->Block < file->SizeBlocks)
 	{
-		if(buf[dir->Offset + ATFS_DIR_ENTRY_OFFSET_TYPE] != ATFS_TYPE_FREE)
+		block = dir->Overflow ? dir->Overflow : file->StartBlock + dir->Block;
+		if(!dir->Offset)
 		{
-			_dir_entry_get(buf + dir->Offset, entry);
-			dir->Offset += ATFS_DIR_ENTRY_SIZE;
-			if(dir->Offset >= dev->BlockSize)
+			if(!dir->Overflow)
 			{
-				dir->Offset = 0;
-				++dir->Block;
+				atfs_readahead(file, dir->Block, 1);
 			}
 
-			return ATFS_STATUS_OK;
+			/* The first slot of a bucket is its header */
+			if(dir->Format == ATFS_DIR_HASHED)
+			{
+				dir->Offset = ATFS_DIR_ENTRY_SIZE;
+			}
 		}
 
-		dir->Offset += ATFS_DIR_ENTRY_SIZE;
-		if(dir->Offset >= dev->BlockSize)
+		PROPAGATE(dev_map(dev, block, buf, &data));
+		status = dir->Format == ATFS_DIR_SORTED ?
+			_block_next_sorted(dev, data, dir, entry) :
+			_block_next(dev, data, dir, entry);
+		if(status != ATFS_STATUS_DIR_END)
 		{
-			dir->Offset = 0;
-			++dir->Block;
-			if(dir->Block >= dir->InternalFile.SizeBlocks)
-			{
-				return ATFS_STATUS_DIR_END;
-			}
+			dev_unmap(dev, block);
+			return status;
+		}
 
-			PROPAGATE(atfs_fread(&dir->InternalFile, dir->Block, 1, buf));
+		/* A bucket continues in its overflow blocks */
+		next = dir->Format == ATFS_DIR_HASHED ?
+			atfs_read32(data + ATFS_BUCKET_OFFSET_NEXT) : 0;
+		dev_unmap(dev, block);
+		if(next >= dev->BlockCount)
+		{
+			return ATFS_STATUS_INVALID_VOLUME;
+		}
+
+		dir->Offset = 0;
+		dir->Overflow = next;
+		if(!next)
+		{
+			++dir->Block;
 		}
 	}
+
+	return ATFS_STATUS_DIR_END;
+}
+
+ATFS_Status atfs_dread(ATFS_Dir *dir, ATFS_DirEntry *entry)
+{
+	ATFS_OP(ATFS_OP_DREAD, _dread(dir, entry));
 }
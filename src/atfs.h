@@ -34,7 +34,19 @@
 #define ATFS_SIZE_BOOT              1
 
 /** Current FS Revision */
-#define ATFS_REVISION               1
+#define ATFS_REVISION               5
+
+/** First revision with allocation groups */
+#define ATFS_REVISION_GROUPS        2
+
+/** First revision with complete free space summaries */
+#define ATFS_REVISION_SUMMARY       3
+
+/** First revision with a directory format in the boot block */
+#define ATFS_REVISION_DIR_FORMAT    4
+
+/** First revision with name tags in the type byte of directory entries */
+#define ATFS_REVISION_NAME_TAGS     5
 
 /* --- Directory entries --- */
 
@@ -44,9 +56,6 @@
 /** Size of a directory entry in bytes */
 #define ATFS_DIR_ENTRY_SIZE          (1 << ATFS_DIR_ENTRY_SIZE_POT)
 
-/** Maximum number of entries in a directory */
-#define ATFS_DIR_MAX_ENTRIES       32
-
 /** Byte offset of the file starting block number in a directory entry */
 #define ATFS_DIR_ENTRY_OFFSET_START 0
 
@@ -62,6 +71,79 @@
 /** Maximum length of a file name */
 #define ATFS_MAX_FILE_NAME_LENGTH  54
 
+/* --- Files in several extents --- */
+
+/*
+ * A file that grew and could not be extended in place is stored in several
+ * extents and has ATFS_TYPE_FLAG_EXTENTS set in its type byte. The size
+ * field of its directory entry is the capacity of all extents together.
+ * Up to ATFS_INLINE_EXTENTS extents are stored at the end of the directory
+ * entry if the name is short enough, the start field then holds the first
+ * extent. Otherwise ATFS_TYPE_FLAG_INDIRECT is set and the start field
+ * points to a chain of extent blocks.
+ */
+
+/** Type flag of a file stored in several extents */
+#define ATFS_TYPE_FLAG_EXTENTS      0x80
+
+/** Type flag of a file whose extents are in extent blocks */
+#define ATFS_TYPE_FLAG_INDIRECT     0x40
+
+/** Mask for the file type without the flags and the name tag */
+#define ATFS_TYPE_MASK              0x03
+
+/* --- Name tags --- */
+
+/*
+ * The type byte of a directory entry also holds a small tag derived from
+ * the hash and the length of the name (1 to 15, see atfs_dscan.h). A scan
+ * compares the tag of every entry first and only compares the names of
+ * entries whose tag matches. Entries written before revision
+ * 5 have tag 0, their names are always compared.
+ */
+
+/** Bits of the type byte that hold the name tag */
+#define ATFS_TYPE_TAG_MASK          0x3C
+
+/** Position of the name tag in the type byte */
+#define ATFS_TYPE_TAG_SHIFT         2
+
+/** Byte offset of the extents in a directory entry */
+#define ATFS_DIR_ENTRY_OFFSET_EXTENTS 40
+
+/** Number of extents in a directory entry */
+#define ATFS_INLINE_EXTENTS          3
+
+/** Longest name of a file with extents in its directory entry */
+#define ATFS_INLINE_EXTENTS_NAME_LENGTH \
+	(ATFS_DIR_ENTRY_OFFSET_EXTENTS - ATFS_DIR_ENTRY_OFFSET_NAME - 1)
+
+/** Size of an extent (start block and number of blocks) in bytes */
+#define ATFS_EXTENT_SIZE             8
+
+/** Byte offset of the next extent block in an extent block, 0 for none */
+#define ATFS_EXTENT_BLOCK_OFFSET_NEXT  0
+
+/** Byte offset of the number of extents in an extent block */
+#define ATFS_EXTENT_BLOCK_OFFSET_COUNT 4
+
+/** Byte offset of the first extent in an extent block */
+#define ATFS_EXTENT_BLOCK_OFFSET_LIST  8
+
+/**
+ * Starting block of a file that was created with delayed allocation and
+ * has no blocks yet. Block 0 is the boot block, so no file can start there.
+ */
+#define ATFS_START_DELAYED          0
+
+/* --- Read-ahead --- */
+
+/** Initial read-ahead window in blocks after sequential access is detected */
+#define ATFS_READAHEAD_MIN          4
+
+/** Maximum read-ahead window in blocks, the window doubles up to this */
+#define ATFS_READAHEAD_MAX         16
+
 /* --- Boot block --- */
 
 /** FS Signature (bytes 0-4) */
@@ -85,8 +167,105 @@ extern const u8 ATFS_SIGNATURE[4];
 /** Offset of root block size in ATFS boot block */
 #define ATFS_OFFSET_ROOT_SIZE      20
 
-/** Error propagation macro */
-#define PROPAGATE(X) do { int a = X; if(a) { return a; } } while(0)
+/** Offset of the number of allocation groups in ATFS boot block */
+#define ATFS_OFFSET_GROUP_COUNT    24
+
+/** Offset of the size of an allocation group in blocks in ATFS boot block */
+#define ATFS_OFFSET_GROUP_SIZE     28
+
+/* --- Allocation groups --- */
+
+/*
+ * Every allocation group has its own free list. The head of the list is
+ * the boot block for group 0 and the first block of the group for all
+ * others, it uses the same offsets for the next free area as the boot
+ * block and additionally holds a summary of the free space of the group.
+ */
+
+/** Byte offset of the number of free blocks in a free list head */
+#define ATFS_OFFSET_GROUP_FREE     32
+
+/** Byte offset of the number of free areas in a free list head */
+#define ATFS_OFFSET_GROUP_AREAS    36
+
+/**
+ * Byte offset of the size of the largest free area in a free list head.
+ * Exact after the volume was mounted, an upper bound after allocations
+ * on a volume that is not mounted.
+ */
+#define ATFS_OFFSET_GROUP_LARGEST  40
+
+/** Smallest allocation group in blocks */
+#define ATFS_MIN_GROUP_SIZE        16
+
+/* --- Free space bitmap --- */
+
+/*
+ * Volumes formatted with ATFS_ALLOCATOR_BITMAP have no free list. One bit
+ * per block (bit i of byte i / 8, set if the block is used) is stored in
+ * the blocks after the root directory. The summary in the boot block is
+ * kept up to date as for the free list.
+ */
+
+/** Offset of the free space allocator (ATFS_Allocator) in the boot block */
+#define ATFS_OFFSET_ALLOCATOR      44
+
+/** Offset of the first block of the bitmap in the boot block */
+#define ATFS_OFFSET_BITMAP_BLOCK   48
+
+/** Offset of the number of bitmap blocks in the boot block */
+#define ATFS_OFFSET_BITMAP_SIZE    52
+
+/* --- Hashed directories --- */
+
+/*
+ * On volumes formatted with ATFS_DIR_HASHED every block of a directory is
+ * a hash bucket: a name is stored in the block given by its hash modulo the
+ * directory size in blocks. The first entry slot of a bucket block is a
+ * header with the type ATFS_TYPE_FREE, its start field links to an
+ * overflow block with the same layout when the bucket is full. Overflow
+ * blocks are allocated near the directory and are not part of its size.
+ */
+
+/** Offset of the directory format (ATFS_DirFormat) in the boot block */
+#define ATFS_OFFSET_DIR_FORMAT     56
+
+/** Byte offset of the next overflow block in a bucket header, 0 if none */
+#define ATFS_BUCKET_OFFSET_NEXT     ATFS_DIR_ENTRY_OFFSET_START
+
+/* --- Sorted directories --- */
+
+/*
+ * On volumes formatted with ATFS_DIR_SORTED every directory block starts
+ * with the number of entries and the start of the entry area, followed by
+ * the byte offsets of the entries sorted by name. The entries are packed
+ * from the end of the block towards the offsets and are only as long as
+ * their name: start, size, type and the null-terminated name at the same
+ * offsets as in a fixed size entry. The first and last name in sorted
+ * order are the key range of the block. The used blocks come first and
+ * their key ranges follow each other in name order. Splitting a full
+ * block moves entries into other blocks and to other offsets, the moves
+ * are reported with atfs_mount_moved. A file in several extents always
+ * uses extent blocks.
+ */
+
+/** Byte offset of the number of entries in a sorted directory block */
+#define ATFS_SDIR_OFFSET_COUNT      0
+
+/** Byte offset of the first byte of the entry area, 0 if the block is empty */
+#define ATFS_SDIR_OFFSET_LOW        2
+
+/** Byte offset of the sorted entry offsets (16 bit each) */
+#define ATFS_SDIR_OFFSET_SLOTS      4
+
+/** Size of an entry offset in bytes */
+#define ATFS_SDIR_SLOT_SIZE         2
+
+/** Largest block size for sorted directories, offsets are 16 bit */
+#define ATFS_SDIR_MAX_BLOCK_SIZE    65536
+
+/** Size of a packed entry with a name of `len` characters */
+#define ATFS_SDIR_ENTRY_SIZE(len)   (ATFS_DIR_ENTRY_OFFSET_NAME + (len) + 1)
 
 /** ATFS status code enum */
 enum
@@ -99,10 +278,51 @@ enum
 	ATFS_STATUS_OUT_OF_BOUNDS,
 	ATFS_STATUS_DIR_END,
 	ATFS_STATUS_NOT_IMPLEMENTED,
+	ATFS_STATUS_OUT_OF_MEMORY,
+	ATFS_STATUS_INVALID_VOLUME,
+	ATFS_STATUS_NOT_MOUNTED,
+	ATFS_STATUS_INVALID_ARGUMENT,
+	ATFS_STATUS_EXISTS,
 };
 
 typedef int ATFS_Status;
 
+/** ATFS API operations, device I/O is accounted to the innermost one */
+typedef enum
+{
+	ATFS_OP_OTHER,
+	ATFS_OP_FORMAT,
+	ATFS_OP_CREATE,
+	ATFS_OP_OPEN,
+	ATFS_OP_READ,
+	ATFS_OP_WRITE,
+	ATFS_OP_DOPEN,
+	ATFS_OP_DREAD,
+	ATFS_OP_ALLOC,
+	ATFS_OP_FREE,
+	ATFS_OP_DELETE,
+	ATFS_OP_MOVE,
+	ATFS_OP_DEFRAG,
+	ATFS_OP_STATFS,
+	ATFS_OP_CLOSE,
+	ATFS_OP_RESIZE,
+	ATFS_OP_COUNT,
+} ATFS_Op;
+
+/** Number of calls of every API operation */
+extern u64 atfs_op_calls[ATFS_OP_COUNT];
+
+/** Return the result of `call`, accounting its device I/O to `op` */
+#define ATFS_OP(op, call) \
+	do \
+	{ \
+		u32 prev_op = atfs_op_enter(op); \
+		ATFS_Status op_status = (call); \
+		atfs_op_leave(prev_op); \
+		return op_status; \
+	} \
+	while(0)
+
 /** ATFS File type enum */
 typedef enum
 {
@@ -111,6 +331,80 @@ typedef enum
 	ATFS_TYPE_FILE,
 } ATFS_FileType;
 
+/** How free space is tracked on disk */
+typedef enum
+{
+	/** Sorted linked list of free areas per allocation group */
+	ATFS_ALLOCATOR_LIST,
+
+	/** One bit per block */
+	ATFS_ALLOCATOR_BITMAP,
+
+	ATFS_ALLOCATOR_COUNT,
+} ATFS_Allocator;
+
+/** How directory entries are arranged */
+typedef enum
+{
+	/** Entries in any free slot, found by scanning the directory */
+	ATFS_DIR_LINEAR,
+
+	/** Entries in the hash bucket of their name */
+	ATFS_DIR_HASHED,
+
+	/** Packed entries sorted by name in every block */
+	ATFS_DIR_SORTED,
+
+	ATFS_DIR_FORMAT_COUNT,
+} ATFS_DirFormat;
+
+/** Layout of the free space of a volume */
+typedef struct
+{
+	/** Number of groups */
+	u32 Count;
+
+	/** Blocks per group, the last group also gets the remaining blocks */
+	u32 Size;
+
+	/** Number of blocks of the volume */
+	u32 BlockCount;
+
+	/** Free space summaries in the list heads are maintained */
+	u32 HasSummary;
+
+	/** Free space allocator */
+	ATFS_Allocator Allocator;
+
+	/** Position of the bitmap for ATFS_ALLOCATOR_BITMAP */
+	u32 BitmapStart, BitmapBlocks;
+} ATFS_Groups;
+
+/** Free space of a volume */
+typedef struct
+{
+	/** Block size in bytes */
+	u32 BlockSize;
+
+	/** Number of blocks of the volume */
+	u32 BlockCount;
+
+	/** Number of allocation groups */
+	u32 Groups;
+
+	/** Number of free blocks */
+	u32 FreeBlocks;
+
+	/** Number of free areas */
+	u32 FreeAreas;
+
+	/** Largest number of blocks that can be allocated at once */
+	u32 Largest;
+
+	/** Free blocks reserved for files with delayed allocation */
+	u32 Reserved;
+} ATFS_StatFS;
+
 /** Directory Entry struct */
 typedef struct
 {
@@ -140,6 +434,19 @@ typedef struct
 	u8 Type;
 } ATFS_NamelessDirEntry;
 
+/** Extent of a file that is stored in several of them */
+typedef struct
+{
+	/** First block of the extent relative to the file */
+	u32 Logical;
+
+	/** First block of the extent on the device */
+	u32 Start;
+
+	/** Number of blocks */
+	u32 Count;
+} ATFS_FileExtent;
+
 /** File Handle */
 typedef struct
 {
@@ -151,6 +458,31 @@ typedef struct
 
 	/** Capacity of the file in blocks */
 	u32 SizeBlocks;
+
+	/** Directory block and byte offset of the directory entry, to give
+		a file with delayed allocation its blocks */
+	u32 EntryBlock, EntryOffset;
+
+	/** Extents of a file that is stored in several of them, NULL for
+		a contiguous file. Freed by atfs_fclose. */
+	ATFS_FileExtent *Extents;
+	u32 ExtentCount;
+
+	/** Extent of the last access, looked at first */
+	u32 ExtentHint;
+
+	/** Extent blocks of a file with ATFS_TYPE_FLAG_INDIRECT */
+	u32 *ExtentBlocks;
+	u32 ExtentBlockCount;
+
+	/** Block after the last access, used to detect sequential access */
+	u32 NextBlock;
+
+	/** Current read-ahead window in blocks, 0 for random access */
+	u32 ReadAhead;
+
+	/** End of the blocks that were already prefetched */
+	u32 PrefetchEnd;
 } ATFS_File;
 
 /** Directory Handle */
@@ -162,8 +494,15 @@ typedef struct
 	/* Current directory block */
 	u32 Block;
 
-	/* Current directory offset within block */
+	/* Current directory offset within block,
+		number of entries read from it in a sorted directory */
 	u32 Offset;
+
+	/* Current overflow block of a hashed directory, 0 if in the bucket */
+	u32 Overflow;
+
+	/* Directory format of the volume */
+	ATFS_DirFormat Format;
 } ATFS_Dir;
 
 /**
@@ -174,8 +513,40 @@ typedef struct
  */
 const char *atfs_status_string(ATFS_Status status);
 
+/**
+ * @brief Start accounting device I/O to an API operation
+ *
+ * @param op Operation
+ * @return Previous operation, to be passed to atfs_op_leave
+ */
+u32 atfs_op_enter(ATFS_Op op);
+
+/**
+ * @brief Stop accounting device I/O to the current API operation
+ *
+ * @param prev Return value of the matching atfs_op_enter
+ */
+void atfs_op_leave(u32 prev);
+
+/**
+ * @brief Returns the name of an API operation
+ *
+ * @param op Operation
+ * @return Pointer to string constant
+ */
+const char *atfs_op_string(u32 op);
+
 /* --- Directories --- */
 ATFS_Status atfs_dopen(BlockDevice *dev, const char *path, ATFS_Dir *dir);
 ATFS_Status atfs_dread(ATFS_Dir *dir, ATFS_DirEntry *entry);
 
+/**
+ * @brief Close a directory. Defragmentation does not move a directory
+ *        that is open, or the directory that contains its entry.
+ *
+ * @param dir Directory opened with atfs_dopen
+ * @return Status code
+ */
+ATFS_Status atfs_dclose(ATFS_Dir *dir);
+
 #endif /* __ATFS_H__ */
@@ -7,6 +7,9 @@
 
 #include "atfs_alloc.h"
 #include "atfs_util.h"
+#include "atfs_mount.h"
+#include "atfs_bitmap.h"
+#include <stdlib.h>
 #include <string.h>
 
 #ifdef ATFS_DEBUG
@@ -14,13 +17,127 @@
 #include <inttypes.h>
 #endif /* ATFS_DEBUG */
 
-static DeviceStatus read_for_modify(BlockDevice *dev, u32 block, u8 *buf)
+/** Allocation goal: the group of the calling thread */
+#define ATFS_GOAL_THREAD  0xFFFFFFFE
+
+/** Number of threads that have been assigned a group */
+static u32 _thread_count;
+
+/** Group of the calling thread plus one, 0 if none was assigned yet */
+static _Thread_local u32 _thread_group;
+
+ATFS_Status atfs_groups_read(BlockDevice *dev, ATFS_Groups *groups)
+{
+	u8 buf[dev->BlockSize];
+	const u8 *data;
+	u32 revision;
+
+	PROPAGATE(dev_map(dev, ATFS_SECTOR_BOOT, buf, &data));
+	revision = atfs_read32(data + ATFS_OFFSET_REVISION);
+	groups->Count = atfs_read32(data + ATFS_OFFSET_GROUP_COUNT);
+	groups->Size = atfs_read32(data + ATFS_OFFSET_GROUP_SIZE);
+	groups->Allocator = atfs_read32(data + ATFS_OFFSET_ALLOCATOR);
+	groups->BitmapStart = atfs_read32(data + ATFS_OFFSET_BITMAP_BLOCK);
+	groups->BitmapBlocks = atfs_read32(data + ATFS_OFFSET_BITMAP_SIZE);
+	dev_unmap(dev, ATFS_SECTOR_BOOT);
+
+	groups->BlockCount = dev->BlockCount;
+	groups->HasSummary = revision >= ATFS_REVISION_SUMMARY;
+	if(revision < ATFS_REVISION_GROUPS)
+	{
+		/* Older volumes have a single free list */
+		groups->Count = 1;
+		groups->Size = dev->BlockCount;
+		groups->Allocator = ATFS_ALLOCATOR_LIST;
+		return ATFS_STATUS_OK;
+	}
+
+	if(!groups->Count || !groups->Size ||
+		(u64)groups->Count * groups->Size > dev->BlockCount ||
+		groups->Allocator >= ATFS_ALLOCATOR_COUNT)
+	{
+		return ATFS_STATUS_INVALID_VOLUME;
+	}
+
+	/* The bitmap covers the whole volume and only exists with a summary */
+	if(groups->Allocator == ATFS_ALLOCATOR_BITMAP &&
+		(!groups->HasSummary || groups->Count != 1 ||
+		(u64)groups->BitmapBlocks << (dev->BlockSizePOT + 3) <
+			dev->BlockCount ||
+		groups->BitmapStart < ATFS_SIZE_BOOT ||
+		(u64)groups->BitmapStart + groups->BitmapBlocks > dev->BlockCount))
+	{
+		return ATFS_STATUS_INVALID_VOLUME;
+	}
+
+	return ATFS_STATUS_OK;
+}
+
+u32 atfs_group_of(const ATFS_Groups *groups, u32 block)
+{
+	u32 group = block / groups->Size;
+	return group < groups->Count ? group : groups->Count - 1;
+}
+
+u32 atfs_group_head(const ATFS_Groups *groups, u32 group)
+{
+	return group * groups->Size;
+}
+
+u32 atfs_group_end(const ATFS_Groups *groups, u32 group)
+{
+	return group + 1 < groups->Count ?
+		(group + 1) * groups->Size : groups->BlockCount;
+}
+
+/* Layout of a mounted volume, or read it from the boot block */
+static ATFS_Status _groups_get(BlockDevice *dev, const ATFS_Mount *m,
+	ATFS_Groups *groups)
+{
+	if(m)
+	{
+		/* Reloading the free lists failed */
+		if(!m->Groups)
+		{
+			return ATFS_STATUS_INVALID_VOLUME;
+		}
+
+		*groups = m->Layout;
+		return ATFS_STATUS_OK;
+	}
+
+	return atfs_groups_read(dev, groups);
+}
+
+/* Lock a group of a mounted volume */
+static ATFS_Group *_group_lock(ATFS_Mount *m, u32 group)
+{
+	if(!m)
+	{
+		return NULL;
+	}
+
+	pthread_mutex_lock(&m->Groups[group].Lock);
+	return &m->Groups[group];
+}
+
+static void _group_unlock(ATFS_Group *grp)
+{
+	if(grp)
+	{
+		pthread_mutex_unlock(&grp->Lock);
+	}
+}
+
+static DeviceStatus read_for_modify(BlockDevice *dev, u32 block, u32 head,
+	u8 *buf)
 {
 	DeviceStatus status = DEVICE_STATUS_OK;
-	if(block == ATFS_SECTOR_BOOT)
+	if(block == head)
 	{
-		/* Read contents to not overwrite bootsector (yikes) */
-		status = dev->Read(block, 1, buf);
+		/* Read contents to not overwrite the list head
+			(the bootsector for the first group, yikes) */
+		status = dev_read(dev, block, 1, buf);
 	}
 	else
 	{
@@ -31,166 +148,866 @@ static DeviceStatus read_for_modify(BlockDevice *dev, u32 block, u8 *buf)
 	return status;
 }
 
-ATFS_Status atfs_alloc(BlockDevice *dev, u32 req_size, u32 *start)
+/* Read the header of a free area without copying the block if possible */
+static DeviceStatus _free_area_get(BlockDevice *dev, u32 block, u8 *buf,
+	u32 *next, u32 *size)
+{
+	const u8 *data;
+
+	PROPAGATE(dev_map(dev, block, buf, &data));
+	*next = atfs_read32(data + ATFS_OFFSET_FREE_NEXT);
+	*size = atfs_read32(data + ATFS_OFFSET_FREE_SIZE);
+	dev_unmap(dev, block);
+	return DEVICE_STATUS_OK;
+}
+
+/** Free space summary of a group */
+typedef struct
+{
+	u32 Free, Areas, Largest;
+} FreeSummary;
+
+/* Read the free space summary from the head of a group */
+static DeviceStatus _summary_get(BlockDevice *dev, u32 head, u8 *buf,
+	FreeSummary *sum)
+{
+	const u8 *data;
+
+	PROPAGATE(dev_map(dev, head, buf, &data));
+	sum->Free = atfs_read32(data + ATFS_OFFSET_GROUP_FREE);
+	sum->Areas = atfs_read32(data + ATFS_OFFSET_GROUP_AREAS);
+	sum->Largest = atfs_read32(data + ATFS_OFFSET_GROUP_LARGEST);
+	dev_unmap(dev, head);
+	return DEVICE_STATUS_OK;
+}
+
+/* Write the header of a free area, the head of the list
+	keeps its other contents */
+static DeviceStatus _free_area_set(BlockDevice *dev, u32 head, u32 block,
+	u8 *buf, u32 next, u32 size)
+{
+	PROPAGATE(read_for_modify(dev, block, head, buf));
+	atfs_write32(buf + ATFS_OFFSET_FREE_NEXT, next);
+	atfs_write32(buf + ATFS_OFFSET_FREE_SIZE, size);
+	return DEVICE_STATUS_OK;
+}
+
+/** Free area and its neighbours in the free list */
+typedef struct
+{
+	/** Head of the free list of the group */
+	u32 Head;
+
+	/** Previous area, the head if there is none */
+	u32 Prev, PrevSize;
+
+	/** Area that was found, 0 if there is none */
+	u32 Cur, CurSize;
+
+	/** Area after Cur, 0 if there is none */
+	u32 Next;
+} FreePos;
+
+/** Change of the free space summary of a group */
+typedef struct
+{
+	/** Change of the number of free blocks and areas */
+	i32 Free, Areas;
+
+	/** New largest area if Exact, otherwise the size of an area that was
+		created or grown, the old value stays an upper bound */
+	u32 Largest;
+	int Exact;
+} SummaryDelta;
+
+/** Blocks of the free list changed by one operation, in ascending order */
+typedef struct
+{
+	DeviceIOVec Vec[3];
+	u32 Count;
+} FreeWrite;
+
+static void _write_add(FreeWrite *w, u32 block, u8 *buf)
+{
+	w->Vec[w->Count].Offset = block;
+	w->Vec[w->Count].Count = 1;
+	w->Vec[w->Count].Buffer = buf;
+	++w->Count;
+}
+
+/* Write the changed headers with one request and update the summary in
+	the head of the group, which is read into `head` if it is not
+	already one of the changed blocks */
+static DeviceStatus _write_commit(BlockDevice *dev, const ATFS_Groups *groups,
+	const FreePos *pos, FreeWrite *w, u8 *head, const SummaryDelta *delta)
+{
+	u32 largest;
+	u8 *p;
+
+	if(groups->HasSummary)
+	{
+		if(w->Vec[0].Offset == pos->Head)
+		{
+			p = w->Vec[0].Buffer;
+		}
+		else
+		{
+			PROPAGATE(dev_read(dev, pos->Head, 1, head));
+			memmove(w->Vec + 1, w->Vec, w->Count * sizeof(*w->Vec));
+			w->Vec[0].Offset = pos->Head;
+			w->Vec[0].Count = 1;
+			w->Vec[0].Buffer = head;
+			++w->Count;
+			p = head;
+		}
+
+		atfs_write32(p + ATFS_OFFSET_GROUP_FREE,
+			atfs_read32(p + ATFS_OFFSET_GROUP_FREE) + (u32)delta->Free);
+		atfs_write32(p + ATFS_OFFSET_GROUP_AREAS,
+			atfs_read32(p + ATFS_OFFSET_GROUP_AREAS) + (u32)delta->Areas);
+		largest = atfs_read32(p + ATFS_OFFSET_GROUP_LARGEST);
+		if(delta->Exact || delta->Largest > largest)
+		{
+			atfs_write32(p + ATFS_OFFSET_GROUP_LARGEST, delta->Largest);
+		}
+	}
+
+	return dev_writev(dev, w->Vec, w->Count);
+}
+
+/* Find the areas around `block` in the index of a group */
+static void _index_around(const ATFS_ExtentTree *tree, u32 head, u32 block,
+	FreePos *pos)
+{
+	ATFS_Extent e;
+
+	pos->Head = head;
+	pos->Prev = head;
+	pos->PrevSize = 0;
+	if(atfs_extent_prev(tree, block, &e))
+	{
+		pos->Prev = e.Start;
+		pos->PrevSize = e.Size;
+	}
+
+	pos->Cur = 0;
+	pos->CurSize = 0;
+	pos->Next = 0;
+	if(atfs_extent_next(tree, block, &e))
+	{
+		pos->Cur = e.Start;
+		pos->CurSize = e.Size;
+		pos->Next = atfs_extent_next(tree, e.Start + 1, &e) ? e.Start : 0;
+	}
+}
+
+/* Choose a free area according to the policy of the volume */
+static int _index_fit(ATFS_AllocPolicy policy, const ATFS_ExtentTree *tree,
+	u32 req_size, ATFS_Extent *e)
+{
+	switch(policy)
+	{
+	case ATFS_POLICY_BEST_FIT:
+		return atfs_extent_best_fit(tree, req_size, e);
+
+	case ATFS_POLICY_SEGREGATED:
+		return atfs_extent_class_fit(tree, req_size, e);
+
+	default:
+		return atfs_extent_first_fit(tree, req_size, e);
+	}
+}
+
+/* First fit by walking the on-disk list, for volumes that are not mounted */
+static ATFS_Status _list_fit(BlockDevice *dev, const ATFS_Groups *groups,
+	u32 head, u32 req_size, FreePos *pos)
 {
 	u8 buf[dev->BlockSize];
-	u32 cur, prev, next, cur_size;
+	u32 cur, size, next;
+
+	FreeSummary sum;
 
-	cur = ATFS_SECTOR_BOOT;
-	prev = 0;
+	/* The summary tells if it is worth walking the list at all */
+	if(groups->HasSummary)
+	{
+		PROPAGATE(_summary_get(dev, head, buf, &sum));
+		if(sum.Largest < req_size)
+		{
+			return ATFS_STATUS_NO_SPACE_LEFT_ON_DEVICE;
+		}
+	}
+
+	pos->Head = head;
+	pos->Prev = head;
+	pos->PrevSize = 0;
+	cur = head;
 	do
 	{
-		PROPAGATE(dev->Read(cur, 1, buf));
-		next = atfs_read32(buf + ATFS_OFFSET_FREE_NEXT);
-		cur_size = atfs_read32(buf + ATFS_OFFSET_FREE_SIZE);
-		if(cur_size >= req_size)
+		PROPAGATE(_free_area_get(dev, cur, buf, &next, &size));
+		if(cur != head && size >= req_size)
 		{
 			/* First fit: Suitable area found */
-			break;
+			pos->Cur = cur;
+			pos->CurSize = size;
+			pos->Next = next;
+			return ATFS_STATUS_OK;
 		}
 
-		prev = cur;
+		pos->Prev = cur;
+		pos->PrevSize = size;
 		cur = next;
 	}
 	while(cur);
 
-	if(cur_size < req_size)
+	return ATFS_STATUS_NO_SPACE_LEFT_ON_DEVICE;
+}
+
+/* Find the areas around `block` by walking the on-disk list */
+static ATFS_Status _list_around(BlockDevice *dev, u32 head, u32 block,
+	FreePos *pos)
+{
+	u8 buf[dev->BlockSize];
+	u32 next;
+
+	pos->Head = head;
+	pos->Prev = head;
+	do
 	{
-		return ATFS_STATUS_NO_SPACE_LEFT_ON_DEVICE;
+		PROPAGATE(_free_area_get(dev, pos->Prev, buf, &next, &pos->PrevSize));
+		if(!next || next > block)
+		{
+			break;
+		}
+
+		pos->Prev = next;
+	}
+	while(pos->Prev);
+
+	pos->Cur = next;
+	pos->CurSize = 0;
+	pos->Next = 0;
+	if(pos->Cur)
+	{
+		PROPAGATE(_free_area_get(dev, pos->Cur, buf,
+			&pos->Next, &pos->CurSize));
 	}
-	else if(cur_size == req_size)
+
+	return ATFS_STATUS_OK;
+}
+
+/* Allocate the first `req_size` blocks of the area Cur */
+static ATFS_Status _take(BlockDevice *dev, const ATFS_Groups *groups,
+	ATFS_ExtentTree *tree, const FreePos *pos, u32 req_size)
+{
+	u8 head[dev->BlockSize], buf[dev->BlockSize], area[dev->BlockSize];
+	SummaryDelta delta;
+	FreeWrite w;
+
+	/* Only the index knows the largest area that is left */
+	w.Count = 0;
+	delta.Free = -(i32)req_size;
+	delta.Largest = tree ? atfs_extent_largest_except(tree, pos->Cur) : 0;
+	delta.Exact = tree != NULL;
+	if(pos->CurSize == req_size)
 	{
 		/* Make previous area point to next area */
-		PROPAGATE(read_for_modify(dev, prev, buf));
-		atfs_write32(buf + ATFS_OFFSET_FREE_NEXT, next);
-		PROPAGATE(dev->Write(prev, 1, buf));
+		PROPAGATE(_free_area_set(dev, pos->Head, pos->Prev, buf,
+			pos->Next, pos->PrevSize));
+		_write_add(&w, pos->Prev, buf);
+		delta.Areas = -1;
+		PROPAGATE(_write_commit(dev, groups, pos, &w, head, &delta));
+		if(tree)
+		{
+			atfs_extent_remove(tree, pos->Cur);
+		}
 	}
-	else /* cur_size > req_size */
+	else /* pos->CurSize > req_size */
 	{
 		/* Split area */
-		u32 new_start = cur + req_size;
-		u32 new_size = cur_size - req_size;
+		u32 new_start = pos->Cur + req_size;
+		u32 new_size = pos->CurSize - req_size;
 
-		/* Make previous area point to second part */
-		PROPAGATE(read_for_modify(dev, prev, buf));
-		atfs_write32(buf + ATFS_OFFSET_FREE_NEXT, new_start);
-		PROPAGATE(dev->Write(prev, 1, buf));
+		/* Make previous area point to second part,
+			and second part point to next area */
+		PROPAGATE(_free_area_set(dev, pos->Head, pos->Prev, buf,
+			new_start, pos->PrevSize));
+		PROPAGATE(_free_area_set(dev, pos->Head, new_start, area,
+			pos->Next, new_size));
+		_write_add(&w, pos->Prev, buf);
+		_write_add(&w, new_start, area);
+		delta.Areas = 0;
+		if(tree && new_size > delta.Largest)
+		{
+			delta.Largest = new_size;
+		}
 
-		/* Make second part point to next area */
-		memset(buf, 0, dev->BlockSize);
-		atfs_write32(buf + ATFS_OFFSET_FREE_SIZE, new_size);
-		atfs_write32(buf + ATFS_OFFSET_FREE_NEXT, next);
-		PROPAGATE(dev->Write(new_start, 1, buf));
+		PROPAGATE(_write_commit(dev, groups, pos, &w, head, &delta));
+		if(tree)
+		{
+			atfs_extent_update(tree, pos->Cur, new_start, new_size);
+		}
 	}
 
-	*start = cur;
 	return ATFS_STATUS_OK;
 }
 
-ATFS_Status atfs_free(BlockDevice *dev, u32 block, u32 count)
+/* Allocate from one group */
+static ATFS_Status _alloc_group(BlockDevice *dev, ATFS_Mount *m,
+	const ATFS_Groups *groups, u32 group, u32 req_size, u32 *start)
+{
+	ATFS_Status status;
+	ATFS_Group *grp;
+	ATFS_Extent e;
+	FreePos pos;
+	u32 head;
+
+	head = atfs_group_head(groups, group);
+	if((grp = _group_lock(m, group)))
+	{
+		status = ATFS_STATUS_NO_SPACE_LEFT_ON_DEVICE;
+		if(atfs_extent_largest(&grp->Free) >= req_size &&
+			_index_fit(m->Policy, &grp->Free, req_size, &e))
+		{
+			_index_around(&grp->Free, head, e.Start, &pos);
+			status = _take(dev, groups, &grp->Free, &pos, req_size);
+		}
+	}
+	else if(!(status = _list_fit(dev, groups, head, req_size, &pos)))
+	{
+		status = _take(dev, groups, NULL, &pos, req_size);
+	}
+
+	_group_unlock(grp);
+	if(!status)
+	{
+		*start = pos.Cur;
+	}
+
+	return status;
+}
+
+/* Group with the most free blocks */
+static ATFS_Status _group_spread(BlockDevice *dev, ATFS_Mount *m,
+	const ATFS_Groups *groups, u32 *group)
 {
 	u8 buf[dev->BlockSize];
-	u32 prev, prev_size, next, next_size, next_next;
-	int merge_with_prev, merge_with_next;
+	u32 i, free_blocks, best;
+	ATFS_Group *grp;
+	FreeSummary sum;
 
-	prev = ATFS_SECTOR_BOOT;
-	do
+	*group = 0;
+	if(groups->Count == 1)
 	{
-		PROPAGATE(dev->Read(prev, 1, buf));
-		next = atfs_read32(buf + ATFS_OFFSET_FREE_NEXT);
-		prev_size = atfs_read32(buf + ATFS_OFFSET_FREE_SIZE);
-		if(next > block)
+		return ATFS_STATUS_OK;
+	}
+
+	for(i = 0, best = 0; i < groups->Count; ++i)
+	{
+		if((grp = _group_lock(m, i)))
 		{
-			break;
+			free_blocks = grp->Free.Blocks;
+			_group_unlock(grp);
+		}
+		else
+		{
+			PROPAGATE(_summary_get(dev, atfs_group_head(groups, i), buf,
+				&sum));
+			free_blocks = sum.Free;
 		}
 
-		prev = next;
+		if(free_blocks > best)
+		{
+			best = free_blocks;
+			*group = i;
+		}
 	}
-	while(prev);
 
-	merge_with_prev = prev + prev_size == block;
-	merge_with_next = block + count == next;
-	if(merge_with_next)
+	return ATFS_STATUS_OK;
+}
+
+static ATFS_Status _alloc(BlockDevice *dev, u32 req_size, u32 goal,
+	u32 *start)
+{
+	ATFS_Groups groups;
+	ATFS_Status status;
+	ATFS_Group *grp;
+	ATFS_Mount *m;
+	u32 i, first;
+
+	m = atfs_mount_find(dev);
+	PROPAGATE(_groups_get(dev, m, &groups));
+	if(groups.Allocator == ATFS_ALLOCATOR_BITMAP)
 	{
-		PROPAGATE(dev->Read(next, 1, buf));
-		next_size = atfs_read32(buf + ATFS_OFFSET_FREE_SIZE);
-		next_next = atfs_read32(buf + ATFS_OFFSET_FREE_NEXT);
+		grp = _group_lock(m, 0);
+		status = atfs_bitmap_alloc(dev, &groups, m ? m->Bitmap : NULL,
+			req_size, start);
+		_group_unlock(grp);
+		return status;
 	}
 
+	if(goal == ATFS_GOAL_THREAD)
+	{
+		/* Threads are assigned groups round robin when they first
+			allocate, so they do not contend on the same free list */
+		if(!_thread_group)
+		{
+			_thread_group = __atomic_add_fetch(&_thread_count, 1,
+				__ATOMIC_RELAXED);
+		}
+
+		first = (_thread_group - 1) % groups.Count;
+	}
+	else if(goal == ATFS_GOAL_SPREAD)
+	{
+		PROPAGATE(_group_spread(dev, m, &groups, &first));
+	}
+	else
+	{
+		first = atfs_group_of(&groups, goal);
+	}
+
+	/* Fall back to the following groups when the first one is full */
+	for(i = 0; i < groups.Count; ++i)
+	{
+		status = _alloc_group(dev, m, &groups, (first + i) % groups.Count,
+			req_size, start);
+		if(status != ATFS_STATUS_NO_SPACE_LEFT_ON_DEVICE)
+		{
+			return status;
+		}
+	}
+
+	return ATFS_STATUS_NO_SPACE_LEFT_ON_DEVICE;
+}
+
+ATFS_Status atfs_alloc(BlockDevice *dev, u32 req_size, u32 *start)
+{
+	ATFS_OP(ATFS_OP_ALLOC, _alloc(dev, req_size, ATFS_GOAL_THREAD, start));
+}
+
+ATFS_Status atfs_alloc_near(BlockDevice *dev, u32 req_size, u32 goal,
+	u32 *start)
+{
+	ATFS_OP(ATFS_OP_ALLOC, _alloc(dev, req_size, goal, start));
+}
+
+static ATFS_Status _alloc_at(BlockDevice *dev, u32 start, u32 size)
+{
+	ATFS_Groups groups;
+	ATFS_Status status;
+	ATFS_Group *grp;
+	ATFS_Mount *m;
+	FreePos pos;
+	u32 group, head;
+
+	m = atfs_mount_find(dev);
+	PROPAGATE(_groups_get(dev, m, &groups));
+	if(groups.Allocator == ATFS_ALLOCATOR_BITMAP)
+	{
+		grp = _group_lock(m, 0);
+		status = atfs_bitmap_alloc_at(dev, &groups, m ? m->Bitmap : NULL,
+			start, size);
+		_group_unlock(grp);
+		return status;
+	}
+
+	group = atfs_group_of(&groups, start);
+	head = atfs_group_head(&groups, group);
+	if(start == head)
+	{
+		return ATFS_STATUS_NO_SPACE_LEFT_ON_DEVICE;
+	}
+
+	status = ATFS_STATUS_OK;
+	if((grp = _group_lock(m, group)))
+	{
+		_index_around(&grp->Free, head, start, &pos);
+	}
+	else
+	{
+		status = _list_around(dev, head, start - 1, &pos);
+	}
+
+	if(!status)
+	{
+		status = pos.Cur != start || pos.CurSize < size ?
+			ATFS_STATUS_NO_SPACE_LEFT_ON_DEVICE :
+			_take(dev, &groups, grp ? &grp->Free : NULL, &pos, size);
+	}
+
+	_group_unlock(grp);
+	return status;
+}
+
+ATFS_Status atfs_alloc_at(BlockDevice *dev, u32 start, u32 size)
+{
+	ATFS_OP(ATFS_OP_ALLOC, _alloc_at(dev, start, size));
+}
+
+ATFS_Status atfs_alloc_many(BlockDevice *dev, const u32 *sizes, u32 n,
+	u32 goal, u32 *starts)
+{
+	ATFS_Status status;
+	u64 total;
+	u32 i, k;
+
+	for(i = 0, total = 0; i < n; ++i)
+	{
+		total += sizes[i];
+	}
+
+	/* One area for all, the files end up next to each other */
+	if(total <= 0xFFFFFFFF)
+	{
+		status = atfs_alloc_near(dev, total, goal, &starts[0]);
+		if(status == ATFS_STATUS_OK)
+		{
+			for(i = 1; i < n; ++i)
+			{
+				starts[i] = starts[i - 1] + sizes[i - 1];
+			}
+
+			return ATFS_STATUS_OK;
+		}
+
+		if(status != ATFS_STATUS_NO_SPACE_LEFT_ON_DEVICE)
+		{
+			return status;
+		}
+	}
+
+	/* The free space is fragmented, allocate one by one */
+	for(i = 0; i < n; ++i)
+	{
+		if((status = atfs_alloc_near(dev, sizes[i], goal, &starts[i])))
+		{
+			for(k = 0; k < i; ++k)
+			{
+				atfs_free(dev, starts[k], sizes[k]);
+			}
+
+			return status;
+		}
+	}
+
+	return ATFS_STATUS_OK;
+}
+
+/* Give `count` blocks at `block` back to the free list of the group,
+	which must be locked */
+static ATFS_Status _free_locked(BlockDevice *dev, const ATFS_Groups *groups,
+	ATFS_ExtentTree *tree, const FreePos *pos, u32 block, u32 count)
+{
+	u8 head[dev->BlockSize], buf[dev->BlockSize], area[dev->BlockSize];
+	u32 discard_start, discard_end;
+	int merge_with_prev, merge_with_next;
+	SummaryDelta delta;
+	DeviceStatus status;
+	FreeWrite w;
+
+	/* The area that is freed can only become the largest one */
+	w.Count = 0;
+	merge_with_prev = pos->Prev + pos->PrevSize == block;
+	merge_with_next = block + count == pos->Cur;
+	delta.Free = count;
+	delta.Largest = (merge_with_prev ? pos->PrevSize : 0) + count +
+		(merge_with_next ? pos->CurSize : 0);
+	delta.Exact = 0;
 	if(merge_with_prev && merge_with_next)
 	{
-		PROPAGATE(read_for_modify(dev, prev, buf));
-		atfs_write32(buf + ATFS_OFFSET_FREE_NEXT, next_next);
-		atfs_write32(buf + ATFS_OFFSET_FREE_SIZE,
-			prev_size + count + next_size);
-		PROPAGATE(dev->Write(prev, 1, buf));
+		PROPAGATE(_free_area_set(dev, pos->Head, pos->Prev, buf, pos->Next,
+			pos->PrevSize + count + pos->CurSize));
+		_write_add(&w, pos->Prev, buf);
+		delta.Areas = -1;
+		PROPAGATE(_write_commit(dev, groups, pos, &w, head, &delta));
+		if(tree)
+		{
+			atfs_extent_remove(tree, pos->Cur);
+			atfs_extent_update(tree, pos->Prev, pos->Prev,
+				pos->PrevSize + count + pos->CurSize);
+		}
 	}
 	else if(merge_with_prev)
 	{
-		PROPAGATE(read_for_modify(dev, prev, buf));
-		atfs_write32(buf + ATFS_OFFSET_FREE_SIZE, prev_size + count);
-		PROPAGATE(dev->Write(prev, 1, buf));
+		PROPAGATE(_free_area_set(dev, pos->Head, pos->Prev, buf, pos->Cur,
+			pos->PrevSize + count));
+		_write_add(&w, pos->Prev, buf);
+		delta.Areas = 0;
+		PROPAGATE(_write_commit(dev, groups, pos, &w, head, &delta));
+		if(tree)
+		{
+			atfs_extent_update(tree, pos->Prev, pos->Prev,
+				pos->PrevSize + count);
+		}
 	}
-	else if(merge_with_next)
+	else
 	{
-		memset(buf, 0, dev->BlockSize);
-		atfs_write32(buf + ATFS_OFFSET_FREE_NEXT, next_next);
-		atfs_write32(buf + ATFS_OFFSET_FREE_SIZE, count + next_size);
-		PROPAGATE(dev->Write(block, 1, buf));
+		if(merge_with_next)
+		{
+			PROPAGATE(_free_area_set(dev, pos->Head, block, area, pos->Next,
+				count + pos->CurSize));
+		}
+		else
+		{
+			PROPAGATE(_free_area_set(dev, pos->Head, block, area,
+				pos->Cur, count));
+		}
+
+		/* Insert first, the index can not fail after the write */
+		if(tree && !merge_with_next && atfs_extent_insert(tree, block, count))
+		{
+			return ATFS_STATUS_OUT_OF_MEMORY;
+		}
+
+		PROPAGATE(_free_area_set(dev, pos->Head, pos->Prev, buf,
+			block, pos->PrevSize));
+		_write_add(&w, pos->Prev, buf);
+		_write_add(&w, block, area);
+		delta.Areas = !merge_with_next;
+		if((status = _write_commit(dev, groups, pos, &w, head, &delta)))
+		{
+			if(tree && !merge_with_next)
+			{
+				atfs_extent_remove(tree, block);
+			}
+
+			return status;
+		}
+
+		if(tree && merge_with_next)
+		{
+			atfs_extent_update(tree, pos->Cur, block, count + pos->CurSize);
+		}
+	}
+
+	/* Release everything except the header of the free area,
+		including the old header of the next area if it was merged */
+	discard_start = merge_with_prev ? block : block + 1;
+	discard_end = block + count + merge_with_next;
+	if(discard_end <= discard_start)
+	{
+		return ATFS_STATUS_OK;
+	}
+
+	return dev_discard(dev, discard_start, discard_end - discard_start);
+}
+
+static ATFS_Status _free(BlockDevice *dev, u32 block, u32 count)
+{
+	ATFS_Groups groups;
+	ATFS_Status status;
+	ATFS_Group *grp;
+	ATFS_Mount *m;
+	FreePos pos;
+	u32 group, head;
+
+	m = atfs_mount_find(dev);
+	PROPAGATE(_groups_get(dev, m, &groups));
+	if(groups.Allocator == ATFS_ALLOCATOR_BITMAP)
+	{
+		grp = _group_lock(m, 0);
+		status = atfs_bitmap_free(dev, &groups, m ? m->Bitmap : NULL,
+			block, count);
+		_group_unlock(grp);
+		return status;
+	}
 
-		PROPAGATE(read_for_modify(dev, prev, buf));
-		atfs_write32(buf + ATFS_OFFSET_FREE_NEXT, block);
-		PROPAGATE(dev->Write(prev, 1, buf));
+	group = atfs_group_of(&groups, block);
+	head = atfs_group_head(&groups, group);
+
+	/* Free areas never cross into another group */
+	if(block <= head || (u64)block + count > atfs_group_end(&groups, group))
+	{
+		return ATFS_STATUS_INVALID_ARGUMENT;
+	}
+
+	status = ATFS_STATUS_OK;
+	if((grp = _group_lock(m, group)))
+	{
+		_index_around(&grp->Free, head, block, &pos);
 	}
 	else
 	{
-		memset(buf, 0, dev->BlockSize);
-		atfs_write32(buf + ATFS_OFFSET_FREE_NEXT, next);
-		atfs_write32(buf + ATFS_OFFSET_FREE_SIZE, count);
-		PROPAGATE(dev->Write(block, 1, buf));
+		status = _list_around(dev, head, block, &pos);
+	}
 
-		PROPAGATE(read_for_modify(dev, prev, buf));
-		atfs_write32(buf + ATFS_OFFSET_FREE_NEXT, block);
-		PROPAGATE(dev->Write(prev, 1, buf));
+	if(!status)
+	{
+		status = _free_locked(dev, &groups, grp ? &grp->Free : NULL,
+			&pos, block, count);
 	}
 
-	return ATFS_STATUS_OK;
+	_group_unlock(grp);
+	return status;
 }
 
-#ifdef ATFS_DEBUG
+ATFS_Status atfs_free(BlockDevice *dev, u32 block, u32 count)
+{
+	ATFS_OP(ATFS_OP_FREE, _free(dev, block, count));
+}
 
-void atfs_print_free(BlockDevice *dev)
+/* Free space of a group by walking its list, for volumes of an older
+	revision that are not mounted */
+static ATFS_Status _list_summary(BlockDevice *dev, u32 head,
+	FreeSummary *sum)
 {
 	u8 buf[dev->BlockSize];
-	u32 i, prev, cur, next, cur_size;
+	u32 cur, next, size;
 
-	i = 0;
-	prev = 0;
-	cur = ATFS_SECTOR_BOOT;
-	do
+	sum->Free = 0;
+	sum->Areas = 0;
+	sum->Largest = 0;
+	PROPAGATE(_free_area_get(dev, head, buf, &cur, &size));
+	for(; cur; cur = next)
+	{
+		PROPAGATE(_free_area_get(dev, cur, buf, &next, &size));
+		sum->Free += size;
+		++sum->Areas;
+		if(size > sum->Largest)
+		{
+			sum->Largest = size;
+		}
+	}
+
+	return ATFS_STATUS_OK;
+}
+
+static ATFS_Status _statfs(BlockDevice *dev, ATFS_StatFS *st)
+{
+	u8 buf[dev->BlockSize];
+	ATFS_Groups groups;
+	ATFS_Group *grp;
+	ATFS_Mount *m;
+	FreeSummary sum;
+	u32 i, head;
+
+	m = atfs_mount_find(dev);
+	PROPAGATE(_groups_get(dev, m, &groups));
+	st->BlockSize = dev->BlockSize;
+	st->BlockCount = dev->BlockCount;
+	st->Groups = groups.Count;
+	st->FreeBlocks = 0;
+	st->FreeAreas = 0;
+	st->Largest = 0;
+	st->Reserved = m ? __atomic_load_n(&m->Reserved, __ATOMIC_RELAXED) : 0;
+	for(i = 0; i < groups.Count; ++i)
 	{
-		DeviceStatus status = dev->Read(cur, 1, buf);
-		if(status)
+		head = atfs_group_head(&groups, i);
+		if((grp = _group_lock(m, i)))
+		{
+			if(groups.Allocator == ATFS_ALLOCATOR_BITMAP)
+			{
+				atfs_bitmap_count(m->Bitmap, groups.BlockCount,
+					&sum.Free, &sum.Areas, &sum.Largest);
+			}
+			else
+			{
+				sum.Free = grp->Free.Blocks;
+				sum.Areas = grp->Free.Count;
+				sum.Largest = atfs_extent_largest(&grp->Free);
+			}
+
+			_group_unlock(grp);
+		}
+		else if(groups.HasSummary)
+		{
+			PROPAGATE(_summary_get(dev, head, buf, &sum));
+		}
+		else
 		{
-			printf("%s\n", dev_status_string(status));
-			return;
+			PROPAGATE(_list_summary(dev, head, &sum));
 		}
 
-		next = atfs_read32(buf + ATFS_OFFSET_FREE_NEXT);
-		cur_size = atfs_read32(buf + ATFS_OFFSET_FREE_SIZE);
+		st->FreeBlocks += sum.Free;
+		st->FreeAreas += sum.Areas;
+		if(sum.Largest > st->Largest)
+		{
+			st->Largest = sum.Largest;
+		}
+	}
+
+	return ATFS_STATUS_OK;
+}
+
+ATFS_Status atfs_statfs(BlockDevice *dev, ATFS_StatFS *st)
+{
+	ATFS_OP(ATFS_OP_STATFS, _statfs(dev, st));
+}
+
+#ifdef ATFS_DEBUG
+
+static void _print_bitmap(BlockDevice *dev, const ATFS_Groups *groups)
+{
+	u32 i, cur, size;
+	ATFS_Status err;
+	u8 *map;
+
+	if((err = atfs_bitmap_read(dev, groups, &map)))
+	{
+		printf("%s\n", atfs_status_string(err));
+		return;
+	}
 
-		printf("Free Area %d:\n"
+	for(i = 0, cur = 0; (cur = atfs_bitmap_next_run(map, groups->BlockCount,
+		cur, &size)) < groups->BlockCount; cur += size, ++i)
+	{
+		printf("Free Area %"PRIu32":\n"
 			"Start: %"PRIu32"\n"
-			"Size:  %"PRIu32"\n"
-			"Prev:  %"PRIu32"\n"
-			"Next:  %"PRIu32"\n\n",
-				i, cur, cur_size, prev, next);
+			"Size:  %"PRIu32"\n\n",
+				i, cur, size);
+	}
 
-		prev = cur;
-		cur = next;
-		++i;
+	free(map);
+}
+
+void atfs_print_free(BlockDevice *dev)
+{
+	u8 buf[dev->BlockSize];
+	u32 i, group, prev, cur, next, cur_size;
+	ATFS_Groups groups;
+	ATFS_Status err;
+
+	if((err = atfs_groups_read(dev, &groups)))
+	{
+		printf("%s\n", atfs_status_string(err));
+		return;
+	}
+
+	if(groups.Allocator == ATFS_ALLOCATOR_BITMAP)
+	{
+		_print_bitmap(dev, &groups);
+		return;
+	}
+
+	for(group = 0; group < groups.Count; ++group)
+	{
+		printf("Group %"PRIu32":\n\n", group);
+		i = 0;
+		prev = 0;
+		cur = atfs_group_head(&groups, group);
+		do
+		{
+			DeviceStatus status = _free_area_get(dev, cur, buf,
+				&next, &cur_size);
+			if(status)
+			{
+				printf("%s\n", dev_status_string(status));
+				return;
+			}
+
+			printf("Free Area %d:\n"
+				"Start: %"PRIu32"\n"
+				"Size:  %"PRIu32"\n"
+				"Prev:  %"PRIu32"\n"
+				"Next:  %"PRIu32"\n\n",
+					i, cur, cur_size, prev, next);
+
+			prev = cur;
+			cur = next;
+			++i;
+		}
+		while(cur);
 	}
-	while(cur);
 }
 
 #endif /* ATFS_DEBUG */
@@ -11,8 +11,48 @@
 
 #include "atfs.h"
 
+/** Allocation goal: the group with the most free blocks, for directories */
+#define ATFS_GOAL_SPREAD  0xFFFFFFFF
+
 /**
- * @brief Allocate `size` contiguous blocks on disk
+ * @brief Read the allocation group layout from the boot block
+ *
+ * @param dev Block device
+ * @param groups Output parameter layout
+ * @return Status
+ */
+ATFS_Status atfs_groups_read(BlockDevice *dev, ATFS_Groups *groups);
+
+/**
+ * @brief Returns the allocation group that contains a block
+ *
+ * @param groups Group layout
+ * @param block Block number
+ * @return Group index
+ */
+u32 atfs_group_of(const ATFS_Groups *groups, u32 block);
+
+/**
+ * @brief Returns the first block of a group, which holds its free list head
+ *
+ * @param groups Group layout
+ * @param group Group index
+ * @return Block number
+ */
+u32 atfs_group_head(const ATFS_Groups *groups, u32 group);
+
+/**
+ * @brief Returns the block after the end of a group
+ *
+ * @param groups Group layout
+ * @param group Group index
+ * @return Block number
+ */
+u32 atfs_group_end(const ATFS_Groups *groups, u32 group);
+
+/**
+ * @brief Allocate `size` contiguous blocks on disk, preferably in the
+ *        allocation group of the calling thread
  *
  * @param dev Block device
  * @param size Number of blocks to allocate
@@ -21,6 +61,47 @@
  */
 ATFS_Status atfs_alloc(BlockDevice *dev, u32 size, u32 *start);
 
+/**
+ * @brief Allocate `size` contiguous blocks, preferably in the allocation
+ *        group that contains `goal` (for example the parent directory).
+ *        With ATFS_GOAL_SPREAD, the group with the most free blocks is used.
+ *        Other groups are tried when it is full.
+ *
+ * @param dev Block device
+ * @param size Number of blocks to allocate
+ * @param goal Block near which to allocate, or ATFS_GOAL_SPREAD
+ * @param start Output parameter starting block
+ * @return Status
+ */
+ATFS_Status atfs_alloc_near(BlockDevice *dev, u32 size, u32 goal, u32 *start);
+
+/**
+ * @brief Allocate `size` blocks at a fixed position. A free area must
+ *        start at `start` and have at least `size` blocks.
+ *
+ * @param dev Block device
+ * @param start First block to allocate
+ * @param size Number of blocks to allocate
+ * @return Status
+ */
+ATFS_Status atfs_alloc_at(BlockDevice *dev, u32 start, u32 size);
+
+/**
+ * @brief Allocate blocks for several files near `goal`. All of them are
+ *        taken from one free area with a single allocation if there is one
+ *        that is large enough, so the files are contiguous in the order
+ *        given. Otherwise each file is allocated on its own.
+ *
+ * @param dev Block device
+ * @param sizes Number of blocks of each file
+ * @param n Number of files, at least one
+ * @param goal Block near which to allocate, or ATFS_GOAL_SPREAD
+ * @param starts Output parameter starting block of each file
+ * @return Status, nothing is allocated on failure
+ */
+ATFS_Status atfs_alloc_many(BlockDevice *dev, const u32 *sizes, u32 n,
+	u32 goal, u32 *starts);
+
 /**
  * @brief Free `count` blocks starting at `block`
  *
@@ -30,6 +111,18 @@ ATFS_Status atfs_alloc(BlockDevice *dev, u32 size, u32 *start);
  */
 ATFS_Status atfs_free(BlockDevice *dev, u32 block, u32 count);
 
+/**
+ * @brief Get the free space of a volume from the summaries in the free list
+ *        heads, without walking the free lists. On a volume that is not
+ *        mounted, Largest can be too high after allocations until
+ *        it is mounted again.
+ *
+ * @param dev Block device
+ * @param st Output parameter free space
+ * @return Status
+ */
+ATFS_Status atfs_statfs(BlockDevice *dev, ATFS_StatFS *st);
+
 /**
  * @brief Print all free areas on device for debugging purposes
  *
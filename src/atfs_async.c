@@ -0,0 +1,143 @@
+/**
+ * @file    atfs_async.c
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ */
+
+#include "atfs_async.h"
+#include "atfs_file.h"
+#include <stdlib.h>
+
+static ATFS_Status _file_submit(DeviceQueue *q, ATFS_File *file, u32 op,
+	u32 block, u32 count, void *buf, DeviceRequest *req)
+{
+	u32 len;
+
+	if(block > file->SizeBlocks || count > file->SizeBlocks - block)
+	{
+		return ATFS_STATUS_OUT_OF_BOUNDS;
+	}
+
+	/* The request needs the final position of the blocks */
+	PROPAGATE(atfs_fplace(file));
+
+	/* One request covers one extent */
+	len = count;
+	req->Offset = atfs_fmap(file, block, &len);
+	if(len < count)
+	{
+		return ATFS_STATUS_INVALID_ARGUMENT;
+	}
+
+	req->Op = op;
+	req->Count = count;
+	req->Buffer = buf;
+	req->Status = DEVICE_STATUS_OK;
+	return devqueue_submit(q, req);
+}
+
+static ATFS_Status _file_queued(DeviceQueue *q, ATFS_File *file, u32 op,
+	u32 block, u32 count, u8 *buf, u32 chunk)
+{
+	DeviceRequest *reqs, **free_reqs, *done;
+	ATFS_Status status, wait;
+	u32 i, n, num_free;
+
+	if(!chunk || block > file->SizeBlocks || count > file->SizeBlocks - block)
+	{
+		return ATFS_STATUS_OUT_OF_BOUNDS;
+	}
+
+	/* The queue depth is not bounded, so the requests are not on the stack */
+	reqs = malloc(q->Depth * (sizeof(*reqs) + sizeof(*free_reqs)));
+	if(!reqs)
+	{
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	free_reqs = (DeviceRequest **)(reqs + q->Depth);
+	for(i = 0; i < q->Depth; ++i)
+	{
+		free_reqs[i] = &reqs[i];
+	}
+
+	status = ATFS_STATUS_OK;
+	num_free = q->Depth;
+	i = 0;
+	while(i < count || num_free < q->Depth)
+	{
+		/* Fill the queue, then wait for one request to complete */
+		while(!status && i < count && num_free)
+		{
+			n = (count - i < chunk) ? count - i : chunk;
+			atfs_fmap(file, block + i, &n);
+			status = _file_submit(q, file, op, block + i, n,
+				buf + ((size_t)i << file->Device->BlockSizePOT),
+				free_reqs[num_free - 1]);
+			if(status == DEVICE_STATUS_QUEUE_FULL && num_free < q->Depth)
+			{
+				/* The device queue is shorter, retry after a completion */
+				status = ATFS_STATUS_OK;
+				break;
+			}
+
+			if(status)
+			{
+				break;
+			}
+
+			--num_free;
+			i += n;
+		}
+
+		if(num_free == q->Depth)
+		{
+			break;
+		}
+
+		if((wait = devqueue_wait(q, &done)))
+		{
+			status = wait;
+			break;
+		}
+
+		if(!status)
+		{
+			status = done->Status;
+		}
+
+		free_reqs[num_free++] = done;
+	}
+
+	free(reqs);
+	return status;
+}
+
+ATFS_Status atfs_fread_async(DeviceQueue *q, ATFS_File *file,
+	u32 block, u32 count, void *buf, DeviceRequest *req)
+{
+	ATFS_OP(ATFS_OP_READ, _file_submit(q, file, DEVICE_REQUEST_READ,
+		block, count, buf, req));
+}
+
+ATFS_Status atfs_fwrite_async(DeviceQueue *q, ATFS_File *file,
+	u32 block, u32 count, const void *buf, DeviceRequest *req)
+{
+	ATFS_OP(ATFS_OP_WRITE, _file_submit(q, file, DEVICE_REQUEST_WRITE,
+		block, count, (void *)buf, req));
+}
+
+ATFS_Status atfs_fread_queued(DeviceQueue *q, ATFS_File *file,
+	u32 block, u32 count, void *buf, u32 chunk)
+{
+	ATFS_OP(ATFS_OP_READ, _file_queued(q, file, DEVICE_REQUEST_READ,
+		block, count, buf, chunk));
+}
+
+ATFS_Status atfs_fwrite_queued(DeviceQueue *q, ATFS_File *file,
+	u32 block, u32 count, const void *buf, u32 chunk)
+{
+	ATFS_OP(ATFS_OP_WRITE, _file_queued(q, file, DEVICE_REQUEST_WRITE,
+		block, count, (void *)buf, chunk));
+}
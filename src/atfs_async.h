@@ -0,0 +1,79 @@
+/**
+ * @file    atfs_async.h
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ * @brief   Asynchronous file read and write functions
+ */
+
+#ifndef __ATFS_ASYNC_H__
+#define __ATFS_ASYNC_H__
+
+#include "atfs.h"
+#include "devqueue.h"
+
+/**
+ * @brief Start reading blocks from a file. Completion is reported by
+ *        devqueue_wait, the request and buffer must stay valid until then.
+ *        The blocks must be in one extent of the file.
+ *
+ * @param q Request queue of the device the file is on
+ * @param file Pointer to file struct
+ * @param block First block to read
+ * @param count Number of blocks to read
+ * @param buf Pointer to buffer for read data
+ * @param req Request to use
+ * @return Status code, DEVICE_STATUS_QUEUE_FULL if the queue is full
+ */
+ATFS_Status atfs_fread_async(DeviceQueue *q, ATFS_File *file,
+	u32 block, u32 count, void *buf, DeviceRequest *req);
+
+/**
+ * @brief Start writing blocks to a file. Completion is reported by
+ *        devqueue_wait, the request and buffer must stay valid until then.
+ *        The blocks must be in one extent of the file.
+ *
+ * @param q Request queue of the device the file is on
+ * @param file Pointer to file struct
+ * @param block First block to write
+ * @param count Number of blocks to write
+ * @param buf Pointer to buffer with data to write
+ * @param req Request to use
+ * @return Status code, DEVICE_STATUS_QUEUE_FULL if the queue is full
+ */
+ATFS_Status atfs_fwrite_async(DeviceQueue *q, ATFS_File *file,
+	u32 block, u32 count, const void *buf, DeviceRequest *req);
+
+/**
+ * @brief Read a range of a file as requests of `chunk` blocks, keeping
+ *        as many requests in flight as the queue depth allows. Requests
+ *        are split at extent boundaries.
+ *
+ * @param q Request queue of the device the file is on
+ * @param file Pointer to file struct
+ * @param block First block to read
+ * @param count Number of blocks to read
+ * @param buf Pointer to buffer for read data
+ * @param chunk Number of blocks per request
+ * @return Status code
+ */
+ATFS_Status atfs_fread_queued(DeviceQueue *q, ATFS_File *file,
+	u32 block, u32 count, void *buf, u32 chunk);
+
+/**
+ * @brief Write a range of a file as requests of `chunk` blocks, keeping
+ *        as many requests in flight as the queue depth allows. Requests
+ *        are split at extent boundaries.
+ *
+ * @param q Request queue of the device the file is on
+ * @param file Pointer to file struct
+ * @param block First block to write
+ * @param count Number of blocks to write
+ * @param buf Pointer to buffer with data to write
+ * @param chunk Number of blocks per request
+ * @return Status code
+ */
+ATFS_Status atfs_fwrite_queued(DeviceQueue *q, ATFS_File *file,
+	u32 block, u32 count, const void *buf, u32 chunk);
+
+#endif /* __ATFS_ASYNC_H__ */
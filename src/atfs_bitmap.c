@@ -0,0 +1,626 @@
+/**
+ * @file    atfs_bitmap.c
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ */
+
+#include "atfs_bitmap.h"
+#include "atfs_util.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define ATFS_BITMAP_HAVE_AVX2
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/** All bits set */
+#define WORD_FULL  (~(u64)0)
+
+/** Instruction set for _skip, the best one until a benchmark changes it */
+static ATFS_BitmapIsa _isa = ATFS_BITMAP_ISA_COUNT;
+
+/* Load word `i` of the bitmap, bit k of the word is block 64 * i + k */
+static u64 _load(const u8 *map, u32 i)
+{
+	u64 w;
+
+	memcpy(&w, map + ((size_t)i << 3), sizeof(w));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	w = __builtin_bswap64(w);
+#endif
+	return w;
+}
+
+static u32 _words(u32 nbits)
+{
+	return (nbits >> 6) + !!(nbits & 63);
+}
+
+/* First word in [i, n) that is not `fill` (all zeros or all ones) */
+static u32 _skip_scalar(const u8 *map, u32 i, u32 n, u64 fill)
+{
+	for(; i < n && _load(map, i) == fill; ++i) ;
+	return i;
+}
+
+#ifdef __SSE2__
+
+/* Compare two words at a time */
+static u32 _skip_sse2(const u8 *map, u32 i, u32 n, u64 fill)
+{
+	__m128i f = _mm_set1_epi8((char)fill);
+	__m128i v;
+
+	for(; i + 2 <= n; i += 2)
+	{
+		v = _mm_loadu_si128((const __m128i *)(map + ((size_t)i << 3)));
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(v, f)) != 0xFFFF)
+		{
+			break;
+		}
+	}
+
+	return _skip_scalar(map, i, n, fill);
+}
+
+#endif /* __SSE2__ */
+
+#ifdef ATFS_BITMAP_HAVE_AVX2
+
+/* Compare eight words (512 blocks) at a time */
+__attribute__((target("avx2")))
+static u32 _skip_avx2(const u8 *map, u32 i, u32 n, u64 fill)
+{
+	__m256i f = _mm256_set1_epi8((char)fill);
+	__m256i a, b;
+	const u8 *p;
+
+	for(; i + 8 <= n; i += 8)
+	{
+		p = map + ((size_t)i << 3);
+		a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), f);
+		b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 32)), f);
+		if(_mm256_movemask_epi8(_mm256_and_si256(a, b)) != -1)
+		{
+			break;
+		}
+	}
+
+	return _skip_scalar(map, i, n, fill);
+}
+
+#endif /* ATFS_BITMAP_HAVE_AVX2 */
+
+static ATFS_BitmapIsa _isa_best(void)
+{
+#ifdef ATFS_BITMAP_HAVE_AVX2
+	if(__builtin_cpu_supports("avx2"))
+	{
+		return ATFS_BITMAP_AVX2;
+	}
+#endif
+
+#ifdef __SSE2__
+	return ATFS_BITMAP_SSE2;
+#else
+	return ATFS_BITMAP_SCALAR;
+#endif
+}
+
+ATFS_BitmapIsa atfs_bitmap_isa(ATFS_BitmapIsa isa)
+{
+	ATFS_BitmapIsa best = _isa_best();
+	_isa = isa < best ? isa : best;
+	return _isa;
+}
+
+const char *atfs_bitmap_isa_string(ATFS_BitmapIsa isa)
+{
+	static const char *isa_str[] =
+	{
+		"scalar",
+		"sse2",
+		"avx2",
+	};
+
+	return isa < ATFS_BITMAP_ISA_COUNT ? isa_str[isa] : "unknown";
+}
+
+static u32 _skip(const u8 *map, u32 i, u32 n, u64 fill)
+{
+	if(_isa == ATFS_BITMAP_ISA_COUNT)
+	{
+		_isa = _isa_best();
+	}
+
+	switch(_isa)
+	{
+#ifdef ATFS_BITMAP_HAVE_AVX2
+	case ATFS_BITMAP_AVX2:
+		return _skip_avx2(map, i, n, fill);
+#endif
+
+#ifdef __SSE2__
+	case ATFS_BITMAP_SSE2:
+		return _skip_sse2(map, i, n, fill);
+#endif
+
+	default:
+		return _skip_scalar(map, i, n, fill);
+	}
+}
+
+/* First free block at or after `i`, `nbits` if there is none */
+static u32 _next_zero(const u8 *map, u32 nbits, u32 i)
+{
+	u32 n, w;
+	u64 x;
+
+	if(i >= nbits)
+	{
+		return nbits;
+	}
+
+	n = _words(nbits);
+	w = i >> 6;
+	if(!(x = ~_load(map, w) & (WORD_FULL << (i & 63))))
+	{
+		if((w = _skip(map, w + 1, n, WORD_FULL)) >= n)
+		{
+			return nbits;
+		}
+
+		x = ~_load(map, w);
+	}
+
+	i = (w << 6) + __builtin_ctzll(x);
+	return i < nbits ? i : nbits;
+}
+
+/* First used block in [i, limit), `limit` if there is none */
+static u32 _next_one(const u8 *map, u32 i, u32 limit)
+{
+	u32 n, w;
+	u64 x;
+
+	if(i >= limit)
+	{
+		return limit;
+	}
+
+	n = _words(limit);
+	w = i >> 6;
+	if(!(x = _load(map, w) & (WORD_FULL << (i & 63))))
+	{
+		if((w = _skip(map, w + 1, n, 0)) >= n)
+		{
+			return limit;
+		}
+
+		x = _load(map, w);
+	}
+
+	i = (w << 6) + __builtin_ctzll(x);
+	return i < limit ? i : limit;
+}
+
+/* Start of the run of free blocks that ends at `i` */
+static u32 _run_start(const u8 *map, u32 i)
+{
+	u32 w;
+	u64 x;
+
+	if(!i)
+	{
+		return 0;
+	}
+
+	w = (i - 1) >> 6;
+	x = _load(map, w) & (WORD_FULL >> (63 - ((i - 1) & 63)));
+	while(!x)
+	{
+		if(!w)
+		{
+			return 0;
+		}
+
+		x = _load(map, --w);
+	}
+
+	return (w << 6) + 64 - __builtin_clzll(x);
+}
+
+static int _bit(const u8 *map, u32 i)
+{
+	return (map[i >> 3] >> (i & 7)) & 1;
+}
+
+/* Set or clear `count` bits */
+static void _fill(u8 *map, u32 start, u32 count, int used)
+{
+	u32 end = start + count;
+
+	for(; start < end && (start & 7); ++start)
+	{
+		map[start >> 3] ^= (u8)((_bit(map, start) ^ used) << (start & 7));
+	}
+
+	memset(map + (start >> 3), used ? 0xFF : 0, (end - start) >> 3);
+	for(start += (end - start) & ~7u; start < end; ++start)
+	{
+		map[start >> 3] ^= (u8)((_bit(map, start) ^ used) << (start & 7));
+	}
+}
+
+/* Number of free blocks directly next to the range */
+static u32 _free_neighbours(const u8 *map, u32 nbits, u32 start, u32 count)
+{
+	return (start && !_bit(map, start - 1)) +
+		(start + count < nbits && !_bit(map, start + count));
+}
+
+/* Bits where a run of `count` free blocks (at most 64) starts inside
+	the word with the free bits `f` */
+static u64 _runs_in_word(u64 f, u32 count)
+{
+	u32 len, shift;
+
+	for(len = 1; len < count && f; len += shift)
+	{
+		shift = len < count - len ? len : count - len;
+		f &= f >> shift;
+	}
+
+	return f;
+}
+
+/* The bits after `nbits` count as free here, so a run that is found
+	must still be checked against the end */
+static u32 _find(const u8 *map, u32 nbits, u32 count)
+{
+	u32 n, w, next, run, start;
+	u64 x, r;
+
+	n = _words(nbits);
+	run = 0;
+	start = ATFS_BITMAP_NONE;
+	for(w = 0; w < n; ++w)
+	{
+		if((x = _load(map, w)) == WORD_FULL)
+		{
+			/* Skip used blocks */
+			run = 0;
+			w = _skip(map, w + 1, n, WORD_FULL) - 1;
+		}
+		else if(!x)
+		{
+			/* Skip free blocks, unless this word is already enough */
+			next = run + 64 >= count ? w + 1 : _skip(map, w + 1, n, 0);
+			if(run + ((next - w) << 6) >= count)
+			{
+				start = (w << 6) - run;
+				break;
+			}
+
+			run += (next - w) << 6;
+			w = next - 1;
+		}
+		else if(run + __builtin_ctzll(x) >= count)
+		{
+			/* Run that started in an earlier word ends here */
+			start = (w << 6) - run;
+			break;
+		}
+		else if(count <= 64 && (r = _runs_in_word(~x, count)))
+		{
+			start = (w << 6) + __builtin_ctzll(r);
+			break;
+		}
+		else
+		{
+			/* Free blocks at the end of the word start a new run */
+			run = __builtin_clzll(x);
+		}
+	}
+
+	return start != ATFS_BITMAP_NONE && start <= nbits - count ?
+		start : ATFS_BITMAP_NONE;
+}
+
+u32 atfs_bitmap_find(const u8 *map, u32 nbits, u32 count, u32 *largest)
+{
+	u32 start, free_blocks, areas;
+
+	*largest = 0;
+	start = count && count <= nbits ? _find(map, nbits, count) :
+		ATFS_BITMAP_NONE;
+
+	if(start == ATFS_BITMAP_NONE)
+	{
+		/* Only needed when nothing was found, so it is not tracked
+			during the search */
+		atfs_bitmap_count(map, nbits, &free_blocks, &areas, largest);
+	}
+
+	return start;
+}
+
+u32 atfs_bitmap_next_run(const u8 *map, u32 nbits, u32 from, u32 *size)
+{
+	u32 start = _next_zero(map, nbits, from);
+	*size = _next_one(map, start, nbits) - start;
+	return start;
+}
+
+void atfs_bitmap_count(const u8 *map, u32 nbits, u32 *free_blocks,
+	u32 *areas, u32 *largest)
+{
+	u32 start, size;
+
+	*free_blocks = 0;
+	*areas = 0;
+	*largest = 0;
+	for(start = 0; (start = atfs_bitmap_next_run(map, nbits, start, &size)) <
+		nbits; start += size)
+	{
+		*free_blocks += size;
+		++*areas;
+		if(size > *largest)
+		{
+			*largest = size;
+		}
+	}
+}
+
+/* Bytes of the bitmap */
+static size_t _map_bytes(BlockDevice *dev, const ATFS_Groups *groups)
+{
+	return (size_t)groups->BitmapBlocks << dev->BlockSizePOT;
+}
+
+ATFS_Status atfs_bitmap_read(BlockDevice *dev, const ATFS_Groups *groups,
+	u8 **map)
+{
+	DeviceStatus status;
+	u8 *p;
+
+	if(!(p = malloc(_map_bytes(dev, groups))))
+	{
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	if((status = dev_read(dev, groups->BitmapStart, groups->BitmapBlocks, p)))
+	{
+		free(p);
+		return status;
+	}
+
+	*map = p;
+	return ATFS_STATUS_OK;
+}
+
+ATFS_Status atfs_bitmap_check(BlockDevice *dev, const ATFS_Groups *groups,
+	const u8 *map)
+{
+	u8 buf[dev->BlockSize];
+	u32 free_blocks, areas, largest;
+
+	/* Boot block, root directory and the bitmap itself are never free */
+	if(_next_zero(map, groups->BlockCount, 0) <
+		groups->BitmapStart + groups->BitmapBlocks)
+	{
+		return ATFS_STATUS_INVALID_VOLUME;
+	}
+
+	atfs_bitmap_count(map, groups->BlockCount, &free_blocks, &areas, &largest);
+	PROPAGATE(dev_read(dev, ATFS_SECTOR_BOOT, 1, buf));
+	if(atfs_read32(buf + ATFS_OFFSET_GROUP_FREE) == free_blocks &&
+		atfs_read32(buf + ATFS_OFFSET_GROUP_AREAS) == areas &&
+		atfs_read32(buf + ATFS_OFFSET_GROUP_LARGEST) == largest)
+	{
+		return ATFS_STATUS_OK;
+	}
+
+	atfs_write32(buf + ATFS_OFFSET_GROUP_FREE, free_blocks);
+	atfs_write32(buf + ATFS_OFFSET_GROUP_AREAS, areas);
+	atfs_write32(buf + ATFS_OFFSET_GROUP_LARGEST, largest);
+	return dev_write(dev, ATFS_SECTOR_BOOT, 1, buf);
+}
+
+/* Write the changed bitmap blocks together with the summary in the boot
+	block. Largest is the new largest run if `exact`, otherwise the size
+	of a run that was created. */
+static ATFS_Status _commit(BlockDevice *dev, const ATFS_Groups *groups,
+	u8 *map, u32 start, u32 count, i32 free_delta, i32 area_delta,
+	u32 largest, int exact)
+{
+	u8 buf[dev->BlockSize];
+	DeviceIOVec vec[2];
+	u32 first, last;
+
+	PROPAGATE(dev_read(dev, ATFS_SECTOR_BOOT, 1, buf));
+	atfs_write32(buf + ATFS_OFFSET_GROUP_FREE,
+		atfs_read32(buf + ATFS_OFFSET_GROUP_FREE) + (u32)free_delta);
+	atfs_write32(buf + ATFS_OFFSET_GROUP_AREAS,
+		atfs_read32(buf + ATFS_OFFSET_GROUP_AREAS) + (u32)area_delta);
+	if(exact || largest > atfs_read32(buf + ATFS_OFFSET_GROUP_LARGEST))
+	{
+		atfs_write32(buf + ATFS_OFFSET_GROUP_LARGEST, largest);
+	}
+
+	vec[0].Offset = ATFS_SECTOR_BOOT;
+	vec[0].Count = 1;
+	vec[0].Buffer = buf;
+	if(!count)
+	{
+		return dev_writev(dev, vec, 1);
+	}
+
+	first = (start >> 3) >> dev->BlockSizePOT;
+	last = ((start + count - 1) >> 3) >> dev->BlockSizePOT;
+	vec[1].Offset = groups->BitmapStart + first;
+	vec[1].Count = last - first + 1;
+	vec[1].Buffer = map + ((size_t)first << dev->BlockSizePOT);
+	return dev_writev(dev, vec, 2);
+}
+
+/* Mark a range as used and write it */
+static ATFS_Status _take(BlockDevice *dev, const ATFS_Groups *groups,
+	u8 *map, u32 start, u32 count)
+{
+	ATFS_Status status;
+	u32 neighbours;
+
+	/* The largest run can only shrink, it stays an upper bound */
+	neighbours = _free_neighbours(map, groups->BlockCount, start, count);
+	_fill(map, start, count, 1);
+	if((status = _commit(dev, groups, map, start, count, -(i32)count,
+		(i32)neighbours - 1, 0, 0)))
+	{
+		_fill(map, start, count, 0);
+	}
+
+	return status;
+}
+
+static ATFS_Status _alloc(BlockDevice *dev, const ATFS_Groups *groups,
+	u8 *map, u32 count, u32 *start)
+{
+	u32 s, largest;
+
+	if((s = atfs_bitmap_find(map, groups->BlockCount, count, &largest)) ==
+		ATFS_BITMAP_NONE)
+	{
+		/* The search saw every run, so the summary can be made exact
+			and the next request of this size fails right away */
+		PROPAGATE(_commit(dev, groups, map, 0, 0, 0, 0, largest, 1));
+		return ATFS_STATUS_NO_SPACE_LEFT_ON_DEVICE;
+	}
+
+	PROPAGATE(_take(dev, groups, map, s, count));
+	*start = s;
+	return ATFS_STATUS_OK;
+}
+
+ATFS_Status atfs_bitmap_alloc(BlockDevice *dev, const ATFS_Groups *groups,
+	u8 *map, u32 count, u32 *start)
+{
+	u8 buf[dev->BlockSize];
+	ATFS_Status status;
+	const u8 *data;
+	u32 largest;
+	u8 *own;
+
+	/* Doomed requests fail on the summary */
+	PROPAGATE(dev_map(dev, ATFS_SECTOR_BOOT, buf, &data));
+	largest = atfs_read32(data + ATFS_OFFSET_GROUP_LARGEST);
+	dev_unmap(dev, ATFS_SECTOR_BOOT);
+	if(largest < count)
+	{
+		return ATFS_STATUS_NO_SPACE_LEFT_ON_DEVICE;
+	}
+
+	if(map)
+	{
+		return _alloc(dev, groups, map, count, start);
+	}
+
+	PROPAGATE(atfs_bitmap_read(dev, groups, &own));
+	status = _alloc(dev, groups, own, count, start);
+	free(own);
+	return status;
+}
+
+static ATFS_Status _alloc_at(BlockDevice *dev, const ATFS_Groups *groups,
+	u8 *map, u32 start, u32 count)
+{
+	if(_next_one(map, start, start + count) != start + count)
+	{
+		return ATFS_STATUS_NO_SPACE_LEFT_ON_DEVICE;
+	}
+
+	return _take(dev, groups, map, start, count);
+}
+
+ATFS_Status atfs_bitmap_alloc_at(BlockDevice *dev, const ATFS_Groups *groups,
+	u8 *map, u32 start, u32 count)
+{
+	ATFS_Status status;
+	u8 *own;
+
+	if(!count || start >= groups->BlockCount ||
+		count > groups->BlockCount - start)
+	{
+		return ATFS_STATUS_NO_SPACE_LEFT_ON_DEVICE;
+	}
+
+	if(map)
+	{
+		return _alloc_at(dev, groups, map, start, count);
+	}
+
+	PROPAGATE(atfs_bitmap_read(dev, groups, &own));
+	status = _alloc_at(dev, groups, own, start, count);
+	free(own);
+	return status;
+}
+
+static ATFS_Status _free(BlockDevice *dev, const ATFS_Groups *groups,
+	u8 *map, u32 start, u32 count)
+{
+	ATFS_Status status;
+	u32 neighbours, run;
+
+	/* Blocks that are already free would be counted twice */
+	if(_next_zero(map, start + count, start) != start + count)
+	{
+		return ATFS_STATUS_INVALID_ARGUMENT;
+	}
+
+	neighbours = _free_neighbours(map, groups->BlockCount, start, count);
+	_fill(map, start, count, 0);
+	run = _next_one(map, start + count, groups->BlockCount) -
+		_run_start(map, start);
+	if((status = _commit(dev, groups, map, start, count, count,
+		1 - (i32)neighbours, run, 0)))
+	{
+		_fill(map, start, count, 1);
+		return status;
+	}
+
+	return dev_discard(dev, start, count);
+}
+
+ATFS_Status atfs_bitmap_free(BlockDevice *dev, const ATFS_Groups *groups,
+	u8 *map, u32 start, u32 count)
+{
+	ATFS_Status status;
+	u8 *own;
+
+	if(!count)
+	{
+		return ATFS_STATUS_OK;
+	}
+
+	if(start < groups->BitmapStart + groups->BitmapBlocks ||
+		start >= groups->BlockCount || count > groups->BlockCount - start)
+	{
+		return ATFS_STATUS_INVALID_ARGUMENT;
+	}
+
+	if(map)
+	{
+		return _free(dev, groups, map, start, count);
+	}
+
+	PROPAGATE(atfs_bitmap_read(dev, groups, &own));
+	status = _free(dev, groups, own, start, count);
+	free(own);
+	return status;
+}
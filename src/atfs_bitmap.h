@@ -0,0 +1,150 @@
+/**
+ * @file    atfs_bitmap.h
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ * @brief   ATFS Free space bitmap
+ *
+ * Volumes formatted with ATFS_ALLOCATOR_BITMAP track free space with one
+ * bit per block instead of a free list. The search functions work on a
+ * copy of the bitmap in memory, which a mounted volume keeps, and look at
+ * 64 blocks at a time, runs inside one word are found with shifts. Long
+ * stretches of used or free blocks are skipped with SSE2, or with AVX2 if
+ * the processor supports it.
+ *
+ * The bitmap in memory must be a whole number of 64 bit words,
+ * which the bitmap blocks always are.
+ */
+
+#ifndef __ATFS_BITMAP_H__
+#define __ATFS_BITMAP_H__
+
+#include "atfs.h"
+
+/** No run of free blocks was found */
+#define ATFS_BITMAP_NONE  0xFFFFFFFF
+
+/** Instruction set used to skip used or free stretches of the bitmap */
+typedef enum
+{
+	ATFS_BITMAP_SCALAR,
+	ATFS_BITMAP_SSE2,
+	ATFS_BITMAP_AVX2,
+	ATFS_BITMAP_ISA_COUNT,
+} ATFS_BitmapIsa;
+
+/**
+ * @brief Select the instruction set for the bitmap search, for
+ *        benchmarking. The best one that is supported is used by default.
+ *
+ * @param isa Requested instruction set
+ * @return Instruction set that is used, at most the requested one
+ */
+ATFS_BitmapIsa atfs_bitmap_isa(ATFS_BitmapIsa isa);
+
+/**
+ * @brief Returns the name of an instruction set
+ *
+ * @param isa Instruction set
+ * @return Pointer to string constant
+ */
+const char *atfs_bitmap_isa_string(ATFS_BitmapIsa isa);
+
+/**
+ * @brief Find the first run of `count` free blocks
+ *
+ * @param map Bitmap
+ * @param nbits Number of blocks
+ * @param count Number of blocks needed
+ * @param largest Output parameter largest run of the bitmap if none was
+ *        found, otherwise 0
+ * @return First block of the run or ATFS_BITMAP_NONE
+ */
+u32 atfs_bitmap_find(const u8 *map, u32 nbits, u32 count, u32 *largest);
+
+/**
+ * @brief Find the next run of free blocks
+ *
+ * @param map Bitmap
+ * @param nbits Number of blocks
+ * @param from First block to look at
+ * @param size Output parameter number of blocks of the run
+ * @return First block of the run, `nbits` if there is none
+ */
+u32 atfs_bitmap_next_run(const u8 *map, u32 nbits, u32 from, u32 *size);
+
+/**
+ * @brief Count the free blocks and runs of free blocks
+ *
+ * @param map Bitmap
+ * @param nbits Number of blocks
+ * @param free_blocks Output parameter number of free blocks
+ * @param areas Output parameter number of runs
+ * @param largest Output parameter size of the largest run
+ */
+void atfs_bitmap_count(const u8 *map, u32 nbits, u32 *free_blocks,
+	u32 *areas, u32 *largest);
+
+/**
+ * @brief Read the bitmap of a volume into memory
+ *
+ * @param dev Block device
+ * @param groups Free space layout
+ * @param map Output parameter bitmap, must be freed by the caller
+ * @return Status
+ */
+ATFS_Status atfs_bitmap_read(BlockDevice *dev, const ATFS_Groups *groups,
+	u8 **map);
+
+/**
+ * @brief Check that the blocks in front of the free space are marked as
+ *        used and correct the free space summary in the boot block
+ *
+ * @param dev Block device
+ * @param groups Free space layout
+ * @param map Bitmap
+ * @return Status
+ */
+ATFS_Status atfs_bitmap_check(BlockDevice *dev, const ATFS_Groups *groups,
+	const u8 *map);
+
+/**
+ * @brief Allocate the first run of `count` free blocks
+ *
+ * @param dev Block device
+ * @param groups Free space layout
+ * @param map Bitmap of a mounted volume, NULL to read it from disk
+ * @param count Number of blocks
+ * @param start Output parameter first block
+ * @return Status
+ */
+ATFS_Status atfs_bitmap_alloc(BlockDevice *dev, const ATFS_Groups *groups,
+	u8 *map, u32 count, u32 *start);
+
+/**
+ * @brief Allocate `count` blocks at `start`, which must all be free
+ *
+ * @param dev Block device
+ * @param groups Free space layout
+ * @param map Bitmap of a mounted volume, NULL to read it from disk
+ * @param start First block
+ * @param count Number of blocks
+ * @return Status
+ */
+ATFS_Status atfs_bitmap_alloc_at(BlockDevice *dev, const ATFS_Groups *groups,
+	u8 *map, u32 start, u32 count);
+
+/**
+ * @brief Free `count` blocks at `start`, which must all be used
+ *
+ * @param dev Block device
+ * @param groups Free space layout
+ * @param map Bitmap of a mounted volume, NULL to read it from disk
+ * @param start First block
+ * @param count Number of blocks
+ * @return Status
+ */
+ATFS_Status atfs_bitmap_free(BlockDevice *dev, const ATFS_Groups *groups,
+	u8 *map, u32 start, u32 count);
+
+#endif /* __ATFS_BITMAP_H__ */
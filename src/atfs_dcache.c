@@ -0,0 +1,494 @@
+/**
+ * @file    atfs_dcache.c
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ */
+
+#include "atfs_dcache.h"
+#include "atfs_hdir.h"
+#include "atfs_mount.h"
+#include <stdlib.h>
+#include <string.h>
+
+/** No entry, end of a list */
+#define DCACHE_NONE  0xFFFFFFFF
+
+static u32 _hash(u32 dir, const char *name, size_t len)
+{
+	return atfs_name_hash(name, len) ^ (dir * 2654435761u);
+}
+
+static u32 _mix(u32 x)
+{
+	x *= 2654435761u;
+	return x ^ (x >> 16);
+}
+
+/* Bucket of the position of a directory entry */
+static u32 *_pos_bucket(ATFS_DCache *c, u32 block, u32 offset)
+{
+	return &c->PosBuckets[_mix(block ^ _mix(offset)) & c->Mask];
+}
+
+/* Bucket of the names cached in a directory */
+static u32 *_dir_bucket(ATFS_DCache *c, u32 dir)
+{
+	return &c->DirBuckets[_mix(dir) & c->Mask];
+}
+
+static void _clear(ATFS_DCache *c)
+{
+	u32 i;
+
+	c->Count = 0;
+	c->Head = DCACHE_NONE;
+	c->Tail = DCACHE_NONE;
+	c->Free = DCACHE_NONE;
+	for(i = 0; c->Buckets && i <= c->Mask; ++i)
+	{
+		c->Buckets[i] = DCACHE_NONE;
+		c->PosBuckets[i] = DCACHE_NONE;
+		c->DirBuckets[i] = DCACHE_NONE;
+	}
+}
+
+static void _free(ATFS_DCache *c)
+{
+	free(c->Entries);
+	free(c->Buckets);
+	free(c->PosBuckets);
+	free(c->DirBuckets);
+	c->Entries = NULL;
+	c->Buckets = NULL;
+	c->PosBuckets = NULL;
+	c->DirBuckets = NULL;
+}
+
+static ATFS_Status _alloc(ATFS_DCache *c, u32 size)
+{
+	u32 buckets;
+
+	c->Entries = NULL;
+	c->Buckets = NULL;
+	c->PosBuckets = NULL;
+	c->DirBuckets = NULL;
+	c->Capacity = 0;
+	c->Mask = 0;
+	_clear(c);
+	if(!size)
+	{
+		return ATFS_STATUS_OK;
+	}
+
+	if(size > 0x80000000)
+	{
+		return ATFS_STATUS_INVALID_ARGUMENT;
+	}
+
+	/* About one entry per bucket */
+	for(buckets = 1; buckets < size; buckets <<= 1) ;
+	c->Entries = malloc((size_t)size * sizeof(*c->Entries));
+	c->Buckets = malloc((size_t)buckets * sizeof(*c->Buckets));
+	c->PosBuckets = malloc((size_t)buckets * sizeof(*c->PosBuckets));
+	c->DirBuckets = malloc((size_t)buckets * sizeof(*c->DirBuckets));
+	if(!c->Entries || !c->Buckets || !c->PosBuckets || !c->DirBuckets)
+	{
+		_free(c);
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	c->Capacity = size;
+	c->Mask = buckets - 1;
+	_clear(c);
+	return ATFS_STATUS_OK;
+}
+
+ATFS_Status atfs_dcache_init(ATFS_DCache *cache, u32 size)
+{
+	ATFS_Status status;
+
+	if(!(status = _alloc(cache, size)))
+	{
+		pthread_mutex_init(&cache->Lock, NULL);
+		cache->Hits = 0;
+		cache->Misses = 0;
+	}
+
+	return status;
+}
+
+ATFS_Status atfs_dcache_resize(ATFS_DCache *cache, u32 size)
+{
+	ATFS_Status status;
+
+	pthread_mutex_lock(&cache->Lock);
+	_free(cache);
+	status = _alloc(cache, size);
+	pthread_mutex_unlock(&cache->Lock);
+	return status;
+}
+
+void atfs_dcache_destroy(ATFS_DCache *cache)
+{
+	_free(cache);
+	pthread_mutex_destroy(&cache->Lock);
+}
+
+/* Locked cache of a mounted volume, NULL if there is none */
+static ATFS_DCache *_lock(BlockDevice *dev)
+{
+	ATFS_Mount *m;
+
+	if(!(m = atfs_mount_find(dev)))
+	{
+		return NULL;
+	}
+
+	pthread_mutex_lock(&m->Dentries.Lock);
+	if(!m->Dentries.Capacity)
+	{
+		pthread_mutex_unlock(&m->Dentries.Lock);
+		return NULL;
+	}
+
+	return &m->Dentries;
+}
+
+static u32 _find(const ATFS_DCache *c, u32 dir, u32 hash,
+	const char *name, size_t len)
+{
+	const ATFS_Dentry *d;
+	u32 i;
+
+	for(i = c->Buckets[hash & c->Mask]; i != DCACHE_NONE; i = d->Chain)
+	{
+		d = &c->Entries[i];
+		if(d->Hash == hash && d->Dir == dir && d->Len == len &&
+			!memcmp(d->Name, name, len))
+		{
+			break;
+		}
+	}
+
+	return i;
+}
+
+static void _lru_unlink(ATFS_DCache *c, u32 i)
+{
+	ATFS_Dentry *d = &c->Entries[i];
+
+	if(d->Prev != DCACHE_NONE)
+	{
+		c->Entries[d->Prev].Next = d->Next;
+	}
+	else
+	{
+		c->Head = d->Next;
+	}
+
+	if(d->Next != DCACHE_NONE)
+	{
+		c->Entries[d->Next].Prev = d->Prev;
+	}
+	else
+	{
+		c->Tail = d->Prev;
+	}
+}
+
+static void _lru_front(ATFS_DCache *c, u32 i)
+{
+	ATFS_Dentry *d = &c->Entries[i];
+
+	d->Prev = DCACHE_NONE;
+	d->Next = c->Head;
+	if(c->Head != DCACHE_NONE)
+	{
+		c->Entries[c->Head].Prev = i;
+	}
+	else
+	{
+		c->Tail = i;
+	}
+
+	c->Head = i;
+}
+
+/* Index the position of the entry of a name that exists */
+static void _pos_link(ATFS_DCache *c, u32 i)
+{
+	ATFS_Dentry *d = &c->Entries[i];
+	u32 *bucket;
+
+	if(d->Entry.Type != ATFS_TYPE_FREE)
+	{
+		bucket = _pos_bucket(c, d->EntryBlock, d->EntryOffset);
+		d->PosChain = *bucket;
+		*bucket = i;
+	}
+}
+
+static void _pos_unlink(ATFS_DCache *c, u32 i)
+{
+	ATFS_Dentry *d = &c->Entries[i];
+	u32 *p;
+
+	if(d->Entry.Type != ATFS_TYPE_FREE)
+	{
+		for(p = _pos_bucket(c, d->EntryBlock, d->EntryOffset); *p != i;
+			p = &c->Entries[*p].PosChain) ;
+
+		*p = d->PosChain;
+	}
+}
+
+static void _dir_link(ATFS_DCache *c, u32 i)
+{
+	ATFS_Dentry *d = &c->Entries[i];
+	u32 *bucket = _dir_bucket(c, d->Dir);
+
+	d->DirPrev = DCACHE_NONE;
+	d->DirNext = *bucket;
+	if(*bucket != DCACHE_NONE)
+	{
+		c->Entries[*bucket].DirPrev = i;
+	}
+
+	*bucket = i;
+}
+
+static void _dir_unlink(ATFS_DCache *c, u32 i)
+{
+	ATFS_Dentry *d = &c->Entries[i];
+
+	if(d->DirPrev != DCACHE_NONE)
+	{
+		c->Entries[d->DirPrev].DirNext = d->DirNext;
+	}
+	else
+	{
+		*_dir_bucket(c, d->Dir) = d->DirNext;
+	}
+
+	if(d->DirNext != DCACHE_NONE)
+	{
+		c->Entries[d->DirNext].DirPrev = d->DirPrev;
+	}
+}
+
+static void _remove(ATFS_DCache *c, u32 i)
+{
+	u32 *p;
+
+	for(p = &c->Buckets[c->Entries[i].Hash & c->Mask]; *p != i;
+		p = &c->Entries[*p].Chain) ;
+
+	*p = c->Entries[i].Chain;
+	_pos_unlink(c, i);
+	_dir_unlink(c, i);
+	_lru_unlink(c, i);
+	c->Entries[i].Chain = c->Free;
+	c->Free = i;
+	--c->Count;
+}
+
+/* Unused entry, the least recently used one is dropped if there is none */
+static u32 _take(ATFS_DCache *c)
+{
+	u32 i;
+
+	/* Without forgotten entries, the first Count entries are in use */
+	if(c->Free == DCACHE_NONE && c->Count == c->Capacity)
+	{
+		_remove(c, c->Tail);
+	}
+
+	if(c->Free != DCACHE_NONE)
+	{
+		i = c->Free;
+		c->Free = c->Entries[i].Chain;
+	}
+	else
+	{
+		i = c->Count;
+	}
+
+	++c->Count;
+	return i;
+}
+
+int atfs_dcache_lookup(BlockDevice *dev, u32 dir, const char *name,
+	size_t len, ATFS_NamelessDirEntry *entry,
+	u32 *entry_block, u32 *entry_offset)
+{
+	ATFS_DCache *c;
+	ATFS_Dentry *d;
+	u32 i;
+
+	if(!(c = _lock(dev)))
+	{
+		return 0;
+	}
+
+	if((i = _find(c, dir, _hash(dir, name, len), name, len)) == DCACHE_NONE)
+	{
+		++c->Misses;
+		pthread_mutex_unlock(&c->Lock);
+		return 0;
+	}
+
+	d = &c->Entries[i];
+	*entry = d->Entry;
+	*entry_block = d->EntryBlock;
+	*entry_offset = d->EntryOffset;
+	_lru_unlink(c, i);
+	_lru_front(c, i);
+	++c->Hits;
+	pthread_mutex_unlock(&c->Lock);
+	return 1;
+}
+
+void atfs_dcache_add(BlockDevice *dev, u32 dir, const char *name,
+	size_t len, const ATFS_NamelessDirEntry *entry,
+	u32 entry_block, u32 entry_offset)
+{
+	ATFS_DCache *c;
+	ATFS_Dentry *d;
+	u32 i, hash;
+
+	if(len > ATFS_MAX_FILE_NAME_LENGTH || !(c = _lock(dev)))
+	{
+		return;
+	}
+
+	hash = _hash(dir, name, len);
+	if((i = _find(c, dir, hash, name, len)) != DCACHE_NONE)
+	{
+		_pos_unlink(c, i);
+		_lru_unlink(c, i);
+	}
+	else
+	{
+		i = _take(c);
+		d = &c->Entries[i];
+		d->Dir = dir;
+		d->Hash = hash;
+		d->Len = len;
+		memcpy(d->Name, name, len);
+		d->Chain = c->Buckets[hash & c->Mask];
+		c->Buckets[hash & c->Mask] = i;
+		_dir_link(c, i);
+	}
+
+	d = &c->Entries[i];
+	if(entry)
+	{
+		d->Entry = *entry;
+	}
+	else
+	{
+		d->Entry.Type = ATFS_TYPE_FREE;
+		d->Entry.StartBlock = 0;
+		d->Entry.SizeBlocks = 0;
+	}
+
+	d->EntryBlock = entry_block;
+	d->EntryOffset = entry_offset;
+	_pos_link(c, i);
+	_lru_front(c, i);
+	pthread_mutex_unlock(&c->Lock);
+}
+
+void atfs_dcache_forget(BlockDevice *dev, u32 dir, const char *name,
+	size_t len)
+{
+	ATFS_DCache *c;
+	u32 i;
+
+	if(!(c = _lock(dev)))
+	{
+		return;
+	}
+
+	if((i = _find(c, dir, _hash(dir, name, len), name, len)) != DCACHE_NONE)
+	{
+		_remove(c, i);
+	}
+
+	pthread_mutex_unlock(&c->Lock);
+}
+
+void atfs_dcache_forget_entry(BlockDevice *dev, u32 entry_block,
+	u32 entry_offset)
+{
+	ATFS_DCache *c;
+	ATFS_Dentry *d;
+	u32 i, next, dir;
+
+	if(!(c = _lock(dev)))
+	{
+		return;
+	}
+
+	dir = DCACHE_NONE;
+	for(i = *_pos_bucket(c, entry_block, entry_offset); i != DCACHE_NONE;
+		i = next)
+	{
+		d = &c->Entries[i];
+		next = d->PosChain;
+		if(d->EntryBlock == entry_block && d->EntryOffset == entry_offset)
+		{
+			/* A directory that moved leaves names behind */
+			if((d->Entry.Type & ATFS_TYPE_MASK) == ATFS_TYPE_DIR)
+			{
+				dir = d->Entry.StartBlock;
+			}
+
+			_remove(c, i);
+		}
+	}
+
+	for(i = dir != DCACHE_NONE ? *_dir_bucket(c, dir) : DCACHE_NONE;
+		i != DCACHE_NONE; i = next)
+	{
+		next = c->Entries[i].DirNext;
+		if(c->Entries[i].Dir == dir)
+		{
+			_remove(c, i);
+		}
+	}
+
+	pthread_mutex_unlock(&c->Lock);
+}
+
+void atfs_dcache_clear(BlockDevice *dev)
+{
+	ATFS_DCache *c;
+
+	if((c = _lock(dev)))
+	{
+		_clear(c);
+		pthread_mutex_unlock(&c->Lock);
+	}
+}
+
+ATFS_Status atfs_dcache_stats(BlockDevice *dev, ATFS_DCacheStats *stats)
+{
+	ATFS_Mount *m;
+
+	if(!(m = atfs_mount_find(dev)))
+	{
+		return ATFS_STATUS_NOT_MOUNTED;
+	}
+
+	pthread_mutex_lock(&m->Dentries.Lock);
+	stats->Size = m->Dentries.Capacity;
+	stats->Count = m->Dentries.Count;
+	stats->Hits = m->Dentries.Hits;
+	stats->Misses = m->Dentries.Misses;
+	m->Dentries.Hits = 0;
+	m->Dentries.Misses = 0;
+	pthread_mutex_unlock(&m->Dentries.Lock);
+	return ATFS_STATUS_OK;
+}
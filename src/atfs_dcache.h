@@ -0,0 +1,201 @@
+/**
+ * @file    atfs_dcache.h
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ * @brief   ATFS Directory entry cache
+ *
+ * A mounted volume remembers the result of recent name lookups, keyed by
+ * the first block of the directory and the name. Names that were not
+ * found are remembered too, so looking up a path again does not read any
+ * directory. The cache holds a fixed number of names and drops the least
+ * recently used one when it is full.
+ *
+ * Everything that changes a directory entry forgets it: creating a name
+ * forgets the name, rewriting an entry (resize, placing a delayed file)
+ * forgets the entry at that position (found through a second hash table
+ * keyed by the position, and one keyed by the directory for the names
+ * in a directory that moved), and operations that move many
+ * entries (defragmentation, delayed allocation flush, format) clear the
+ * whole cache.
+ */
+
+#ifndef __ATFS_DCACHE_H__
+#define __ATFS_DCACHE_H__
+
+#include "atfs.h"
+#include <pthread.h>
+
+/** Default number of names in the cache of a mounted volume */
+#define ATFS_DCACHE_DEFAULT_SIZE  1024
+
+/** Cached name lookup */
+typedef struct
+{
+	/** First block of the directory */
+	u32 Dir;
+
+	/** Hash of the directory and the name */
+	u32 Hash;
+
+	/** Next entry with the same hash bucket, or free entry */
+	u32 Chain;
+
+	/** Next entry with the same position bucket, only for names that
+		exist */
+	u32 PosChain;
+
+	/** Neighbours in the list of the directory bucket */
+	u32 DirPrev, DirNext;
+
+	/** Neighbours in the LRU list, most recently used first */
+	u32 Prev, Next;
+
+	/** Directory entry, type ATFS_TYPE_FREE if the name does not exist */
+	ATFS_NamelessDirEntry Entry;
+
+	/** Position of the directory entry */
+	u32 EntryBlock, EntryOffset;
+
+	/** Name, not null-terminated */
+	u8 Len;
+	char Name[ATFS_MAX_FILE_NAME_LENGTH];
+} ATFS_Dentry;
+
+/** Directory entry cache of a mounted volume */
+typedef struct
+{
+	/** Capacity entries */
+	ATFS_Dentry *Entries;
+
+	/** First entry of every hash bucket, Mask + 1 buckets */
+	u32 *Buckets;
+
+	/** First entry of every bucket by position of the directory entry
+		and by directory, Mask + 1 buckets each, so rewriting an entry
+		finds it and the names cached in it without a full scan */
+	u32 *PosBuckets, *DirBuckets;
+
+	/** Number of entries, entries in use and hash bucket mask */
+	u32 Capacity, Count, Mask;
+
+	/** Most and least recently used entry */
+	u32 Head, Tail;
+
+	/** List of entries that were forgotten */
+	u32 Free;
+
+	/** Lookups that were answered and lookups that were not */
+	u32 Hits, Misses;
+
+	/** Held while the cache is used */
+	pthread_mutex_t Lock;
+} ATFS_DCache;
+
+/** Statistics of a directory entry cache */
+typedef struct
+{
+	/** Maximum and current number of names */
+	u32 Size, Count;
+
+	/** Lookups answered from the cache and lookups that were not */
+	u32 Hits, Misses;
+} ATFS_DCacheStats;
+
+/**
+ * @brief Initialize a directory entry cache
+ *
+ * @param cache Cache
+ * @param size Number of names, 0 disables the cache
+ * @return Status code
+ */
+ATFS_Status atfs_dcache_init(ATFS_DCache *cache, u32 size);
+
+/**
+ * @brief Change the number of names a cache holds, it is cleared
+ *
+ * @param cache Cache
+ * @param size Number of names, 0 disables the cache
+ * @return Status code
+ */
+ATFS_Status atfs_dcache_resize(ATFS_DCache *cache, u32 size);
+
+/**
+ * @brief Free the memory of a directory entry cache
+ *
+ * @param cache Cache
+ */
+void atfs_dcache_destroy(ATFS_DCache *cache);
+
+/**
+ * @brief Look up a name in the cache of a mounted volume
+ *
+ * @param dev Block device
+ * @param dir First block of the directory
+ * @param name File name, does not need to be null-terminated
+ * @param len Length of the name
+ * @param entry Output parameter entry, type ATFS_TYPE_FREE if the name
+ *        is known not to exist
+ * @param entry_block Output parameter block of the entry
+ * @param entry_offset Output parameter byte offset of the entry in its block
+ * @return Nonzero if the cache knows the name
+ */
+int atfs_dcache_lookup(BlockDevice *dev, u32 dir, const char *name,
+	size_t len, ATFS_NamelessDirEntry *entry,
+	u32 *entry_block, u32 *entry_offset);
+
+/**
+ * @brief Remember the result of a lookup
+ *
+ * @param dev Block device
+ * @param dir First block of the directory
+ * @param name File name, does not need to be null-terminated
+ * @param len Length of the name
+ * @param entry Entry that was found, NULL if the name does not exist
+ * @param entry_block Block of the entry
+ * @param entry_offset Byte offset of the entry in its block
+ */
+void atfs_dcache_add(BlockDevice *dev, u32 dir, const char *name,
+	size_t len, const ATFS_NamelessDirEntry *entry,
+	u32 entry_block, u32 entry_offset);
+
+/**
+ * @brief Forget a name, after it was created, deleted or renamed
+ *
+ * @param dev Block device
+ * @param dir First block of the directory
+ * @param name File name, does not need to be null-terminated
+ * @param len Length of the name
+ */
+void atfs_dcache_forget(BlockDevice *dev, u32 dir, const char *name,
+	size_t len);
+
+/**
+ * @brief Forget the directory entry at a position after it was rewritten.
+ *        The contents of a directory are forgotten as well.
+ *
+ * @param dev Block device
+ * @param entry_block Block of the entry
+ * @param entry_offset Byte offset of the entry in its block
+ */
+void atfs_dcache_forget_entry(BlockDevice *dev, u32 entry_block,
+	u32 entry_offset);
+
+/**
+ * @brief Forget everything
+ *
+ * @param dev Block device
+ */
+void atfs_dcache_clear(BlockDevice *dev);
+
+/**
+ * @brief Get the statistics of the cache of a mounted volume and reset
+ *        the hit and miss counters
+ *
+ * @param dev Block device
+ * @param stats Output parameter statistics
+ * @return Status code
+ */
+ATFS_Status atfs_dcache_stats(BlockDevice *dev, ATFS_DCacheStats *stats);
+
+#endif /* __ATFS_DCACHE_H__ */
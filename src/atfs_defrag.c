@@ -0,0 +1,482 @@
+/**
+ * @file    atfs_defrag.c
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ */
+
+#include "atfs_defrag.h"
+#include "atfs_alloc.h"
+#include "atfs_dcache.h"
+#include "atfs_delay.h"
+#include "atfs_file.h"
+#include "atfs_hdir.h"
+#include "atfs_mount.h"
+#include "atfs_sdir.h"
+#include "atfs_util.h"
+#include <stdlib.h>
+#include <string.h>
+
+/** Parent of the root directory, its entry is in the boot block */
+#define DEFRAG_NO_PARENT  0xFFFFFFFF
+
+/** Type of an overflow block of a hashed directory, which is not moved
+	but scanned for entries like a directory */
+#define DEFRAG_TYPE_OVERFLOW  0xFF
+
+/** File or directory found on the volume */
+typedef struct
+{
+	/** Current position */
+	u32 Start, Size;
+
+	/** Directory that contains the entry, index into the file array */
+	u32 Parent;
+
+	/** Byte offset of the entry in the parent directory */
+	u32 Entry;
+
+	/** File type */
+	u8 Type;
+} DefragFile;
+
+/** All files of the volume */
+typedef struct
+{
+	DefragFile *Files;
+	u32 Count, Capacity;
+} DefragList;
+
+static ATFS_Status _list_add(DefragList *list, const DefragFile *file)
+{
+	DefragFile *p;
+	u32 cap;
+
+	if(list->Count == list->Capacity)
+	{
+		cap = list->Capacity ? 2 * list->Capacity : 64;
+		if(!(p = realloc(list->Files, cap * sizeof(*p))))
+		{
+			return ATFS_STATUS_OUT_OF_MEMORY;
+		}
+
+		list->Files = p;
+		list->Capacity = cap;
+	}
+
+	list->Files[list->Count++] = *file;
+	return ATFS_STATUS_OK;
+}
+
+/* The extents of a file in several extents and its extent blocks stay
+	where they are, they are added like free space group heads */
+static ATFS_Status _collect_extents(BlockDevice *dev, DefragList *list,
+	const u8 *entry)
+{
+	ATFS_FileExtent *extents;
+	ATFS_Status status;
+	DefragFile f;
+	u32 i, count, *blocks, block_count;
+
+	PROPAGATE(atfs_extents_read(dev, entry, &extents, &count,
+		&blocks, &block_count));
+
+	f.Parent = DEFRAG_NO_PARENT;
+	f.Entry = 0;
+	f.Type = ATFS_TYPE_FREE;
+	status = ATFS_STATUS_OK;
+	for(i = 0; !status && i < count; ++i)
+	{
+		f.Start = extents[i].Start;
+		f.Size = extents[i].Count;
+		status = _list_add(list, &f);
+	}
+
+	for(i = 0; !status && i < block_count; ++i)
+	{
+		f.Start = blocks[i];
+		f.Size = 1;
+		status = _list_add(list, &f);
+	}
+
+	free(extents);
+	free(blocks);
+	return status;
+}
+
+/* Number of entries of a directory block and the byte offset of each,
+	sorted directory blocks are checked first */
+static ATFS_Status _block_entries(BlockDevice *dev, ATFS_DirFormat format,
+	const u8 *data, u32 *offsets, u32 *count)
+{
+	u32 i;
+
+	if(format != ATFS_DIR_SORTED)
+	{
+		*count = dev->BlockSize >> ATFS_DIR_ENTRY_SIZE_POT;
+		for(i = 0; i < *count; ++i)
+		{
+			offsets[i] = i << ATFS_DIR_ENTRY_SIZE_POT;
+		}
+
+		return ATFS_STATUS_OK;
+	}
+
+	PROPAGATE(atfs_sdir_count(dev, data, count));
+	for(i = 0; i < *count; ++i)
+	{
+		PROPAGATE(atfs_sdir_entry(dev, data, i, &offsets[i]));
+	}
+
+	return ATFS_STATUS_OK;
+}
+
+/* Collect all entries of the directory tree. The list is its own queue,
+	directories are scanned in the order they were found. */
+static ATFS_Status _collect(BlockDevice *dev, DefragList *list)
+{
+	u8 buf[dev->BlockSize];
+	u8 copy[dev->BlockSize + ATFS_DIR_ENTRY_SIZE];
+	u32 offsets[dev->BlockSize / ATFS_SDIR_SLOT_SIZE];
+	const u8 *data, *cur;
+	u32 i, k, block, count, num_extent, next;
+	ATFS_DirFormat format;
+	ATFS_Status status;
+	DefragFile f;
+
+	PROPAGATE(dev_map(dev, ATFS_SECTOR_BOOT, buf, &data));
+	f.Start = atfs_read32(data + ATFS_OFFSET_ROOT_BLOCK);
+	f.Size = atfs_read32(data + ATFS_OFFSET_ROOT_SIZE);
+	status = atfs_dir_format_get(data, &format);
+	dev_unmap(dev, ATFS_SECTOR_BOOT);
+	PROPAGATE(status);
+	f.Parent = DEFRAG_NO_PARENT;
+	f.Entry = 0;
+	f.Type = ATFS_TYPE_DIR;
+	PROPAGATE(_list_add(list, &f));
+
+	for(i = 0; i < list->Count; ++i)
+	{
+		if(list->Files[i].Type != ATFS_TYPE_DIR &&
+			list->Files[i].Type != DEFRAG_TYPE_OVERFLOW)
+		{
+			continue;
+		}
+
+		for(block = 0; block < list->Files[i].Size; ++block)
+		{
+			PROPAGATE(dev_map(dev, list->Files[i].Start + block, buf, &data));
+			if((status = _block_entries(dev, format, data, offsets, &count)))
+			{
+				dev_unmap(dev, list->Files[i].Start + block);
+				return status;
+			}
+
+			num_extent = 0;
+			for(k = 0; k < count; ++k)
+			{
+				cur = data + offsets[k];
+				if(cur[ATFS_DIR_ENTRY_OFFSET_TYPE] == ATFS_TYPE_FREE)
+				{
+					continue;
+				}
+
+				/* Read the extent list once the block is unmapped */
+				if(cur[ATFS_DIR_ENTRY_OFFSET_TYPE] & ATFS_TYPE_FLAG_EXTENTS)
+				{
+					offsets[num_extent++] = offsets[k];
+					continue;
+				}
+
+				f.Start = atfs_read32(cur + ATFS_DIR_ENTRY_OFFSET_START);
+				f.Size = atfs_read32(cur + ATFS_DIR_ENTRY_OFFSET_SIZE);
+				f.Parent = i;
+				f.Entry = (block << dev->BlockSizePOT) + offsets[k];
+				f.Type = cur[ATFS_DIR_ENTRY_OFFSET_TYPE] & ATFS_TYPE_MASK;
+				if(f.Size && f.Start != ATFS_START_DELAYED &&
+					_list_add(list, &f))
+				{
+					dev_unmap(dev, list->Files[i].Start + block);
+					return ATFS_STATUS_OUT_OF_MEMORY;
+				}
+			}
+
+			/* Entries in the overflow blocks of a bucket have them
+				as their parent */
+			next = format == ATFS_DIR_HASHED ?
+				atfs_read32(data + ATFS_BUCKET_OFFSET_NEXT) : 0;
+
+			/* A packed entry at the end of the block is shorter than
+				a whole entry */
+			if(num_extent)
+			{
+				memcpy(copy, data, dev->BlockSize);
+				memset(copy + dev->BlockSize, 0, ATFS_DIR_ENTRY_SIZE);
+			}
+
+			dev_unmap(dev, list->Files[i].Start + block);
+			if(next >= dev->BlockCount)
+			{
+				return ATFS_STATUS_INVALID_VOLUME;
+			}
+
+			if(next)
+			{
+				f.Start = next;
+				f.Size = 1;
+				f.Parent = DEFRAG_NO_PARENT;
+				f.Entry = 0;
+				f.Type = DEFRAG_TYPE_OVERFLOW;
+				PROPAGATE(_list_add(list, &f));
+			}
+
+			for(k = 0; k < num_extent; ++k)
+			{
+				PROPAGATE(_collect_extents(dev, list, copy + offsets[k]));
+			}
+		}
+	}
+
+	return ATFS_STATUS_OK;
+}
+
+/* The list heads of the allocation groups can not be moved,
+	they are added as files without a type */
+static ATFS_Status _collect_groups(BlockDevice *dev, DefragList *list)
+{
+	ATFS_Groups groups;
+	DefragFile f;
+	u32 i;
+
+	PROPAGATE(atfs_groups_read(dev, &groups));
+	for(i = 1; i < groups.Count; ++i)
+	{
+		f.Start = atfs_group_head(&groups, i);
+		f.Size = 1;
+		f.Parent = DEFRAG_NO_PARENT;
+		f.Entry = 0;
+		f.Type = ATFS_TYPE_FREE;
+		PROPAGATE(_list_add(list, &f));
+	}
+
+	if(groups.Allocator == ATFS_ALLOCATOR_BITMAP)
+	{
+		f.Start = groups.BitmapStart;
+		f.Size = groups.BitmapBlocks;
+		f.Parent = DEFRAG_NO_PARENT;
+		f.Entry = 0;
+		f.Type = ATFS_TYPE_FREE;
+		PROPAGATE(_list_add(list, &f));
+	}
+
+	return ATFS_STATUS_OK;
+}
+
+static int _file_cmp(const void *a, const void *b)
+{
+	const DefragFile *x = *(DefragFile *const *)a;
+	const DefragFile *y = *(DefragFile *const *)b;
+	return (x->Start > y->Start) - (x->Start < y->Start);
+}
+
+/* Copy blocks to a lower position, chunks are copied in ascending
+	order so overlapping ranges work */
+static ATFS_Status _copy_down(BlockDevice *dev, u32 dst, u32 src, u32 count)
+{
+	u8 *buf;
+	u32 i, n;
+	DeviceStatus status;
+
+	n = count < ATFS_DEFRAG_CHUNK ? count : ATFS_DEFRAG_CHUNK;
+	if(!(buf = malloc((size_t)n * dev->BlockSize)))
+	{
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	status = DEVICE_STATUS_OK;
+	for(i = 0; i < count && !status; i += n)
+	{
+		n = count - i < ATFS_DEFRAG_CHUNK ? count - i : ATFS_DEFRAG_CHUNK;
+		if(!(status = dev_read(dev, src + i, n, buf)))
+		{
+			status = dev_write(dev, dst + i, n, buf);
+		}
+	}
+
+	free(buf);
+	return status;
+}
+
+/* Block and byte offset of the start block in the directory entry
+	(or the boot block for the root) of a file */
+static void _entry_location(BlockDevice *dev, const DefragList *list,
+	const DefragFile *file, u32 *block, u32 *offset)
+{
+	const DefragFile *parent;
+
+	if(file->Parent == DEFRAG_NO_PARENT)
+	{
+		*block = ATFS_SECTOR_BOOT;
+		*offset = ATFS_OFFSET_ROOT_BLOCK;
+	}
+	else
+	{
+		parent = &list->Files[file->Parent];
+		*block = parent->Start + (file->Entry >> dev->BlockSizePOT);
+		*offset = (file->Entry & (dev->BlockSize - 1)) +
+			ATFS_DIR_ENTRY_OFFSET_START;
+	}
+}
+
+/* Open handles keep the start block and the entry location, so an open
+	file and a directory with the entry of an open file stay in place */
+static int _in_use(BlockDevice *dev, const DefragList *list,
+	const DefragFile *file)
+{
+	u32 block, offset;
+
+	_entry_location(dev, list, file, &block, &offset);
+	return atfs_mount_in_use(dev, block, 1) ||
+		(file->Type == ATFS_TYPE_DIR &&
+			atfs_mount_in_use(dev, file->Start, file->Size));
+}
+
+/* Point the directory entry (or the boot block for the root) of a file
+	to its new start block */
+static ATFS_Status _update_entry(BlockDevice *dev, const DefragList *list,
+	const DefragFile *file, u32 start)
+{
+	u8 buf[dev->BlockSize];
+	u32 block, offset;
+	ATFS_Mount *m;
+
+	_entry_location(dev, list, file, &block, &offset);
+	PROPAGATE(dev_read(dev, block, 1, buf));
+	atfs_write32(buf + offset, start);
+	PROPAGATE(dev_write(dev, block, 1, buf));
+	if(file->Parent == DEFRAG_NO_PARENT && (m = atfs_mount_find(dev)))
+	{
+		m->RootBlock = start;
+	}
+
+	return ATFS_STATUS_OK;
+}
+
+/* Move a file down into the free area in front of it */
+static ATFS_Status _move_down(BlockDevice *dev, const DefragList *list,
+	DefragFile *file, u32 gap_start)
+{
+	u32 gap = file->Start - gap_start;
+	ATFS_Status status;
+
+	/* Take the free area, so nothing else can be put there meanwhile */
+	PROPAGATE(atfs_alloc_at(dev, gap_start, gap));
+	if((status = _copy_down(dev, gap_start, file->Start, file->Size)) ||
+		(status = _update_entry(dev, list, file, gap_start)))
+	{
+		atfs_free(dev, gap_start, gap);
+		return status;
+	}
+
+	/* The free space is now behind the file and is merged with the
+		next free area if there is one */
+	file->Start = gap_start;
+	return atfs_free(dev, gap_start + file->Size, gap);
+}
+
+/* Move files down in block order until the budget is used up */
+static ATFS_Status _compact(BlockDevice *dev, DefragList *list,
+	u32 budget, u32 *done)
+{
+	DefragFile **order;
+	u32 i, end;
+	ATFS_Status status;
+
+	if(!(order = malloc(list->Count * sizeof(*order))))
+	{
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	for(i = 0; i < list->Count; ++i)
+	{
+		order[i] = &list->Files[i];
+	}
+
+	qsort(order, list->Count, sizeof(*order), _file_cmp);
+	status = ATFS_STATUS_OK;
+	for(i = 0, end = ATFS_SIZE_BOOT; i < list->Count; ++i)
+	{
+		if(order[i]->Start > end && order[i]->Type != ATFS_TYPE_FREE &&
+			order[i]->Type != DEFRAG_TYPE_OVERFLOW &&
+			!_in_use(dev, list, order[i]))
+		{
+			if(budget && *done && *done + order[i]->Size > budget)
+			{
+				break;
+			}
+
+			/* Blocks in front of the file that are not one free area
+				(lost by an interrupted operation) are left alone */
+			status = _move_down(dev, list, order[i], end);
+			if(status == ATFS_STATUS_OK)
+			{
+				*done += order[i]->Size;
+			}
+			else if(status == ATFS_STATUS_NO_SPACE_LEFT_ON_DEVICE)
+			{
+				status = ATFS_STATUS_OK;
+			}
+			else
+			{
+				break;
+			}
+		}
+
+		if(order[i]->Start + order[i]->Size > end)
+		{
+			end = order[i]->Start + order[i]->Size;
+		}
+	}
+
+	free(order);
+	return status;
+}
+
+static ATFS_Status _defrag(BlockDevice *dev, u32 budget, u32 *moved)
+{
+	DefragList list;
+	ATFS_Status status;
+	u32 done;
+
+	/* Directories can be moved, so no directory entry may be waiting
+		for its blocks */
+	PROPAGATE(atfs_delay_flush(dev));
+	list.Files = NULL;
+	list.Count = 0;
+	list.Capacity = 0;
+	done = 0;
+	if(!(status = _collect(dev, &list)) &&
+		!(status = _collect_groups(dev, &list)))
+	{
+		status = _compact(dev, &list, budget, &done);
+	}
+
+	/* Files and directories may have moved */
+	if(done)
+	{
+		atfs_dcache_clear(dev);
+	}
+
+	if(moved)
+	{
+		*moved = done;
+	}
+
+	free(list.Files);
+	return status;
+}
+
+ATFS_Status atfs_defrag(BlockDevice *dev, u32 budget, u32 *moved)
+{
+	ATFS_OP(ATFS_OP_DEFRAG, _defrag(dev, budget, moved));
+}
@@ -0,0 +1,36 @@
+/**
+ * @file    atfs_defrag.h
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ * @brief   ATFS Online defragmentation
+ *
+ * Files are moved towards the start of the volume, in block order,
+ * until there is no free space left between them. Afterwards all free
+ * space is one area at the end of the volume. Files that are open and
+ * directories that contain the entry of an open file are not moved, the
+ * free space in front of them stays where it is.
+ */
+
+#ifndef __ATFS_DEFRAG_H__
+#define __ATFS_DEFRAG_H__
+
+#include "atfs.h"
+
+/** Number of blocks copied with one device request */
+#define ATFS_DEFRAG_CHUNK  64
+
+/**
+ * @brief Move files towards the start of the volume to merge free space.
+ *        Call repeatedly with a budget to spread the work, the first file
+ *        of a call is always moved, even if it is larger than the budget.
+ *
+ * @param dev Block device
+ * @param budget Maximum number of blocks to copy, 0 for no limit
+ * @param moved Output parameter number of blocks copied,
+ *        0 if the volume is fully compacted (may be NULL)
+ * @return Status code
+ */
+ATFS_Status atfs_defrag(BlockDevice *dev, u32 budget, u32 *moved);
+
+#endif /* __ATFS_DEFRAG_H__ */
@@ -0,0 +1,234 @@
+/**
+ * @file    atfs_delay.c
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ */
+
+#include "atfs_delay.h"
+#include "atfs_alloc.h"
+#include "atfs_dcache.h"
+#include "atfs_mount.h"
+#include "atfs_util.h"
+#include <stdlib.h>
+#include <string.h>
+
+int atfs_delay_enabled(BlockDevice *dev)
+{
+	ATFS_Mount *m = atfs_mount_find(dev);
+	return m && m->DelayAlloc;
+}
+
+ATFS_Status atfs_delay_reserve(BlockDevice *dev, u32 size)
+{
+	ATFS_StatFS st;
+	ATFS_Mount *m;
+	ATFS_Status status;
+
+	if(!(m = atfs_mount_find(dev)))
+	{
+		return ATFS_STATUS_OK;
+	}
+
+	pthread_mutex_lock(&m->DelayLock);
+	if(!(status = atfs_statfs(dev, &st)))
+	{
+		if(st.FreeBlocks < st.Reserved || st.FreeBlocks - st.Reserved < size)
+		{
+			status = ATFS_STATUS_NO_SPACE_LEFT_ON_DEVICE;
+		}
+		else
+		{
+			__atomic_fetch_add(&m->Reserved, size, __ATOMIC_RELAXED);
+		}
+	}
+
+	pthread_mutex_unlock(&m->DelayLock);
+	return status;
+}
+
+ATFS_Status atfs_delay_check(BlockDevice *dev, u32 size)
+{
+	ATFS_Mount *m;
+	ATFS_StatFS st;
+
+	/* Only worth a look if something is reserved */
+	if(!(m = atfs_mount_find(dev)) ||
+		!__atomic_load_n(&m->Reserved, __ATOMIC_RELAXED))
+	{
+		return ATFS_STATUS_OK;
+	}
+
+	PROPAGATE(atfs_statfs(dev, &st));
+	return st.FreeBlocks < st.Reserved || st.FreeBlocks - st.Reserved < size ?
+		ATFS_STATUS_NO_SPACE_LEFT_ON_DEVICE : ATFS_STATUS_OK;
+}
+
+void atfs_delay_release(BlockDevice *dev, u32 size)
+{
+	ATFS_Mount *m;
+
+	if((m = atfs_mount_find(dev)))
+	{
+		__atomic_fetch_sub(&m->Reserved, size, __ATOMIC_RELAXED);
+	}
+}
+
+void atfs_delay_add(BlockDevice *dev, u32 entry_block, u32 entry_offset,
+	u32 size)
+{
+	ATFS_Delayed *d;
+	ATFS_Mount *m;
+	u32 capacity;
+
+	if(!(m = atfs_mount_find(dev)))
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&m->DelayLock);
+	if(m->DelayedCount == m->DelayedCapacity)
+	{
+		capacity = m->DelayedCapacity ? 2 * m->DelayedCapacity : 16;
+		if(!(d = realloc(m->Delayed, capacity * sizeof(*d))))
+		{
+			/* Not fatal, the file gets its blocks when it is written */
+			pthread_mutex_unlock(&m->DelayLock);
+			atfs_delay_release(dev, size);
+			return;
+		}
+
+		m->Delayed = d;
+		m->DelayedCapacity = capacity;
+	}
+
+	d = &m->Delayed[m->DelayedCount++];
+	d->EntryBlock = entry_block;
+	d->EntryOffset = entry_offset;
+	d->Size = size;
+	pthread_mutex_unlock(&m->DelayLock);
+}
+
+static int _delayed_cmp(const void *a, const void *b)
+{
+	const ATFS_Delayed *x = a, *y = b;
+	if(x->EntryBlock != y->EntryBlock)
+	{
+		return (x->EntryBlock > y->EntryBlock) -
+			(x->EntryBlock < y->EntryBlock);
+	}
+
+	return (x->EntryOffset > y->EntryOffset) -
+		(x->EntryOffset < y->EntryOffset);
+}
+
+/* Store the starting blocks in the directory entries, every directory
+	block is written once. `done` is the number of entries written. */
+static ATFS_Status _write_entries(BlockDevice *dev, const ATFS_Delayed *d,
+	u32 n, const u32 *starts, u32 *done)
+{
+	u8 buf[dev->BlockSize];
+	u32 i, j;
+
+	for(i = 0; i < n; i = j)
+	{
+		*done = i;
+		PROPAGATE(dev_read(dev, d[i].EntryBlock, 1, buf));
+		for(j = i; j < n && d[j].EntryBlock == d[i].EntryBlock; ++j)
+		{
+			atfs_write32(buf + d[j].EntryOffset + ATFS_DIR_ENTRY_OFFSET_START,
+				starts[j]);
+		}
+
+		PROPAGATE(dev_write(dev, d[i].EntryBlock, 1, buf));
+	}
+
+	*done = n;
+	return ATFS_STATUS_OK;
+}
+
+static ATFS_Status _flush(BlockDevice *dev, ATFS_Mount *m)
+{
+	ATFS_Delayed *d = m->Delayed;
+	ATFS_Status status;
+	u32 i, j, k, n, group, done, placed, *starts, *sizes;
+
+	if(!(n = m->DelayedCount))
+	{
+		return ATFS_STATUS_OK;
+	}
+
+	if(!(starts = malloc(2 * n * sizeof(*starts))))
+	{
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	/* Groups are block ranges, so the files of one group are together */
+	qsort(d, n, sizeof(*d), _delayed_cmp);
+	sizes = starts + n;
+	for(i = 0; i < n; ++i)
+	{
+		sizes[i] = d[i].Size;
+	}
+
+	status = ATFS_STATUS_OK;
+	for(i = 0, j = 0; i < n; i = j)
+	{
+		group = atfs_group_of(&m->Layout, d[i].EntryBlock);
+		for(j = i + 1; j < n &&
+			atfs_group_of(&m->Layout, d[j].EntryBlock) == group; ++j) ;
+
+		/* In one extent per group if possible */
+		if((status = atfs_alloc_many(dev, sizes + i, j - i,
+			d[i].EntryBlock, starts + i)))
+		{
+			j = i;
+			break;
+		}
+
+		if((status = _write_entries(dev, d + i, j - i, starts + i, &done)))
+		{
+			for(k = i + done; k < j; ++k)
+			{
+				atfs_free(dev, starts[k], d[k].Size);
+			}
+
+			j = i + done;
+			break;
+		}
+	}
+
+	/* The files in front of `j` have their blocks now, the cached
+		entries of all of them are out of date */
+	placed = j;
+	if(placed)
+	{
+		atfs_dcache_clear(dev);
+	}
+
+	for(k = 0; k < placed; ++k)
+	{
+		__atomic_fetch_sub(&m->Reserved, d[k].Size, __ATOMIC_RELAXED);
+	}
+
+	memmove(d, d + placed, (n - placed) * sizeof(*d));
+	m->DelayedCount = n - placed;
+	free(starts);
+	return status;
+}
+
+ATFS_Status atfs_delay_flush(BlockDevice *dev)
+{
+	ATFS_Mount *m;
+	ATFS_Status status;
+
+	if(!(m = atfs_mount_find(dev)))
+	{
+		return ATFS_STATUS_OK;
+	}
+
+	pthread_mutex_lock(&m->DelayLock);
+	status = _flush(dev, m);
+	pthread_mutex_unlock(&m->DelayLock);
+	return status;
+}
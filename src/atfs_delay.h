@@ -0,0 +1,82 @@
+/**
+ * @file    atfs_delay.h
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ * @brief   ATFS Delayed allocation
+ *
+ * With delayed allocation (atfs_mount_delalloc) a new file only reserves
+ * its capacity against the free blocks of the mounted volume. Its
+ * directory entry starts at ATFS_START_DELAYED until the file is first
+ * written or closed. Then all files that are still waiting are placed at
+ * once, the files of one allocation group in a single extent in the order
+ * of their directory entries, and every directory block is written once.
+ *
+ * The reservations only exist in memory. A file that was left without
+ * blocks (the volume was not unmounted) gets them when it is written.
+ */
+
+#ifndef __ATFS_DELAY_H__
+#define __ATFS_DELAY_H__
+
+#include "atfs.h"
+
+/**
+ * @brief Returns whether new files on a device are created with
+ *        delayed allocation
+ *
+ * @param dev Block device
+ * @return Nonzero if the volume is mounted with delayed allocation
+ */
+int atfs_delay_enabled(BlockDevice *dev);
+
+/**
+ * @brief Reserve free blocks for a new file. Nothing is reserved on a
+ *        volume that is not mounted.
+ *
+ * @param dev Block device
+ * @param size Number of blocks
+ * @return Status code, ATFS_STATUS_NO_SPACE_LEFT_ON_DEVICE if the free
+ *         blocks that are not reserved yet are not enough
+ */
+ATFS_Status atfs_delay_reserve(BlockDevice *dev, u32 size);
+
+/**
+ * @brief Check that an allocation leaves enough free blocks for the
+ *        reservations
+ *
+ * @param dev Block device
+ * @param size Number of blocks to allocate
+ * @return Status code
+ */
+ATFS_Status atfs_delay_check(BlockDevice *dev, u32 size);
+
+/**
+ * @brief Give back a reservation of atfs_delay_reserve
+ *
+ * @param dev Block device
+ * @param size Number of blocks
+ */
+void atfs_delay_release(BlockDevice *dev, u32 size);
+
+/**
+ * @brief Remember a file that was created with ATFS_START_DELAYED,
+ *        its reservation is kept until it is placed
+ *
+ * @param dev Block device
+ * @param entry_block Directory block of the directory entry
+ * @param entry_offset Byte offset of the directory entry in the block
+ * @param size Capacity of the file in blocks
+ */
+void atfs_delay_add(BlockDevice *dev, u32 entry_block, u32 entry_offset,
+	u32 size);
+
+/**
+ * @brief Allocate blocks for all files that are waiting for them
+ *
+ * @param dev Block device
+ * @return Status code
+ */
+ATFS_Status atfs_delay_flush(BlockDevice *dev);
+
+#endif /* __ATFS_DELAY_H__ */
@@ -6,6 +6,7 @@
  */
 
 #include "atfs_delete.h"
+#include "atfs_dcache.h"
 #include <string.h>
 
 ATFS_Status _dir_entry_delete(BlockDevice *dev,
@@ -15,7 +16,7 @@ ATFS_Status _dir_entry_delete(BlockDevice *dev,
 	u32 end, offset;
 	for(end = block + size; block < end; ++block)
 	{
-		dev->Read(block, 1, buf);
+		dev_read(dev, block, 1, buf);
 		for(offset = 0; offset < dev->BlockSize;
 			offset += ATFS_DIR_ENTRY_SIZE)
 		{
@@ -25,7 +26,8 @@ ATFS_Status _dir_entry_delete(BlockDevice *dev,
 			{
 				// atfs_free(dev, entry_start, entry_size);
 				memset(entry_name, 0, ATFS_DIR_ENTRY_SIZE);
-				dev->Write(block, 1, buf);
+				dev_write(dev, block, 1, buf);
+				atfs_dcache_forget_entry(dev, block, offset);
 				return ATFS_STATUS_OK;
 			}
 		}
@@ -34,7 +36,7 @@ ATFS_Status _dir_entry_delete(BlockDevice *dev,
 	return ATFS_STATUS_NO_SUCH_FILE_OR_DIRECTORY;
 }
 
-ATFS_Status atfs_delete(BlockDevice *dev, const char *path)
+static ATFS_Status _delete(BlockDevice *dev, const char *path)
 {
 	/* TODO: This is work in progress */
 
@@ -42,3 +44,8 @@ ATFS_Status atfs_delete(BlockDevice *dev, const char *path)
 	(void)dev;
 	(void)path;
 }
+
+ATFS_Status atfs_delete(BlockDevice *dev, const char *path)
+{
+	ATFS_OP(ATFS_OP_DELETE, _delete(dev, path));
+}
@@ -0,0 +1,214 @@
+/**
+ * @file    atfs_dscan.c
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ */
+
+#include "atfs_dscan.h"
+#include "atfs_hdir.h"
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define ATFS_DSCAN_HAVE_AVX2
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/** Instruction set for atfs_dscan_find, changed by benchmarks */
+static ATFS_DScanIsa _isa = ATFS_DSCAN_DEFAULT;
+
+/* Whether the entry at `p` is in use and has the name */
+static int _match(const u8 *p, const char *name, size_t len)
+{
+	return (p[ATFS_DIR_ENTRY_OFFSET_TYPE] & ATFS_TYPE_MASK) != ATFS_TYPE_FREE &&
+		!memcmp(p + ATFS_DIR_ENTRY_OFFSET_NAME, name, len) &&
+		!p[ATFS_DIR_ENTRY_OFFSET_NAME + len];
+}
+
+static u32 _find_scalar(const u8 *data, u32 size, const char *name,
+	size_t len, u8 tag)
+{
+	const u8 *p, *end;
+	u8 t;
+
+	/* Most entries fail on the tag alone */
+	for(p = data, end = data + size; p < end; p += ATFS_DIR_ENTRY_SIZE)
+	{
+		t = p[ATFS_DIR_ENTRY_OFFSET_TYPE] & ATFS_TYPE_TAG_MASK;
+		if((t == tag || !t) && _match(p, name, len))
+		{
+			return (u32)(p - data);
+		}
+	}
+
+	return size;
+}
+
+/* The 16 bytes from the type byte of an entry on hold its tag and the
+	start of its name. `key` has the tag and the name with its null
+	terminator as far as they fit, `select` the bits that are compared. */
+static void _key(const char *name, size_t len, u8 tag,
+	u8 key[16], u8 select[16])
+{
+	size_t n = len < 15 ? len + 1 : 15;
+
+	memset(key, 0, 16);
+	memset(select, 0, 16);
+	key[0] = tag;
+	select[0] = ATFS_TYPE_TAG_MASK;
+	memcpy(key + 1, name, n < len ? n : len);
+	memset(select + 1, 0xFF, n);
+}
+
+/* Compare mask of an entry: all bits, or all but the tag of an entry
+	written without one */
+static int _key_match(u32 eq, u8 t)
+{
+	return eq == 0xFFFF || (eq == 0xFFFE && !(t & ATFS_TYPE_TAG_MASK));
+}
+
+#ifdef __SSE2__
+
+static u32 _find_sse2(const u8 *data, u32 size, const char *name,
+	size_t len, u8 tag)
+{
+	u8 key_bytes[16], select_bytes[16];
+	__m128i key, select, v;
+	const u8 *p;
+	u32 offset;
+
+	_key(name, len, tag, key_bytes, select_bytes);
+	key = _mm_loadu_si128((const __m128i *)key_bytes);
+	select = _mm_loadu_si128((const __m128i *)select_bytes);
+	for(offset = 0; offset < size; offset += ATFS_DIR_ENTRY_SIZE)
+	{
+		p = data + offset;
+		v = _mm_loadu_si128((const __m128i *)(p + ATFS_DIR_ENTRY_OFFSET_TYPE));
+		if(_key_match((u32)_mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_and_si128(v, select), key)), p[ATFS_DIR_ENTRY_OFFSET_TYPE]) &&
+			_match(p, name, len))
+		{
+			return offset;
+		}
+	}
+
+	return size;
+}
+
+#endif /* __SSE2__ */
+
+#ifdef ATFS_DSCAN_HAVE_AVX2
+
+/* Two entries per compare, one in each half of the register */
+__attribute__((target("avx2")))
+static u32 _find_avx2(const u8 *data, u32 size, const char *name,
+	size_t len, u8 tag)
+{
+	u8 key_bytes[16], select_bytes[16];
+	__m256i key, select, v;
+	const u8 *p;
+	u32 offset, eq;
+
+	_key(name, len, tag, key_bytes, select_bytes);
+	key = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i *)key_bytes));
+	select = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i *)select_bytes));
+	for(offset = 0; offset + ATFS_DIR_ENTRY_SIZE < size;
+		offset += 2 * ATFS_DIR_ENTRY_SIZE)
+	{
+		p = data + offset;
+		v = _mm256_inserti128_si256(_mm256_castsi128_si256(
+			_mm_loadu_si128((const __m128i *)(p + ATFS_DIR_ENTRY_OFFSET_TYPE))),
+			_mm_loadu_si128((const __m128i *)(p + ATFS_DIR_ENTRY_SIZE +
+				ATFS_DIR_ENTRY_OFFSET_TYPE)), 1);
+		eq = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+			_mm256_and_si256(v, select), key));
+		if(_key_match(eq & 0xFFFF, p[ATFS_DIR_ENTRY_OFFSET_TYPE]) &&
+			_match(p, name, len))
+		{
+			return offset;
+		}
+
+		p += ATFS_DIR_ENTRY_SIZE;
+		if(_key_match(eq >> 16, p[ATFS_DIR_ENTRY_OFFSET_TYPE]) &&
+			_match(p, name, len))
+		{
+			return offset + ATFS_DIR_ENTRY_SIZE;
+		}
+	}
+
+	/* An odd entry at the end */
+	return offset + _find_scalar(data + offset, size - offset,
+		name, len, tag);
+}
+
+#endif /* ATFS_DSCAN_HAVE_AVX2 */
+
+/* Best instruction set the processor supports */
+static ATFS_DScanIsa _isa_supported(void)
+{
+#ifdef ATFS_DSCAN_HAVE_AVX2
+	if(__builtin_cpu_supports("avx2"))
+	{
+		return ATFS_DSCAN_AVX2;
+	}
+#endif
+
+#ifdef __SSE2__
+	return ATFS_DSCAN_SSE2;
+#else
+	return ATFS_DSCAN_SCALAR;
+#endif
+}
+
+ATFS_DScanIsa atfs_dscan_isa(ATFS_DScanIsa isa)
+{
+	ATFS_DScanIsa best = _isa_supported();
+	_isa = isa < best ? isa : best;
+	return _isa;
+}
+
+const char *atfs_dscan_isa_string(ATFS_DScanIsa isa)
+{
+	static const char *isa_str[] =
+	{
+		"scalar",
+		"sse2",
+		"avx2",
+	};
+
+	return isa < ATFS_DSCAN_ISA_COUNT ? isa_str[isa] : "unknown";
+}
+
+u8 atfs_name_tag(const char *name, size_t len)
+{
+	/* The upper bits of the hash, the lower ones select the bucket
+		of a hashed directory and are the same for the whole bucket */
+	u32 tag = 1 + ((atfs_name_hash(name, len) >> 16) + len) % 15;
+	return (u8)(tag << ATFS_TYPE_TAG_SHIFT);
+}
+
+u32 atfs_dscan_find(const u8 *data, u32 size, const char *name, size_t len,
+	u8 tag)
+{
+	switch(_isa)
+	{
+#ifdef ATFS_DSCAN_HAVE_AVX2
+	case ATFS_DSCAN_AVX2:
+		return _find_avx2(data, size, name, len, tag);
+#endif
+
+#ifdef __SSE2__
+	case ATFS_DSCAN_SSE2:
+		return _find_sse2(data, size, name, len, tag);
+#endif
+
+	default:
+		return _find_scalar(data, size, name, len, tag);
+	}
+}
@@ -0,0 +1,78 @@
+/**
+ * @file    atfs_dscan.h
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ * @brief   ATFS Directory block scan
+ *
+ * Finding a name in a block of fixed size directory entries first compares
+ * the name tag in the type byte of an entry and only compares the names of
+ * the entries whose tag matches, about one in fifteen of those in use, or
+ * all of them if they were written without a tag.
+ *
+ * The SSE2 and AVX2 versions load the 16 bytes from the type byte of an
+ * entry on, which hold its tag and the first 15 bytes of its name, and
+ * compare them with the tag and the name in one step, one or two entries
+ * at a time. They only pay off on large blocks in an optimized build, so
+ * the scalar tag compare is the default (see `dirbench`).
+ */
+
+#ifndef __ATFS_DSCAN_H__
+#define __ATFS_DSCAN_H__
+
+#include "atfs.h"
+
+/** Instruction set used to compare the tags of a block */
+typedef enum
+{
+	ATFS_DSCAN_SCALAR,
+	ATFS_DSCAN_SSE2,
+	ATFS_DSCAN_AVX2,
+	ATFS_DSCAN_ISA_COUNT,
+} ATFS_DScanIsa;
+
+/** Instruction set that is used unless a benchmark selects another one,
+	the fastest for the block sizes of a volume */
+#define ATFS_DSCAN_DEFAULT  ATFS_DSCAN_SCALAR
+
+/**
+ * @brief Select the instruction set for the directory scan, for
+ *        benchmarking. ATFS_DSCAN_DEFAULT is used by default.
+ *
+ * @param isa Requested instruction set
+ * @return Instruction set that is used, at most the requested one
+ */
+ATFS_DScanIsa atfs_dscan_isa(ATFS_DScanIsa isa);
+
+/**
+ * @brief Returns the name of an instruction set
+ *
+ * @param isa Instruction set
+ * @return Pointer to string constant
+ */
+const char *atfs_dscan_isa_string(ATFS_DScanIsa isa);
+
+/**
+ * @brief Name tag of a file name, already shifted into place
+ *        (see ATFS_TYPE_TAG_MASK), never 0
+ *
+ * @param name File name, does not need to be null-terminated
+ * @param len Length of the name
+ * @return Tag bits of the type byte
+ */
+u8 atfs_name_tag(const char *name, size_t len);
+
+/**
+ * @brief Find a name in a block of fixed size directory entries
+ *
+ * @param data Directory entries
+ * @param size Size of the entries in bytes, a multiple of the entry size
+ * @param name File name, does not need to be null-terminated
+ * @param len Length of the name
+ * @param tag Name tag from atfs_name_tag, computed once per lookup
+ * @return Byte offset of the entry, `size` if there is none
+ */
+u32 atfs_dscan_find(const u8 *data, u32 size, const char *name, size_t len,
+	u8 tag);
+
+#endif /* __ATFS_DSCAN_H__ */
@@ -0,0 +1,472 @@
+/**
+ * @file    atfs_extent.c
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ */
+
+#include "atfs_extent.h"
+#include <stdlib.h>
+#include <string.h>
+
+static u32 _max_size(const ATFS_ExtentNode *node)
+{
+	return node ? node->MaxSize : 0;
+}
+
+/* Recalculate the subtree maximum after a child changed */
+static void _pull(ATFS_ExtentNode *node)
+{
+	u32 l = _max_size(node->Left), r = _max_size(node->Right);
+	node->MaxSize = node->Extent.Size;
+	if(l > node->MaxSize)
+	{
+		node->MaxSize = l;
+	}
+
+	if(r > node->MaxSize)
+	{
+		node->MaxSize = r;
+	}
+}
+
+/* Split into extents that start below `key` and the rest */
+static void _split(ATFS_ExtentNode *node, u32 key,
+	ATFS_ExtentNode **l, ATFS_ExtentNode **r)
+{
+	if(!node)
+	{
+		*l = *r = NULL;
+	}
+	else if(node->Extent.Start < key)
+	{
+		_split(node->Right, key, &node->Right, r);
+		_pull(node);
+		*l = node;
+	}
+	else
+	{
+		_split(node->Left, key, l, &node->Left);
+		_pull(node);
+		*r = node;
+	}
+}
+
+/* Join two trees, all extents in `l` must start before those in `r` */
+static ATFS_ExtentNode *_merge(ATFS_ExtentNode *l, ATFS_ExtentNode *r)
+{
+	if(!l || !r)
+	{
+		return l ? l : r;
+	}
+
+	if(l->Priority > r->Priority)
+	{
+		l->Right = _merge(l->Right, r);
+		_pull(l);
+		return l;
+	}
+
+	r->Left = _merge(l, r->Left);
+	_pull(r);
+	return r;
+}
+
+/* Order of the size tree, (size, start) below the key */
+static int _size_less(const ATFS_ExtentNode *node, u32 size, u32 start)
+{
+	return node->Extent.Size < size ||
+		(node->Extent.Size == size && node->Extent.Start < start);
+}
+
+static void _size_split(ATFS_ExtentNode *node, u32 size, u32 start,
+	ATFS_ExtentNode **l, ATFS_ExtentNode **r)
+{
+	if(!node)
+	{
+		*l = *r = NULL;
+	}
+	else if(_size_less(node, size, start))
+	{
+		_size_split(node->SizeRight, size, start, &node->SizeRight, r);
+		*l = node;
+	}
+	else
+	{
+		_size_split(node->SizeLeft, size, start, l, &node->SizeLeft);
+		*r = node;
+	}
+}
+
+static ATFS_ExtentNode *_size_merge(ATFS_ExtentNode *l, ATFS_ExtentNode *r)
+{
+	if(!l || !r)
+	{
+		return l ? l : r;
+	}
+
+	if(l->Priority > r->Priority)
+	{
+		l->SizeRight = _size_merge(l->SizeRight, r);
+		return l;
+	}
+
+	r->SizeLeft = _size_merge(l, r->SizeLeft);
+	return r;
+}
+
+static u32 _class(u32 size)
+{
+	return 31 - __builtin_clz(size);
+}
+
+/* Add a node to the size tree and its segregated list */
+static void _size_link(ATFS_ExtentTree *tree, ATFS_ExtentNode *node)
+{
+	ATFS_ExtentNode *l, *r;
+	u32 c;
+
+	node->SizeLeft = NULL;
+	node->SizeRight = NULL;
+	_size_split(tree->SizeRoot, node->Extent.Size, node->Extent.Start, &l, &r);
+	tree->SizeRoot = _size_merge(_size_merge(l, node), r);
+
+	c = _class(node->Extent.Size);
+	node->ClassPrev = NULL;
+	node->ClassNext = tree->Class[c];
+	if(tree->Class[c])
+	{
+		tree->Class[c]->ClassPrev = node;
+	}
+
+	tree->Class[c] = node;
+	tree->ClassMask |= (u32)1 << c;
+}
+
+/* Remove a node from the size tree and its segregated list */
+static void _size_unlink(ATFS_ExtentTree *tree, ATFS_ExtentNode *node)
+{
+	ATFS_ExtentNode *l, *m, *r;
+	u32 c, size = node->Extent.Size, start = node->Extent.Start;
+
+	_size_split(tree->SizeRoot, size, start, &l, &r);
+	_size_split(r, size, start + 1, &m, &r);
+	tree->SizeRoot = _size_merge(l, r);
+
+	c = _class(size);
+	if(node->ClassPrev)
+	{
+		node->ClassPrev->ClassNext = node->ClassNext;
+	}
+	else
+	{
+		tree->Class[c] = node->ClassNext;
+	}
+
+	if(node->ClassNext)
+	{
+		node->ClassNext->ClassPrev = node->ClassPrev;
+	}
+
+	if(!tree->Class[c])
+	{
+		tree->ClassMask &= ~((u32)1 << c);
+	}
+}
+
+static void _free_nodes(ATFS_ExtentNode *node)
+{
+	if(node)
+	{
+		_free_nodes(node->Left);
+		_free_nodes(node->Right);
+		free(node);
+	}
+}
+
+static int _update(ATFS_ExtentTree *tree, ATFS_ExtentNode *node, u32 start,
+	u32 new_start, u32 new_size, u32 *old_size)
+{
+	int found;
+
+	if(!node)
+	{
+		return 0;
+	}
+
+	if(start < node->Extent.Start)
+	{
+		found = _update(tree, node->Left, start,
+			new_start, new_size, old_size);
+	}
+	else if(start > node->Extent.Start)
+	{
+		found = _update(tree, node->Right, start,
+			new_start, new_size, old_size);
+	}
+	else
+	{
+		/* The position in the start tree stays the same,
+			the size indexes need to be updated */
+		_size_unlink(tree, node);
+		*old_size = node->Extent.Size;
+		node->Extent.Start = new_start;
+		node->Extent.Size = new_size;
+		_size_link(tree, node);
+		found = 1;
+	}
+
+	if(found)
+	{
+		_pull(node);
+	}
+
+	return found;
+}
+
+static u32 _random(ATFS_ExtentTree *tree)
+{
+	/* xorshift32 */
+	u32 x = tree->Seed;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return tree->Seed = x;
+}
+
+void atfs_extent_init(ATFS_ExtentTree *tree)
+{
+	tree->Root = NULL;
+	tree->SizeRoot = NULL;
+	memset(tree->Class, 0, sizeof(tree->Class));
+	tree->ClassMask = 0;
+	tree->Count = 0;
+	tree->Blocks = 0;
+	tree->Seed = 0x2545F491;
+}
+
+void atfs_extent_clear(ATFS_ExtentTree *tree)
+{
+	_free_nodes(tree->Root);
+	atfs_extent_init(tree);
+}
+
+int atfs_extent_insert(ATFS_ExtentTree *tree, u32 start, u32 size)
+{
+	ATFS_ExtentNode *node, *l, *r;
+
+	if(!(node = malloc(sizeof(*node))))
+	{
+		return 1;
+	}
+
+	node->Left = NULL;
+	node->Right = NULL;
+	node->Extent.Start = start;
+	node->Extent.Size = size;
+	node->MaxSize = size;
+	node->Priority = _random(tree);
+
+	_split(tree->Root, start, &l, &r);
+	tree->Root = _merge(_merge(l, node), r);
+	_size_link(tree, node);
+	++tree->Count;
+	tree->Blocks += size;
+	return 0;
+}
+
+void atfs_extent_remove(ATFS_ExtentTree *tree, u32 start)
+{
+	ATFS_ExtentNode *l, *m, *r;
+
+	_split(tree->Root, start, &l, &r);
+	_split(r, start + 1, &m, &r);
+	if(m)
+	{
+		_size_unlink(tree, m);
+		--tree->Count;
+		tree->Blocks -= m->Extent.Size;
+		free(m);
+	}
+
+	tree->Root = _merge(l, r);
+}
+
+void atfs_extent_update(ATFS_ExtentTree *tree, u32 start,
+	u32 new_start, u32 new_size)
+{
+	u32 old_size;
+	if(_update(tree, tree->Root, start, new_start, new_size, &old_size))
+	{
+		tree->Blocks += new_size - old_size;
+	}
+}
+
+int atfs_extent_first_fit(const ATFS_ExtentTree *tree, u32 size,
+	ATFS_Extent *out)
+{
+	const ATFS_ExtentNode *node = tree->Root;
+
+	if(_max_size(node) < size)
+	{
+		return 0;
+	}
+
+	/* The subtree maximum tells which side has a fitting extent */
+	for(;;)
+	{
+		if(_max_size(node->Left) >= size)
+		{
+			node = node->Left;
+		}
+		else if(node->Extent.Size >= size)
+		{
+			*out = node->Extent;
+			return 1;
+		}
+		else
+		{
+			node = node->Right;
+		}
+	}
+}
+
+int atfs_extent_best_fit(const ATFS_ExtentTree *tree, u32 size,
+	ATFS_Extent *out)
+{
+	const ATFS_ExtentNode *node, *found;
+
+	for(node = tree->SizeRoot, found = NULL; node; )
+	{
+		if(node->Extent.Size >= size)
+		{
+			found = node;
+			node = node->SizeLeft;
+		}
+		else
+		{
+			node = node->SizeRight;
+		}
+	}
+
+	if(found)
+	{
+		*out = found->Extent;
+	}
+
+	return found != NULL;
+}
+
+int atfs_extent_class_fit(const ATFS_ExtentTree *tree, u32 size,
+	ATFS_Extent *out)
+{
+	u32 c, larger;
+
+	if(!size)
+	{
+		size = 1;
+	}
+
+	/* An extent of the own class that fits keeps the larger ones intact,
+		the size tree finds the smallest one without walking the list */
+	c = _class(size);
+	if(tree->ClassMask & ((u32)1 << c) && atfs_extent_best_fit(tree, size, out) &&
+		_class(out->Size) == c)
+	{
+		return 1;
+	}
+
+	/* Otherwise any extent of the smallest larger class fits */
+	if((larger = tree->ClassMask & ~(((u32)2 << c) - 1)))
+	{
+		*out = tree->Class[__builtin_ctz(larger)]->Extent;
+		return 1;
+	}
+
+	return 0;
+}
+
+u32 atfs_extent_largest(const ATFS_ExtentTree *tree)
+{
+	return _max_size(tree->Root);
+}
+
+u32 atfs_extent_largest_except(const ATFS_ExtentTree *tree, u32 start)
+{
+	const ATFS_ExtentNode *node, *parent;
+
+	/* The largest extent is the rightmost one in size order */
+	for(node = tree->SizeRoot, parent = NULL; node && node->SizeRight;
+		parent = node, node = node->SizeRight) ;
+
+	if(!node)
+	{
+		return 0;
+	}
+
+	if(node->Extent.Start != start)
+	{
+		return node->Extent.Size;
+	}
+
+	/* Otherwise the one before it */
+	if(node->SizeLeft)
+	{
+		for(node = node->SizeLeft; node->SizeRight; node = node->SizeRight) ;
+		return node->Extent.Size;
+	}
+
+	return parent ? parent->Extent.Size : 0;
+}
+
+int atfs_extent_prev(const ATFS_ExtentTree *tree, u32 block,
+	ATFS_Extent *out)
+{
+	const ATFS_ExtentNode *node, *found;
+
+	for(node = tree->Root, found = NULL; node; )
+	{
+		if(node->Extent.Start < block)
+		{
+			found = node;
+			node = node->Right;
+		}
+		else
+		{
+			node = node->Left;
+		}
+	}
+
+	if(found)
+	{
+		*out = found->Extent;
+	}
+
+	return found != NULL;
+}
+
+int atfs_extent_next(const ATFS_ExtentTree *tree, u32 block,
+	ATFS_Extent *out)
+{
+	const ATFS_ExtentNode *node, *found;
+
+	for(node = tree->Root, found = NULL; node; )
+	{
+		if(node->Extent.Start >= block)
+		{
+			found = node;
+			node = node->Left;
+		}
+		else
+		{
+			node = node->Right;
+		}
+	}
+
+	if(found)
+	{
+		*out = found->Extent;
+	}
+
+	return found != NULL;
+}
@@ -0,0 +1,207 @@
+/**
+ * @file    atfs_extent.h
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ * @brief   In-memory index of free extents
+ *
+ * Every extent is kept in three indexes at once:
+ * - A balanced search tree (treap) ordered by start block. Every node also
+ *   stores the largest extent size in its subtree, so the first extent that
+ *   is large enough can be found without visiting the others.
+ * - A second treap ordered by size, for best fit.
+ * - Segregated lists of extents with a size between 2^k and 2^(k+1) - 1
+ *   and a bit mask of the non-empty lists, for good fit. An extent of a
+ *   larger class is found in O(1), one of the own class with the size tree.
+ *
+ * All operations take O(log n) expected time.
+ */
+
+#ifndef __ATFS_EXTENT_H__
+#define __ATFS_EXTENT_H__
+
+#include "types.h"
+
+/** Range of contiguous blocks */
+typedef struct
+{
+	/** First block */
+	u32 Start;
+
+	/** Number of blocks */
+	u32 Size;
+} ATFS_Extent;
+
+/** Number of size classes of the segregated lists */
+#define ATFS_EXTENT_CLASSES  32
+
+/** Tree node */
+typedef struct ATFS_ExtentNode
+{
+	/** Subtrees with lower and higher start blocks */
+	struct ATFS_ExtentNode *Left, *Right;
+
+	/** Subtrees with smaller and larger sizes */
+	struct ATFS_ExtentNode *SizeLeft, *SizeRight;
+
+	/** Neighbours in the segregated list */
+	struct ATFS_ExtentNode *ClassPrev, *ClassNext;
+
+	/** Free extent */
+	ATFS_Extent Extent;
+
+	/** Largest extent size in this subtree */
+	u32 MaxSize;
+
+	/** Random heap priority that keeps the tree balanced */
+	u32 Priority;
+} ATFS_ExtentNode;
+
+/** Free extent index */
+typedef struct
+{
+	/** Root node */
+	ATFS_ExtentNode *Root;
+
+	/** Root node of the tree ordered by size */
+	ATFS_ExtentNode *SizeRoot;
+
+	/** Segregated lists by size class */
+	ATFS_ExtentNode *Class[ATFS_EXTENT_CLASSES];
+
+	/** Bit k is set if the list of class k is not empty */
+	u32 ClassMask;
+
+	/** Number of extents */
+	u32 Count;
+
+	/** Sum of the sizes of all extents */
+	u32 Blocks;
+
+	/** State of the priority generator */
+	u32 Seed;
+} ATFS_ExtentTree;
+
+/**
+ * @brief Initialize an empty tree
+ *
+ * @param tree Extent tree
+ */
+void atfs_extent_init(ATFS_ExtentTree *tree);
+
+/**
+ * @brief Remove all extents and free the memory
+ *
+ * @param tree Extent tree
+ */
+void atfs_extent_clear(ATFS_ExtentTree *tree);
+
+/**
+ * @brief Add an extent, it must not overlap any other extent
+ *
+ * @param tree Extent tree
+ * @param start First block
+ * @param size Number of blocks
+ * @return 0 on success, non-zero if out of memory
+ */
+int atfs_extent_insert(ATFS_ExtentTree *tree, u32 start, u32 size);
+
+/**
+ * @brief Remove the extent that starts at a block
+ *
+ * @param tree Extent tree
+ * @param start First block of the extent
+ */
+void atfs_extent_remove(ATFS_ExtentTree *tree, u32 start);
+
+/**
+ * @brief Move and resize an extent. The extent must stay between
+ *        its neighbours, so the order of the tree does not change.
+ *
+ * @param tree Extent tree
+ * @param start Current first block of the extent
+ * @param new_start New first block
+ * @param new_size New number of blocks
+ */
+void atfs_extent_update(ATFS_ExtentTree *tree, u32 start,
+	u32 new_start, u32 new_size);
+
+/**
+ * @brief Find the extent with the lowest start block that has at least
+ *        `size` blocks
+ *
+ * @param tree Extent tree
+ * @param size Minimum number of blocks
+ * @param out Output parameter extent
+ * @return Non-zero if an extent was found
+ */
+int atfs_extent_first_fit(const ATFS_ExtentTree *tree, u32 size,
+	ATFS_Extent *out);
+
+/**
+ * @brief Find the smallest extent that has at least `size` blocks,
+ *        the one with the lowest start block if there are several
+ *
+ * @param tree Extent tree
+ * @param size Minimum number of blocks
+ * @param out Output parameter extent
+ * @return Non-zero if an extent was found
+ */
+int atfs_extent_best_fit(const ATFS_ExtentTree *tree, u32 size,
+	ATFS_Extent *out);
+
+/**
+ * @brief Find an extent that has at least `size` blocks in the segregated
+ *        lists. The smallest fitting extent of the own size class is taken
+ *        first (from the size tree), so larger extents are only split if
+ *        none of it fits, then any extent of the smallest non-empty larger
+ *        class.
+ *
+ * @param tree Extent tree
+ * @param size Minimum number of blocks
+ * @param out Output parameter extent
+ * @return Non-zero if an extent was found
+ */
+int atfs_extent_class_fit(const ATFS_ExtentTree *tree, u32 size,
+	ATFS_Extent *out);
+
+/**
+ * @brief Size of the largest extent
+ *
+ * @param tree Extent tree
+ * @return Number of blocks, 0 if the tree is empty
+ */
+u32 atfs_extent_largest(const ATFS_ExtentTree *tree);
+
+/**
+ * @brief Size of the largest extent, not counting the extent at `start`
+ *
+ * @param tree Extent tree
+ * @param start Start block of the extent to leave out
+ * @return Number of blocks, 0 if there is no other extent
+ */
+u32 atfs_extent_largest_except(const ATFS_ExtentTree *tree, u32 start);
+
+/**
+ * @brief Find the extent with the highest start block below `block`
+ *
+ * @param tree Extent tree
+ * @param block Block number
+ * @param out Output parameter extent
+ * @return Non-zero if an extent was found
+ */
+int atfs_extent_prev(const ATFS_ExtentTree *tree, u32 block,
+	ATFS_Extent *out);
+
+/**
+ * @brief Find the extent with the lowest start block at or above `block`
+ *
+ * @param tree Extent tree
+ * @param block Block number
+ * @param out Output parameter extent
+ * @return Non-zero if an extent was found
+ */
+int atfs_extent_next(const ATFS_ExtentTree *tree, u32 block,
+	ATFS_Extent *out);
+
+#endif /* __ATFS_EXTENT_H__ */
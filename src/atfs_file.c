@@ -8,164 +8,1722 @@
 #include "atfs_file.h"
 #include "atfs_path.h"
 #include "atfs_alloc.h"
+#include "atfs_dcache.h"
+#include "atfs_delay.h"
+#include "atfs_dscan.h"
+#include "atfs_hdir.h"
+#include "atfs_mount.h"
+#include "atfs_sdir.h"
 #include "atfs_util.h"
+#include <stdlib.h>
 #include <string.h>
 
 /* TODO: Also too many parameters for my liking */
 static ATFS_Status _dir_entry_find(BlockDevice *dev,
 	const char *name, size_t name_len,
 	u32 block, u32 size,
-	ATFS_NamelessDirEntry *entry)
+	ATFS_NamelessDirEntry *entry, u32 *entry_block, u32 *entry_offset)
 {
 	u8 buf[dev->BlockSize];
+	u8 tag = atfs_name_tag(name, name_len);
 	u32 end, offset;
-	const u8 *cur;
-	const char *entry_name;
-	ATFS_FileType entry_type;
+	const u8 *data, *cur;
 
 	for(end = block + size; block < end; ++block)
 	{
-		dev->Read(block, 1, buf);
-		for(offset = 0; offset < dev->BlockSize;
+		PROPAGATE(dev_map(dev, block, buf, &data));
+		offset = atfs_dscan_find(data, dev->BlockSize, name, name_len, tag);
+		if(offset < dev->BlockSize)
+		{
+			cur = data + offset;
+			entry->Type = cur[ATFS_DIR_ENTRY_OFFSET_TYPE] &
+				~ATFS_TYPE_TAG_MASK;
+			entry->StartBlock = atfs_read32(cur + ATFS_DIR_ENTRY_OFFSET_START);
+			entry->SizeBlocks = atfs_read32(cur + ATFS_DIR_ENTRY_OFFSET_SIZE);
+			if(entry_block)
+			{
+				*entry_block = block;
+				*entry_offset = offset;
+			}
+
+			dev_unmap(dev, block);
+			return ATFS_STATUS_OK;
+		}
+
+		dev_unmap(dev, block);
+	}
+
+	return ATFS_STATUS_NO_SUCH_FILE_OR_DIRECTORY;
+}
+
+ATFS_Status _dir_entry_insert(BlockDevice *dev, u32 block, u32 size,
+	ATFS_DirEntry *entry, u32 *entry_block, u32 *entry_offset);
+
+/* Find an entry in a directory of the given format,
+	the result is remembered on a mounted volume */
+static ATFS_Status _dir_lookup(BlockDevice *dev, ATFS_DirFormat format,
+	const char *name, size_t name_len, u32 block, u32 size,
+	ATFS_NamelessDirEntry *entry, u32 *entry_block, u32 *entry_offset)
+{
+	ATFS_Status status;
+	u32 eb, eo;
+
+	if(atfs_dcache_lookup(dev, block, name, name_len, entry, &eb, &eo))
+	{
+		status = entry->Type == ATFS_TYPE_FREE ?
+			ATFS_STATUS_NO_SUCH_FILE_OR_DIRECTORY : ATFS_STATUS_OK;
+	}
+	else
+	{
+		status = format == ATFS_DIR_HASHED ?
+			atfs_hdir_find(dev, block, size, name, name_len, entry,
+				&eb, &eo) :
+			format == ATFS_DIR_SORTED ?
+			atfs_sdir_find(dev, block, size, name, name_len, entry,
+				&eb, &eo) :
+			_dir_entry_find(dev, name, name_len, block, size, entry,
+				&eb, &eo);
+
+		if(status == ATFS_STATUS_OK)
+		{
+			atfs_dcache_add(dev, block, name, name_len, entry, eb, eo);
+		}
+		else if(status == ATFS_STATUS_NO_SUCH_FILE_OR_DIRECTORY)
+		{
+			atfs_dcache_add(dev, block, name, name_len, NULL, 0, 0);
+		}
+	}
+
+	if(status == ATFS_STATUS_OK && entry_block)
+	{
+		*entry_block = eb;
+		*entry_offset = eo;
+	}
+
+	return status;
+}
+
+static int _file_check_bounds(u32 start, u32 count, u32 capacity)
+{
+	/* Written so that start + count can not overflow */
+	return start > capacity || count > capacity - start;
+}
+
+u32 atfs_fmap(ATFS_File *file, u32 block, u32 *count)
+{
+	const ATFS_FileExtent *e;
+	u32 lo, hi, mid, left;
+
+	if(!file->Extents)
+	{
+		return file->StartBlock + block;
+	}
+
+	/* Sequential access stays in the same extent */
+	e = &file->Extents[file->ExtentHint];
+	if(block < e->Logical || block - e->Logical >= e->Count)
+	{
+		lo = 0;
+		hi = file->ExtentCount;
+		while(hi - lo > 1)
+		{
+			mid = lo + (hi - lo) / 2;
+			if(file->Extents[mid].Logical <= block)
+			{
+				lo = mid;
+			}
+			else
+			{
+				hi = mid;
+			}
+		}
+
+		file->ExtentHint = lo;
+		e = &file->Extents[lo];
+	}
+
+	left = e->Count - (block - e->Logical);
+	if(count && *count > left)
+	{
+		*count = left;
+	}
+
+	return e->Start + (block - e->Logical);
+}
+
+/* Number of device ranges that a range of the file is stored in */
+static u32 _file_pieces(ATFS_File *file, u32 block, u32 count)
+{
+	u32 n, len;
+
+	if(!file->Extents)
+	{
+		return 1;
+	}
+
+	for(n = 0; count; ++n, block += len, count -= len)
+	{
+		len = count;
+		atfs_fmap(file, block, &len);
+	}
+
+	return n;
+}
+
+/* Translate a file relative block range to device block ranges,
+	returns the number of ranges */
+static u32 _file_map_range(ATFS_File *file, u32 block, u32 count, u8 *buf,
+	DeviceIOVec *out)
+{
+	u32 n, len;
+
+	for(n = 0; count; ++n, block += len, count -= len)
+	{
+		len = count;
+		out[n].Offset = atfs_fmap(file, block, &len);
+		out[n].Count = len;
+		out[n].Buffer = buf;
+		buf += (size_t)len << file->Device->BlockSizePOT;
+	}
+
+	return n;
+}
+
+/* Check file relative block ranges and count the device ranges
+	they are stored in */
+static ATFS_Status _file_vec_pieces(ATFS_File *file, const DeviceIOVec *vec,
+	u32 n, u32 *pieces)
+{
+	u32 i;
+
+	*pieces = 0;
+	for(i = 0; i < n; ++i)
+	{
+		if(_file_check_bounds(vec[i].Offset, vec[i].Count, file->SizeBlocks))
+		{
+			return ATFS_STATUS_OUT_OF_BOUNDS;
+		}
+
+		*pieces += _file_pieces(file, vec[i].Offset, vec[i].Count);
+	}
+
+	return ATFS_STATUS_OK;
+}
+
+/* Translate file relative block ranges to device block ranges, `out`
+	has room for the number returned by _file_vec_pieces */
+static u32 _file_map_vec(ATFS_File *file, const DeviceIOVec *vec, u32 n,
+	DeviceIOVec *out)
+{
+	u32 i, pieces;
+
+	for(i = 0, pieces = 0; i < n; ++i)
+	{
+		pieces += _file_map_range(file, vec[i].Offset, vec[i].Count,
+			vec[i].Buffer, out + pieces);
+	}
+
+	return pieces;
+}
+
+/* Read or write file relative block ranges, which are stored in
+	`pieces` device ranges */
+static ATFS_Status _file_iov(ATFS_File *file, const DeviceIOVec *vec, u32 n,
+	u32 pieces, int write)
+{
+	DeviceIOVec dev_vec[pieces ? pieces : 1];
+
+	pieces = _file_map_vec(file, vec, n, dev_vec);
+	return write ? dev_writev(file->Device, dev_vec, pieces) :
+		dev_readv(file->Device, dev_vec, pieces);
+}
+
+/* Read or write a range of a file, split at extent boundaries */
+static ATFS_Status _file_io(ATFS_File *file, u32 block, u32 count, u8 *buf,
+	int write)
+{
+	u32 n = _file_pieces(file, block, count);
+	DeviceIOVec vec[n ? n : 1];
+
+	if(n <= 1)
+	{
+		block = atfs_fmap(file, block, &count);
+		return write ? dev_write(file->Device, block, count, buf) :
+			dev_read(file->Device, block, count, buf);
+	}
+
+	_file_map_range(file, block, count, buf, vec);
+	return write ? dev_writev(file->Device, vec, n) :
+		dev_readv(file->Device, vec, n);
+}
+
+/* Make room for one more element of an array that grows in powers of two,
+	returns the new array or NULL */
+static void *_array_room(void *array, u32 count, size_t size)
+{
+	if(count && (count < 4 || (count & (count - 1))))
+	{
+		return array;
+	}
+
+	return realloc(array, (count ? 2 * (size_t)count : 4) * size);
+}
+
+/* Append the extent stored at `p` */
+static ATFS_Status _extent_push(BlockDevice *dev, ATFS_FileExtent **extents,
+	u32 *count, u32 size, u32 *total, const u8 *p)
+{
+	ATFS_FileExtent *e;
+	u32 start, n;
+
+	start = atfs_read32(p);
+	n = atfs_read32(p + 4);
+	if(!start || !n || start >= dev->BlockCount ||
+		n > dev->BlockCount - start || n > size - *total)
+	{
+		return ATFS_STATUS_INVALID_VOLUME;
+	}
+
+	if(!(e = _array_room(*extents, *count, sizeof(*e))))
+	{
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	*extents = e;
+	e += (*count)++;
+	e->Logical = *total;
+	e->Start = start;
+	e->Count = n;
+	*total += n;
+	return ATFS_STATUS_OK;
+}
+
+/* Extents that fit into an extent block */
+static u32 _extents_per_block(BlockDevice *dev)
+{
+	return (dev->BlockSize - ATFS_EXTENT_BLOCK_OFFSET_LIST) / ATFS_EXTENT_SIZE;
+}
+
+static ATFS_Status _extents_read(BlockDevice *dev, const u8 *entry,
+	ATFS_FileExtent **extents, u32 *count, u32 **blocks, u32 *block_count)
+{
+	u8 buf[dev->BlockSize];
+	u32 i, n, next, size, total, *b;
+	ATFS_Status status;
+
+	status = ATFS_STATUS_OK;
+	size = atfs_read32(entry + ATFS_DIR_ENTRY_OFFSET_SIZE);
+	total = 0;
+	if(!(entry[ATFS_DIR_ENTRY_OFFSET_TYPE] & ATFS_TYPE_FLAG_INDIRECT))
+	{
+		for(i = 0; !status && i < ATFS_INLINE_EXTENTS && total < size; ++i)
+		{
+			status = _extent_push(dev, extents, count, size, &total,
+				entry + ATFS_DIR_ENTRY_OFFSET_EXTENTS + i * ATFS_EXTENT_SIZE);
+		}
+	}
+	else
+	{
+		/* Every block adds at least one block to the file,
+			so a loop in the chain ends when the size is reached */
+		next = atfs_read32(entry + ATFS_DIR_ENTRY_OFFSET_START);
+		while(!status && total < size)
+		{
+			if(!next || next >= dev->BlockCount)
+			{
+				return ATFS_STATUS_INVALID_VOLUME;
+			}
+
+			if(!(b = _array_room(*blocks, *block_count, sizeof(*b))))
+			{
+				return ATFS_STATUS_OUT_OF_MEMORY;
+			}
+
+			*blocks = b;
+			b[(*block_count)++] = next;
+			PROPAGATE(dev_read(dev, next, 1, buf));
+			n = atfs_read32(buf + ATFS_EXTENT_BLOCK_OFFSET_COUNT);
+			if(!n || n > _extents_per_block(dev))
+			{
+				return ATFS_STATUS_INVALID_VOLUME;
+			}
+
+			for(i = 0; !status && i < n; ++i)
+			{
+				status = _extent_push(dev, extents, count, size, &total,
+					buf + ATFS_EXTENT_BLOCK_OFFSET_LIST + i * ATFS_EXTENT_SIZE);
+			}
+
+			next = atfs_read32(buf + ATFS_EXTENT_BLOCK_OFFSET_NEXT);
+		}
+	}
+
+	return !status && total != size ? ATFS_STATUS_INVALID_VOLUME : status;
+}
+
+ATFS_Status atfs_extents_read(BlockDevice *dev, const u8 *entry,
+	ATFS_FileExtent **extents, u32 *count, u32 **blocks, u32 *block_count)
+{
+	ATFS_Status status;
+
+	*extents = NULL;
+	*count = 0;
+	*blocks = NULL;
+	*block_count = 0;
+	if((status = _extents_read(dev, entry, extents, count,
+		blocks, block_count)))
+	{
+		free(*extents);
+		free(*blocks);
+		*extents = NULL;
+		*blocks = NULL;
+	}
+
+	return status;
+}
+
+static ATFS_Status _extents_load(ATFS_File *file)
+{
+	BlockDevice *dev = file->Device;
+	u8 buf[dev->BlockSize];
+
+	PROPAGATE(dev_read(dev, file->EntryBlock, 1, buf));
+	PROPAGATE(atfs_extents_read(dev, buf + file->EntryOffset,
+		&file->Extents, &file->ExtentCount,
+		&file->ExtentBlocks, &file->ExtentBlockCount));
+	file->StartBlock = file->Extents[0].Start;
+	return ATFS_STATUS_OK;
+}
+
+/* Write extent blocks `first` to `n - 1` of the list `e` */
+static ATFS_Status _extent_blocks_write(BlockDevice *dev,
+	const ATFS_FileExtent *e, u32 count, const u32 *blocks, u32 n, u32 first)
+{
+	u8 buf[dev->BlockSize];
+	u32 i, k, per;
+
+	per = _extents_per_block(dev);
+	for(i = first; i < n; ++i)
+	{
+		memset(buf, 0, dev->BlockSize);
+		atfs_write32(buf + ATFS_EXTENT_BLOCK_OFFSET_NEXT,
+			i + 1 < n ? blocks[i + 1] : 0);
+		for(k = 0; k < per && i * per + k < count; ++k)
+		{
+			atfs_write32(buf + ATFS_EXTENT_BLOCK_OFFSET_LIST +
+				k * ATFS_EXTENT_SIZE, e[i * per + k].Start);
+			atfs_write32(buf + ATFS_EXTENT_BLOCK_OFFSET_LIST +
+				k * ATFS_EXTENT_SIZE + 4, e[i * per + k].Count);
+		}
+
+		atfs_write32(buf + ATFS_EXTENT_BLOCK_OFFSET_COUNT, k);
+		PROPAGATE(dev_write(dev, blocks[i], 1, buf));
+	}
+
+	return ATFS_STATUS_OK;
+}
+
+/* Allocate extent blocks `have` to `n - 1`, near the previous one */
+static ATFS_Status _extent_blocks_alloc(BlockDevice *dev, u32 *blocks,
+	u32 have, u32 n, u32 goal)
+{
+	u32 i;
+	ATFS_Status status;
+
+	for(i = have; i < n; ++i)
+	{
+		if((status = atfs_alloc_near(dev, 1, i ? blocks[i - 1] : goal,
+			&blocks[i])))
+		{
+			while(i-- > have)
+			{
+				atfs_free(dev, blocks[i], 1);
+			}
+
+			return status;
+		}
+	}
+
+	return ATFS_STATUS_OK;
+}
+
+/* Store the extent list `e` of `n` extents and `size` blocks, of which the
+	first `same` extents did not change. The file takes over `e`. */
+static ATFS_Status _extents_store(ATFS_File *file, ATFS_FileExtent *e,
+	u32 n, u32 same, u32 size)
+{
+	BlockDevice *dev = file->Device;
+	u8 buf[dev->BlockSize];
+	u32 i, type, per, have, need, first, *blocks;
+	ATFS_DirFormat format;
+	ATFS_Status status;
+	int has_room;
+	u8 *cur;
+
+	PROPAGATE(atfs_dir_format(dev, &format));
+	PROPAGATE(dev_read(dev, file->EntryBlock, 1, buf));
+	cur = buf + file->EntryOffset;
+
+	/* The space after a short name is cleared, a long name runs into it.
+		Packed entries of sorted directories end after the name. */
+	has_room = format != ATFS_DIR_SORTED &&
+		strnlen((const char *)(cur + ATFS_DIR_ENTRY_OFFSET_NAME),
+			ATFS_MAX_FILE_NAME_LENGTH + 1) <= ATFS_INLINE_EXTENTS_NAME_LENGTH;
+	if(has_room)
+	{
+		memset(cur + ATFS_DIR_ENTRY_OFFSET_EXTENTS, 0,
+			ATFS_DIR_ENTRY_SIZE - ATFS_DIR_ENTRY_OFFSET_EXTENTS);
+	}
+
+	/* Directories are always contiguous */
+	type = cur[ATFS_DIR_ENTRY_OFFSET_TYPE] & ATFS_TYPE_MASK;
+	if(type == ATFS_TYPE_DIR && n > 1)
+	{
+		return ATFS_STATUS_INVALID_ARGUMENT;
+	}
+
+	have = file->ExtentBlockCount;
+	need = 0;
+	blocks = NULL;
+	if(n == 1)
+	{
+		/* Contiguous again */
+		atfs_write32(cur + ATFS_DIR_ENTRY_OFFSET_START, e[0].Start);
+	}
+	else if(n <= ATFS_INLINE_EXTENTS && has_room)
+	{
+		type |= ATFS_TYPE_FLAG_EXTENTS;
+		atfs_write32(cur + ATFS_DIR_ENTRY_OFFSET_START, e[0].Start);
+		for(i = 0; i < n; ++i)
+		{
+			atfs_write32(cur + ATFS_DIR_ENTRY_OFFSET_EXTENTS +
+				i * ATFS_EXTENT_SIZE, e[i].Start);
+			atfs_write32(cur + ATFS_DIR_ENTRY_OFFSET_EXTENTS +
+				i * ATFS_EXTENT_SIZE + 4, e[i].Count);
+		}
+	}
+	else
+	{
+		/* Only the extent blocks from the first changed extent on are
+			written, and the last one if the chain gets longer or shorter */
+		per = _extents_per_block(dev);
+		need = (n + per - 1) / per;
+		if(!(blocks = malloc(need * sizeof(*blocks))))
+		{
+			return ATFS_STATUS_OUT_OF_MEMORY;
+		}
+
+		if(have)
+		{
+			memcpy(blocks, file->ExtentBlocks,
+				(have < need ? have : need) * sizeof(*blocks));
+		}
+		first = have ? same / per : 0;
+		if(have && have != need)
+		{
+			i = (have < need ? have : need) - 1;
+			first = first < i ? first : i;
+		}
+
+		if((status = _extent_blocks_alloc(dev, blocks,
+			have < need ? have : need, need, e[n - 1].Start)))
+		{
+			free(blocks);
+			return status;
+		}
+
+		if((status = _extent_blocks_write(dev, e, n, blocks, need, first)))
+		{
+			for(i = have; i < need; ++i)
+			{
+				atfs_free(dev, blocks[i], 1);
+			}
+
+			free(blocks);
+			return status;
+		}
+
+		type |= ATFS_TYPE_FLAG_EXTENTS | ATFS_TYPE_FLAG_INDIRECT;
+		atfs_write32(cur + ATFS_DIR_ENTRY_OFFSET_START, blocks[0]);
+	}
+
+	cur[ATFS_DIR_ENTRY_OFFSET_TYPE] = type |
+		(cur[ATFS_DIR_ENTRY_OFFSET_TYPE] & ATFS_TYPE_TAG_MASK);
+	atfs_write32(cur + ATFS_DIR_ENTRY_OFFSET_SIZE, size);
+	if((status = dev_write(dev, file->EntryBlock, 1, buf)))
+	{
+		for(i = have; i < need; ++i)
+		{
+			atfs_free(dev, blocks[i], 1);
+		}
+
+		free(blocks);
+		return status;
+	}
+
+	atfs_dcache_forget_entry(dev, file->EntryBlock, file->EntryOffset);
+
+	/* Extent blocks that are no longer needed */
+	for(i = need; i < have; ++i)
+	{
+		atfs_free(dev, file->ExtentBlocks[i], 1);
+	}
+
+	free(file->ExtentBlocks);
+	free(file->Extents);
+	file->ExtentBlocks = blocks;
+	file->ExtentBlockCount = need;
+	file->StartBlock = e[0].Start;
+	file->SizeBlocks = size;
+	file->ExtentHint = 0;
+	if(n == 1)
+	{
+		free(e);
+		file->Extents = NULL;
+		file->ExtentCount = 0;
+	}
+	else
+	{
+		file->Extents = e;
+		file->ExtentCount = n;
+	}
+
+	return ATFS_STATUS_OK;
+}
+
+/* Extent list of a file as a new array, a contiguous file is one extent */
+static ATFS_FileExtent *_extents_copy(ATFS_File *file, u32 extra, u32 *count)
+{
+	ATFS_FileExtent *e;
+
+	*count = file->Extents ? file->ExtentCount : 1;
+	if(!(e = malloc((*count + extra) * sizeof(*e))))
+	{
+		return NULL;
+	}
+
+	if(file->Extents)
+	{
+		memcpy(e, file->Extents, *count * sizeof(*e));
+	}
+	else
+	{
+		e[0].Logical = 0;
+		e[0].Start = file->StartBlock;
+		e[0].Count = file->SizeBlocks;
+	}
+
+	return e;
+}
+
+/* Copy blocks to a range that does not overlap, in requests of
+	up to ATFS_RESIZE_CHUNK blocks */
+static ATFS_Status _copy_blocks(BlockDevice *dev, u32 dst, u32 src, u32 count)
+{
+	u8 *buf;
+	u32 i, n;
+	ATFS_Status status;
+
+	if(!count)
+	{
+		return ATFS_STATUS_OK;
+	}
+
+	n = count < ATFS_RESIZE_CHUNK ? count : ATFS_RESIZE_CHUNK;
+	if(!(buf = malloc((size_t)n << dev->BlockSizePOT)))
+	{
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	status = ATFS_STATUS_OK;
+	for(i = 0; i < count && !status; i += n)
+	{
+		n = count - i < ATFS_RESIZE_CHUNK ? count - i : ATFS_RESIZE_CHUNK;
+		if(!(status = dev_read(dev, src + i, n, buf)))
+		{
+			status = dev_write(dev, dst + i, n, buf);
+		}
+	}
+
+	free(buf);
+	return status;
+}
+
+/* Move a contiguous file to a free area of `size` blocks */
+static ATFS_Status _frelocate(ATFS_File *file, u32 size)
+{
+	BlockDevice *dev = file->Device;
+	ATFS_FileExtent *e;
+	ATFS_Status status;
+	u32 start, old_start, old_size;
+
+	old_start = file->StartBlock;
+	old_size = file->SizeBlocks;
+	PROPAGATE(atfs_alloc_near(dev, size, old_start, &start));
+	if(!(e = malloc(sizeof(*e))))
+	{
+		atfs_free(dev, start, size);
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	e->Logical = 0;
+	e->Start = start;
+	e->Count = size;
+	if((status = _copy_blocks(dev, start, old_start, old_size)) ||
+		(status = _extents_store(file, e, 1, 0, size)))
+	{
+		atfs_free(dev, start, size);
+		free(e);
+		return status;
+	}
+
+	/* The old blocks are only freed once the entry points to the new ones */
+	atfs_free(dev, old_start, old_size);
+	return ATFS_STATUS_OK;
+}
+
+static ATFS_Status _fgrow(ATFS_File *file, u32 count, int relocate)
+{
+	BlockDevice *dev = file->Device;
+	ATFS_FileExtent *e, *last;
+	u32 n, end, start, same;
+	ATFS_Status status;
+
+	if(!count)
+	{
+		return ATFS_STATUS_OK;
+	}
+
+	PROPAGATE(atfs_delay_check(dev, count));
+	if(!(e = _extents_copy(file, 1, &n)))
+	{
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	/* Extend the last extent if the blocks after it are free */
+	last = &e[n - 1];
+	end = last->Start + last->Count;
+	status = end < dev->BlockCount ? atfs_alloc_at(dev, end, count) :
+		ATFS_STATUS_NO_SPACE_LEFT_ON_DEVICE;
+	if(status == ATFS_STATUS_OK)
+	{
+		start = end;
+		last->Count += count;
+		same = n - 1;
+	}
+	else if(status == ATFS_STATUS_NO_SPACE_LEFT_ON_DEVICE && relocate &&
+		!file->Extents && (status = _frelocate(file,
+			file->SizeBlocks + count)) != ATFS_STATUS_NO_SPACE_LEFT_ON_DEVICE)
+	{
+		/* Moved to an area that is large enough, or failed */
+		free(e);
+		return status;
+	}
+
+	/* Otherwise the new blocks are a new extent close to the old end */
+	if(status == ATFS_STATUS_NO_SPACE_LEFT_ON_DEVICE &&
+		!(status = atfs_alloc_near(dev, count, end - 1, &start)))
+	{
+		e[n].Logical = file->SizeBlocks;
+		e[n].Start = start;
+		e[n].Count = count;
+		same = n++;
+	}
+
+	if(status)
+	{
+		free(e);
+		return status;
+	}
+
+	if((status = _extents_store(file, e, n, same, file->SizeBlocks + count)))
+	{
+		atfs_free(dev, start, count);
+		free(e);
+		return status;
+	}
+
+	return ATFS_STATUS_OK;
+}
+
+static ATFS_Status _fshrink(ATFS_File *file, u32 size)
+{
+	BlockDevice *dev = file->Device;
+	ATFS_FileExtent *e, *tail;
+	ATFS_Status status;
+	u32 i, n, keep, cut;
+
+	if(!(e = _extents_copy(file, 0, &n)))
+	{
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	/* Extents from `keep` on are dropped, the last one that is kept
+		loses `cut` blocks. An empty file keeps an empty extent. */
+	for(keep = 1; keep < n && e[keep].Logical < size; ++keep) ;
+	cut = e[keep - 1].Logical + e[keep - 1].Count - size;
+
+	/* The blocks to free, after the directory entry no longer has them */
+	if(!(tail = malloc((n - keep + 1) * sizeof(*tail))))
+	{
+		free(e);
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	memcpy(tail, e + keep - 1, (n - keep + 1) * sizeof(*tail));
+	tail[0].Start += tail[0].Count - cut;
+	tail[0].Count = cut;
+	e[keep - 1].Count -= cut;
+	if((status = _extents_store(file, e, keep, keep - 1, size)))
+	{
+		free(tail);
+		free(e);
+		return status;
+	}
+
+	for(i = 0; i < n - keep + 1; ++i)
+	{
+		if(tail[i].Count)
+		{
+			atfs_free(dev, tail[i].Start, tail[i].Count);
+		}
+	}
+
+	free(tail);
+	return ATFS_STATUS_OK;
+}
+
+/* The root directory has no directory entry */
+static ATFS_Status _fresizable(ATFS_File *file, u8 *type)
+{
+	BlockDevice *dev = file->Device;
+	u8 buf[dev->BlockSize];
+	const u8 *data;
+
+	if(file->EntryBlock == ATFS_SECTOR_BOOT)
+	{
+		return ATFS_STATUS_INVALID_ARGUMENT;
+	}
+
+	PROPAGATE(dev_map(dev, file->EntryBlock, buf, &data));
+	*type = data[file->EntryOffset + ATFS_DIR_ENTRY_OFFSET_TYPE] &
+		ATFS_TYPE_MASK;
+	dev_unmap(dev, file->EntryBlock);
+	return ATFS_STATUS_OK;
+}
+
+/* The size of a hashed directory is its number of buckets, so it is
+	rehashed into a new area of `size` blocks */
+static ATFS_Status _frehash(ATFS_File *file, u32 size)
+{
+	BlockDevice *dev = file->Device;
+	ATFS_FileExtent *e;
+	ATFS_Status status;
+	u32 start, old_start, old_size;
+
+	if(!size)
+	{
+		return ATFS_STATUS_INVALID_ARGUMENT;
+	}
+
+	old_start = file->StartBlock;
+	old_size = file->SizeBlocks;
+	PROPAGATE(atfs_delay_check(dev, size));
+	PROPAGATE(atfs_alloc_near(dev, size, old_start, &start));
+	if(!(e = malloc(sizeof(*e))))
+	{
+		atfs_free(dev, start, size);
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	e->Logical = 0;
+	e->Start = start;
+	e->Count = size;
+	if((status = dev_zero(dev, start, size)) ||
+		(status = atfs_hdir_rehash(dev, old_start, old_size, start, size)))
+	{
+		atfs_free(dev, start, size);
+		free(e);
+		return status;
+	}
+
+	if((status = _extents_store(file, e, 1, 0, size)))
+	{
+		atfs_hdir_free_overflow(dev, start, size);
+		atfs_free(dev, start, size);
+		free(e);
+		return status;
+	}
+
+	/* Every entry moved */
+	atfs_dcache_clear(dev);
+	atfs_hdir_free_overflow(dev, old_start, old_size);
+	atfs_free(dev, old_start, old_size);
+	return ATFS_STATUS_OK;
+}
+
+/* Empty the blocks of a directory from `size` on before it shrinks,
+	entries of a linear directory are never dropped, those of a
+	sorted directory are moved into the blocks that are kept */
+static ATFS_Status _dir_vacate(ATFS_File *file, u32 size)
+{
+	BlockDevice *dev = file->Device;
+	u8 buf[dev->BlockSize];
+	const u8 *data;
+	ATFS_DirFormat format;
+	u32 block, offset;
+	int used;
+
+	PROPAGATE(atfs_dir_format(dev, &format));
+	if(format == ATFS_DIR_SORTED)
+	{
+		PROPAGATE(atfs_sdir_repack(dev, file->StartBlock,
+			file->SizeBlocks, size));
+		atfs_dcache_clear(dev);
+		return ATFS_STATUS_OK;
+	}
+
+	for(block = size, used = 0; !used && block < file->SizeBlocks; ++block)
+	{
+		PROPAGATE(dev_map(dev, file->StartBlock + block, buf, &data));
+		for(offset = 0; !used && offset < dev->BlockSize;
 			offset += ATFS_DIR_ENTRY_SIZE)
 		{
-			cur = buf + offset;
-			entry_name = (const char *)(cur + ATFS_DIR_ENTRY_OFFSET_NAME);
-			entry_type = cur[ATFS_DIR_ENTRY_OFFSET_TYPE];
-			if(entry_type != ATFS_TYPE_FREE &&
-				strlen(entry_name) == name_len &&
-				!strncmp(name, entry_name, name_len))
-			{
-				entry->Type = entry_type;
-				entry->StartBlock = atfs_read32(
-					cur + ATFS_DIR_ENTRY_OFFSET_START);
-				entry->SizeBlocks = atfs_read32(
-					cur + ATFS_DIR_ENTRY_OFFSET_SIZE);
-				return ATFS_STATUS_OK;
-			}
+			used = data[offset + ATFS_DIR_ENTRY_OFFSET_TYPE] !=
+				ATFS_TYPE_FREE;
+		}
+
+		dev_unmap(dev, file->StartBlock + block);
+	}
+
+	return used ? ATFS_STATUS_DIRECTORY_FULL : ATFS_STATUS_OK;
+}
+
+static ATFS_Status _fresize(ATFS_File *file, u32 size, int relocate)
+{
+	ATFS_DirFormat format;
+	u8 type;
+
+	PROPAGATE(_fresizable(file, &type));
+	PROPAGATE(atfs_fplace(file));
+	if(type == ATFS_TYPE_DIR)
+	{
+		/* Files without blocks are found by the position of their
+			entry, which changes when the directory moves or shrinks */
+		PROPAGATE(atfs_delay_flush(file->Device));
+		PROPAGATE(atfs_dir_format(file->Device, &format));
+		if(format == ATFS_DIR_HASHED && size != file->SizeBlocks)
+		{
+			/* Rehashing always moves the directory */
+			return relocate ? _frehash(file, size) :
+				ATFS_STATUS_INVALID_ARGUMENT;
+		}
+
+		if(size < file->SizeBlocks)
+		{
+			PROPAGATE(_dir_vacate(file, size));
+		}
+	}
+
+	if(size < file->SizeBlocks)
+	{
+		return _fshrink(file, size);
+	}
+
+	return _fgrow(file, size - file->SizeBlocks, relocate);
+}
+
+static ATFS_Status _fextend(ATFS_File *file, u32 count)
+{
+	if(count > 0xFFFFFFFF - file->SizeBlocks)
+	{
+		return ATFS_STATUS_OUT_OF_BOUNDS;
+	}
+
+	/* Never moves the file */
+	return _fresize(file, file->SizeBlocks + count, 0);
+}
+
+ATFS_Status atfs_fgrow(ATFS_File *file, u32 count)
+{
+	ATFS_OP(ATFS_OP_RESIZE, _fextend(file, count));
+}
+
+ATFS_Status atfs_fresize(ATFS_File *file, u32 size)
+{
+	ATFS_OP(ATFS_OP_RESIZE, _fresize(file, size, 1));
+}
+
+static void dir_entry_init(
+	ATFS_DirEntry *entry, u32 start, u32 size, ATFS_FileType type,
+	const char *name)
+{
+	entry->Type = type;
+	entry->StartBlock = start;
+	entry->SizeBlocks = size;
+	strcpy(entry->Name, name);
+}
+
+static ATFS_Status check_path(const char *path)
+{
+	return atfs_path_valid(path) ? ATFS_STATUS_OK :
+		ATFS_STATUS_PATH_FORMAT_INVALID;
+}
+
+/* A single name without a directory path */
+static ATFS_Status check_name(const char *name)
+{
+	size_t len = strlen(name);
+
+	return len && len <= ATFS_MAX_FILE_NAME_LENGTH &&
+		!strchr(name, ATFS_DIR_SEPARATOR) && atfs_path_valid(name) ?
+		ATFS_STATUS_OK : ATFS_STATUS_PATH_FORMAT_INVALID;
+}
+
+/* Root directory and directory format, a mounted volume has them
+	in memory */
+static ATFS_Status _root(BlockDevice *dev, ATFS_NamelessDirEntry *root,
+	ATFS_DirFormat *format)
+{
+	u8 buf[dev->BlockSize];
+	const u8 *data;
+	ATFS_Status status;
+	ATFS_Mount *m;
+
+	root->Type = ATFS_TYPE_DIR;
+	if((m = atfs_mount_find(dev)))
+	{
+		root->StartBlock = m->RootBlock;
+		root->SizeBlocks = m->RootSize;
+		*format = m->DirFormat;
+		return ATFS_STATUS_OK;
+	}
+
+	PROPAGATE(dev_map(dev, ATFS_SECTOR_BOOT, buf, &data));
+	root->StartBlock = atfs_read32(data + ATFS_OFFSET_ROOT_BLOCK);
+	root->SizeBlocks = atfs_read32(data + ATFS_OFFSET_ROOT_SIZE);
+	status = atfs_dir_format_get(data, format);
+	dev_unmap(dev, ATFS_SECTOR_BOOT);
+	return status;
+}
+
+static ATFS_Status atfs_traverse(BlockDevice *dev, const char *path,
+	u32 *parent, u32 *size, const char **last, const char **end,
+	ATFS_DirFormat *format)
+{
+	ATFS_NamelessDirEntry entry;
+	const char *name;
+	int c;
+
+	PROPAGATE(_root(dev, &entry, format));
+	for(name = path; (c = *path); ++path)
+	{
+		if(c == ATFS_DIR_SEPARATOR)
+		{
+			PROPAGATE(_dir_lookup(dev, *format, name, path - name,
+				entry.StartBlock, entry.SizeBlocks, &entry, NULL, NULL));
+
+			if(entry.Type != ATFS_TYPE_DIR)
+			{
+				return ATFS_STATUS_NO_SUCH_FILE_OR_DIRECTORY;
+			}
+
+			name = path + 1;
+		}
+	}
+
+	/* TODO: This is way to many pointer parameters */
+	*parent = entry.StartBlock;
+	*size = entry.SizeBlocks;
+	*last = name;
+	*end = path;
+	return ATFS_STATUS_OK;
+}
+
+/* Add an entry to a directory of the given format */
+static ATFS_Status _dir_add(BlockDevice *dev, ATFS_DirFormat format,
+	u32 block, u32 size, ATFS_DirEntry *entry,
+	u32 *entry_block, u32 *entry_offset)
+{
+	PROPAGATE(format == ATFS_DIR_HASHED ?
+		atfs_hdir_insert(dev, block, size, entry,
+			entry_block, entry_offset) :
+		format == ATFS_DIR_SORTED ?
+		atfs_sdir_insert(dev, block, size, entry,
+			entry_block, entry_offset) :
+		_dir_entry_insert(dev, block, size, entry,
+			entry_block, entry_offset));
+
+	/* The name may be cached as not existing */
+	atfs_dcache_forget(dev, block, entry->Name, strlen(entry->Name));
+	return ATFS_STATUS_OK;
+}
+
+/* Create a file or directory in the directory at `parent` */
+static ATFS_Status _create(BlockDevice *dev, ATFS_DirFormat format,
+	u32 parent, u32 parent_size, const char *name,
+	ATFS_FileType type, u32 size)
+{
+	u32 start, entry_block, entry_offset;
+	ATFS_DirEntry entry;
+	ATFS_Status status;
+
+	/* With delayed allocation a file only reserves its capacity,
+		the blocks are allocated when it is written or closed */
+	if(type == ATFS_TYPE_FILE && size && atfs_delay_enabled(dev))
+	{
+		PROPAGATE(atfs_delay_reserve(dev, size));
+		dir_entry_init(&entry, ATFS_START_DELAYED, size, type, name);
+		if((status = _dir_add(dev, format, parent, parent_size, &entry,
+			&entry_block, &entry_offset)))
+		{
+			atfs_delay_release(dev, size);
+			return status;
+		}
+
+		atfs_delay_add(dev, entry_block, entry_offset, size);
+		return ATFS_STATUS_OK;
+	}
+
+	/* Files are kept in the group of their directory,
+		new directories are spread over the groups */
+	PROPAGATE(atfs_delay_check(dev, size));
+	PROPAGATE(atfs_alloc_near(dev, size,
+		type == ATFS_TYPE_DIR ? ATFS_GOAL_SPREAD : parent, &start));
+	dir_entry_init(&entry, start, size, type, name);
+
+	/* Free space can contain anything, a new directory must be empty */
+	if((type == ATFS_TYPE_DIR && (status = dev_zero(dev, start, size))) ||
+		(status = _dir_add(dev, format, parent, parent_size, &entry,
+			&entry_block, &entry_offset)))
+	{
+		atfs_free(dev, start, size);
+		return status;
+	}
+
+	return ATFS_STATUS_OK;
+}
+
+static ATFS_Status _fcreate(BlockDevice *dev, const char *path,
+	ATFS_FileType type, u32 size)
+{
+	const char *last, *end;
+	u32 parent, parent_size;
+	ATFS_DirFormat format;
+
+	PROPAGATE(check_path(path));
+	PROPAGATE(atfs_traverse(dev, path, &parent, &parent_size, &last, &end,
+		&format));
+	return _create(dev, format, parent, parent_size, last, type, size);
+}
+
+ATFS_Status atfs_fcreate(BlockDevice *dev, const char *path,
+	ATFS_FileType type, u32 size)
+{
+	ATFS_OP(ATFS_OP_CREATE, _fcreate(dev, path, type, size));
+}
+
+static ATFS_Status _fcreate_at(ATFS_Dir *dir, const char *name,
+	ATFS_FileType type, u32 size)
+{
+	ATFS_File *d = &dir->InternalFile;
+
+	PROPAGATE(check_name(name));
+	return _create(d->Device, dir->Format, d->StartBlock, d->SizeBlocks,
+		name, type, size);
+}
+
+ATFS_Status atfs_fcreate_at(ATFS_Dir *dir, const char *name,
+	ATFS_FileType type, u32 size)
+{
+	ATFS_OP(ATFS_OP_CREATE, _fcreate_at(dir, name, type, size));
+}
+
+/* Find the directory at `path` */
+static ATFS_Status _dir_resolve(BlockDevice *dev, const char *path,
+	ATFS_NamelessDirEntry *dir, ATFS_DirFormat *format)
+{
+	const char *name, *end;
+
+	PROPAGATE(check_path(path));
+	PROPAGATE(atfs_traverse(dev, path, &dir->StartBlock, &dir->SizeBlocks,
+		&name, &end, format));
+
+	dir->Type = ATFS_TYPE_DIR;
+	if(*name != '\0')
+	{
+		PROPAGATE(_dir_lookup(dev, *format, name, end - name,
+			dir->StartBlock, dir->SizeBlocks, dir, NULL, NULL));
+	}
+
+	return dir->Type == ATFS_TYPE_DIR ? ATFS_STATUS_OK :
+		ATFS_STATUS_NO_SUCH_FILE_OR_DIRECTORY;
+}
+
+/* Byte offsets of the first `count` free entries of a directory,
+	returns the number found */
+static u32 _dir_free_slots(BlockDevice *dev, const u8 *buf, u32 size,
+	u32 *slots, u32 count)
+{
+	u32 offset, end, n;
+
+	end = size << dev->BlockSizePOT;
+	for(offset = 0, n = 0; n < count && offset < end;
+		offset += ATFS_DIR_ENTRY_SIZE)
+	{
+		if(buf[offset + ATFS_DIR_ENTRY_OFFSET_TYPE] == ATFS_TYPE_FREE)
+		{
+			slots[n++] = offset;
 		}
 	}
 
-	return ATFS_STATUS_NO_SUCH_FILE_OR_DIRECTORY;
+	return n;
 }
 
-ATFS_Status _dir_entry_insert(BlockDevice *dev, u32 block,
-	ATFS_DirEntry *entry);
+static int _name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
 
-static int _file_check_bounds(u32 start, u32 count, u32 capacity)
+/* Check that no entry of a directory in memory has one of the names
+	and that no name is given twice */
+static ATFS_Status _dir_check_names(BlockDevice *dev, const u8 *buf,
+	u32 size, const char *const *names, u32 count)
 {
-	/* TODO: Implement this without a sneaky integer overflow bug */
-	return 0;
-	(void)start;
-	(void)count;
-	(void)capacity;
+	const char **sorted, *name;
+	ATFS_Status status;
+	u32 i, offset, end;
+
+	if(!(sorted = malloc(count * sizeof(*sorted))))
+	{
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	/* Equal names are next to each other */
+	memcpy(sorted, names, count * sizeof(*sorted));
+	qsort(sorted, count, sizeof(*sorted), _name_cmp);
+	status = ATFS_STATUS_OK;
+	for(i = 1; !status && i < count; ++i)
+	{
+		if(!strcmp(sorted[i], sorted[i - 1]))
+		{
+			status = ATFS_STATUS_EXISTS;
+		}
+	}
+
+	end = size << dev->BlockSizePOT;
+	for(offset = 0; !status && offset < end; offset += ATFS_DIR_ENTRY_SIZE)
+	{
+		name = (const char *)(buf + offset + ATFS_DIR_ENTRY_OFFSET_NAME);
+		if(buf[offset + ATFS_DIR_ENTRY_OFFSET_TYPE] != ATFS_TYPE_FREE &&
+			memchr(name, '\0', ATFS_MAX_FILE_NAME_LENGTH + 1) &&
+			bsearch(&name, sorted, count, sizeof(*sorted), _name_cmp))
+		{
+			status = ATFS_STATUS_EXISTS;
+		}
+	}
+
+	free(sorted);
+	return status;
 }
 
-static void dir_entry_init(
-	ATFS_DirEntry *entry, u32 start, u32 size, ATFS_FileType type,
-	const char *name)
+/* Write the directory blocks that contain the entries at `slots`, runs of
+	neighbouring blocks in one request. `done` is the number of entries
+	that were written. */
+static ATFS_Status _dir_write_slots(BlockDevice *dev, u32 dir, const u8 *buf,
+	const u32 *slots, u32 count, u32 *done)
 {
-	entry->Type = type;
-	entry->StartBlock = start;
-	entry->SizeBlocks = size;
-	strcpy(entry->Name, name);
+	u32 i, j, first, last, pot;
+
+	pot = dev->BlockSizePOT;
+	for(i = 0; i < count; i = j)
+	{
+		*done = i;
+		first = last = slots[i] >> pot;
+		for(j = i; j < count && (slots[j] >> pot) <= last + 1; ++j)
+		{
+			last = slots[j] >> pot;
+		}
+
+		PROPAGATE(dev_write(dev, dir + first, last - first + 1,
+			buf + ((size_t)first << pot)));
+	}
+
+	*done = count;
+	return ATFS_STATUS_OK;
 }
 
-static ATFS_Status check_path(const char *path)
+/* Forget the names of a batch, some of them may have been created */
+static void _dir_forget_names(BlockDevice *dev, u32 dir,
+	const char *const *names, u32 count)
 {
-	return atfs_path_valid(path) ? ATFS_STATUS_OK :
-		ATFS_STATUS_PATH_FORMAT_INVALID;
+	u32 i;
+
+	for(i = 0; i < count; ++i)
+	{
+		atfs_dcache_forget(dev, dir, names[i], strlen(names[i]));
+	}
 }
 
-static ATFS_Status atfs_traverse(BlockDevice *dev, const char *path,
-	u32 *parent, u32 *size, const char **last, const char **end)
+/* Create files in a hashed or sorted directory, which refuse names that
+	exist. A hashed directory only reads and writes the buckets of the
+	names, a sorted one is read once and every changed block written once. */
+static ATFS_Status _create_many_unique(BlockDevice *dev,
+	ATFS_DirFormat format, const ATFS_NamelessDirEntry *dir,
+	const char *const *names, const u32 *capacities, u32 count, u32 total)
 {
-	u8 buf[dev->BlockSize];
-	ATFS_NamelessDirEntry entry;
-	const char *name;
-	int c;
+	ATFS_DirEntry *entries;
+	ATFS_Status status;
+	u32 i, *starts, *blocks, *offsets;
+	int delayed;
 
-	PROPAGATE(dev->Read(0, 1, buf));
-	entry.StartBlock = atfs_read32(buf + ATFS_OFFSET_ROOT_BLOCK);
-	entry.SizeBlocks = atfs_read32(buf + ATFS_OFFSET_ROOT_SIZE);
-	for(name = path; (c = *path); ++path)
+	PROPAGATE(format == ATFS_DIR_HASHED ?
+		atfs_hdir_check_many(dev, dir->StartBlock, dir->SizeBlocks,
+			names, count) :
+		atfs_sdir_check_many(dev, dir->StartBlock, dir->SizeBlocks,
+			names, count));
+	entries = malloc(count * sizeof(*entries));
+	starts = malloc(3 * (size_t)count * sizeof(*starts));
+	if(!entries || !starts)
 	{
-		if(c == ATFS_DIR_SEPARATOR)
+		free(entries);
+		free(starts);
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	blocks = starts + count;
+	offsets = blocks + count;
+	delayed = atfs_delay_enabled(dev);
+	status = delayed ? atfs_delay_reserve(dev, total) :
+		atfs_delay_check(dev, total);
+	if(!status && !delayed)
+	{
+		status = atfs_alloc_many(dev, capacities, count, dir->StartBlock,
+			starts);
+	}
+
+	if(status)
+	{
+		free(entries);
+		free(starts);
+		return status;
+	}
+
+	for(i = 0; i < count; ++i)
+	{
+		dir_entry_init(&entries[i], delayed ? ATFS_START_DELAYED : starts[i],
+			capacities[i], ATFS_TYPE_FILE, names[i]);
+	}
+
+	/* Files whose block was not written do not exist */
+	status = format == ATFS_DIR_HASHED ?
+		atfs_hdir_insert_many(dev, dir->StartBlock, dir->SizeBlocks,
+			entries, count, blocks, offsets) :
+		atfs_sdir_insert_many(dev, dir->StartBlock, dir->SizeBlocks,
+			entries, count, blocks, offsets);
+	_dir_forget_names(dev, dir->StartBlock, names, count);
+	for(i = 0; i < count; ++i)
+	{
+		if(delayed && blocks[i])
+		{
+			atfs_delay_add(dev, blocks[i], offsets[i], capacities[i]);
+		}
+		else if(delayed)
+		{
+			atfs_delay_release(dev, capacities[i]);
+		}
+		else if(!blocks[i])
 		{
-			PROPAGATE(_dir_entry_find(dev, name, path - name,
-				entry.StartBlock, entry.SizeBlocks, &entry));
+			atfs_free(dev, starts[i], capacities[i]);
+		}
+	}
 
-			if(entry.Type != ATFS_TYPE_DIR)
-			{
-				return ATFS_STATUS_NO_SUCH_FILE_OR_DIRECTORY;
-			}
+	free(entries);
+	free(starts);
+	return status;
+}
 
-			name = path + 1;
+static ATFS_Status _fcreate_many(BlockDevice *dev, const char *parent,
+	const char *const *names, const u32 *capacities, u32 count)
+{
+	ATFS_NamelessDirEntry dir;
+	ATFS_DirFormat format;
+	ATFS_Status status;
+	u32 i, done, pot, *slots, *starts;
+	u64 total;
+	u8 *buf, *cur;
+	int delayed;
+
+	if(!count)
+	{
+		return ATFS_STATUS_OK;
+	}
+
+	PROPAGATE(_dir_resolve(dev, parent, &dir, &format));
+	for(i = 0, total = 0; i < count; ++i)
+	{
+		PROPAGATE(check_name(names[i]));
+		total += capacities[i];
+	}
+
+	if(total > 0xFFFFFFFF)
+	{
+		return ATFS_STATUS_NO_SPACE_LEFT_ON_DEVICE;
+	}
+
+	if(!dir.SizeBlocks)
+	{
+		return ATFS_STATUS_DIRECTORY_FULL;
+	}
+
+	if(format != ATFS_DIR_LINEAR)
+	{
+		return _create_many_unique(dev, format, &dir, names, capacities,
+			count, total);
+	}
+
+	/* The whole directory is read and searched once */
+	pot = dev->BlockSizePOT;
+	buf = malloc((size_t)dir.SizeBlocks << pot);
+	slots = malloc(2 * (size_t)count * sizeof(*slots));
+	if(!buf || !slots)
+	{
+		free(buf);
+		free(slots);
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	starts = slots + count;
+	if(!(status = dev_read(dev, dir.StartBlock, dir.SizeBlocks, buf)) &&
+		!(status = _dir_check_names(dev, buf, dir.SizeBlocks,
+			names, count)) &&
+		_dir_free_slots(dev, buf, dir.SizeBlocks, slots, count) < count)
+	{
+		status = ATFS_STATUS_DIRECTORY_FULL;
+	}
+
+	/* All files in one allocation, next to their directory */
+	delayed = atfs_delay_enabled(dev);
+	if(!status)
+	{
+		status = delayed ? atfs_delay_reserve(dev, total) :
+			atfs_delay_check(dev, total);
+	}
+
+	if(!status && !delayed)
+	{
+		status = atfs_alloc_many(dev, capacities, count, dir.StartBlock,
+			starts);
+	}
+
+	for(i = 0; delayed && i < count; ++i)
+	{
+		starts[i] = ATFS_START_DELAYED;
+	}
+
+	if(status)
+	{
+		free(buf);
+		free(slots);
+		return status;
+	}
+
+	for(i = 0; i < count; ++i)
+	{
+		cur = buf + slots[i];
+		memset(cur, 0, ATFS_DIR_ENTRY_SIZE);
+		atfs_write32(cur + ATFS_DIR_ENTRY_OFFSET_START, starts[i]);
+		atfs_write32(cur + ATFS_DIR_ENTRY_OFFSET_SIZE, capacities[i]);
+		cur[ATFS_DIR_ENTRY_OFFSET_TYPE] = ATFS_TYPE_FILE |
+			atfs_name_tag(names[i], strlen(names[i]));
+		strcpy((char *)(cur + ATFS_DIR_ENTRY_OFFSET_NAME), names[i]);
+	}
+
+	/* Files in blocks that were not written do not exist */
+	status = _dir_write_slots(dev, dir.StartBlock, buf, slots, count, &done);
+	_dir_forget_names(dev, dir.StartBlock, names, count);
+	for(i = 0; i < count; ++i)
+	{
+		if(delayed && i < done)
+		{
+			atfs_delay_add(dev, dir.StartBlock + (slots[i] >> pot),
+				slots[i] & (dev->BlockSize - 1), capacities[i]);
+		}
+		else if(delayed)
+		{
+			atfs_delay_release(dev, capacities[i]);
+		}
+		else if(i >= done)
+		{
+			atfs_free(dev, starts[i], capacities[i]);
 		}
 	}
 
-	/* TODO: This is way to many pointer parameters */
-	*parent = entry.StartBlock;
-	*size = entry.SizeBlocks;
-	*last = name;
-	*end = path;
-	return ATFS_STATUS_OK;
+	free(buf);
+	free(slots);
+	return status;
 }
 
-ATFS_Status atfs_fcreate(BlockDevice *dev, const char *path,
-	ATFS_FileType type, u32 size)
+ATFS_Status atfs_fcreate_many(BlockDevice *dev, const char *parent,
+	const char *const *names, const u32 *capacities, u32 count)
 {
-	const char *last, *end;
-	u32 start, parent, parent_size;
-	ATFS_DirEntry entry;
+	ATFS_OP(ATFS_OP_CREATE, _fcreate_many(dev, parent, names,
+		capacities, count));
+}
 
-	PROPAGATE(check_path(path));
-	PROPAGATE(atfs_traverse(dev, path, &parent, &parent_size, &last, &end));
-	PROPAGATE(atfs_alloc(dev, size, &start));
-	dir_entry_init(&entry, start, size, type, last);
+/* Set up a file handle for an entry, the position of the entry
+	is already set */
+static ATFS_Status _file_setup(BlockDevice *dev,
+	const ATFS_NamelessDirEntry *entry, ATFS_File *file)
+{
+	ATFS_Status status;
 
-	/* TODO BUG: This leaks allocated space for file if insert fails */
-	PROPAGATE(_dir_entry_insert(dev, parent, &entry));
-	return ATFS_STATUS_OK;
+	file->Device = dev;
+	file->StartBlock = entry->StartBlock;
+	file->SizeBlocks = entry->SizeBlocks;
+	file->NextBlock = 0;
+	file->ReadAhead = 0;
+	file->PrefetchEnd = 0;
+	file->Extents = NULL;
+	file->ExtentCount = 0;
+	file->ExtentHint = 0;
+	file->ExtentBlocks = NULL;
+	file->ExtentBlockCount = 0;
+	if(entry->Type & ATFS_TYPE_FLAG_EXTENTS)
+	{
+		PROPAGATE(_extents_load(file));
+	}
+
+	/* Defragmentation leaves open files alone, moved entries update
+		the entry position */
+	if((status = atfs_mount_open(dev, file)))
+	{
+		free(file->Extents);
+		free(file->ExtentBlocks);
+		file->Extents = NULL;
+		file->ExtentBlocks = NULL;
+	}
+
+	return status;
 }
 
-ATFS_Status atfs_fopen(BlockDevice *dev, const char *path, ATFS_File *file)
+static ATFS_Status _fopen(BlockDevice *dev, const char *path, ATFS_File *file)
 {
 	ATFS_NamelessDirEntry entry;
+	ATFS_DirFormat format;
 	const char *name, *end;
 
 	PROPAGATE(check_path(path));
 	PROPAGATE(atfs_traverse(dev, path, &entry.StartBlock, &entry.SizeBlocks,
-		&name, &end));
+		&name, &end, &format));
 
+	/* The root directory has no directory entry */
+	entry.Type = ATFS_TYPE_DIR;
+	file->EntryBlock = ATFS_SECTOR_BOOT;
+	file->EntryOffset = 0;
 	if(*name != '\0')
 	{
-		PROPAGATE(_dir_entry_find(dev, name, end - name,
-			entry.StartBlock, entry.SizeBlocks, &entry));
+		PROPAGATE(_dir_lookup(dev, format, name, end - name,
+			entry.StartBlock, entry.SizeBlocks, &entry,
+			&file->EntryBlock, &file->EntryOffset));
 	}
 
-	file->Device = dev;
-	file->StartBlock = entry.StartBlock;
-	file->SizeBlocks = entry.SizeBlocks;
+	return _file_setup(dev, &entry, file);
+}
+
+ATFS_Status atfs_fopen(BlockDevice *dev, const char *path, ATFS_File *file)
+{
+	ATFS_OP(ATFS_OP_OPEN, _fopen(dev, path, file));
+}
+
+static ATFS_Status _fopen_at(ATFS_Dir *dir, const char *name,
+	ATFS_File *file)
+{
+	ATFS_File *d = &dir->InternalFile;
+	ATFS_NamelessDirEntry entry;
+
+	PROPAGATE(check_name(name));
+	PROPAGATE(_dir_lookup(d->Device, dir->Format, name, strlen(name),
+		d->StartBlock, d->SizeBlocks, &entry,
+		&file->EntryBlock, &file->EntryOffset));
+	return _file_setup(d->Device, &entry, file);
+}
+
+ATFS_Status atfs_fopen_at(ATFS_Dir *dir, const char *name, ATFS_File *file)
+{
+	ATFS_OP(ATFS_OP_OPEN, _fopen_at(dir, name, file));
+}
+
+ATFS_Status atfs_fplace(ATFS_File *file)
+{
+	BlockDevice *dev = file->Device;
+	u8 buf[dev->BlockSize];
+	u8 *cur;
+	u32 start;
+	ATFS_Status status;
+
+	if(file->StartBlock != ATFS_START_DELAYED)
+	{
+		return ATFS_STATUS_OK;
+	}
+
+	/* All files that are waiting are placed together */
+	PROPAGATE(atfs_delay_flush(dev));
+	PROPAGATE(dev_read(dev, file->EntryBlock, 1, buf));
+	cur = buf + file->EntryOffset;
+	if((start = atfs_read32(cur + ATFS_DIR_ENTRY_OFFSET_START)) ==
+		ATFS_START_DELAYED)
+	{
+		/* Created on an earlier mount, there is no reservation */
+		PROPAGATE(atfs_delay_check(dev, file->SizeBlocks));
+		PROPAGATE(atfs_alloc_near(dev, file->SizeBlocks,
+			file->EntryBlock, &start));
+		atfs_write32(cur + ATFS_DIR_ENTRY_OFFSET_START, start);
+		if((status = dev_write(dev, file->EntryBlock, 1, buf)))
+		{
+			atfs_free(dev, start, file->SizeBlocks);
+			return status;
+		}
+
+		atfs_dcache_forget_entry(dev, file->EntryBlock, file->EntryOffset);
+	}
+
+	file->StartBlock = start;
 	return ATFS_STATUS_OK;
 }
 
-ATFS_Status atfs_fread(ATFS_File *file, u32 block, u32 count, void *buf)
+static ATFS_Status _fclose(ATFS_File *file)
+{
+	free(file->Extents);
+	free(file->ExtentBlocks);
+	file->Extents = NULL;
+	file->ExtentBlocks = NULL;
+	atfs_mount_close(file->Device, file);
+	return atfs_fplace(file);
+}
+
+ATFS_Status atfs_fclose(ATFS_File *file)
+{
+	ATFS_OP(ATFS_OP_CLOSE, _fclose(file));
+}
+
+void atfs_readahead(ATFS_File *file, u32 block, u32 count)
+{
+	u32 start, end, window, len;
+
+	if(block != file->NextBlock)
+	{
+		file->ReadAhead = 0;
+		file->PrefetchEnd = 0;
+	}
+	else if(file->ReadAhead < ATFS_READAHEAD_MAX)
+	{
+		file->ReadAhead = file->ReadAhead ?
+			2 * file->ReadAhead : ATFS_READAHEAD_MIN;
+	}
+
+	file->NextBlock = block + count;
+	if(!(window = file->ReadAhead))
+	{
+		return;
+	}
+
+	/* Top up the window once half of it is used. The extents of a file
+		are in memory, so this never needs any metadata. */
+	end = block + count;
+	if(file->PrefetchEnd >= end + window / 2)
+	{
+		return;
+	}
+
+	start = file->PrefetchEnd > block ? file->PrefetchEnd : block;
+	end = file->SizeBlocks - end < window ? file->SizeBlocks : end + window;
+	if(start < end)
+	{
+		/* Only a hint, errors show up when the blocks are read */
+		file->PrefetchEnd = end;
+		for(; start < end; start += len)
+		{
+			len = end - start;
+			dev_prefetch(file->Device, atfs_fmap(file, start, &len), len);
+		}
+	}
+}
+
+static ATFS_Status _fread(ATFS_File *file, u32 block, u32 count, void *buf)
 {
 	if(_file_check_bounds(block, count, file->SizeBlocks))
 	{
 		return ATFS_STATUS_OUT_OF_BOUNDS;
 	}
 
-	return file->Device->Read(file->StartBlock + block, count, buf);
+	/* Nothing was written yet */
+	if(file->StartBlock == ATFS_START_DELAYED)
+	{
+		memset(buf, 0, (size_t)count << file->Device->BlockSizePOT);
+		return ATFS_STATUS_OK;
+	}
+
+	atfs_readahead(file, block, count);
+	return _file_io(file, block, count, buf, 0);
 }
 
-ATFS_Status atfs_fwrite(ATFS_File *file, u32 block, u32 count, const void *buf)
+ATFS_Status atfs_fread(ATFS_File *file, u32 block, u32 count, void *buf)
+{
+	ATFS_OP(ATFS_OP_READ, _fread(file, block, count, buf));
+}
+
+static ATFS_Status _fwrite(ATFS_File *file, u32 block, u32 count,
+	const void *buf)
 {
 	if(_file_check_bounds(block, count, file->SizeBlocks))
 	{
 		return ATFS_STATUS_OUT_OF_BOUNDS;
 	}
 
-	return file->Device->Write(file->StartBlock + block, count, buf);
+	PROPAGATE(atfs_fplace(file));
+	return _file_io(file, block, count, (void *)buf, 1);
+}
+
+ATFS_Status atfs_fwrite(ATFS_File *file, u32 block, u32 count, const void *buf)
+{
+	ATFS_OP(ATFS_OP_WRITE, _fwrite(file, block, count, buf));
+}
+
+static ATFS_Status _freadv(ATFS_File *file, const DeviceIOVec *vec, u32 n)
+{
+	u32 i, pieces;
+
+	PROPAGATE(_file_vec_pieces(file, vec, n, &pieces));
+	if(file->StartBlock == ATFS_START_DELAYED)
+	{
+		for(i = 0; i < n; ++i)
+		{
+			memset(vec[i].Buffer, 0,
+				(size_t)vec[i].Count << file->Device->BlockSizePOT);
+		}
+
+		return ATFS_STATUS_OK;
+	}
+
+	return _file_iov(file, vec, n, pieces, 0);
+}
+
+ATFS_Status atfs_freadv(ATFS_File *file, const DeviceIOVec *vec, u32 n)
+{
+	ATFS_OP(ATFS_OP_READ, _freadv(file, vec, n));
+}
+
+static ATFS_Status _fwritev(ATFS_File *file, const DeviceIOVec *vec, u32 n)
+{
+	u32 pieces;
+
+	PROPAGATE(_file_vec_pieces(file, vec, n, &pieces));
+	PROPAGATE(atfs_fplace(file));
+	return _file_iov(file, vec, n, pieces, 1);
+}
+
+ATFS_Status atfs_fwritev(ATFS_File *file, const DeviceIOVec *vec, u32 n)
+{
+	ATFS_OP(ATFS_OP_WRITE, _fwritev(file, vec, n));
 }
@@ -11,11 +11,129 @@
 
 #include "atfs.h"
 
+/** Blocks per request when atfs_fresize moves a file */
+#define ATFS_RESIZE_CHUNK  64
+
 ATFS_Status atfs_fcreate(BlockDevice *dev, const char *path,
 	ATFS_FileType type, u32 capacity);
 
+/**
+ * @brief Create a file or directory in an open directory, without
+ *        resolving its path again
+ *
+ * @param dir Directory opened with atfs_dopen
+ * @param name Name of the new file, without the directory path
+ * @param type File type
+ * @param capacity Capacity in blocks
+ * @return Status code
+ */
+ATFS_Status atfs_fcreate_at(ATFS_Dir *dir, const char *name,
+	ATFS_FileType type, u32 capacity);
+
+/**
+ * @brief Create many files in one directory. The directory is looked up
+ *        and read once, the files are allocated together (contiguous if
+ *        there is a free area for all of them) and every directory block
+ *        that gets new entries is written once.
+ *
+ * @param dev Block device
+ * @param parent Path of the directory
+ * @param names Names of the new files, without the directory path
+ * @param capacities Capacity of each file in blocks
+ * @param count Number of files
+ * @return Status code, no file is created if the directory does not
+ *         have enough free entries or there is not enough space
+ */
+ATFS_Status atfs_fcreate_many(BlockDevice *dev, const char *parent,
+	const char *const *names, const u32 *capacities, u32 count);
+
 ATFS_Status atfs_fopen(BlockDevice *dev, const char *path, ATFS_File *file);
 
+/**
+ * @brief Open a file or directory in an open directory, without
+ *        resolving its path again
+ *
+ * @param dir Directory opened with atfs_dopen
+ * @param name Name of the file, without the directory path
+ * @param file Pointer to file struct
+ * @return Status code
+ */
+ATFS_Status atfs_fopen_at(ATFS_Dir *dir, const char *name, ATFS_File *file);
+
+/**
+ * @brief Allocate the blocks of a file that was created with delayed
+ *        allocation, together with all other files that are waiting.
+ *        Writes do this on their own.
+ *
+ * @param file Pointer to file struct
+ * @return Status code
+ */
+ATFS_Status atfs_fplace(ATFS_File *file);
+
+/**
+ * @brief Close a file, a file with delayed allocation gets its blocks.
+ *        Must be called for every file that was opened, to free the
+ *        extent list and so defragmentation can move the file again.
+ *
+ * @param file Pointer to file struct
+ * @return Status code
+ */
+ATFS_Status atfs_fclose(ATFS_File *file);
+
+/**
+ * @brief Add blocks to the end of a file. The file is extended in place
+ *        if the blocks after it are free, otherwise the new blocks become
+ *        a new extent. A hashed directory can only be resized with
+ *        atfs_fresize, which moves it.
+ *
+ * @param file Pointer to file struct
+ * @param count Number of blocks to add
+ * @return Status code
+ */
+ATFS_Status atfs_fgrow(ATFS_File *file, u32 count);
+
+/**
+ * @brief Change the capacity of a file. Shrinking frees the end of the
+ *        file. Growing extends the file in place if the blocks after it
+ *        are free, otherwise a contiguous file is moved to a free area
+ *        that is large enough, and only if there is none the new blocks
+ *        become a new extent. Directories are never split into extents,
+ *        and a directory only shrinks if its entries fit into the blocks
+ *        that are kept (those of a sorted directory are moved there).
+ *        A hashed directory is rehashed into a new area of `size` buckets.
+ *
+ * @param file Pointer to file struct
+ * @param size New capacity in blocks
+ * @return Status code, ATFS_STATUS_DIRECTORY_FULL if the directory
+ *         has entries in the blocks that would be dropped
+ */
+ATFS_Status atfs_fresize(ATFS_File *file, u32 size);
+
+/**
+ * @brief Find the device block of a file block
+ *
+ * @param file Pointer to file struct
+ * @param block File block, must be inside the file
+ * @param count Output parameter number of blocks from `block` to the end of
+ *        its extent, can be NULL
+ * @return Device block
+ */
+u32 atfs_fmap(ATFS_File *file, u32 block, u32 *count);
+
+/**
+ * @brief Read the extent list of a directory entry
+ *
+ * @param dev Block device
+ * @param entry Directory entry with ATFS_TYPE_FLAG_EXTENTS
+ * @param extents Output parameter extents, must be freed by the caller
+ * @param count Output parameter number of extents
+ * @param blocks Output parameter extent blocks, must be freed by the caller
+ * @param block_count Output parameter number of extent blocks
+ * @return Status code
+ */
+ATFS_Status atfs_extents_read(BlockDevice *dev, const u8 *entry,
+	ATFS_FileExtent **extents, u32 *count, u32 **blocks, u32 *block_count);
+
 /**
  * @brief Read blocks from a file
  *
@@ -38,4 +156,34 @@ ATFS_Status atfs_fread(ATFS_File *file, u32 block, u32 count, void *buf);
  */
 ATFS_Status atfs_fwrite(ATFS_File *file, u32 block, u32 count, const void *buf);
 
+/**
+ * @brief Read several block ranges of a file, each into its own buffer
+ *
+ * @param file Pointer to file struct
+ * @param vec Array of block ranges (relative to the file) and buffers
+ * @param n Number of array elements
+ * @return Status code
+ */
+ATFS_Status atfs_freadv(ATFS_File *file, const DeviceIOVec *vec, u32 n);
+
+/**
+ * @brief Write several block ranges of a file, each from its own buffer
+ *
+ * @param file Pointer to file struct
+ * @param vec Array of block ranges (relative to the file) and buffers
+ * @param n Number of array elements
+ * @return Status code
+ */
+ATFS_Status atfs_fwritev(ATFS_File *file, const DeviceIOVec *vec, u32 n);
+
+/**
+ * @brief Note an access to a file and prefetch the following blocks
+ *        if the file is read sequentially
+ *
+ * @param file Pointer to file struct
+ * @param block First block that is accessed
+ * @param count Number of blocks that are accessed
+ */
+void atfs_readahead(ATFS_File *file, u32 block, u32 count);
+
 #endif /* __ATFS_FILE_H__ */
@@ -7,61 +7,187 @@
 
 #include "atfs_format.h"
 #include "atfs_util.h"
+#include "atfs_alloc.h"
+#include "atfs_mount.h"
+#include <stdlib.h>
 #include <string.h>
 
-static ATFS_Status _setup_boot_block(BlockDevice *dev)
+/* First block after the root directory and the bitmap */
+static u32 _first_free(const ATFS_Groups *groups)
+{
+	return ATFS_INITIAL_ROOT_SIZE + 1 + groups->BitmapBlocks;
+}
+
+static ATFS_Status _setup_boot_block(BlockDevice *dev,
+	const ATFS_Groups *groups, ATFS_DirFormat directories)
 {
 	u8 buf[dev->BlockSize];
+	u32 free_size;
 	memset(buf, 0, dev->BlockSize);
 
+	/* Free space of the first group is its size minus the initial size
+		of the root directory, the bitmap and minus 1 for the bootsector */
+	free_size = atfs_group_end(groups, 0) - _first_free(groups);
+
 	memcpy(buf + ATFS_OFFSET_SIGNATURE, ATFS_SIGNATURE, sizeof(ATFS_SIGNATURE));
 	atfs_write32(buf + ATFS_OFFSET_REVISION, ATFS_REVISION);
-	atfs_write32(buf + ATFS_OFFSET_FREE_NEXT, ATFS_INITIAL_ROOT_SIZE + 1);
+	atfs_write32(buf + ATFS_OFFSET_FREE_NEXT,
+		groups->Allocator == ATFS_ALLOCATOR_LIST ? _first_free(groups) : 0);
 	atfs_write32(buf + ATFS_OFFSET_FREE_SIZE, 0);
 	atfs_write32(buf + ATFS_OFFSET_ROOT_BLOCK, 1);
 	atfs_write32(buf + ATFS_OFFSET_ROOT_SIZE, ATFS_INITIAL_ROOT_SIZE);
-	return dev->Write(0, 1, buf);
+	atfs_write32(buf + ATFS_OFFSET_GROUP_COUNT, groups->Count);
+	atfs_write32(buf + ATFS_OFFSET_GROUP_SIZE, groups->Size);
+	atfs_write32(buf + ATFS_OFFSET_GROUP_FREE, free_size);
+	atfs_write32(buf + ATFS_OFFSET_GROUP_AREAS, 1);
+	atfs_write32(buf + ATFS_OFFSET_GROUP_LARGEST, free_size);
+	atfs_write32(buf + ATFS_OFFSET_ALLOCATOR, groups->Allocator);
+	atfs_write32(buf + ATFS_OFFSET_BITMAP_BLOCK, groups->BitmapStart);
+	atfs_write32(buf + ATFS_OFFSET_BITMAP_SIZE, groups->BitmapBlocks);
+	atfs_write32(buf + ATFS_OFFSET_DIR_FORMAT, directories);
+	return dev_write(dev, 0, 1, buf);
 }
 
 static ATFS_Status _setup_root_block(BlockDevice *dev)
 {
-	u8 buf[dev->BlockSize];
-	u32 i;
-
-	/* TODO: Not really satisfied with having to use a buffer just to
-		zero blocks. Maybe add a dev->Zero() operation? */
-	memset(buf, 0, dev->BlockSize);
-	for(i = 1; i < 1 + ATFS_INITIAL_ROOT_SIZE; ++i)
-	{
-		PROPAGATE(dev->Write(i, 1, buf));
-	}
-
-	return ATFS_STATUS_OK;
+	return dev_zero(dev, 1, ATFS_INITIAL_ROOT_SIZE);
 }
 
-static ATFS_Status _setup_free_list(BlockDevice *dev)
+/* Make all blocks from `start` to the end of the group one free area */
+static ATFS_Status _setup_free_area(BlockDevice *dev,
+	const ATFS_Groups *groups, u32 group, u32 start)
 {
 	u8 buf[dev->BlockSize];
+	u32 free_size = atfs_group_end(groups, group) - start;
 	memset(buf, 0, dev->BlockSize);
 
-	/* Free space is total size minus the initial size of the root directory
-		and minus 1 for the bootsector */
-	u32 free_size = dev->BlockCount - ATFS_INITIAL_ROOT_SIZE - 1;
-
 	/* There is no next free area */
 	atfs_write32(buf + ATFS_OFFSET_FREE_NEXT, 0);
 
 	/* Whole remaining space is marked as free */
 	atfs_write32(buf + ATFS_OFFSET_FREE_SIZE, free_size);
+	PROPAGATE(dev_write(dev, start, 1, buf));
 
-	/* Free space starts after the root directory */
-	return dev->Write(ATFS_INITIAL_ROOT_SIZE + 1, 1, buf);
+	/* Everything after the free area header is unused */
+	return dev_discard(dev, start + 1, free_size - 1);
 }
 
-ATFS_Status atfs_format(BlockDevice *dev)
+/* Write the list head of every group after the first, which is the
+	first block of the group, followed by one free area */
+static ATFS_Status _setup_group(BlockDevice *dev, const ATFS_Groups *groups,
+	u32 group)
 {
-	PROPAGATE(_setup_boot_block(dev));
+	u8 buf[dev->BlockSize];
+	u32 head = atfs_group_head(groups, group);
+	u32 free_size = atfs_group_end(groups, group) - head - 1;
+	memset(buf, 0, dev->BlockSize);
+
+	atfs_write32(buf + ATFS_OFFSET_FREE_NEXT, head + 1);
+	atfs_write32(buf + ATFS_OFFSET_FREE_SIZE, 0);
+	atfs_write32(buf + ATFS_OFFSET_GROUP_FREE, free_size);
+	atfs_write32(buf + ATFS_OFFSET_GROUP_AREAS, 1);
+	atfs_write32(buf + ATFS_OFFSET_GROUP_LARGEST, free_size);
+	PROPAGATE(dev_write(dev, head, 1, buf));
+	return _setup_free_area(dev, groups, group, head + 1);
+}
+
+/* Mark the blocks in front of the free space and the bits after the end
+	of the volume as used, everything in between is free */
+static ATFS_Status _setup_bitmap(BlockDevice *dev, const ATFS_Groups *groups)
+{
+	u32 i, first_free, bits;
+	DeviceStatus status;
+	u8 *map;
+
+	bits = groups->BitmapBlocks << (dev->BlockSizePOT + 3);
+	if(!(map = calloc(groups->BitmapBlocks, dev->BlockSize)))
+	{
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	first_free = _first_free(groups);
+	for(i = 0; i < bits; i = i == first_free - 1 ? dev->BlockCount : i + 1)
+	{
+		map[i >> 3] |= 1 << (i & 7);
+	}
+
+	status = dev_write(dev, groups->BitmapStart, groups->BitmapBlocks, map);
+	free(map);
+	PROPAGATE(status);
+	return dev_discard(dev, first_free, dev->BlockCount - first_free);
+}
+
+static ATFS_Status _format(BlockDevice *dev, const ATFS_FormatOptions *opts)
+{
+	ATFS_Groups groups;
+	ATFS_Mount *m;
+	u32 i;
+
+	if(!opts->Groups || dev->BlockCount / opts->Groups < ATFS_MIN_GROUP_SIZE ||
+		opts->Allocator >= ATFS_ALLOCATOR_COUNT ||
+		opts->Directories >= ATFS_DIR_FORMAT_COUNT ||
+		(opts->Directories == ATFS_DIR_SORTED &&
+			dev->BlockSize > ATFS_SDIR_MAX_BLOCK_SIZE))
+	{
+		return ATFS_STATUS_INVALID_ARGUMENT;
+	}
+
+	groups.Count = opts->Groups;
+	groups.Size = dev->BlockCount / opts->Groups;
+	groups.BlockCount = dev->BlockCount;
+	groups.HasSummary = 1;
+	groups.Allocator = opts->Allocator;
+	groups.BitmapStart = 0;
+	groups.BitmapBlocks = 0;
+	if(groups.Allocator == ATFS_ALLOCATOR_BITMAP)
+	{
+		/* One bitmap for the whole volume, directly after the root */
+		groups.BitmapStart = ATFS_INITIAL_ROOT_SIZE + 1;
+		groups.BitmapBlocks = (dev->BlockCount - 1) /
+			(dev->BlockSize * 8) + 1;
+		if(groups.Count != 1 ||
+			_first_free(&groups) >= dev->BlockCount)
+		{
+			return ATFS_STATUS_INVALID_ARGUMENT;
+		}
+	}
+
+	PROPAGATE(_setup_boot_block(dev, &groups, opts->Directories));
 	PROPAGATE(_setup_root_block(dev));
-	PROPAGATE(_setup_free_list(dev));
+	if(groups.Allocator == ATFS_ALLOCATOR_BITMAP)
+	{
+		PROPAGATE(_setup_bitmap(dev, &groups));
+	}
+	else
+	{
+		PROPAGATE(_setup_free_area(dev, &groups, 0, _first_free(&groups)));
+		for(i = 1; i < groups.Count; ++i)
+		{
+			PROPAGATE(_setup_group(dev, &groups, i));
+		}
+	}
+
+	/* The free list of a mounted volume was replaced */
+	if((m = atfs_mount_find(dev)))
+	{
+		PROPAGATE(atfs_mount_load(m));
+	}
+
 	return ATFS_STATUS_OK;
 }
+
+ATFS_Status atfs_format(BlockDevice *dev)
+{
+	ATFS_FormatOptions opts =
+	{
+		.Groups = 1,
+		.Allocator = ATFS_ALLOCATOR_LIST,
+		.Directories = ATFS_DIR_LINEAR
+	};
+	ATFS_OP(ATFS_OP_FORMAT, _format(dev, &opts));
+}
+
+ATFS_Status atfs_format_opts(BlockDevice *dev, const ATFS_FormatOptions *opts)
+{
+	ATFS_OP(ATFS_OP_FORMAT, _format(dev, opts));
+}
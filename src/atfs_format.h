@@ -11,12 +11,37 @@
 
 #include "atfs.h"
 
+/** Format options */
+typedef struct
+{
+	/** Number of allocation groups, each has its own free list */
+	u32 Groups;
+
+	/** How free space is tracked, a bitmap allows only one group */
+	ATFS_Allocator Allocator;
+
+	/** How directory entries are arranged */
+	ATFS_DirFormat Directories;
+} ATFS_FormatOptions;
+
 /**
  * @brief Format a block device with the ATFS file system
+ *        with a single allocation group
  *
  * @param dev Block device
  * @return Status code
  */
 ATFS_Status atfs_format(BlockDevice *dev);
 
+/**
+ * @brief Format a block device with the ATFS file system.
+ *        Every allocation group must have at least ATFS_MIN_GROUP_SIZE
+ *        blocks, the last group also gets the remaining blocks.
+ *
+ * @param dev Block device
+ * @param opts Format options
+ * @return Status code
+ */
+ATFS_Status atfs_format_opts(BlockDevice *dev, const ATFS_FormatOptions *opts);
+
 #endif /* __ATFS_FORMAT_H__ */
@@ -0,0 +1,794 @@
+/**
+ * @file    atfs_hdir.c
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ */
+
+#include "atfs_hdir.h"
+#include "atfs_alloc.h"
+#include "atfs_dscan.h"
+#include "atfs_mount.h"
+#include "atfs_util.h"
+#include <stdlib.h>
+#include <string.h>
+
+/** Name of a batch, sorted by bucket and name */
+typedef struct
+{
+	/** Bucket relative to the start of the directory */
+	u32 Bucket;
+
+	/** Index in the batch */
+	u32 Index;
+
+	/** Null-terminated name */
+	const char *Name;
+} NameRef;
+
+/** Blocks of one bucket chain in memory */
+typedef struct
+{
+	/** Contents */
+	u8 *Data;
+
+	/** Block numbers */
+	u32 *Blocks;
+
+	/** Nonzero for every block that changed */
+	u8 *Dirty;
+
+	/** Number of blocks, of which the first `Old` were already there */
+	u32 Count, Old;
+} Chain;
+
+/** Entry of a directory that is rehashed, with its new bucket */
+typedef struct
+{
+	/** Bucket relative to the start of the new directory */
+	u32 Bucket;
+
+	/** Entry as stored, with its extents */
+	u8 Data[ATFS_DIR_ENTRY_SIZE];
+} Rehashed;
+
+ATFS_Status atfs_dir_format_get(const u8 *boot, ATFS_DirFormat *format)
+{
+	u32 f;
+
+	/* Older volumes only have linear directories */
+	f = ATFS_DIR_LINEAR;
+	if(atfs_read32(boot + ATFS_OFFSET_REVISION) >= ATFS_REVISION_DIR_FORMAT)
+	{
+		f = atfs_read32(boot + ATFS_OFFSET_DIR_FORMAT);
+	}
+
+	if(f >= ATFS_DIR_FORMAT_COUNT)
+	{
+		return ATFS_STATUS_INVALID_VOLUME;
+	}
+
+	*format = f;
+	return ATFS_STATUS_OK;
+}
+
+ATFS_Status atfs_dir_format(BlockDevice *dev, ATFS_DirFormat *format)
+{
+	u8 buf[dev->BlockSize];
+	const u8 *data;
+	ATFS_Status status;
+	ATFS_Mount *m;
+
+	if((m = atfs_mount_find(dev)))
+	{
+		*format = m->DirFormat;
+		return ATFS_STATUS_OK;
+	}
+
+	PROPAGATE(dev_map(dev, ATFS_SECTOR_BOOT, buf, &data));
+	status = atfs_dir_format_get(data, format);
+	dev_unmap(dev, ATFS_SECTOR_BOOT);
+	return status;
+}
+
+u32 atfs_name_hash(const char *name, size_t len)
+{
+	u32 hash = 2166136261u;
+
+	while(len--)
+	{
+		hash ^= (u8)*name++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/* Byte offset of the entry with the name in a bucket block,
+	the block size if there is none */
+static u32 _find(BlockDevice *dev, const u8 *data, const char *name,
+	size_t len, u8 tag)
+{
+	/* The first slot is the header */
+	return ATFS_DIR_ENTRY_SIZE + atfs_dscan_find(data + ATFS_DIR_ENTRY_SIZE,
+		dev->BlockSize - ATFS_DIR_ENTRY_SIZE, name, len, tag);
+}
+
+/* Next block of a bucket chain from the header in `data`, 0 at the end */
+static ATFS_Status _next(BlockDevice *dev, const u8 *data, u32 *steps,
+	u32 *next)
+{
+	*next = atfs_read32(data + ATFS_BUCKET_OFFSET_NEXT);
+
+	/* A longer chain than the volume has a loop */
+	if(*next && (*next >= dev->BlockCount || ++*steps >= dev->BlockCount))
+	{
+		return ATFS_STATUS_INVALID_VOLUME;
+	}
+
+	return ATFS_STATUS_OK;
+}
+
+static void _entry_put(u8 *p, const ATFS_DirEntry *entry)
+{
+	memset(p, 0, ATFS_DIR_ENTRY_SIZE);
+	atfs_write32(p + ATFS_DIR_ENTRY_OFFSET_START, entry->StartBlock);
+	atfs_write32(p + ATFS_DIR_ENTRY_OFFSET_SIZE, entry->SizeBlocks);
+	p[ATFS_DIR_ENTRY_OFFSET_TYPE] = entry->Type |
+		atfs_name_tag(entry->Name, strlen(entry->Name));
+	strncpy((char *)(p + ATFS_DIR_ENTRY_OFFSET_NAME), entry->Name,
+		ATFS_MAX_FILE_NAME_LENGTH + 1);
+}
+
+ATFS_Status atfs_hdir_find(BlockDevice *dev, u32 start, u32 size,
+	const char *name, size_t len, ATFS_NamelessDirEntry *entry,
+	u32 *entry_block, u32 *entry_offset)
+{
+	u8 buf[dev->BlockSize];
+	const u8 *data, *cur;
+	u32 block, next, offset, steps;
+	ATFS_Status status;
+	u8 tag;
+
+	if(!size)
+	{
+		return ATFS_STATUS_NO_SUCH_FILE_OR_DIRECTORY;
+	}
+
+	tag = atfs_name_tag(name, len);
+	steps = 0;
+	for(block = start + atfs_name_hash(name, len) % size; block; block = next)
+	{
+		PROPAGATE(dev_map(dev, block, buf, &data));
+		offset = _find(dev, data, name, len, tag);
+		if(offset < dev->BlockSize)
+		{
+			cur = data + offset;
+			entry->Type = cur[ATFS_DIR_ENTRY_OFFSET_TYPE] &
+				~ATFS_TYPE_TAG_MASK;
+			entry->StartBlock = atfs_read32(cur + ATFS_DIR_ENTRY_OFFSET_START);
+			entry->SizeBlocks = atfs_read32(cur + ATFS_DIR_ENTRY_OFFSET_SIZE);
+			if(entry_block)
+			{
+				*entry_block = block;
+				*entry_offset = offset;
+			}
+
+			dev_unmap(dev, block);
+			return ATFS_STATUS_OK;
+		}
+
+		status = _next(dev, data, &steps, &next);
+		dev_unmap(dev, block);
+		PROPAGATE(status);
+	}
+
+	return ATFS_STATUS_NO_SUCH_FILE_OR_DIRECTORY;
+}
+
+ATFS_Status atfs_hdir_insert(BlockDevice *dev, u32 start, u32 size,
+	const ATFS_DirEntry *entry, u32 *entry_block, u32 *entry_offset)
+{
+	u8 buf[dev->BlockSize], slot_buf[dev->BlockSize];
+	u32 block, next, last, offset, steps, slot_block, slot_offset;
+	size_t len;
+	ATFS_Status status;
+	u8 tag;
+
+	if(!size)
+	{
+		return ATFS_STATUS_DIRECTORY_FULL;
+	}
+
+	/* The whole bucket is checked for the name,
+		the entry goes into the first free slot */
+	len = strlen(entry->Name);
+	tag = atfs_name_tag(entry->Name, len);
+	slot_block = 0;
+	slot_offset = 0;
+	steps = 0;
+	last = 0;
+	for(block = start + atfs_name_hash(entry->Name, len) % size; block;
+		block = next)
+	{
+		PROPAGATE(dev_read(dev, block, 1, buf));
+		if(_find(dev, buf, entry->Name, len, tag) < dev->BlockSize)
+		{
+			return ATFS_STATUS_EXISTS;
+		}
+
+		for(offset = ATFS_DIR_ENTRY_SIZE; !slot_block &&
+			offset < dev->BlockSize; offset += ATFS_DIR_ENTRY_SIZE)
+		{
+			if(buf[offset + ATFS_DIR_ENTRY_OFFSET_TYPE] == ATFS_TYPE_FREE)
+			{
+				slot_block = block;
+				slot_offset = offset;
+				memcpy(slot_buf, buf, dev->BlockSize);
+			}
+		}
+
+		last = block;
+		PROPAGATE(_next(dev, buf, &steps, &next));
+	}
+
+	if(slot_block)
+	{
+		_entry_put(slot_buf + slot_offset, entry);
+		PROPAGATE(dev_write(dev, slot_block, 1, slot_buf));
+	}
+	else
+	{
+		/* The bucket is full, a new overflow block is written
+			and then linked to the last one, which is still in `buf` */
+		PROPAGATE(atfs_alloc_near(dev, 1, last, &slot_block));
+		slot_offset = ATFS_DIR_ENTRY_SIZE;
+		memset(slot_buf, 0, dev->BlockSize);
+		_entry_put(slot_buf + slot_offset, entry);
+		atfs_write32(buf + ATFS_BUCKET_OFFSET_NEXT, slot_block);
+		if((status = dev_write(dev, slot_block, 1, slot_buf)) ||
+			(status = dev_write(dev, last, 1, buf)))
+		{
+			atfs_free(dev, slot_block, 1);
+			return status;
+		}
+	}
+
+	*entry_block = slot_block;
+	*entry_offset = slot_offset;
+	return ATFS_STATUS_OK;
+}
+
+static int _ref_cmp(const void *a, const void *b)
+{
+	const NameRef *x = a, *y = b;
+
+	if(x->Bucket != y->Bucket)
+	{
+		return (x->Bucket > y->Bucket) - (x->Bucket < y->Bucket);
+	}
+
+	return strcmp(x->Name, y->Name);
+}
+
+static int _ref_name_cmp(const void *key, const void *ref)
+{
+	return strcmp(key, ((const NameRef *)ref)->Name);
+}
+
+/* Names sorted by bucket and name, NULL if out of memory */
+static NameRef *_refs(const char *const *names, u32 count, u32 size)
+{
+	NameRef *refs;
+	u32 i;
+
+	if(!(refs = malloc(count * sizeof(*refs))))
+	{
+		return NULL;
+	}
+
+	for(i = 0; i < count; ++i)
+	{
+		refs[i].Bucket = atfs_name_hash(names[i], strlen(names[i])) % size;
+		refs[i].Index = i;
+		refs[i].Name = names[i];
+	}
+
+	qsort(refs, count, sizeof(*refs), _ref_cmp);
+	return refs;
+}
+
+/* Check that no entry of the bucket has one of the `n` sorted names */
+static ATFS_Status _check_bucket(BlockDevice *dev, u32 block,
+	const NameRef *refs, u32 n)
+{
+	u8 buf[dev->BlockSize];
+	char name[ATFS_MAX_FILE_NAME_LENGTH + 1];
+	const u8 *data, *cur;
+	u32 next, offset, steps;
+	ATFS_Status status;
+
+	for(steps = 0; block; block = next)
+	{
+		PROPAGATE(dev_map(dev, block, buf, &data));
+		status = ATFS_STATUS_OK;
+		for(offset = ATFS_DIR_ENTRY_SIZE;
+			!status && offset < dev->BlockSize;
+			offset += ATFS_DIR_ENTRY_SIZE)
+		{
+			cur = data + offset;
+			if(cur[ATFS_DIR_ENTRY_OFFSET_TYPE] != ATFS_TYPE_FREE)
+			{
+				memcpy(name, cur + ATFS_DIR_ENTRY_OFFSET_NAME,
+					ATFS_MAX_FILE_NAME_LENGTH);
+				name[ATFS_MAX_FILE_NAME_LENGTH] = '\0';
+				if(bsearch(name, refs, n, sizeof(*refs), _ref_name_cmp))
+				{
+					status = ATFS_STATUS_EXISTS;
+				}
+			}
+		}
+
+		if(!status)
+		{
+			status = _next(dev, data, &steps, &next);
+		}
+
+		dev_unmap(dev, block);
+		PROPAGATE(status);
+	}
+
+	return ATFS_STATUS_OK;
+}
+
+ATFS_Status atfs_hdir_check_many(BlockDevice *dev, u32 start, u32 size,
+	const char *const *names, u32 count)
+{
+	NameRef *refs;
+	ATFS_Status status;
+	u32 i, j;
+
+	if(!size || !count)
+	{
+		return ATFS_STATUS_OK;
+	}
+
+	if(!(refs = _refs(names, count, size)))
+	{
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	status = ATFS_STATUS_OK;
+	for(i = 0; !status && i < count; i = j)
+	{
+		/* Equal names are next to each other */
+		for(j = i + 1; j < count && refs[j].Bucket == refs[i].Bucket; ++j)
+		{
+			if(!strcmp(refs[j].Name, refs[j - 1].Name))
+			{
+				status = ATFS_STATUS_EXISTS;
+			}
+		}
+
+		if(!status)
+		{
+			status = _check_bucket(dev, start + refs[i].Bucket,
+				refs + i, j - i);
+		}
+	}
+
+	free(refs);
+	return status;
+}
+
+static void _chain_init(Chain *c)
+{
+	c->Data = NULL;
+	c->Blocks = NULL;
+	c->Dirty = NULL;
+	c->Count = 0;
+	c->Old = 0;
+}
+
+static void _chain_free(Chain *c)
+{
+	free(c->Data);
+	free(c->Blocks);
+	free(c->Dirty);
+}
+
+/* Append a block to a chain in memory */
+static ATFS_Status _chain_add(BlockDevice *dev, Chain *c, u32 block)
+{
+	u8 *data, *dirty;
+	u32 *blocks;
+
+	if(!(data = realloc(c->Data, (size_t)(c->Count + 1) << dev->BlockSizePOT)))
+	{
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	c->Data = data;
+	if(!(blocks = realloc(c->Blocks, (c->Count + 1) * sizeof(*blocks))))
+	{
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	c->Blocks = blocks;
+	if(!(dirty = realloc(c->Dirty, c->Count + 1)))
+	{
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	c->Dirty = dirty;
+	c->Dirty[c->Count] = 0;
+	c->Blocks[c->Count++] = block;
+	return ATFS_STATUS_OK;
+}
+
+static u8 *_chain_block(BlockDevice *dev, Chain *c, u32 i)
+{
+	return c->Data + ((size_t)i << dev->BlockSizePOT);
+}
+
+/* Read a bucket chain into memory */
+static ATFS_Status _chain_read(BlockDevice *dev, Chain *c, u32 block)
+{
+	u32 steps;
+
+	for(steps = 0; block; )
+	{
+		PROPAGATE(_chain_add(dev, c, block));
+		PROPAGATE(dev_read(dev, block, 1, _chain_block(dev, c, c->Count - 1)));
+		PROPAGATE(_next(dev, _chain_block(dev, c, c->Count - 1),
+			&steps, &block));
+	}
+
+	c->Old = c->Count;
+	return ATFS_STATUS_OK;
+}
+
+/* Copy `n` stored entries, `stride` bytes apart, into free slots of the
+	chain, new overflow blocks are allocated when it is full */
+static ATFS_Status _chain_fill(BlockDevice *dev, Chain *c,
+	const u8 *raw, size_t stride, u32 n,
+	u32 *slot_blocks, u32 *slot_offsets)
+{
+	u32 i, k, offset, block;
+	u8 *data;
+
+	for(i = 0, k = 0, offset = ATFS_DIR_ENTRY_SIZE; k < n; )
+	{
+		if(offset == dev->BlockSize)
+		{
+			offset = ATFS_DIR_ENTRY_SIZE;
+			++i;
+		}
+
+		if(i == c->Count)
+		{
+			PROPAGATE(atfs_alloc_near(dev, 1, c->Blocks[i - 1], &block));
+			if(_chain_add(dev, c, block))
+			{
+				atfs_free(dev, block, 1);
+				return ATFS_STATUS_OUT_OF_MEMORY;
+			}
+
+			memset(_chain_block(dev, c, i), 0, dev->BlockSize);
+			atfs_write32(_chain_block(dev, c, i - 1) +
+				ATFS_BUCKET_OFFSET_NEXT, block);
+			c->Dirty[i - 1] = 1;
+		}
+
+		data = _chain_block(dev, c, i);
+		if(data[offset + ATFS_DIR_ENTRY_OFFSET_TYPE] == ATFS_TYPE_FREE)
+		{
+			memcpy(data + offset, raw + k * stride, ATFS_DIR_ENTRY_SIZE);
+			if(slot_blocks)
+			{
+				slot_blocks[k] = c->Blocks[i];
+				slot_offsets[k] = offset;
+			}
+
+			c->Dirty[i] = 1;
+			++k;
+		}
+
+		offset += ATFS_DIR_ENTRY_SIZE;
+	}
+
+	return ATFS_STATUS_OK;
+}
+
+/* Write the changed blocks of a chain, the new ones first
+	so they are complete before they are linked */
+static ATFS_Status _chain_write(BlockDevice *dev, const Chain *c,
+	int *linked)
+{
+	u32 i;
+
+	*linked = 0;
+	for(i = c->Old; i < c->Count; ++i)
+	{
+		PROPAGATE(dev_write(dev, c->Blocks[i], 1,
+			c->Data + ((size_t)i << dev->BlockSizePOT)));
+	}
+
+	for(i = 0; i < c->Old; ++i)
+	{
+		if(c->Dirty[i])
+		{
+			*linked = 1;
+			PROPAGATE(dev_write(dev, c->Blocks[i], 1,
+				c->Data + ((size_t)i << dev->BlockSizePOT)));
+		}
+	}
+
+	return ATFS_STATUS_OK;
+}
+
+/* Add `n` entries to the bucket at `block` */
+static ATFS_Status _insert_bucket(BlockDevice *dev, u32 block,
+	const ATFS_DirEntry *entries, const NameRef *refs, u32 n,
+	u32 *entry_blocks, u32 *entry_offsets)
+{
+	u32 i, *slot_blocks, *slot_offsets;
+	ATFS_Status status;
+	int linked;
+	u8 *raw;
+	Chain c;
+
+	slot_blocks = malloc(2 * (size_t)n * sizeof(*slot_blocks));
+	raw = malloc((size_t)n * ATFS_DIR_ENTRY_SIZE);
+	if(!slot_blocks || !raw)
+	{
+		free(slot_blocks);
+		free(raw);
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	for(i = 0; i < n; ++i)
+	{
+		_entry_put(raw + i * ATFS_DIR_ENTRY_SIZE, &entries[refs[i].Index]);
+	}
+
+	slot_offsets = slot_blocks + n;
+	_chain_init(&c);
+	linked = 0;
+	if(!(status = _chain_read(dev, &c, block)) &&
+		!(status = _chain_fill(dev, &c, raw, ATFS_DIR_ENTRY_SIZE, n,
+			slot_blocks, slot_offsets)) &&
+		!(status = _chain_write(dev, &c, &linked)))
+	{
+		for(i = 0; i < n; ++i)
+		{
+			entry_blocks[refs[i].Index] = slot_blocks[i];
+			entry_offsets[refs[i].Index] = slot_offsets[i];
+		}
+	}
+
+	/* New overflow blocks that were never linked are given back */
+	if(status && !linked)
+	{
+		for(i = c.Old; i < c.Count; ++i)
+		{
+			atfs_free(dev, c.Blocks[i], 1);
+		}
+	}
+
+	_chain_free(&c);
+	free(slot_blocks);
+	free(raw);
+	return status;
+}
+
+ATFS_Status atfs_hdir_insert_many(BlockDevice *dev, u32 start, u32 size,
+	const ATFS_DirEntry *entries, u32 count,
+	u32 *entry_blocks, u32 *entry_offsets)
+{
+	const char **names;
+	NameRef *refs;
+	ATFS_Status status;
+	u32 i, j;
+
+	for(i = 0; i < count; ++i)
+	{
+		entry_blocks[i] = 0;
+	}
+
+	if(!count)
+	{
+		return ATFS_STATUS_OK;
+	}
+
+	if(!size)
+	{
+		return ATFS_STATUS_DIRECTORY_FULL;
+	}
+
+	if(!(names = malloc(count * sizeof(*names))))
+	{
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	for(i = 0; i < count; ++i)
+	{
+		names[i] = entries[i].Name;
+	}
+
+	refs = _refs(names, count, size);
+	free(names);
+	if(!refs)
+	{
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	status = ATFS_STATUS_OK;
+	for(i = 0; !status && i < count; i = j)
+	{
+		for(j = i + 1; j < count && refs[j].Bucket == refs[i].Bucket; ++j) ;
+		status = _insert_bucket(dev, start + refs[i].Bucket, entries,
+			refs + i, j - i, entry_blocks, entry_offsets);
+	}
+
+	free(refs);
+	return status;
+}
+
+ATFS_Status atfs_hdir_free_overflow(BlockDevice *dev, u32 start, u32 size)
+{
+	u8 buf[dev->BlockSize];
+	const u8 *data;
+	u32 i, block, next, steps;
+	ATFS_Status status;
+
+	for(i = 0; i < size; ++i)
+	{
+		/* The link is read before the block is given back */
+		for(steps = 0, block = start + i; block; block = next)
+		{
+			PROPAGATE(dev_map(dev, block, buf, &data));
+			status = _next(dev, data, &steps, &next);
+			dev_unmap(dev, block);
+			PROPAGATE(status);
+			if(block != start + i)
+			{
+				atfs_free(dev, block, 1);
+			}
+		}
+	}
+
+	return ATFS_STATUS_OK;
+}
+
+static int _rehashed_cmp(const void *a, const void *b)
+{
+	const Rehashed *x = a, *y = b;
+	return (x->Bucket > y->Bucket) - (x->Bucket < y->Bucket);
+}
+
+/* Copy the entries of a bucket chain and give each its bucket in a
+	directory of `size` buckets */
+static ATFS_Status _rehash_collect(BlockDevice *dev, u32 block, u32 size,
+	Rehashed **entries, u32 *count, u32 *capacity)
+{
+	u8 buf[dev->BlockSize];
+	const u8 *data, *cur;
+	const char *name;
+	Rehashed *e;
+	u32 next, offset, steps;
+	ATFS_Status status;
+
+	for(steps = 0; block; block = next)
+	{
+		PROPAGATE(dev_map(dev, block, buf, &data));
+		status = ATFS_STATUS_OK;
+		for(offset = ATFS_DIR_ENTRY_SIZE; !status &&
+			offset < dev->BlockSize; offset += ATFS_DIR_ENTRY_SIZE)
+		{
+			cur = data + offset;
+			if(cur[ATFS_DIR_ENTRY_OFFSET_TYPE] != ATFS_TYPE_FREE)
+			{
+				if(*count == *capacity)
+				{
+					*capacity = *capacity ? 2 * *capacity : 64;
+					if((e = realloc(*entries, *capacity * sizeof(*e))))
+					{
+						*entries = e;
+					}
+					else
+					{
+						status = ATFS_STATUS_OUT_OF_MEMORY;
+						break;
+					}
+				}
+
+				e = &(*entries)[(*count)++];
+				name = (const char *)(cur + ATFS_DIR_ENTRY_OFFSET_NAME);
+				e->Bucket = atfs_name_hash(name,
+					strnlen(name, ATFS_MAX_FILE_NAME_LENGTH)) % size;
+				memcpy(e->Data, cur, ATFS_DIR_ENTRY_SIZE);
+			}
+		}
+
+		if(!status)
+		{
+			status = _next(dev, data, &steps, &next);
+		}
+
+		dev_unmap(dev, block);
+		PROPAGATE(status);
+	}
+
+	return ATFS_STATUS_OK;
+}
+
+/* Write the entries of one bucket into a cleared bucket block
+	and as many new overflow blocks as they need */
+static ATFS_Status _rehash_bucket(BlockDevice *dev, u32 block,
+	const Rehashed *entries, u32 n)
+{
+	ATFS_Status status;
+	int linked;
+	u32 i;
+	Chain c;
+
+	_chain_init(&c);
+	if(!(status = _chain_add(dev, &c, block)))
+	{
+		memset(_chain_block(dev, &c, 0), 0, dev->BlockSize);
+		if(!(status = _chain_fill(dev, &c, entries->Data, sizeof(*entries),
+			n, NULL, NULL)))
+		{
+			status = _chain_write(dev, &c, &linked);
+		}
+	}
+
+	/* The bucket belongs to a directory nobody refers to yet */
+	for(i = 1; status && i < c.Count; ++i)
+	{
+		atfs_free(dev, c.Blocks[i], 1);
+	}
+
+	_chain_free(&c);
+	return status;
+}
+
+ATFS_Status atfs_hdir_rehash(BlockDevice *dev, u32 start, u32 size,
+	u32 new_start, u32 new_size)
+{
+	Rehashed *entries;
+	u32 i, j, count, capacity;
+	ATFS_Status status;
+
+	entries = NULL;
+	count = 0;
+	capacity = 0;
+	status = new_size ? ATFS_STATUS_OK : ATFS_STATUS_INVALID_ARGUMENT;
+	for(i = 0; !status && i < size; ++i)
+	{
+		status = _rehash_collect(dev, start + i, new_size,
+			&entries, &count, &capacity);
+	}
+
+	/* Every bucket is written once, in block order */
+	if(!status)
+	{
+		qsort(entries, count, sizeof(*entries), _rehashed_cmp);
+	}
+
+	for(i = 0; !status && i < count; i = j)
+	{
+		for(j = i + 1; j < count && entries[j].Bucket == entries[i].Bucket;
+			++j) ;
+		if((status = _rehash_bucket(dev, new_start + entries[i].Bucket,
+			entries + i, j - i)))
+		{
+			/* The buckets in front of it are complete */
+			atfs_hdir_free_overflow(dev, new_start, entries[i].Bucket);
+		}
+	}
+
+	free(entries);
+	return status;
+}
@@ -0,0 +1,138 @@
+/**
+ * @file    atfs_hdir.h
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ * @brief   ATFS Hashed directories
+ *
+ * On volumes formatted with ATFS_DIR_HASHED, a name is stored in the
+ * directory block selected by its hash, or in an overflow block chained to
+ * it. Looking up, creating or checking a name only reads that bucket, which
+ * is one block unless more names hash to it than fit. The number of buckets
+ * is the size of the directory, resizing it moves every entry into the
+ * bucket of its name in a new area.
+ */
+
+#ifndef __ATFS_HDIR_H__
+#define __ATFS_HDIR_H__
+
+#include "atfs.h"
+
+/**
+ * @brief Get the directory format from a boot block
+ *
+ * @param boot Contents of the boot block
+ * @param format Output parameter directory format
+ * @return Status code
+ */
+ATFS_Status atfs_dir_format_get(const u8 *boot, ATFS_DirFormat *format);
+
+/**
+ * @brief Read the directory format of a volume
+ *
+ * @param dev Block device
+ * @param format Output parameter directory format
+ * @return Status code
+ */
+ATFS_Status atfs_dir_format(BlockDevice *dev, ATFS_DirFormat *format);
+
+/**
+ * @brief Hash of a file name (32 bit FNV-1a)
+ *
+ * @param name File name, does not need to be null-terminated
+ * @param len Length of the name
+ * @return Hash
+ */
+u32 atfs_name_hash(const char *name, size_t len);
+
+/**
+ * @brief Find an entry in a hashed directory
+ *
+ * @param dev Block device
+ * @param start First block of the directory
+ * @param size Directory size in blocks
+ * @param name File name, does not need to be null-terminated
+ * @param len Length of the name
+ * @param entry Output parameter entry
+ * @param entry_block Output parameter block of the entry, can be NULL
+ * @param entry_offset Output parameter byte offset of the entry in its block
+ * @return Status code
+ */
+ATFS_Status atfs_hdir_find(BlockDevice *dev, u32 start, u32 size,
+	const char *name, size_t len, ATFS_NamelessDirEntry *entry,
+	u32 *entry_block, u32 *entry_offset);
+
+/**
+ * @brief Add an entry to a hashed directory. An overflow block is
+ *        allocated if the bucket is full.
+ *
+ * @param dev Block device
+ * @param start First block of the directory
+ * @param size Directory size in blocks
+ * @param entry New entry
+ * @param entry_block Output parameter block of the entry
+ * @param entry_offset Output parameter byte offset of the entry in its block
+ * @return Status code, ATFS_STATUS_EXISTS if the name is taken
+ */
+ATFS_Status atfs_hdir_insert(BlockDevice *dev, u32 start, u32 size,
+	const ATFS_DirEntry *entry, u32 *entry_block, u32 *entry_offset);
+
+/**
+ * @brief Check that none of the names exists in a hashed directory and
+ *        that no name is given twice. Every bucket is read once.
+ *
+ * @param dev Block device
+ * @param start First block of the directory
+ * @param size Directory size in blocks
+ * @param names Names, null-terminated
+ * @param count Number of names
+ * @return Status code, ATFS_STATUS_EXISTS if a name is taken
+ */
+ATFS_Status atfs_hdir_check_many(BlockDevice *dev, u32 start, u32 size,
+	const char *const *names, u32 count);
+
+/**
+ * @brief Add many entries to a hashed directory, which must not contain
+ *        their names. Every bucket block that changes is written once.
+ *
+ * @param dev Block device
+ * @param start First block of the directory
+ * @param size Directory size in blocks
+ * @param entries New entries
+ * @param count Number of entries
+ * @param entry_blocks Output parameter block of each entry,
+ *        0 if it was not added because of an error
+ * @param entry_offsets Output parameter byte offset of each entry
+ * @return Status code
+ */
+ATFS_Status atfs_hdir_insert_many(BlockDevice *dev, u32 start, u32 size,
+	const ATFS_DirEntry *entries, u32 count,
+	u32 *entry_blocks, u32 *entry_offsets);
+
+/**
+ * @brief Copy the entries of a hashed directory into a cleared area with a
+ *        different number of buckets. The old directory is left as it is.
+ *        On failure the overflow blocks of the new area are freed again.
+ *
+ * @param dev Block device
+ * @param start First block of the directory
+ * @param size Directory size in blocks
+ * @param new_start First block of the new area, cleared
+ * @param new_size Number of buckets of the new area, at least 1
+ * @return Status code
+ */
+ATFS_Status atfs_hdir_rehash(BlockDevice *dev, u32 start, u32 size,
+	u32 new_start, u32 new_size);
+
+/**
+ * @brief Free the overflow blocks of all buckets of a hashed directory,
+ *        the buckets keep their links
+ *
+ * @param dev Block device
+ * @param start First block of the directory
+ * @param size Directory size in blocks
+ * @return Status code
+ */
+ATFS_Status atfs_hdir_free_overflow(BlockDevice *dev, u32 start, u32 size);
+
+#endif /* __ATFS_HDIR_H__ */
@@ -0,0 +1,460 @@
+/**
+ * @file    atfs_mount.c
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ */
+
+#include "atfs_mount.h"
+#include "atfs_util.h"
+#include "atfs_alloc.h"
+#include "atfs_bitmap.h"
+#include "atfs_delay.h"
+#include "atfs_hdir.h"
+#include <stdlib.h>
+#include <string.h>
+
+/** List of mounted volumes */
+static ATFS_Mount *_mounts;
+
+ATFS_Mount *atfs_mount_find(BlockDevice *dev)
+{
+	ATFS_Mount *m;
+	for(m = _mounts; m && m->Device != dev; m = m->Next) ;
+	return m;
+}
+
+static void _groups_free(ATFS_Mount *m)
+{
+	u32 i;
+
+	for(i = 0; m->Groups && i < m->Layout.Count; ++i)
+	{
+		atfs_extent_clear(&m->Groups[i].Free);
+		pthread_mutex_destroy(&m->Groups[i].Lock);
+	}
+
+	free(m->Groups);
+	free(m->Bitmap);
+	m->Groups = NULL;
+	m->Bitmap = NULL;
+	m->Layout.Count = 0;
+}
+
+static ATFS_Status _groups_alloc(ATFS_Mount *m, const ATFS_Groups *layout)
+{
+	u32 i;
+
+	if(!(m->Groups = malloc(layout->Count * sizeof(*m->Groups))))
+	{
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	for(i = 0; i < layout->Count; ++i)
+	{
+		atfs_extent_init(&m->Groups[i].Free);
+		pthread_mutex_init(&m->Groups[i].Lock, NULL);
+	}
+
+	m->Layout = *layout;
+	return ATFS_STATUS_OK;
+}
+
+/* Read the free list of a group into its index and correct the summary
+	in the head of the list if it does not match */
+static ATFS_Status _load_group(ATFS_Mount *m, u32 group)
+{
+	BlockDevice *dev = m->Device;
+	ATFS_ExtentTree *tree = &m->Groups[group].Free;
+	u8 buf[dev->BlockSize];
+	const u8 *data;
+	u32 head, limit, cur, next, size, end, free_blocks, areas, largest;
+
+	head = atfs_group_head(&m->Layout, group);
+	limit = atfs_group_end(&m->Layout, group);
+	PROPAGATE(dev_map(dev, head, buf, &data));
+	cur = atfs_read32(data + ATFS_OFFSET_FREE_NEXT);
+	free_blocks = atfs_read32(data + ATFS_OFFSET_GROUP_FREE);
+	areas = atfs_read32(data + ATFS_OFFSET_GROUP_AREAS);
+	largest = atfs_read32(data + ATFS_OFFSET_GROUP_LARGEST);
+	dev_unmap(dev, head);
+
+	/* Areas are sorted, do not overlap and stay inside their group,
+		anything else means the list is corrupted */
+	for(end = head + 1; cur; cur = next)
+	{
+		if(cur < end || cur >= limit)
+		{
+			return ATFS_STATUS_INVALID_VOLUME;
+		}
+
+		PROPAGATE(dev_map(dev, cur, buf, &data));
+		next = atfs_read32(data + ATFS_OFFSET_FREE_NEXT);
+		size = atfs_read32(data + ATFS_OFFSET_FREE_SIZE);
+		dev_unmap(dev, cur);
+
+		if(!size || size > limit - cur)
+		{
+			return ATFS_STATUS_INVALID_VOLUME;
+		}
+
+		if(atfs_extent_insert(tree, cur, size))
+		{
+			return ATFS_STATUS_OUT_OF_MEMORY;
+		}
+
+		end = cur + size;
+	}
+
+	/* The largest area may only be an upper bound,
+		it is made exact again here */
+	if(m->Layout.HasSummary && free_blocks == tree->Blocks &&
+		areas == tree->Count && largest == atfs_extent_largest(tree))
+	{
+		return ATFS_STATUS_OK;
+	}
+
+	PROPAGATE(dev_read(dev, head, 1, buf));
+	atfs_write32(buf + ATFS_OFFSET_GROUP_FREE, tree->Blocks);
+	atfs_write32(buf + ATFS_OFFSET_GROUP_AREAS, tree->Count);
+	atfs_write32(buf + ATFS_OFFSET_GROUP_LARGEST, atfs_extent_largest(tree));
+	return dev_write(dev, head, 1, buf);
+}
+
+/* The summaries of volumes of an older revision are complete now,
+	volumes without allocation groups are one group. New entries get name
+	tags, which an older driver would read as part of the type, so the
+	volume gets the current revision. */
+static ATFS_Status _upgrade(BlockDevice *dev)
+{
+	u8 buf[dev->BlockSize];
+
+	PROPAGATE(dev_read(dev, ATFS_SECTOR_BOOT, 1, buf));
+	if(atfs_read32(buf + ATFS_OFFSET_REVISION) < ATFS_REVISION_GROUPS)
+	{
+		atfs_write32(buf + ATFS_OFFSET_GROUP_COUNT, 1);
+		atfs_write32(buf + ATFS_OFFSET_GROUP_SIZE, dev->BlockCount);
+	}
+
+	atfs_write32(buf + ATFS_OFFSET_REVISION, ATFS_REVISION);
+	return dev_write(dev, ATFS_SECTOR_BOOT, 1, buf);
+}
+
+ATFS_Status atfs_mount_load(ATFS_Mount *mount)
+{
+	BlockDevice *dev = mount->Device;
+	u8 buf[dev->BlockSize];
+	const u8 *data;
+	ATFS_Groups layout;
+	ATFS_Status status;
+	u32 i, revision;
+
+	_groups_free(mount);
+
+	/* Names may point anywhere after a format */
+	atfs_dcache_clear(dev);
+	PROPAGATE(dev_map(dev, ATFS_SECTOR_BOOT, buf, &data));
+	if(memcmp(data + ATFS_OFFSET_SIGNATURE, ATFS_SIGNATURE,
+		sizeof(ATFS_SIGNATURE)))
+	{
+		dev_unmap(dev, ATFS_SECTOR_BOOT);
+		return ATFS_STATUS_INVALID_VOLUME;
+	}
+
+	revision = atfs_read32(data + ATFS_OFFSET_REVISION);
+	mount->RootBlock = atfs_read32(data + ATFS_OFFSET_ROOT_BLOCK);
+	mount->RootSize = atfs_read32(data + ATFS_OFFSET_ROOT_SIZE);
+	status = atfs_dir_format_get(data, &mount->DirFormat);
+	dev_unmap(dev, ATFS_SECTOR_BOOT);
+	PROPAGATE(status);
+	PROPAGATE(atfs_groups_read(dev, &layout));
+	PROPAGATE(_groups_alloc(mount, &layout));
+	if(layout.Allocator == ATFS_ALLOCATOR_BITMAP)
+	{
+		if(!(status = atfs_bitmap_read(dev, &layout, &mount->Bitmap)))
+		{
+			status = atfs_bitmap_check(dev, &layout, mount->Bitmap);
+		}
+	}
+	else
+	{
+		for(i = 0, status = ATFS_STATUS_OK; !status && i < layout.Count; ++i)
+		{
+			status = _load_group(mount, i);
+		}
+	}
+
+	if(!status && revision < ATFS_REVISION_NAME_TAGS)
+	{
+		status = _upgrade(dev);
+		mount->Layout.HasSummary = 1;
+	}
+
+	if(status)
+	{
+		_groups_free(mount);
+	}
+
+	return status;
+}
+
+ATFS_Status atfs_mount(BlockDevice *dev)
+{
+	ATFS_Mount *m;
+	ATFS_Status status;
+
+	if((m = atfs_mount_find(dev)))
+	{
+		return atfs_mount_load(m);
+	}
+
+	if(!(m = malloc(sizeof(*m))))
+	{
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	m->Device = dev;
+	m->Policy = ATFS_POLICY_FIRST_FIT;
+	m->Groups = NULL;
+	m->Bitmap = NULL;
+	m->Layout.Count = 0;
+	m->DelayAlloc = 0;
+	m->Reserved = 0;
+	m->Delayed = NULL;
+	m->DelayedCount = 0;
+	m->DelayedCapacity = 0;
+	m->Open = NULL;
+	m->OpenCount = 0;
+	m->OpenCapacity = 0;
+	if((status = atfs_dcache_init(&m->Dentries, ATFS_DCACHE_DEFAULT_SIZE)))
+	{
+		free(m);
+		return status;
+	}
+
+	if((status = atfs_mount_load(m)))
+	{
+		atfs_dcache_destroy(&m->Dentries);
+		free(m);
+		return status;
+	}
+
+	pthread_mutex_init(&m->DelayLock, NULL);
+	pthread_mutex_init(&m->OpenLock, NULL);
+
+	m->Next = _mounts;
+	_mounts = m;
+	return ATFS_STATUS_OK;
+}
+
+ATFS_Status atfs_mount_policy(BlockDevice *dev, ATFS_AllocPolicy policy)
+{
+	ATFS_Mount *m;
+
+	if(!(m = atfs_mount_find(dev)))
+	{
+		return ATFS_STATUS_NOT_MOUNTED;
+	}
+
+	m->Policy = policy;
+	return ATFS_STATUS_OK;
+}
+
+ATFS_Status atfs_mount_delalloc(BlockDevice *dev, int enable)
+{
+	ATFS_Mount *m;
+
+	if(!(m = atfs_mount_find(dev)))
+	{
+		return ATFS_STATUS_NOT_MOUNTED;
+	}
+
+	m->DelayAlloc = !!enable;
+	return ATFS_STATUS_OK;
+}
+
+ATFS_Status atfs_mount_dcache(BlockDevice *dev, u32 size)
+{
+	ATFS_Mount *m;
+
+	if(!(m = atfs_mount_find(dev)))
+	{
+		return ATFS_STATUS_NOT_MOUNTED;
+	}
+
+	return atfs_dcache_resize(&m->Dentries, size);
+}
+
+ATFS_Status atfs_mount_open(BlockDevice *dev, ATFS_File *file)
+{
+	ATFS_File **open;
+	ATFS_Mount *m;
+	u32 capacity;
+
+	if(!(m = atfs_mount_find(dev)))
+	{
+		return ATFS_STATUS_OK;
+	}
+
+	pthread_mutex_lock(&m->OpenLock);
+	if(m->OpenCount == m->OpenCapacity)
+	{
+		capacity = m->OpenCapacity ? 2 * m->OpenCapacity : 16;
+		if(!(open = realloc(m->Open, capacity * sizeof(*open))))
+		{
+			pthread_mutex_unlock(&m->OpenLock);
+			return ATFS_STATUS_OUT_OF_MEMORY;
+		}
+
+		m->Open = open;
+		m->OpenCapacity = capacity;
+	}
+
+	m->Open[m->OpenCount++] = file;
+	pthread_mutex_unlock(&m->OpenLock);
+	return ATFS_STATUS_OK;
+}
+
+void atfs_mount_close(BlockDevice *dev, ATFS_File *file)
+{
+	ATFS_Mount *m;
+	u32 i;
+
+	if(!(m = atfs_mount_find(dev)))
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&m->OpenLock);
+	for(i = 0; i < m->OpenCount; ++i)
+	{
+		if(m->Open[i] == file)
+		{
+			m->Open[i] = m->Open[--m->OpenCount];
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&m->OpenLock);
+}
+
+int atfs_mount_in_use(BlockDevice *dev, u32 block, u32 count)
+{
+	ATFS_Mount *m;
+	u32 i;
+	int found;
+
+	if(!(m = atfs_mount_find(dev)))
+	{
+		return 0;
+	}
+
+	pthread_mutex_lock(&m->OpenLock);
+	for(i = 0, found = 0; i < m->OpenCount && !found; ++i)
+	{
+		found = m->Open[i]->EntryBlock - block < count;
+	}
+
+	pthread_mutex_unlock(&m->OpenLock);
+	return found;
+}
+
+static int _move_cmp(const void *a, const void *b)
+{
+	const ATFS_EntryMove *x = a, *y = b;
+	if(x->Block != y->Block)
+	{
+		return (x->Block > y->Block) - (x->Block < y->Block);
+	}
+
+	return (x->Offset > y->Offset) - (x->Offset < y->Offset);
+}
+
+/* Move an entry position if it is one of the moved entries */
+static void _move_entry(const ATFS_EntryMove *moves, u32 count,
+	u32 *block, u32 *offset)
+{
+	ATFS_EntryMove key;
+	const ATFS_EntryMove *move;
+
+	key.Block = *block;
+	key.Offset = *offset;
+	if((move = bsearch(&key, moves, count, sizeof(*moves), _move_cmp)))
+	{
+		*block = move->NewBlock;
+		*offset = move->NewOffset;
+	}
+}
+
+void atfs_mount_moved(BlockDevice *dev, ATFS_EntryMove *moves, u32 count)
+{
+	ATFS_Mount *m;
+	u32 i;
+
+	if(!count || !(m = atfs_mount_find(dev)))
+	{
+		return;
+	}
+
+	/* Every position is looked up once, so an entry that moved to the
+		old position of another one is not moved twice */
+	qsort(moves, count, sizeof(*moves), _move_cmp);
+	pthread_mutex_lock(&m->OpenLock);
+	for(i = 0; i < m->OpenCount; ++i)
+	{
+		_move_entry(moves, count,
+			&m->Open[i]->EntryBlock, &m->Open[i]->EntryOffset);
+	}
+
+	pthread_mutex_unlock(&m->OpenLock);
+	pthread_mutex_lock(&m->DelayLock);
+	for(i = 0; i < m->DelayedCount; ++i)
+	{
+		_move_entry(moves, count,
+			&m->Delayed[i].EntryBlock, &m->Delayed[i].EntryOffset);
+	}
+
+	pthread_mutex_unlock(&m->DelayLock);
+	for(i = 0; i < count; ++i)
+	{
+		atfs_dcache_forget_entry(dev, moves[i].Block, moves[i].Offset);
+	}
+}
+
+const char *atfs_policy_string(ATFS_AllocPolicy policy)
+{
+	static const char *policy_str[] =
+	{
+		"first-fit",
+		"best-fit",
+		"segregated",
+	};
+
+	return policy < ATFS_POLICY_COUNT ? policy_str[policy] : "unknown";
+}
+
+ATFS_Status atfs_unmount(BlockDevice *dev)
+{
+	ATFS_Mount **p, *m;
+
+	for(p = &_mounts; (m = *p); p = &m->Next)
+	{
+		if(m->Device == dev)
+		{
+			/* Files that still have no blocks get them now, the volume
+				stays mounted if that fails */
+			PROPAGATE(atfs_delay_flush(dev));
+			*p = m->Next;
+			_groups_free(m);
+			pthread_mutex_destroy(&m->DelayLock);
+			pthread_mutex_destroy(&m->OpenLock);
+			atfs_dcache_destroy(&m->Dentries);
+			free(m->Delayed);
+			free(m->Open);
+			free(m);
+			return ATFS_STATUS_OK;
+		}
+	}
+
+	return ATFS_STATUS_NOT_MOUNTED;
+}
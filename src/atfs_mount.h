@@ -0,0 +1,244 @@
+/**
+ * @file    atfs_mount.h
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ * @brief   ATFS Mount table
+ *
+ * Mounting a volume walks the on-disk free list once and keeps it in an
+ * in-memory index, so allocating and freeing blocks on a mounted volume
+ * does not need to read the free list again. The on-disk list stays the
+ * authoritative copy, every change is written through. Volumes that are
+ * not mounted still work, the allocator walks the free list instead.
+ *
+ * Every allocation group has its own index and lock, so threads that
+ * allocate in different groups do not wait for each other.
+ * Volumes with a free space bitmap keep the whole bitmap in memory.
+ * A mounted volume also keeps the location of the root directory and the
+ * directory format from the boot block, so resolving a path does not read
+ * the boot block, and caches name lookups (see atfs_dcache.h).
+ */
+
+#ifndef __ATFS_MOUNT_H__
+#define __ATFS_MOUNT_H__
+
+#include "atfs.h"
+#include "atfs_extent.h"
+#include "atfs_dcache.h"
+#include <pthread.h>
+
+/** Allocation policy, which free area a new file is placed in */
+typedef enum
+{
+	/** Area with the lowest block number that is large enough */
+	ATFS_POLICY_FIRST_FIT,
+
+	/** Smallest area that is large enough, keeps large areas intact */
+	ATFS_POLICY_BEST_FIT,
+
+	/** Any area of the next larger power of two size class, O(1) */
+	ATFS_POLICY_SEGREGATED,
+
+	ATFS_POLICY_COUNT,
+} ATFS_AllocPolicy;
+
+/** Allocation group of a mounted volume */
+typedef struct
+{
+	/** Free areas of the group */
+	ATFS_ExtentTree Free;
+
+	/** Held while the free list of the group is changed */
+	pthread_mutex_t Lock;
+} ATFS_Group;
+
+/** File created with delayed allocation that has no blocks yet */
+typedef struct
+{
+	/** Directory block and byte offset of the directory entry */
+	u32 EntryBlock, EntryOffset;
+
+	/** Capacity of the file in blocks */
+	u32 Size;
+} ATFS_Delayed;
+
+/** Directory entry that was moved to another position */
+typedef struct
+{
+	/** Directory block and byte offset before the move */
+	u32 Block, Offset;
+
+	/** Directory block and byte offset after the move */
+	u32 NewBlock, NewOffset;
+} ATFS_EntryMove;
+
+/** Mounted volume */
+typedef struct ATFS_Mount
+{
+	/** Block device of the volume */
+	BlockDevice *Device;
+
+	/** Allocation group layout */
+	ATFS_Groups Layout;
+
+	/** Allocation groups, Layout.Count entries */
+	ATFS_Group *Groups;
+
+	/** Free space bitmap for ATFS_ALLOCATOR_BITMAP, protected by the
+		lock of the only group */
+	u8 *Bitmap;
+
+	/** First block and size of the root directory */
+	u32 RootBlock, RootSize;
+
+	/** Directory format */
+	ATFS_DirFormat DirFormat;
+
+	/** Allocation policy */
+	ATFS_AllocPolicy Policy;
+
+	/** New files are created with delayed allocation */
+	int DelayAlloc;
+
+	/** Held while the reservations and delayed files are changed */
+	pthread_mutex_t DelayLock;
+
+	/** Free blocks reserved for delayed files and creates in progress */
+	u32 Reserved;
+
+	/** Files without blocks yet, DelayedCount entries */
+	ATFS_Delayed *Delayed;
+	u32 DelayedCount, DelayedCapacity;
+
+	/** Recent name lookups */
+	ATFS_DCache Dentries;
+
+	/** Held while the open files are changed */
+	pthread_mutex_t OpenLock;
+
+	/** Handles of the open files and directories, OpenCount entries */
+	ATFS_File **Open;
+	u32 OpenCount, OpenCapacity;
+
+	/** Next entry in the mount table */
+	struct ATFS_Mount *Next;
+} ATFS_Mount;
+
+/**
+ * @brief Mount a volume, or reload the free list if it is already mounted
+ *
+ * @param dev Block device
+ * @return Status code
+ */
+ATFS_Status atfs_mount(BlockDevice *dev);
+
+/**
+ * @brief Unmount a volume
+ *
+ * @param dev Block device
+ * @return Status code
+ */
+ATFS_Status atfs_unmount(BlockDevice *dev);
+
+/**
+ * @brief Select the allocation policy of a mounted volume.
+ *        Volumes that are not mounted always use first fit.
+ *
+ * @param dev Block device
+ * @param policy Allocation policy
+ * @return Status code
+ */
+ATFS_Status atfs_mount_policy(BlockDevice *dev, ATFS_AllocPolicy policy);
+
+/**
+ * @brief Enable or disable delayed allocation on a mounted volume.
+ *        Files created while it is enabled only reserve their capacity
+ *        and get their blocks when they are first written or closed.
+ *
+ * @param dev Block device
+ * @param enable Nonzero to enable
+ * @return Status code
+ */
+ATFS_Status atfs_mount_delalloc(BlockDevice *dev, int enable);
+
+/**
+ * @brief Change the number of names the directory entry cache of a
+ *        mounted volume holds, which is ATFS_DCACHE_DEFAULT_SIZE after
+ *        mounting. The cache is cleared.
+ *
+ * @param dev Block device
+ * @param size Number of names, 0 disables the cache
+ * @return Status code
+ */
+ATFS_Status atfs_mount_dcache(BlockDevice *dev, u32 size);
+
+/**
+ * @brief Returns the name of an allocation policy
+ *
+ * @param policy Allocation policy
+ * @return Pointer to string constant
+ */
+const char *atfs_policy_string(ATFS_AllocPolicy policy);
+
+/**
+ * @brief Remember that a file is open, so defragmentation does not move
+ *        it or the directory that contains its entry, and its entry
+ *        position is kept up to date when the entry moves.
+ *        Does nothing if the volume is not mounted.
+ *
+ * @param dev Block device
+ * @param file File handle, must stay at its address until it is closed
+ * @return Status code
+ */
+ATFS_Status atfs_mount_open(BlockDevice *dev, ATFS_File *file);
+
+/**
+ * @brief Forget a file that was remembered with atfs_mount_open
+ *
+ * @param dev Block device
+ * @param file File handle
+ */
+void atfs_mount_close(BlockDevice *dev, ATFS_File *file);
+
+/**
+ * @brief Check if the entry of an open file is in a range of blocks
+ *
+ * @param dev Block device
+ * @param block First block of the range
+ * @param count Number of blocks
+ * @return Nonzero if an open file has its entry in the range
+ */
+int atfs_mount_in_use(BlockDevice *dev, u32 block, u32 count);
+
+/**
+ * @brief Directory entries were moved: update the entry positions of the
+ *        open files and of the files waiting for delayed allocation, and
+ *        forget the cached names at the old positions.
+ *        Does nothing if the volume is not mounted.
+ *
+ * @param dev Block device
+ * @param moves Moved entries, sorted by this function
+ * @param count Number of moved entries
+ */
+void atfs_mount_moved(BlockDevice *dev, ATFS_EntryMove *moves, u32 count);
+
+/**
+ * @brief Find the mount table entry of a device
+ *
+ * @param dev Block device
+ * @return Mount table entry or NULL if the device is not mounted
+ */
+ATFS_Mount *atfs_mount_find(BlockDevice *dev);
+
+/**
+ * @brief Read the boot block and the free lists of a mounted volume
+ *        into memory again.
+ *        Free space summaries that do not match are rewritten and
+ *        volumes of an older revision are upgraded.
+ *
+ * @param mount Mount table entry
+ * @return Status code
+ */
+ATFS_Status atfs_mount_load(ATFS_Mount *mount);
+
+#endif /* __ATFS_MOUNT_H__ */
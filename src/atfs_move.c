@@ -6,6 +6,7 @@
  */
 
 #include "atfs_move.h"
+#include "atfs_dcache.h"
 #include "atfs_util.h"
 #include <string.h>
 
@@ -13,10 +14,10 @@ ATFS_Status _dir_entry_rename(BlockDevice *dev,
 	const char *dst, const char *src, u32 block, u32 size)
 {
 	u8 buf[dev->BlockSize];
-	u32 end, offset;
-	for(end = block + size; block < end; ++block)
+	u32 dir, end, offset;
+	for(dir = block, end = block + size; block < end; ++block)
 	{
-		dev->Read(block, 1, buf);
+		dev_read(dev, block, 1, buf);
 		for(offset = 0; offset < dev->BlockSize;
 			offset += ATFS_DIR_ENTRY_SIZE)
 		{
@@ -25,7 +26,9 @@ ATFS_Status _dir_entry_rename(BlockDevice *dev,
 			if(!strcmp(entry_name, src))
 			{
 				strncpy(entry_name, dst, ATFS_MAX_FILE_NAME_LENGTH);
-				dev->Write(block, 1, buf);
+				dev_write(dev, block, 1, buf);
+				atfs_dcache_forget_entry(dev, block, offset);
+				atfs_dcache_forget(dev, dir, dst, strlen(dst));
 				return ATFS_STATUS_OK;
 			}
 		}
@@ -34,7 +37,7 @@ ATFS_Status _dir_entry_rename(BlockDevice *dev,
 	return ATFS_STATUS_NO_SUCH_FILE_OR_DIRECTORY;
 }
 
-ATFS_Status atfs_move(BlockDevice *dev, const char *dst, const char *src)
+static ATFS_Status _move(BlockDevice *dev, const char *dst, const char *src)
 {
 	/* TODO: This is work in progress */
 
@@ -43,3 +46,8 @@ ATFS_Status atfs_move(BlockDevice *dev, const char *dst, const char *src)
 	(void)dst;
 	(void)src;
 }
+
+ATFS_Status atfs_move(BlockDevice *dev, const char *dst, const char *src)
+{
+	ATFS_OP(ATFS_OP_MOVE, _move(dev, dst, src));
+}
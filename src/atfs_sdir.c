@@ -0,0 +1,829 @@
+/**
+ * @file    atfs_sdir.c
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ */
+
+#include "atfs_sdir.h"
+#include "atfs_dscan.h"
+#include "atfs_mount.h"
+#include "atfs_util.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* First byte of the entry area, the end of the block if it is empty */
+static u32 _low(BlockDevice *dev, const u8 *data)
+{
+	u32 low = atfs_read16(data + ATFS_SDIR_OFFSET_LOW);
+	return low ? low : dev->BlockSize;
+}
+
+ATFS_Status atfs_sdir_count(BlockDevice *dev, const u8 *data, u32 *count)
+{
+	u32 low = _low(dev, data);
+
+	/* The offsets end before the entries start */
+	*count = atfs_read16(data + ATFS_SDIR_OFFSET_COUNT);
+	if(low > dev->BlockSize ||
+		(*count && !atfs_read16(data + ATFS_SDIR_OFFSET_LOW)) ||
+		ATFS_SDIR_OFFSET_SLOTS + *count * ATFS_SDIR_SLOT_SIZE > low)
+	{
+		return ATFS_STATUS_INVALID_VOLUME;
+	}
+
+	return ATFS_STATUS_OK;
+}
+
+ATFS_Status atfs_sdir_entry(BlockDevice *dev, const u8 *data, u32 index,
+	u32 *offset)
+{
+	u32 name, left;
+
+	/* The entry and the end of its name are in the entry area */
+	*offset = atfs_read16(data + ATFS_SDIR_OFFSET_SLOTS +
+		index * ATFS_SDIR_SLOT_SIZE);
+	name = *offset + ATFS_DIR_ENTRY_OFFSET_NAME;
+	if(*offset < _low(dev, data) ||
+		*offset + ATFS_SDIR_ENTRY_SIZE(1) > dev->BlockSize ||
+		!data[name])
+	{
+		return ATFS_STATUS_INVALID_VOLUME;
+	}
+
+	left = dev->BlockSize - name - 1;
+	if(left > ATFS_MAX_FILE_NAME_LENGTH)
+	{
+		left = ATFS_MAX_FILE_NAME_LENGTH;
+	}
+
+	return memchr(data + name + 1, '\0', left) ? ATFS_STATUS_OK :
+		ATFS_STATUS_INVALID_VOLUME;
+}
+
+/* Order of the name of the entry at `p` and a name */
+static int _cmp(const u8 *p, const char *name, size_t len)
+{
+	const char *entry_name = (const char *)(p + ATFS_DIR_ENTRY_OFFSET_NAME);
+	size_t entry_len = strlen(entry_name);
+	int c;
+
+	c = memcmp(entry_name, name, entry_len < len ? entry_len : len);
+	return c ? c : (entry_len > len) - (entry_len < len);
+}
+
+/* Sorted position of a name in a block and whether the entry there has
+	it. A name outside of the key range of the block is decided by the
+	first or the last entry, only names inside it are searched for. */
+static ATFS_Status _search(BlockDevice *dev, const u8 *data,
+	const char *name, size_t len, u32 *pos, u32 *offset, int *found)
+{
+	u32 count, lo, hi, mid;
+	int c;
+
+	*pos = 0;
+	*found = 0;
+	PROPAGATE(atfs_sdir_count(dev, data, &count));
+	if(!count)
+	{
+		return ATFS_STATUS_OK;
+	}
+
+	PROPAGATE(atfs_sdir_entry(dev, data, count - 1, offset));
+	if((c = _cmp(data + *offset, name, len)) <= 0)
+	{
+		*pos = c ? count : count - 1;
+		*found = !c;
+		return ATFS_STATUS_OK;
+	}
+
+	PROPAGATE(atfs_sdir_entry(dev, data, 0, offset));
+	if((c = _cmp(data + *offset, name, len)) >= 0)
+	{
+		*found = !c;
+		return ATFS_STATUS_OK;
+	}
+
+	lo = 1;
+	hi = count - 1;
+	while(lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		PROPAGATE(atfs_sdir_entry(dev, data, mid, offset));
+		if(!(c = _cmp(data + *offset, name, len)))
+		{
+			*pos = mid;
+			*found = 1;
+			return ATFS_STATUS_OK;
+		}
+
+		if(c < 0)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+
+	*pos = lo;
+	return ATFS_STATUS_OK;
+}
+
+/* Whether an entry with a name of `len` characters fits into the block */
+static ATFS_Status _fits(BlockDevice *dev, const u8 *data, size_t len,
+	int *fits)
+{
+	u32 count;
+
+	PROPAGATE(atfs_sdir_count(dev, data, &count));
+	*fits = _low(dev, data) - ATFS_SDIR_OFFSET_SLOTS -
+		count * ATFS_SDIR_SLOT_SIZE >=
+		ATFS_SDIR_ENTRY_SIZE(len) + ATFS_SDIR_SLOT_SIZE;
+	return ATFS_STATUS_OK;
+}
+
+/* Put an entry in front of the entry area of a block that has room for
+	it and its offset at sorted position `pos`, returns the offset */
+static u32 _put(BlockDevice *dev, u8 *data, u32 pos,
+	const ATFS_DirEntry *entry, size_t len)
+{
+	u8 *slots = data + ATFS_SDIR_OFFSET_SLOTS;
+	u32 count, offset;
+	u8 *p;
+
+	count = atfs_read16(data + ATFS_SDIR_OFFSET_COUNT);
+	offset = _low(dev, data) - ATFS_SDIR_ENTRY_SIZE(len);
+	p = data + offset;
+	atfs_write32(p + ATFS_DIR_ENTRY_OFFSET_START, entry->StartBlock);
+	atfs_write32(p + ATFS_DIR_ENTRY_OFFSET_SIZE, entry->SizeBlocks);
+	p[ATFS_DIR_ENTRY_OFFSET_TYPE] = entry->Type |
+		atfs_name_tag(entry->Name, len);
+	memcpy(p + ATFS_DIR_ENTRY_OFFSET_NAME, entry->Name, len + 1);
+
+	memmove(slots + (pos + 1) * ATFS_SDIR_SLOT_SIZE,
+		slots + pos * ATFS_SDIR_SLOT_SIZE,
+		(count - pos) * ATFS_SDIR_SLOT_SIZE);
+	atfs_write16(slots + pos * ATFS_SDIR_SLOT_SIZE, offset);
+	atfs_write16(data + ATFS_SDIR_OFFSET_COUNT, count + 1);
+	atfs_write16(data + ATFS_SDIR_OFFSET_LOW, offset);
+	return offset;
+}
+
+/* Compare the first entry of a block with a name, an empty block comes
+	after every name. Without a name only empty blocks are told apart. */
+static ATFS_Status _first_cmp(BlockDevice *dev, const u8 *data,
+	const char *name, size_t len, int *c)
+{
+	u32 count, offset;
+
+	PROPAGATE(atfs_sdir_count(dev, data, &count));
+	if(!count || !name)
+	{
+		*c = count ? -1 : 1;
+		return ATFS_STATUS_OK;
+	}
+
+	PROPAGATE(atfs_sdir_entry(dev, data, 0, &offset));
+	*c = _cmp(data + offset, name, len);
+	return ATFS_STATUS_OK;
+}
+
+/* The used blocks come first and their key ranges are in order, so a
+	binary search over the blocks finds the number of blocks whose first
+	name is not after `name` (the number of used blocks without a name).
+	The blocks are read from `buf` or, if it is NULL, from the device. */
+static ATFS_Status _bisect(BlockDevice *dev, u32 start, u32 size,
+	const u8 *buf, const char *name, size_t len, u32 *end)
+{
+	u8 tmp[dev->BlockSize];
+	const u8 *data;
+	u32 lo, hi, mid;
+	ATFS_Status status;
+	int c;
+
+	for(lo = 0, hi = size; lo < hi; )
+	{
+		mid = lo + (hi - lo) / 2;
+		if(buf)
+		{
+			data = buf + ((size_t)mid << dev->BlockSizePOT);
+		}
+		else
+		{
+			PROPAGATE(dev_map(dev, start + mid, tmp, &data));
+		}
+
+		status = _first_cmp(dev, data, name, len, &c);
+		if(!buf)
+		{
+			dev_unmap(dev, start + mid);
+		}
+
+		PROPAGATE(status);
+		if(c <= 0)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+
+	*end = lo;
+	return ATFS_STATUS_OK;
+}
+
+ATFS_Status atfs_sdir_find(BlockDevice *dev, u32 start, u32 size,
+	const char *name, size_t len, ATFS_NamelessDirEntry *entry,
+	u32 *entry_block, u32 *entry_offset)
+{
+	u8 buf[dev->BlockSize];
+	const u8 *data, *cur;
+	u32 block, pos, offset;
+	ATFS_Status status;
+	int found;
+
+	/* Only the last block that starts before the name can contain it */
+	PROPAGATE(_bisect(dev, start, size, NULL, name, len, &block));
+	if(!block)
+	{
+		return ATFS_STATUS_NO_SUCH_FILE_OR_DIRECTORY;
+	}
+
+	block += start - 1;
+	PROPAGATE(dev_map(dev, block, buf, &data));
+	status = _search(dev, data, name, len, &pos, &offset, &found);
+	if(!status && found)
+	{
+		cur = data + offset;
+		entry->Type = cur[ATFS_DIR_ENTRY_OFFSET_TYPE] & ~ATFS_TYPE_TAG_MASK;
+		entry->StartBlock = atfs_read32(cur + ATFS_DIR_ENTRY_OFFSET_START);
+		entry->SizeBlocks = atfs_read32(cur + ATFS_DIR_ENTRY_OFFSET_SIZE);
+		if(entry_block)
+		{
+			*entry_block = block;
+			*entry_offset = offset;
+		}
+	}
+
+	dev_unmap(dev, block);
+	PROPAGATE(status);
+	return found ? ATFS_STATUS_OK : ATFS_STATUS_NO_SUCH_FILE_OR_DIRECTORY;
+}
+
+/* Find a name in a directory in memory, `block` is relative to it */
+static ATFS_Status _find_mem(BlockDevice *dev, const u8 *buf, u32 size,
+	const char *name, size_t len, u32 *block, u32 *offset, int *found)
+{
+	u32 pos;
+
+	*found = 0;
+	PROPAGATE(_bisect(dev, 0, size, buf, name, len, block));
+	if(!*block)
+	{
+		return ATFS_STATUS_OK;
+	}
+
+	--*block;
+	return _search(dev, buf + ((size_t)*block << dev->BlockSizePOT),
+		name, len, &pos, offset, found);
+}
+
+static ATFS_Status _insert_all(BlockDevice *dev, u32 start, u32 size,
+	const ATFS_DirEntry *entries, u32 count,
+	u32 *entry_blocks, u32 *entry_offsets);
+
+ATFS_Status atfs_sdir_insert(BlockDevice *dev, u32 start, u32 size,
+	const ATFS_DirEntry *entry, u32 *entry_block, u32 *entry_offset)
+{
+	u8 buf[dev->BlockSize];
+	u32 block, pos, offset;
+	size_t len;
+	int found, fits;
+
+	if(!size)
+	{
+		return ATFS_STATUS_DIRECTORY_FULL;
+	}
+
+	/* The entry goes into the block whose key range covers it,
+		the first one if the name comes before all others */
+	len = strlen(entry->Name);
+	PROPAGATE(_bisect(dev, start, size, NULL, entry->Name, len, &block));
+	block = start + (block ? block - 1 : 0);
+	PROPAGATE(dev_read(dev, block, 1, buf));
+	PROPAGATE(_search(dev, buf, entry->Name, len, &pos, &offset, &found));
+	if(found)
+	{
+		return ATFS_STATUS_EXISTS;
+	}
+
+	PROPAGATE(_fits(dev, buf, len, &fits));
+	if(!fits)
+	{
+		/* The block is split, which moves entries of other blocks */
+		return _insert_all(dev, start, size, entry, 1,
+			entry_block, entry_offset);
+	}
+
+	offset = _put(dev, buf, pos, entry, len);
+	PROPAGATE(dev_write(dev, block, 1, buf));
+	*entry_block = block;
+	*entry_offset = offset;
+	return ATFS_STATUS_OK;
+}
+
+static int _name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+/* Check that no entry of the block has one of the `n` sorted names */
+static ATFS_Status _check_block(BlockDevice *dev, const u8 *data,
+	const char **names, u32 n)
+{
+	const char *name;
+	u32 i, count, offset;
+
+	PROPAGATE(atfs_sdir_count(dev, data, &count));
+	for(i = 0; i < count; ++i)
+	{
+		PROPAGATE(atfs_sdir_entry(dev, data, i, &offset));
+		name = (const char *)(data + offset + ATFS_DIR_ENTRY_OFFSET_NAME);
+		if(bsearch(&name, names, n, sizeof(*names), _name_cmp))
+		{
+			return ATFS_STATUS_EXISTS;
+		}
+	}
+
+	return ATFS_STATUS_OK;
+}
+
+ATFS_Status atfs_sdir_check_many(BlockDevice *dev, u32 start, u32 size,
+	const char *const *names, u32 count)
+{
+	u8 buf[dev->BlockSize];
+	const u8 *data;
+	const char **sorted;
+	ATFS_Status status;
+	u32 i, block;
+
+	if(!size || !count)
+	{
+		return ATFS_STATUS_OK;
+	}
+
+	if(!(sorted = malloc(count * sizeof(*sorted))))
+	{
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	/* Equal names are next to each other */
+	memcpy(sorted, names, count * sizeof(*sorted));
+	qsort(sorted, count, sizeof(*sorted), _name_cmp);
+	status = ATFS_STATUS_OK;
+	for(i = 1; !status && i < count; ++i)
+	{
+		if(!strcmp(sorted[i], sorted[i - 1]))
+		{
+			status = ATFS_STATUS_EXISTS;
+		}
+	}
+
+	for(block = start; !status && block < start + size; ++block)
+	{
+		if(!(status = dev_map(dev, block, buf, &data)))
+		{
+			status = _check_block(dev, data, sorted, count);
+			dev_unmap(dev, block);
+		}
+	}
+
+	free(sorted);
+	return status;
+}
+
+/* Space an entry with a name of `len` characters takes in a block */
+static u32 _space(size_t len)
+{
+	return ATFS_SDIR_ENTRY_SIZE(len) + ATFS_SDIR_SLOT_SIZE;
+}
+
+/* Put sorted entries into empty blocks in order. If `even` is zero, a
+	block is only started when the previous one is full, otherwise every
+	block gets about the same share, so all of them keep some room. */
+static ATFS_Status _spread(BlockDevice *dev, u8 *buf, u32 size,
+	const ATFS_DirEntry *entries, u32 count, int even)
+{
+	u32 i, b, left, used, share;
+	size_t len;
+	int fits;
+	u8 *data;
+
+	memset(buf, 0, (size_t)size << dev->BlockSizePOT);
+	for(i = 0, left = 0; i < count; ++i)
+	{
+		left += _space(strlen(entries[i].Name));
+	}
+
+	data = buf;
+	share = size ? (left + size - 1) / size : 0;
+	for(i = 0, b = 0, used = 0, fits = 0; i < count; ++i)
+	{
+		len = strlen(entries[i].Name);
+		for(; b < size; ++b, used = 0,
+			share = b < size ? (left + size - b - 1) / (size - b) : 0)
+		{
+			data = buf + ((size_t)b << dev->BlockSizePOT);
+			PROPAGATE(_fits(dev, data, len, &fits));
+			if(fits && (!even || used < share || b + 1 == size))
+			{
+				break;
+			}
+
+			fits = 0;
+		}
+
+		if(!fits)
+		{
+			return ATFS_STATUS_DIRECTORY_FULL;
+		}
+
+		_put(dev, data, atfs_read16(data + ATFS_SDIR_OFFSET_COUNT),
+			&entries[i], len);
+		used += _space(len);
+		left -= _space(len);
+	}
+
+	return ATFS_STATUS_OK;
+}
+
+/* Number of entries in `size` blocks */
+static ATFS_Status _total(BlockDevice *dev, const u8 *buf, u32 size,
+	u32 *total)
+{
+	u32 b, count;
+
+	for(b = 0, *total = 0; b < size; ++b)
+	{
+		PROPAGATE(atfs_sdir_count(dev,
+			buf + ((size_t)b << dev->BlockSizePOT), &count));
+		*total += count;
+	}
+
+	return ATFS_STATUS_OK;
+}
+
+/* Copy the entries of `size` blocks into an array in name order,
+	`*count` must be the number of entries on entry */
+static ATFS_Status _collect(BlockDevice *dev, const u8 *buf, u32 size,
+	ATFS_DirEntry *entries, u32 *count)
+{
+	const u8 *data, *cur;
+	u32 b, i, n, block_count, offset;
+
+	for(b = 0, n = 0; b < size; ++b)
+	{
+		data = buf + ((size_t)b << dev->BlockSizePOT);
+		PROPAGATE(atfs_sdir_count(dev, data, &block_count));
+		for(i = 0; i < block_count && n < *count; ++i, ++n)
+		{
+			PROPAGATE(atfs_sdir_entry(dev, data, i, &offset));
+			cur = data + offset;
+			entries[n].StartBlock = atfs_read32(cur +
+				ATFS_DIR_ENTRY_OFFSET_START);
+			entries[n].SizeBlocks = atfs_read32(cur +
+				ATFS_DIR_ENTRY_OFFSET_SIZE);
+			entries[n].Type = cur[ATFS_DIR_ENTRY_OFFSET_TYPE] &
+				~ATFS_TYPE_TAG_MASK;
+			strcpy(entries[n].Name,
+				(const char *)(cur + ATFS_DIR_ENTRY_OFFSET_NAME));
+		}
+	}
+
+	*count = n;
+	return ATFS_STATUS_OK;
+}
+
+/* Spread the entries of `size` blocks and a new one over them again,
+	nothing changes if they do not fit */
+static ATFS_Status _rebalance(BlockDevice *dev, u8 *buf, u32 size,
+	const ATFS_DirEntry *entry)
+{
+	ATFS_DirEntry *entries;
+	u32 i, count;
+	ATFS_Status status;
+	u8 *spread;
+
+	PROPAGATE(_total(dev, buf, size, &count));
+	entries = malloc((count + 1) * sizeof(*entries));
+	spread = malloc((size_t)size << dev->BlockSizePOT);
+	if(!entries || !spread)
+	{
+		free(entries);
+		free(spread);
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	if(!(status = _collect(dev, buf, size, entries, &count)))
+	{
+		for(i = count; i && strcmp(entries[i - 1].Name, entry->Name) > 0; --i)
+		{
+			entries[i] = entries[i - 1];
+		}
+
+		entries[i] = *entry;
+		if((status = _spread(dev, spread, size, entries, count + 1, 1)) ==
+			ATFS_STATUS_DIRECTORY_FULL)
+		{
+			status = _spread(dev, spread, size, entries, count + 1, 0);
+		}
+
+		if(!status)
+		{
+			memcpy(buf, spread, (size_t)size << dev->BlockSizePOT);
+		}
+	}
+
+	free(entries);
+	free(spread);
+	return status;
+}
+
+/* Add an entry to a directory in memory, keeping the blocks partitioned
+	by key range. A full block is split in two: the used blocks after it
+	move up by one if the last block is empty, otherwise the entries of
+	the whole directory are spread over it again. */
+static ATFS_Status _insert_mem(BlockDevice *dev, u8 *buf, u32 size,
+	const ATFS_DirEntry *entry)
+{
+	u32 pot, block, used, pos, offset;
+	size_t len;
+	int found, fits;
+	u8 *data;
+
+	pot = dev->BlockSizePOT;
+	len = strlen(entry->Name);
+	PROPAGATE(_bisect(dev, 0, size, buf, entry->Name, len, &block));
+	block = block ? block - 1 : 0;
+	data = buf + ((size_t)block << pot);
+	PROPAGATE(_search(dev, data, entry->Name, len, &pos, &offset, &found));
+	if(found)
+	{
+		return ATFS_STATUS_EXISTS;
+	}
+
+	PROPAGATE(_fits(dev, data, len, &fits));
+	if(fits)
+	{
+		_put(dev, data, pos, entry, len);
+		return ATFS_STATUS_OK;
+	}
+
+	PROPAGATE(_bisect(dev, 0, size, buf, NULL, 0, &used));
+	if(used == size)
+	{
+		return _rebalance(dev, buf, size, entry);
+	}
+
+	memmove(data + ((size_t)2 << pot), data + ((size_t)1 << pot),
+		(size_t)(used - block - 1) << pot);
+	memset(data + ((size_t)1 << pot), 0, (size_t)1 << pot);
+	return _rebalance(dev, data, 2, entry);
+}
+
+/* Find where the entries of a directory went, `old` holds its `old_size`
+	blocks before and `buf` its `size` blocks after entries moved */
+static ATFS_Status _moves(BlockDevice *dev, u32 start, const u8 *old,
+	u32 old_size, const u8 *buf, u32 size,
+	ATFS_EntryMove **moves, u32 *count)
+{
+	const char *name;
+	const u8 *data;
+	ATFS_EntryMove *m;
+	u32 b, i, n, total, block_count, offset, block, new_offset;
+	ATFS_Status status;
+	int found;
+
+	*moves = NULL;
+	*count = 0;
+	PROPAGATE(_total(dev, old, old_size, &total));
+	if(!total)
+	{
+		return ATFS_STATUS_OK;
+	}
+
+	if(!(m = malloc(total * sizeof(*m))))
+	{
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	status = ATFS_STATUS_OK;
+	for(b = 0, n = 0; !status && b < old_size; ++b)
+	{
+		data = old + ((size_t)b << dev->BlockSizePOT);
+		status = atfs_sdir_count(dev, data, &block_count);
+		for(i = 0; !status && i < block_count; ++i)
+		{
+			if((status = atfs_sdir_entry(dev, data, i, &offset)))
+			{
+				break;
+			}
+
+			name = (const char *)(data + offset + ATFS_DIR_ENTRY_OFFSET_NAME);
+			if(!(status = _find_mem(dev, buf, size, name, strlen(name),
+				&block, &new_offset, &found)) && found &&
+				(block != b || new_offset != offset))
+			{
+				m[n].Block = start + b;
+				m[n].Offset = offset;
+				m[n].NewBlock = start + block;
+				m[n].NewOffset = new_offset;
+				++n;
+			}
+		}
+	}
+
+	if(status)
+	{
+		free(m);
+		return status;
+	}
+
+	*moves = m;
+	*count = n;
+	return ATFS_STATUS_OK;
+}
+
+/* Add entries to a directory in memory and write the blocks that
+	changed, the entries that moved are reported to the mount */
+static ATFS_Status _insert_all(BlockDevice *dev, u32 start, u32 size,
+	const ATFS_DirEntry *entries, u32 count,
+	u32 *entry_blocks, u32 *entry_offsets)
+{
+	u32 i, b, end, unwritten, pot, move_count;
+	ATFS_EntryMove *moves;
+	ATFS_Status status;
+	u8 *buf, *old;
+	size_t len;
+	int found;
+
+	pot = dev->BlockSizePOT;
+	buf = malloc((size_t)size << pot);
+	old = malloc((size_t)size << pot);
+	if(!buf || !old)
+	{
+		free(buf);
+		free(old);
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	moves = NULL;
+	if(!(status = dev_read(dev, start, size, buf)))
+	{
+		memcpy(old, buf, (size_t)size << pot);
+	}
+
+	for(i = 0; !status && i < count; ++i)
+	{
+		status = _insert_mem(dev, buf, size, &entries[i]);
+	}
+
+	/* Entries added later may have moved the earlier ones */
+	for(i = 0; !status && i < count; ++i)
+	{
+		len = strlen(entries[i].Name);
+		status = _find_mem(dev, buf, size, entries[i].Name, len,
+			&entry_blocks[i], &entry_offsets[i], &found);
+	}
+
+	if(!status)
+	{
+		status = _moves(dev, start, old, size, buf, size,
+			&moves, &move_count);
+	}
+
+	if(status)
+	{
+		for(i = 0; i < count; ++i)
+		{
+			entry_blocks[i] = 0;
+		}
+
+		free(buf);
+		free(old);
+		return status;
+	}
+
+	/* Runs of changed blocks in one request,
+		entries in blocks that were not written do not exist */
+	unwritten = size;
+	for(b = 0; b < size; b = end)
+	{
+		for(; b < size && !memcmp(buf + ((size_t)b << pot),
+			old + ((size_t)b << pot), (size_t)1 << pot); ++b) ;
+		for(end = b; end < size && memcmp(buf + ((size_t)end << pot),
+			old + ((size_t)end << pot), (size_t)1 << pot); ++end) ;
+		if(b < size && (status = dev_write(dev, start + b, end - b,
+			buf + ((size_t)b << pot))))
+		{
+			unwritten = b;
+			break;
+		}
+	}
+
+	for(i = 0; i < count; ++i)
+	{
+		entry_blocks[i] = entry_blocks[i] < unwritten ?
+			start + entry_blocks[i] : 0;
+	}
+
+	if(!status)
+	{
+		atfs_mount_moved(dev, moves, move_count);
+	}
+
+	free(moves);
+	free(buf);
+	free(old);
+	return status;
+}
+
+ATFS_Status atfs_sdir_insert_many(BlockDevice *dev, u32 start, u32 size,
+	const ATFS_DirEntry *entries, u32 count,
+	u32 *entry_blocks, u32 *entry_offsets)
+{
+	u32 i;
+
+	for(i = 0; i < count; ++i)
+	{
+		entry_blocks[i] = 0;
+	}
+
+	if(!count)
+	{
+		return ATFS_STATUS_OK;
+	}
+
+	if(!size)
+	{
+		return ATFS_STATUS_DIRECTORY_FULL;
+	}
+
+	return _insert_all(dev, start, size, entries, count,
+		entry_blocks, entry_offsets);
+}
+
+ATFS_Status atfs_sdir_repack(BlockDevice *dev, u32 start, u32 size,
+	u32 new_size)
+{
+	ATFS_EntryMove *moves;
+	ATFS_DirEntry *entries;
+	u32 total, move_count;
+	ATFS_Status status;
+	u8 *buf, *old;
+
+	buf = malloc((size_t)size << dev->BlockSizePOT);
+	old = malloc((size_t)size << dev->BlockSizePOT);
+	if(!buf || !old)
+	{
+		free(buf);
+		free(old);
+		return ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	/* Every block is checked before anything is copied */
+	entries = NULL;
+	moves = NULL;
+	if(!(status = dev_read(dev, start, size, old)) &&
+		!(status = _total(dev, old, size, &total)) &&
+		!(entries = malloc((total + 1) * sizeof(*entries))))
+	{
+		status = ATFS_STATUS_OUT_OF_MEMORY;
+	}
+
+	/* The blocks that are dropped are written empty, so their
+		entries are not there twice if the shrink fails */
+	if(!status &&
+		!(status = _collect(dev, old, size, entries, &total)) &&
+		!(status = _spread(dev, buf, new_size, entries, total, 0)))
+	{
+		memset(buf + ((size_t)new_size << dev->BlockSizePOT), 0,
+			(size_t)(size - new_size) << dev->BlockSizePOT);
+		if(!(status = _moves(dev, start, old, size, buf, new_size,
+			&moves, &move_count)) &&
+			!(status = dev_write(dev, start, size, buf)))
+		{
+			atfs_mount_moved(dev, moves, move_count);
+		}
+	}
+
+	free(moves);
+	free(entries);
+	free(buf);
+	free(old);
+	return status;
+}
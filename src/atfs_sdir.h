@@ -0,0 +1,122 @@
+/**
+ * @file    atfs_sdir.h
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ * @brief   ATFS Sorted directories
+ *
+ * On volumes formatted with ATFS_DIR_SORTED, directory entries are only as
+ * long as their name and every block keeps them sorted by name. The used
+ * blocks come first and their key ranges do not overlap, so looking up a
+ * name finds the only block that can contain it with a binary search over
+ * the blocks and then searches that block. A new entry goes into the block
+ * whose key range covers it, a full block is split and the blocks after
+ * it move up. Moved entries are reported with atfs_mount_moved.
+ */
+
+#ifndef __ATFS_SDIR_H__
+#define __ATFS_SDIR_H__
+
+#include "atfs.h"
+
+/**
+ * @brief Number of entries of a sorted directory block
+ *
+ * @param dev Block device
+ * @param data Contents of the block
+ * @param count Output parameter number of entries
+ * @return Status code
+ */
+ATFS_Status atfs_sdir_count(BlockDevice *dev, const u8 *data, u32 *count);
+
+/**
+ * @brief Byte offset of an entry of a sorted directory block
+ *
+ * @param dev Block device
+ * @param data Contents of the block
+ * @param index Position of the entry in sorted order, less than the count
+ * @param offset Output parameter byte offset of the entry in the block
+ * @return Status code
+ */
+ATFS_Status atfs_sdir_entry(BlockDevice *dev, const u8 *data, u32 index,
+	u32 *offset);
+
+/**
+ * @brief Find an entry in a sorted directory
+ *
+ * @param dev Block device
+ * @param start First block of the directory
+ * @param size Directory size in blocks
+ * @param name File name, does not need to be null-terminated
+ * @param len Length of the name
+ * @param entry Output parameter entry
+ * @param entry_block Output parameter block of the entry, can be NULL
+ * @param entry_offset Output parameter byte offset of the entry in its block
+ * @return Status code
+ */
+ATFS_Status atfs_sdir_find(BlockDevice *dev, u32 start, u32 size,
+	const char *name, size_t len, ATFS_NamelessDirEntry *entry,
+	u32 *entry_block, u32 *entry_offset);
+
+/**
+ * @brief Add an entry to a sorted directory
+ *
+ * @param dev Block device
+ * @param start First block of the directory
+ * @param size Directory size in blocks
+ * @param entry New entry
+ * @param entry_block Output parameter block of the entry
+ * @param entry_offset Output parameter byte offset of the entry in its block
+ * @return Status code, ATFS_STATUS_EXISTS if the name is taken
+ */
+ATFS_Status atfs_sdir_insert(BlockDevice *dev, u32 start, u32 size,
+	const ATFS_DirEntry *entry, u32 *entry_block, u32 *entry_offset);
+
+/**
+ * @brief Check that none of the names exists in a sorted directory and
+ *        that no name is given twice. Every block is read once.
+ *
+ * @param dev Block device
+ * @param start First block of the directory
+ * @param size Directory size in blocks
+ * @param names Names, null-terminated
+ * @param count Number of names
+ * @return Status code, ATFS_STATUS_EXISTS if a name is taken
+ */
+ATFS_Status atfs_sdir_check_many(BlockDevice *dev, u32 start, u32 size,
+	const char *const *names, u32 count);
+
+/**
+ * @brief Add many entries to a sorted directory, which must not contain
+ *        their names. Nothing is written unless all of them fit, every
+ *        block that changes is written once. Earlier entries may move.
+ *
+ * @param dev Block device
+ * @param start First block of the directory
+ * @param size Directory size in blocks
+ * @param entries New entries
+ * @param count Number of entries
+ * @param entry_blocks Output parameter block of each entry,
+ *        0 if it was not added because of an error
+ * @param entry_offsets Output parameter byte offset of each entry
+ * @return Status code
+ */
+ATFS_Status atfs_sdir_insert_many(BlockDevice *dev, u32 start, u32 size,
+	const ATFS_DirEntry *entries, u32 count,
+	u32 *entry_blocks, u32 *entry_offsets);
+
+/**
+ * @brief Move all entries of a sorted directory into its first `new_size`
+ *        blocks, before it is shrunk. The blocks after them are left empty.
+ *
+ * @param dev Block device
+ * @param start First block of the directory
+ * @param size Directory size in blocks
+ * @param new_size Number of blocks that are kept, at most `size`
+ * @return Status code, ATFS_STATUS_DIRECTORY_FULL if the entries do not
+ *         fit into the blocks that are kept
+ */
+ATFS_Status atfs_sdir_repack(BlockDevice *dev, u32 start, u32 size,
+	u32 new_size);
+
+#endif /* __ATFS_SDIR_H__ */
@@ -19,3 +19,14 @@ u32 atfs_read32(const u8 *p)
 {
 	return p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
 }
+
+void atfs_write16(u8 *p, u16 v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+u16 atfs_read16(const u8 *p)
+{
+	return p[0] | (p[1] << 8);
+}
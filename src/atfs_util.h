@@ -27,4 +27,20 @@ void atfs_write32(u8 *p, u32 v);
  */
 u32 atfs_read32(const u8 *p);
 
+/**
+ * @brief Write a unsigned 16-bit integer into a buffer
+ *
+ * @param p Pointer into buffer
+ * @param v 16-bit integer value to write
+ */
+void atfs_write16(u8 *p, u16 v);
+
+/**
+ * @brief Read a unsigned 16-bit integer from a buffer
+ *
+ * @param p Pointer into buffer
+ * @return 16-bit integer that was read
+ */
+u16 atfs_read16(const u8 *p);
+
 #endif /* __ATFS_UTIL_H__ */
@@ -0,0 +1,442 @@
+/**
+ * @file    bcache.c
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ */
+
+#include "bcache.h"
+#include <stdlib.h>
+#include <string.h>
+
+/** Slot contains a valid block */
+#define BCACHE_VALID  (1 << 0)
+
+/** Slot was modified and must be written back */
+#define BCACHE_DIRTY  (1 << 1)
+
+/** Cache slot */
+typedef struct
+{
+	/** Block number on the underlying device */
+	u32 Block;
+
+	/** Time of last access, used for LRU eviction */
+	u32 Stamp;
+
+	/** Valid and dirty flags */
+	u32 Flags;
+
+	/** Number of active Map calls, pinned slots are never evicted */
+	u32 Pins;
+
+	/** Pointer to the cached block data */
+	u8 *Data;
+} BCacheSlot;
+
+/** Block cache instance data */
+typedef struct
+{
+	/** Underlying device */
+	BlockDevice *Lower;
+
+	/** Array of slots */
+	BCacheSlot *Slots;
+
+	/** Memory for the block data of all slots */
+	u8 *Data;
+
+	/** Scratch arrays used to write back all dirty slots at once */
+	BCacheSlot **Dirty;
+	DeviceIOVec *Vec;
+
+	/** Buffer for prefetched runs of blocks */
+	u8 *Scratch;
+
+	/** Number of slots */
+	u32 NumSlots;
+
+	/** Access counter */
+	u32 Clock;
+} BCache;
+
+static BCacheSlot *_slot_find(BCache *bc, u32 block)
+{
+	u32 i;
+	for(i = 0; i < bc->NumSlots; ++i)
+	{
+		if((bc->Slots[i].Flags & BCACHE_VALID) && bc->Slots[i].Block == block)
+		{
+			bc->Slots[i].Stamp = ++bc->Clock;
+			return &bc->Slots[i];
+		}
+	}
+
+	return NULL;
+}
+
+static DeviceStatus _slot_writeback(BCache *bc, BCacheSlot *slot)
+{
+	if(slot->Flags & BCACHE_DIRTY)
+	{
+		PROPAGATE(dev_write(bc->Lower, slot->Block, 1, slot->Data));
+		slot->Flags &= ~BCACHE_DIRTY;
+	}
+
+	return DEVICE_STATUS_OK;
+}
+
+static DeviceStatus _slot_alloc(BCache *bc, u32 block, BCacheSlot **out)
+{
+	u32 i;
+	BCacheSlot *victim;
+
+	/* Prefer an empty slot, otherwise evict the least recently used one */
+	victim = NULL;
+	for(i = 0; i < bc->NumSlots; ++i)
+	{
+		if(!(bc->Slots[i].Flags & BCACHE_VALID))
+		{
+			victim = &bc->Slots[i];
+			break;
+		}
+
+		if(!bc->Slots[i].Pins &&
+			(!victim || bc->Slots[i].Stamp < victim->Stamp))
+		{
+			victim = &bc->Slots[i];
+		}
+	}
+
+	if(!victim)
+	{
+		return DEVICE_STATUS_FAILURE;
+	}
+
+	PROPAGATE(_slot_writeback(bc, victim));
+	victim->Block = block;
+	victim->Flags = BCACHE_VALID;
+	victim->Stamp = ++bc->Clock;
+	*out = victim;
+	return DEVICE_STATUS_OK;
+}
+
+/* Large requests are file contents, don't let them push metadata out */
+static int _cacheable(BCache *bc, u32 count)
+{
+	return count <= bc->NumSlots / 4;
+}
+
+static DeviceStatus _bcache_read(void *ctx, u32 offset, u32 count,
+	u8 *buffer)
+{
+	BCache *bc = ctx;
+	u32 i, run, bs;
+	BCacheSlot *slot;
+
+	bs = bc->Lower->BlockSize;
+	for(i = 0; i < count; )
+	{
+		if((slot = _slot_find(bc, offset + i)))
+		{
+			memcpy(buffer + (size_t)i * bs, slot->Data, bs);
+			++i;
+			continue;
+		}
+
+		/* Read the whole run of uncached blocks with one request */
+		for(run = 1; i + run < count && !_slot_find(bc, offset + i + run);
+			++run) ;
+
+		PROPAGATE(dev_read(bc->Lower, offset + i, run,
+			buffer + (size_t)i * bs));
+
+		if(_cacheable(bc, count))
+		{
+			for(; run; --run, ++i)
+			{
+				PROPAGATE(_slot_alloc(bc, offset + i, &slot));
+				memcpy(slot->Data, buffer + (size_t)i * bs, bs);
+			}
+		}
+		else
+		{
+			i += run;
+		}
+	}
+
+	return DEVICE_STATUS_OK;
+}
+
+static DeviceStatus _bcache_write(void *ctx, u32 offset, u32 count,
+	const u8 *buffer)
+{
+	BCache *bc = ctx;
+	u32 i, bs;
+	BCacheSlot *slot;
+
+	bs = bc->Lower->BlockSize;
+	if(!_cacheable(bc, count))
+	{
+		/* Write through and keep cached copies up to date */
+		PROPAGATE(dev_write(bc->Lower, offset, count, buffer));
+		for(i = 0; i < count; ++i)
+		{
+			if((slot = _slot_find(bc, offset + i)))
+			{
+				memcpy(slot->Data, buffer + (size_t)i * bs, bs);
+				slot->Flags &= ~BCACHE_DIRTY;
+			}
+		}
+
+		return DEVICE_STATUS_OK;
+	}
+
+	for(i = 0; i < count; ++i)
+	{
+		if(!(slot = _slot_find(bc, offset + i)))
+		{
+			PROPAGATE(_slot_alloc(bc, offset + i, &slot));
+		}
+
+		memcpy(slot->Data, buffer + (size_t)i * bs, bs);
+		slot->Flags |= BCACHE_DIRTY;
+	}
+
+	return DEVICE_STATUS_OK;
+}
+
+static DeviceStatus _bcache_map(void *ctx, u32 offset, u32 count,
+	const u8 **ptr)
+{
+	BCache *bc = ctx;
+	BCacheSlot *slot;
+	DeviceStatus status;
+
+	/* Slots are not contiguous in memory */
+	if(count != 1)
+	{
+		return DEVICE_STATUS_FAILURE;
+	}
+
+	if(!(slot = _slot_find(bc, offset)))
+	{
+		PROPAGATE(_slot_alloc(bc, offset, &slot));
+		if((status = dev_read(bc->Lower, offset, 1, slot->Data)))
+		{
+			slot->Flags = 0;
+			return status;
+		}
+	}
+
+	++slot->Pins;
+	*ptr = slot->Data;
+	return DEVICE_STATUS_OK;
+}
+
+static void _bcache_unmap(void *ctx, u32 offset, u32 count)
+{
+	BCache *bc = ctx;
+	BCacheSlot *slot;
+
+	if((slot = _slot_find(bc, offset)) && slot->Pins)
+	{
+		--slot->Pins;
+	}
+
+	(void)count;
+}
+
+/* Cached copies of zeroed or discarded blocks read as zero,
+	the underlying device is already up to date */
+static void _slots_zero(BCache *bc, u32 offset, u32 count)
+{
+	u32 i;
+	for(i = 0; i < bc->NumSlots; ++i)
+	{
+		if((bc->Slots[i].Flags & BCACHE_VALID) &&
+			bc->Slots[i].Block - offset < count)
+		{
+			memset(bc->Slots[i].Data, 0, bc->Lower->BlockSize);
+			bc->Slots[i].Flags &= ~BCACHE_DIRTY;
+		}
+	}
+}
+
+static DeviceStatus _bcache_zero(void *ctx, u32 offset, u32 count)
+{
+	BCache *bc = ctx;
+	PROPAGATE(dev_zero(bc->Lower, offset, count));
+	_slots_zero(bc, offset, count);
+	return DEVICE_STATUS_OK;
+}
+
+static DeviceStatus _bcache_discard(void *ctx, u32 offset, u32 count)
+{
+	BCache *bc = ctx;
+	PROPAGATE(dev_discard(bc->Lower, offset, count));
+	_slots_zero(bc, offset, count);
+	return DEVICE_STATUS_OK;
+}
+
+/* Read blocks into the cache ahead of time. Prefetched blocks may take up
+	half of the cache, the rest of the range is passed on as a hint to the
+	underlying device. */
+static DeviceStatus _bcache_prefetch(void *ctx, u32 offset, u32 count)
+{
+	BCache *bc = ctx;
+	u32 i, j, run, bs, limit;
+	BCacheSlot *slot;
+
+	if(count > (limit = bc->NumSlots / 2))
+	{
+		PROPAGATE(dev_prefetch(bc->Lower, offset + limit, count - limit));
+		count = limit;
+	}
+
+	bs = bc->Lower->BlockSize;
+	for(i = 0; i < count; )
+	{
+		if(_slot_find(bc, offset + i))
+		{
+			++i;
+			continue;
+		}
+
+		for(run = 1; i + run < count && !_slot_find(bc, offset + i + run);
+			++run) ;
+
+		PROPAGATE(dev_read(bc->Lower, offset + i, run, bc->Scratch));
+		for(j = 0; j < run; ++j, ++i)
+		{
+			PROPAGATE(_slot_alloc(bc, offset + i, &slot));
+			memcpy(slot->Data, bc->Scratch + (size_t)j * bs, bs);
+		}
+	}
+
+	return DEVICE_STATUS_OK;
+}
+
+static int _slot_cmp(const void *a, const void *b)
+{
+	const BCacheSlot *x = *(BCacheSlot *const *)a;
+	const BCacheSlot *y = *(BCacheSlot *const *)b;
+	return (x->Block > y->Block) - (x->Block < y->Block);
+}
+
+/* Write back dirty blocks in ascending order with one vectored request */
+static DeviceStatus _bcache_writeback(BCache *bc)
+{
+	u32 i, n;
+
+	for(i = 0, n = 0; i < bc->NumSlots; ++i)
+	{
+		if(bc->Slots[i].Flags & BCACHE_DIRTY)
+		{
+			bc->Dirty[n++] = &bc->Slots[i];
+		}
+	}
+
+	if(!n)
+	{
+		return DEVICE_STATUS_OK;
+	}
+
+	qsort(bc->Dirty, n, sizeof(*bc->Dirty), _slot_cmp);
+	for(i = 0; i < n; ++i)
+	{
+		bc->Vec[i].Offset = bc->Dirty[i]->Block;
+		bc->Vec[i].Count = 1;
+		bc->Vec[i].Buffer = bc->Dirty[i]->Data;
+	}
+
+	PROPAGATE(dev_writev(bc->Lower, bc->Vec, n));
+	for(i = 0; i < n; ++i)
+	{
+		bc->Dirty[i]->Flags &= ~BCACHE_DIRTY;
+	}
+
+	return DEVICE_STATUS_OK;
+}
+
+static DeviceStatus _bcache_flush(void *ctx)
+{
+	BCache *bc = ctx;
+	PROPAGATE(_bcache_writeback(bc));
+	return dev_flush(bc->Lower);
+}
+
+DeviceStatus bcache_create(BlockDevice *cache, BlockDevice *dev, u32 slots)
+{
+	BCache *bc;
+	u32 i;
+
+	if(!slots)
+	{
+		slots = BCACHE_DEFAULT_SLOTS;
+	}
+
+	if(!(bc = malloc(sizeof(*bc))))
+	{
+		return DEVICE_STATUS_FAILURE;
+	}
+
+	bc->Slots = calloc(slots, sizeof(*bc->Slots));
+	bc->Data = malloc((size_t)slots * dev->BlockSize);
+	bc->Dirty = malloc(slots * sizeof(*bc->Dirty));
+	bc->Vec = malloc(slots * sizeof(*bc->Vec));
+	bc->Scratch = malloc((size_t)(slots / 2 + 1) * dev->BlockSize);
+	if(!bc->Slots || !bc->Data || !bc->Dirty || !bc->Vec || !bc->Scratch)
+	{
+		free(bc->Slots);
+		free(bc->Data);
+		free(bc->Dirty);
+		free(bc->Vec);
+		free(bc->Scratch);
+		free(bc);
+		return DEVICE_STATUS_FAILURE;
+	}
+
+	for(i = 0; i < slots; ++i)
+	{
+		bc->Slots[i].Data = bc->Data + (size_t)i * dev->BlockSize;
+	}
+
+	bc->Lower = dev;
+	bc->NumSlots = slots;
+	bc->Clock = 0;
+
+	memset(cache, 0, sizeof(*cache));
+	cache->BlockSize = dev->BlockSize;
+	cache->BlockSizePOT = dev->BlockSizePOT;
+	cache->BlockCount = dev->BlockCount;
+	cache->Context = bc;
+	cache->Read = _bcache_read;
+	cache->Write = _bcache_write;
+	cache->Flush = _bcache_flush;
+	cache->Map = _bcache_map;
+	cache->Unmap = _bcache_unmap;
+	cache->Zero = _bcache_zero;
+	cache->Discard = _bcache_discard;
+	cache->Prefetch = _bcache_prefetch;
+	return DEVICE_STATUS_OK;
+}
+
+DeviceStatus bcache_flush(BlockDevice *cache)
+{
+	return _bcache_writeback(cache->Context);
+}
+
+DeviceStatus bcache_destroy(BlockDevice *cache)
+{
+	BCache *bc = cache->Context;
+	DeviceStatus status = _bcache_writeback(bc);
+	free(bc->Slots);
+	free(bc->Data);
+	free(bc->Dirty);
+	free(bc->Vec);
+	free(bc->Scratch);
+	free(bc);
+	cache->Context = NULL;
+	return status;
+}
@@ -0,0 +1,50 @@
+/**
+ * @file    bcache.h
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ * @brief   Write-back block buffer cache
+ *
+ * The cache sits on top of another block device and is itself a block
+ * device, so the file system can use it without knowing it is there.
+ * Small requests (metadata like the boot block, free area headers and
+ * directory blocks) are served from a fixed number of slots with LRU
+ * eviction. Writes are kept in the cache and only written back to the
+ * underlying device when a dirty slot is evicted or on flush.
+ */
+
+#ifndef __BCACHE_H__
+#define __BCACHE_H__
+
+#include "dev.h"
+
+/** Default number of cache slots */
+#define BCACHE_DEFAULT_SLOTS  32
+
+/**
+ * @brief Create a block cache on top of a device
+ *
+ * @param cache Output parameter cached block device
+ * @param dev Underlying block device
+ * @param slots Number of blocks to keep in memory
+ * @return Status code
+ */
+DeviceStatus bcache_create(BlockDevice *cache, BlockDevice *dev, u32 slots);
+
+/**
+ * @brief Write all dirty blocks back to the underlying device
+ *
+ * @param cache Cached block device
+ * @return Status code
+ */
+DeviceStatus bcache_flush(BlockDevice *cache);
+
+/**
+ * @brief Flush and free a block cache
+ *
+ * @param cache Cached block device
+ * @return Status code of the final flush
+ */
+DeviceStatus bcache_destroy(BlockDevice *cache);
+
+#endif /* __BCACHE_H__ */
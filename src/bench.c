@@ -0,0 +1,451 @@
+/**
+ * @file    bench.c
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ */
+
+#include "bench.h"
+#include "ramdisk.h"
+#include "filedev.h"
+#include "atfs_alloc.h"
+#include "atfs_async.h"
+#include "atfs_bitmap.h"
+#include "atfs_dscan.h"
+#include "atfs_file.h"
+#include "atfs_format.h"
+#include "atfs_mount.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Block size of the volumes of the asynchronous I/O benchmark */
+#define BENCH_ASYNC_BLOCK_SIZE  4096
+
+/** Blocks per request of the asynchronous I/O benchmark */
+#define BENCH_ASYNC_CHUNK       16
+
+/** Allocated extent of the aging workload */
+typedef struct
+{
+	u32 Start, Size;
+} BenchFile;
+
+static u32 _rand(u32 *seed)
+{
+	/* xorshift32, same sequence for every policy */
+	u32 x = *seed;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *seed = x;
+}
+
+/* Mostly small files, some medium ones and a few large ones */
+static u32 _file_size(u32 *seed)
+{
+	u32 r = _rand(seed) % 100;
+	if(r < 70)
+	{
+		return 1 + _rand(seed) % 8;
+	}
+
+	if(r < 95)
+	{
+		return 9 + _rand(seed) % 56;
+	}
+
+	return 65 + _rand(seed) % 960;
+}
+
+static u64 _now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int _u64_cmp(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+	return (x > y) - (x < y);
+}
+
+static void _bench_policy(const char *name, ATFS_AllocPolicy policy,
+	ATFS_Allocator allocator, u32 block_count, u32 ops,
+	BenchFile *files, u64 *lat)
+{
+	ATFS_FormatOptions fmt = { .Groups = 1, .Allocator = allocator };
+	BlockDevice dev;
+	u32 i, j, n, allocs, failed, seed, size, start;
+	ATFS_StatFS st;
+	u64 t, total;
+	ATFS_Status status;
+
+	if(ramdisk_create(&dev, RAMDISK_DEFAULT_BLOCK_SIZE, block_count) ||
+		atfs_format_opts(&dev, &fmt) || atfs_mount(&dev))
+	{
+		printf("%-13s setup failed\n", name);
+		return;
+	}
+
+	atfs_mount_policy(&dev, policy);
+
+	seed = 0x12345678;
+	n = 0;
+	allocs = 0;
+	failed = 0;
+	total = 0;
+	for(i = 0; i < ops; ++i)
+	{
+		/* Fill up to 80 percent, then create and delete at random */
+		atfs_statfs(&dev, &st);
+		if(!n || (u64)st.FreeBlocks * 5 > block_count ||
+			(_rand(&seed) & 1))
+		{
+			size = _file_size(&seed);
+			t = _now_ns();
+			status = atfs_alloc(&dev, size, &start);
+			lat[allocs] = _now_ns() - t;
+			total += lat[allocs++];
+			if(status)
+			{
+				++failed;
+				continue;
+			}
+
+			files[n].Start = start;
+			files[n++].Size = size;
+		}
+		else
+		{
+			j = _rand(&seed) % n;
+			atfs_free(&dev, files[j].Start, files[j].Size);
+			files[j] = files[--n];
+		}
+	}
+
+	qsort(lat, allocs, sizeof(*lat), _u64_cmp);
+	atfs_statfs(&dev, &st);
+	printf("%-13s %8"PRIu32" %8"PRIu32" %8"PRIu32" %8"PRIu32" %8"PRIu32
+		" %8"PRIu64" %8"PRIu64"\n",
+		name, allocs, failed,
+		st.FreeBlocks, st.FreeAreas, st.Largest,
+		allocs ? total / allocs : 0,
+		allocs ? lat[(u64)allocs * 99 / 100] : 0);
+
+	atfs_unmount(&dev);
+	ramdisk_destroy(&dev);
+}
+
+void bench_alloc(u32 block_count, u32 ops)
+{
+	BenchFile *files;
+	u64 *lat;
+	u32 policy, isa;
+	char name[32];
+
+	files = malloc(ops * sizeof(*files));
+	lat = malloc(ops * sizeof(*lat));
+	if(!files || !lat)
+	{
+		printf("Out of memory\n");
+		free(files);
+		free(lat);
+		return;
+	}
+
+	printf("%"PRIu32" blocks, %"PRIu32" operations\n", block_count, ops);
+	printf("%-13s %8s %8s %8s %8s %8s %8s %8s\n",
+		"policy", "allocs", "failed", "free", "areas", "largest",
+		"avg-ns", "p99-ns");
+
+	for(policy = 0; policy < ATFS_POLICY_COUNT; ++policy)
+	{
+		_bench_policy(atfs_policy_string(policy), policy,
+			ATFS_ALLOCATOR_LIST, block_count, ops, files, lat);
+	}
+
+	/* The bitmap is always searched first fit, once for every
+		instruction set the processor supports */
+	for(isa = 0; isa < ATFS_BITMAP_ISA_COUNT; ++isa)
+	{
+		if(atfs_bitmap_isa(isa) != isa)
+		{
+			break;
+		}
+
+		snprintf(name, sizeof(name), "bitmap-%s", atfs_bitmap_isa_string(isa));
+		_bench_policy(name, ATFS_POLICY_FIRST_FIT,
+			ATFS_ALLOCATOR_BITMAP, block_count, ops, files, lat);
+	}
+
+	atfs_bitmap_isa(ATFS_BITMAP_ISA_COUNT - 1);
+
+	free(files);
+	free(lat);
+}
+
+/* Offset of the name in a directory block by comparing every entry,
+	like lookups did before there were name tags */
+static u32 _find_names(const u8 *data, u32 block_size, const char *name,
+	size_t len)
+{
+	const char *entry_name;
+	u32 offset;
+
+	for(offset = 0; offset < block_size;
+		offset += ATFS_DIR_ENTRY_SIZE)
+	{
+		entry_name = (const char *)(data + offset + ATFS_DIR_ENTRY_OFFSET_NAME);
+		if(data[offset + ATFS_DIR_ENTRY_OFFSET_TYPE] != ATFS_TYPE_FREE &&
+			strlen(entry_name) == len && !strncmp(name, entry_name, len))
+		{
+			return offset;
+		}
+	}
+
+	return block_size;
+}
+
+/* Look up every name in the blocks in order until it is found,
+	returns the sum of the offsets to compare the methods */
+static u64 _bench_lookups(const char *method, int scan, const u8 *dir,
+	u32 block_size, u32 blocks, char (*names)[ATFS_MAX_FILE_NAME_LENGTH + 1],
+	u32 lookups)
+{
+	u32 i, block, offset, searched;
+	const u8 *data;
+	u64 t, sum;
+	size_t len;
+	u8 tag;
+
+	sum = 0;
+	searched = 0;
+	t = _now_ns();
+	for(i = 0; i < lookups; ++i)
+	{
+		len = strlen(names[i]);
+		tag = atfs_name_tag(names[i], len);
+		for(block = 0; block < blocks; ++block)
+		{
+			++searched;
+			data = dir + (size_t)block * block_size;
+			offset = scan ?
+				atfs_dscan_find(data, block_size, names[i], len, tag) :
+				_find_names(data, block_size, names[i], len);
+			if(offset < block_size)
+			{
+				sum += (u64)block * block_size + offset;
+				break;
+			}
+		}
+	}
+
+	t = _now_ns() - t;
+	printf("%-13s %10"PRIu64" %10"PRIu64" %18"PRIu64"\n", method,
+		t / (lookups ? lookups : 1), t / (searched ? searched : 1), sum);
+	return sum;
+}
+
+void bench_dscan(u32 block_size, u32 blocks, u32 lookups)
+{
+	char (*names)[ATFS_MAX_FILE_NAME_LENGTH + 1];
+	char method[32];
+	u32 i, isa, seed, count;
+	u8 *dir, *p;
+	size_t len;
+
+	count = blocks * (block_size / ATFS_DIR_ENTRY_SIZE);
+	dir = malloc((size_t)blocks * block_size);
+	names = malloc(lookups * sizeof(*names));
+	if(!dir || !names)
+	{
+		printf("Out of memory\n");
+		free(dir);
+		free(names);
+		return;
+	}
+
+	/* Every entry is in use, with names of different lengths */
+	seed = 0x12345678;
+	for(i = 0; i < count; ++i)
+	{
+		p = dir + (size_t)i * ATFS_DIR_ENTRY_SIZE;
+		memset(p, 0, ATFS_DIR_ENTRY_SIZE);
+		snprintf((char *)(p + ATFS_DIR_ENTRY_OFFSET_NAME),
+			ATFS_MAX_FILE_NAME_LENGTH + 1, "%.*s-%"PRIu32,
+			(int)(_rand(&seed) % 24), "file-with-a-longer-name", i);
+		len = strlen((char *)(p + ATFS_DIR_ENTRY_OFFSET_NAME));
+		p[ATFS_DIR_ENTRY_OFFSET_TYPE] = ATFS_TYPE_FILE |
+			atfs_name_tag((char *)(p + ATFS_DIR_ENTRY_OFFSET_NAME), len);
+	}
+
+	/* Half of the lookups miss and search the whole directory */
+	for(i = 0; i < lookups; ++i)
+	{
+		if(_rand(&seed) & 1)
+		{
+			snprintf(names[i], sizeof(*names), "missing-%"PRIu32, i);
+		}
+		else
+		{
+			memcpy(names[i], dir + (size_t)(_rand(&seed) % count) *
+				ATFS_DIR_ENTRY_SIZE + ATFS_DIR_ENTRY_OFFSET_NAME,
+				sizeof(*names));
+		}
+	}
+
+	printf("%"PRIu32" blocks of %"PRIu32" entries, %"PRIu32" lookups\n",
+		blocks, block_size / ATFS_DIR_ENTRY_SIZE, lookups);
+	printf("%-13s %10s %10s %18s\n",
+		"method", "ns/lookup", "ns/block", "checksum");
+
+	_bench_lookups("names", 0, dir, block_size, blocks, names, lookups);
+	for(isa = 0; isa < ATFS_DSCAN_ISA_COUNT; ++isa)
+	{
+		if(atfs_dscan_isa(isa) != isa)
+		{
+			break;
+		}
+
+		snprintf(method, sizeof(method), "tags-%s", atfs_dscan_isa_string(isa));
+		_bench_lookups(method, 1, dir, block_size, blocks, names, lookups);
+	}
+
+	atfs_dscan_isa(ATFS_DSCAN_DEFAULT);
+
+	free(dir);
+	free(names);
+}
+
+/* Throughput in MiB/s */
+static u64 _mib_per_s(u64 bytes, u64 ns)
+{
+	return ((bytes >> 10) * 1000000000 / (ns ? ns : 1)) >> 10;
+}
+
+/* Write and read back a file with every queue depth */
+static void _bench_queue(const char *name, BlockDevice *dev, u32 blocks,
+	u32 depth, const u8 *data, u8 *check)
+{
+	size_t size = (size_t)blocks * BENCH_ASYNC_BLOCK_SIZE;
+	ATFS_File file;
+	DeviceQueue q;
+	ATFS_Status status;
+	u64 tw, tr;
+	u32 d;
+
+	if(atfs_format(dev) || atfs_mount(dev))
+	{
+		printf("%-13s setup failed\n", name);
+		return;
+	}
+
+	if(atfs_fcreate(dev, "bench", ATFS_TYPE_FILE, blocks) ||
+		atfs_fopen(dev, "bench", &file))
+	{
+		printf("%-13s setup failed\n", name);
+		atfs_unmount(dev);
+		return;
+	}
+
+	for(d = 1; d <= depth; d <<= 1)
+	{
+		if(devqueue_create(&q, dev, d))
+		{
+			printf("%-13s %6"PRIu32" queue setup failed\n", name, d);
+			break;
+		}
+
+		memset(check, 0, size);
+		tw = _now_ns();
+		status = atfs_fwrite_queued(&q, &file, 0, blocks, data,
+			BENCH_ASYNC_CHUNK);
+		tw = _now_ns() - tw;
+		tr = _now_ns();
+		if(!status)
+		{
+			status = atfs_fread_queued(&q, &file, 0, blocks, check,
+				BENCH_ASYNC_CHUNK);
+		}
+
+		tr = _now_ns() - tr;
+		devqueue_destroy(&q);
+		printf("%-13s %6"PRIu32" %11"PRIu64" %11"PRIu64" %s\n", name, d,
+			_mib_per_s(size, tw), _mib_per_s(size, tr),
+			status ? atfs_status_string(status) :
+			memcmp(data, check, size) ? "mismatch" : "ok");
+	}
+
+	atfs_fclose(&file);
+	atfs_unmount(dev);
+}
+
+void bench_async(u32 blocks, u32 depth)
+{
+	char path[] = "/tmp/atfs-bench-XXXXXX";
+	BlockDevice dev;
+	u32 i, seed, volume;
+	u8 *data, *check;
+	int fd;
+
+	/* Room for the boot block, the root directory and the free list */
+	volume = blocks + blocks / 8 + 64;
+	data = malloc((size_t)blocks * BENCH_ASYNC_BLOCK_SIZE);
+	check = malloc((size_t)blocks * BENCH_ASYNC_BLOCK_SIZE);
+	if(!data || !check)
+	{
+		printf("Out of memory\n");
+		free(data);
+		free(check);
+		return;
+	}
+
+	seed = 0x12345678;
+	for(i = 0; i < blocks * (BENCH_ASYNC_BLOCK_SIZE / 4); ++i)
+	{
+		_rand(&seed);
+		memcpy(data + (size_t)i * 4, &seed, 4);
+	}
+
+	printf("%"PRIu32" blocks of %d bytes, %d blocks per request\n",
+		blocks, BENCH_ASYNC_BLOCK_SIZE, BENCH_ASYNC_CHUNK);
+	printf("%-13s %6s %11s %11s %s\n",
+		"device", "depth", "write-MiB/s", "read-MiB/s", "data");
+
+	if(ramdisk_create(&dev, BENCH_ASYNC_BLOCK_SIZE, volume))
+	{
+		printf("%-13s setup failed\n", "ramdisk");
+	}
+	else
+	{
+		_bench_queue("ramdisk", &dev, blocks, depth, data, check);
+		ramdisk_destroy(&dev);
+	}
+
+	/* The image file is removed as soon as it is open */
+	if((fd = mkstemp(path)) < 0 ||
+		filedev_open(&dev, path, BENCH_ASYNC_BLOCK_SIZE, volume, 0))
+	{
+		printf("%-13s setup failed\n", "file");
+	}
+	else
+	{
+		_bench_queue(dev.Submit ? "file-io_uring" : "file-threads", &dev,
+			blocks, depth, data, check);
+		filedev_close(&dev);
+	}
+
+	if(fd >= 0)
+	{
+		close(fd);
+		unlink(path);
+	}
+
+	free(data);
+	free(check);
+}
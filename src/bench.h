@@ -0,0 +1,68 @@
+/**
+ * @file    bench.h
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ * @brief   Benchmarks for the test shell
+ */
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include "types.h"
+
+/** Default number of blocks of the benchmark volume */
+#define BENCH_DEFAULT_BLOCKS  65536
+
+/** Default number of create and delete operations */
+#define BENCH_DEFAULT_OPS     100000
+
+/** Default number of directory blocks of the scan benchmark */
+#define BENCH_DEFAULT_DIR_BLOCKS  64
+
+/** Default number of name lookups of the scan benchmark */
+#define BENCH_DEFAULT_LOOKUPS     20000
+
+/** Default size of the file of the asynchronous I/O benchmark in blocks */
+#define BENCH_DEFAULT_ASYNC_BLOCKS  8192
+
+/** Default largest queue depth of the asynchronous I/O benchmark */
+#define BENCH_DEFAULT_ASYNC_DEPTH   32
+
+/**
+ * @brief Age a fresh RAM disk volume with a mixed create/delete workload
+ *        for every allocation policy and for the bitmap allocator with
+ *        every supported instruction set, then print the largest allocatable
+ *        extent, the number of free areas, failed allocations and the
+ *        allocation latency
+ *
+ * @param block_count Number of blocks of the volume
+ * @param ops Number of create and delete operations
+ */
+void bench_alloc(u32 block_count, u32 ops);
+
+/**
+ * @brief Look up names in a full directory of fixed size entries in memory,
+ *        half of which exist, by comparing every name and with the name
+ *        tag scan for every supported instruction set, then print the time
+ *        per directory block that was searched
+ *
+ * @param block_size Block size of the directory, that of the volume
+ * @param blocks Number of directory blocks
+ * @param lookups Number of lookups
+ */
+void bench_dscan(u32 block_size, u32 blocks, u32 lookups);
+
+/**
+ * @brief Write a file with atfs_fwrite_queued and read it back with
+ *        atfs_fread_queued for queue depths 1, 2, 4 up to `depth`, on a
+ *        RAM disk (worker threads) and on a temporary image file
+ *        (io_uring if the kernel supports it), then print the throughput
+ *        and whether the data read back matches
+ *
+ * @param blocks Size of the file in blocks
+ * @param depth Largest queue depth
+ */
+void bench_async(u32 blocks, u32 depth);
+
+#endif /* __BENCH_H__ */
@@ -0,0 +1,280 @@
+/**
+ * @file    check.c
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ */
+
+#include "check.h"
+#include "atfs.h"
+#include "atfs_file.h"
+#include "atfs_format.h"
+#include "atfs_mount.h"
+#include "atfs_util.h"
+#include "ramdisk.h"
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+/* Print the outcome of a check, returns 1 if it failed */
+static u32 _expect(ATFS_DirFormat format, const char *what, int ok)
+{
+	static const char *format_str[] =
+	{
+		"linear",
+		"hashed",
+		"sorted",
+	};
+
+	printf("%-8s %-44s %s\n", format_str[format], what,
+		ok ? "ok" : "FAILED");
+	return !ok;
+}
+
+/* Number of entries with a name in a directory */
+static u32 _count_name(BlockDevice *dev, const char *path, const char *name)
+{
+	ATFS_DirEntry entry;
+	ATFS_Dir dir;
+	u32 n;
+
+	if(atfs_dopen(dev, path, &dir))
+	{
+		return 0;
+	}
+
+	for(n = 0; !atfs_dread(&dir, &entry); )
+	{
+		n += !strcmp(entry.Name, name);
+	}
+
+	atfs_dclose(&dir);
+	return n;
+}
+
+/* Creating a name that exists fails and leaves a single entry */
+static u32 _check_exists(BlockDevice *dev, ATFS_DirFormat format)
+{
+	const char *taken[] = { "new", "a" };
+	const char *twice[] = { "b", "c", "b" };
+	u32 capacities[] = { 1, 1, 1 };
+	ATFS_File file;
+	u32 failed;
+
+	failed = _expect(format, "create a new name",
+		!atfs_fcreate(dev, "dir.a", ATFS_TYPE_FILE, 1));
+	failed += _expect(format, "create an existing name",
+		atfs_fcreate(dev, "dir.a", ATFS_TYPE_FILE, 2) ==
+			ATFS_STATUS_EXISTS);
+	failed += _expect(format, "create many with an existing name",
+		atfs_fcreate_many(dev, "dir", taken, capacities, 2) ==
+			ATFS_STATUS_EXISTS);
+	failed += _expect(format, "create many with a name twice",
+		atfs_fcreate_many(dev, "dir", twice, capacities, 3) ==
+			ATFS_STATUS_EXISTS);
+	failed += _expect(format, "no entry of a refused batch",
+		atfs_fopen(dev, "dir.new", &file) ==
+			ATFS_STATUS_NO_SUCH_FILE_OR_DIRECTORY &&
+		!_count_name(dev, "dir", "b"));
+	failed += _expect(format, "one entry per name",
+		_count_name(dev, "dir", "a") == 1);
+	if(atfs_fopen(dev, "dir.a", &file))
+	{
+		return failed + _expect(format, "existing file unchanged", 0);
+	}
+
+	failed += _expect(format, "existing file unchanged",
+		file.SizeBlocks == 1);
+	atfs_fclose(&file);
+
+	return failed;
+}
+
+/* Number of the names `big.name_0` to `big.name_<count - 1>`
+	that can be opened */
+static u32 _count_found(BlockDevice *dev, u32 count)
+{
+	char path[32];
+	ATFS_File file;
+	u32 i, n;
+
+	for(i = 0, n = 0; i < count; ++i)
+	{
+		snprintf(path, sizeof(path), "big.name_%"PRIu32, i);
+		if(!atfs_fopen(dev, path, &file))
+		{
+			atfs_fclose(&file);
+			++n;
+		}
+	}
+
+	return n;
+}
+
+/* Resizing a directory keeps every entry and finds it afterwards */
+static u32 _check_resize(BlockDevice *dev, ATFS_DirFormat format)
+{
+	char names[CHECK_RESIZE_NAMES][32];
+	const char *ptrs[CHECK_RESIZE_NAMES];
+	u32 capacities[CHECK_RESIZE_NAMES];
+	ATFS_Status status;
+	ATFS_File dir;
+	u32 i, failed;
+
+	for(i = 0; i < CHECK_RESIZE_NAMES; ++i)
+	{
+		snprintf(names[i], sizeof(names[i]), "name_%"PRIu32, i);
+		ptrs[i] = names[i];
+		capacities[i] = 1;
+	}
+
+	/* Two blocks hold the first batch in every format */
+	if(atfs_fcreate(dev, "big", ATFS_TYPE_DIR, 2) ||
+		atfs_fopen(dev, "big", &dir))
+	{
+		return _expect(format, "set up the directory", 0);
+	}
+
+	failed = _expect(format, "fill a small directory",
+		!atfs_fcreate_many(dev, "big", ptrs, capacities, 12));
+	failed += _expect(format, "grow a directory",
+		!atfs_fresize(&dir, 16) && dir.SizeBlocks == 16);
+	failed += _expect(format, "fill a grown directory",
+		!atfs_fcreate_many(dev, "big", ptrs + 12, capacities + 12,
+			CHECK_RESIZE_NAMES - 12));
+	failed += _expect(format, "find every name after growing",
+		_count_found(dev, CHECK_RESIZE_NAMES) == CHECK_RESIZE_NAMES);
+	failed += _expect(format, "shrink a directory",
+		!atfs_fresize(&dir, 8) && dir.SizeBlocks == 8);
+	failed += _expect(format, "find every name after shrinking",
+		_count_found(dev, CHECK_RESIZE_NAMES) == CHECK_RESIZE_NAMES);
+
+	/* Only buckets can take more entries than fit into them */
+	status = atfs_fresize(&dir, 1);
+	failed += _expect(format, "shrink below the size of the entries",
+		format == ATFS_DIR_HASHED ? !status && dir.SizeBlocks == 1 :
+			status == ATFS_STATUS_DIRECTORY_FULL && dir.SizeBlocks == 8);
+	failed += _expect(format, "find every name after that",
+		_count_found(dev, CHECK_RESIZE_NAMES) == CHECK_RESIZE_NAMES);
+	atfs_fclose(&dir);
+	return failed;
+}
+
+/* Names of a sorted directory stay in order across its blocks, and
+	an open file follows its entry when a block is split */
+static u32 _check_sorted(BlockDevice *dev, ATFS_DirFormat format)
+{
+	char path[32], prev[ATFS_MAX_FILE_NAME_LENGTH + 1];
+	ATFS_DirEntry entry;
+	ATFS_File file, again;
+	ATFS_Dir dir;
+	u32 i, n, failed;
+	int ok;
+
+	if(atfs_fcreate(dev, "sorted", ATFS_TYPE_DIR, 8) ||
+		atfs_fcreate(dev, "sorted.name_z", ATFS_TYPE_FILE, 1) ||
+		atfs_fopen(dev, "sorted.name_z", &file))
+	{
+		return _expect(format, "set up the directory", 0);
+	}
+
+	/* Every name goes in front, so the first block is split again
+		and again */
+	for(i = CHECK_RESIZE_NAMES, failed = 0; i-- > 0 && !failed; )
+	{
+		snprintf(path, sizeof(path), "sorted.name_%03"PRIu32, i);
+		failed = atfs_fcreate(dev, path, ATFS_TYPE_FILE, 1) != 0;
+	}
+
+	failed = _expect(format, "fill blocks in front of the others", !failed);
+	n = 0;
+	ok = 0;
+	if(!atfs_dopen(dev, "sorted", &dir))
+	{
+		for(ok = 1, prev[0] = '\0'; ok && !atfs_dread(&dir, &entry); ++n)
+		{
+			ok = strcmp(prev, entry.Name) < 0;
+			strcpy(prev, entry.Name);
+		}
+
+		atfs_dclose(&dir);
+	}
+
+	failed += _expect(format, "names in order across blocks",
+		ok && n == CHECK_RESIZE_NAMES + 1);
+	if((ok = !atfs_fopen(dev, "sorted.name_z", &again)))
+	{
+		ok = again.EntryBlock == file.EntryBlock &&
+			again.EntryOffset == file.EntryOffset;
+		atfs_fclose(&again);
+	}
+
+	failed += _expect(format, "open file follows its entry", ok);
+	atfs_fclose(&file);
+	return failed;
+}
+
+/* Mounting a volume of revision 4 makes it revision 5, as its new
+	entries get name tags that revision 4 reads as part of the type */
+static u32 _check_upgrade(BlockDevice *dev, ATFS_DirFormat format)
+{
+	u8 buf[CHECK_BLOCK_SIZE];
+	int ok;
+
+	if((ok = !atfs_unmount(dev) &&
+		!dev_read(dev, ATFS_SECTOR_BOOT, 1, buf)))
+	{
+		atfs_write32(buf + ATFS_OFFSET_REVISION, ATFS_REVISION_DIR_FORMAT);
+		ok = !dev_write(dev, ATFS_SECTOR_BOOT, 1, buf) &&
+			!atfs_mount(dev) &&
+			!dev_read(dev, ATFS_SECTOR_BOOT, 1, buf) &&
+			atfs_read32(buf + ATFS_OFFSET_REVISION) ==
+				ATFS_REVISION_NAME_TAGS;
+	}
+
+	return _expect(format, "mount upgrades revision 4 to 5", ok);
+}
+
+u32 check_run(void)
+{
+	ATFS_FormatOptions opts;
+	ATFS_DirFormat format;
+	BlockDevice dev;
+	u32 failed;
+
+	failed = 0;
+	for(format = 0; format < ATFS_DIR_FORMAT_COUNT; ++format)
+	{
+		opts.Groups = 1;
+		opts.Allocator = ATFS_ALLOCATOR_LIST;
+		opts.Directories = format;
+		if(ramdisk_create(&dev, CHECK_BLOCK_SIZE, CHECK_BLOCK_COUNT))
+		{
+			printf("Out of memory\n");
+			return failed + 1;
+		}
+
+		if(atfs_format_opts(&dev, &opts) || atfs_mount(&dev) ||
+			atfs_fcreate(&dev, "dir", ATFS_TYPE_DIR, 4))
+		{
+			failed += _expect(format, "set up the volume", 0);
+		}
+		else
+		{
+			failed += _check_exists(&dev, format);
+			failed += _check_resize(&dev, format);
+			if(format == ATFS_DIR_SORTED)
+			{
+				failed += _check_sorted(&dev, format);
+			}
+
+			failed += _check_upgrade(&dev, format);
+		}
+
+		atfs_unmount(&dev);
+		ramdisk_destroy(&dev);
+	}
+
+	printf("%"PRIu32" checks failed\n", failed);
+	return failed;
+}
@@ -0,0 +1,35 @@
+/**
+ * @file    check.h
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ * @brief   Self checks for the test shell
+ *
+ * Every check formats a scratch RAM disk, runs a few operations on it and
+ * compares the outcome with what the file system promises.
+ */
+
+#ifndef __CHECK_H__
+#define __CHECK_H__
+
+#include "types.h"
+
+/** Block size of the scratch volumes, small so directories fill quickly */
+#define CHECK_BLOCK_SIZE   512
+
+/** Number of blocks of the scratch volumes */
+#define CHECK_BLOCK_COUNT  4096
+
+/** Number of files in the directory of the resize checks, more than
+	fit into one block in every directory format */
+#define CHECK_RESIZE_NAMES  40
+
+/**
+ * @brief Run all checks with every directory format and print the result
+ *        of each one
+ *
+ * @return Number of checks that failed
+ */
+u32 check_run(void);
+
+#endif /* __CHECK_H__ */
@@ -10,13 +10,157 @@
 #include <stdio.h>
 #include <assert.h>
 #include <ctype.h>
+#include <string.h>
+
+/** Number of blocks written per request when zeroing without Zero */
+#define DEV_ZERO_BATCH  64
+
+DeviceStatus dev_read(BlockDevice *dev, u32 offset, u32 count, u8 *buffer)
+{
+	return dev->Read(dev->Context, offset, count, buffer);
+}
+
+DeviceStatus dev_write(BlockDevice *dev, u32 offset, u32 count,
+	const u8 *buffer)
+{
+	return dev->Write(dev->Context, offset, count, buffer);
+}
+
+DeviceStatus dev_readv(BlockDevice *dev, const DeviceIOVec *vec, u32 n)
+{
+	u32 i;
+	if(dev->ReadV)
+	{
+		return dev->ReadV(dev->Context, vec, n);
+	}
+
+	for(i = 0; i < n; ++i)
+	{
+		PROPAGATE(dev_read(dev, vec[i].Offset, vec[i].Count, vec[i].Buffer));
+	}
+
+	return DEVICE_STATUS_OK;
+}
+
+DeviceStatus dev_writev(BlockDevice *dev, const DeviceIOVec *vec, u32 n)
+{
+	u32 i;
+	if(dev->WriteV)
+	{
+		return dev->WriteV(dev->Context, vec, n);
+	}
+
+	for(i = 0; i < n; ++i)
+	{
+		PROPAGATE(dev_write(dev, vec[i].Offset, vec[i].Count, vec[i].Buffer));
+	}
+
+	return DEVICE_STATUS_OK;
+}
+
+DeviceStatus dev_zero(BlockDevice *dev, u32 offset, u32 count)
+{
+	u8 buf[dev->BlockSize];
+	DeviceIOVec vec[DEV_ZERO_BATCH];
+	u32 i, n;
+
+	if(dev->Zero)
+	{
+		return dev->Zero(dev->Context, offset, count);
+	}
+
+	/* Every element of the vector points to the same zero block */
+	memset(buf, 0, dev->BlockSize);
+	while(count)
+	{
+		n = count < DEV_ZERO_BATCH ? count : DEV_ZERO_BATCH;
+		for(i = 0; i < n; ++i)
+		{
+			vec[i].Offset = offset + i;
+			vec[i].Count = 1;
+			vec[i].Buffer = buf;
+		}
+
+		PROPAGATE(dev_writev(dev, vec, n));
+		offset += n;
+		count -= n;
+	}
+
+	return DEVICE_STATUS_OK;
+}
+
+DeviceStatus dev_discard(BlockDevice *dev, u32 offset, u32 count)
+{
+	if(!dev->Discard || !count)
+	{
+		return DEVICE_STATUS_OK;
+	}
+
+	return dev->Discard(dev->Context, offset, count);
+}
+
+DeviceStatus dev_prefetch(BlockDevice *dev, u32 offset, u32 count)
+{
+	if(!dev->Prefetch || !count)
+	{
+		return DEVICE_STATUS_OK;
+	}
+
+	return dev->Prefetch(dev->Context, offset, count);
+}
+
+DeviceStatus dev_flush(BlockDevice *dev)
+{
+	if(!dev->Flush)
+	{
+		return DEVICE_STATUS_OK;
+	}
+
+	return dev->Flush(dev->Context);
+}
+
+DeviceStatus dev_map(BlockDevice *dev, u32 block, u8 *buf, const u8 **ptr)
+{
+	if(!dev->Map)
+	{
+		*ptr = buf;
+		return dev_read(dev, block, 1, buf);
+	}
+
+	return dev->Map(dev->Context, block, 1, ptr);
+}
+
+void dev_unmap(BlockDevice *dev, u32 block)
+{
+	if(dev->Map && dev->Unmap)
+	{
+		dev->Unmap(dev->Context, block, 1);
+	}
+}
+
+DeviceStatus dev_block_size_pot(u32 block_size, u32 *pot)
+{
+	u32 i;
+	for(i = 0; i < 32; ++i)
+	{
+		if(block_size == ((u32)1 << i))
+		{
+			*pot = i;
+			return DEVICE_STATUS_OK;
+		}
+	}
+
+	return DEVICE_STATUS_FAILURE;
+}
+
+_Thread_local u32 dev_io_tag;
 
 void dev_print_block(BlockDevice *dev, u32 block)
 {
 	u32 p, i, c;
 	u8 buffer[dev->BlockSize];
 
-	if(dev->Read(block, 1, buffer) != DEVICE_STATUS_OK)
+	if(dev_read(dev, block, 1, buffer) != DEVICE_STATUS_OK)
 	{
 		fprintf(stderr, "Read error on block %"PRIu32"\n", block);
 		return;
@@ -52,6 +196,7 @@ const char *dev_status_string(DeviceStatus status)
 		"Ok",
 		"Failure",
 		"Out of bounds access",
+		"Queue full",
 	};
 
 	assert(status >= 0 && status < (int)ARRLEN(status_strs));
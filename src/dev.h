@@ -17,11 +17,69 @@ enum
 	DEVICE_STATUS_OK,
 	DEVICE_STATUS_FAILURE,
 	DEVICE_STATUS_OUT_OF_BOUNDS,
+	DEVICE_STATUS_QUEUE_FULL,
 	DEVICE_STATUS_COUNT,
 };
 
 typedef int DeviceStatus;
 
+/** Number of different tags device I/O can be accounted to */
+#define DEV_IO_TAG_COUNT  16
+
+/** Tag of the operation the calling thread currently does device I/O for */
+extern _Thread_local u32 dev_io_tag;
+
+/** Error propagation macro */
+#define PROPAGATE(X) do { int a = X; if(a) { return a; } } while(0)
+
+/** Scatter-gather list element: `Count` blocks starting at `Offset` */
+typedef struct
+{
+	/** First block */
+	u32 Offset;
+
+	/** Number of blocks */
+	u32 Count;
+
+	/** Data buffer, not modified by write operations */
+	u8 *Buffer;
+} DeviceIOVec;
+
+/** Asynchronous request operation */
+enum
+{
+	DEVICE_REQUEST_READ,
+	DEVICE_REQUEST_WRITE,
+};
+
+/** Asynchronous request, owned by the caller until it is completed */
+typedef struct DeviceRequest
+{
+	/** DEVICE_REQUEST_READ or DEVICE_REQUEST_WRITE */
+	u32 Op;
+
+	/** First block */
+	u32 Offset;
+
+	/** Number of blocks */
+	u32 Count;
+
+	/** Data buffer */
+	u8 *Buffer;
+
+	/** Result, valid after completion */
+	DeviceStatus Status;
+
+	/** I/O accounting tag of the submitting thread, set on submit */
+	u32 Tag;
+
+	/** Free for use by the caller */
+	void *User;
+
+	/** Used internally to queue the request */
+	struct DeviceRequest *Next;
+} DeviceRequest;
+
 /** Block device interface struct */
 typedef struct
 {
@@ -34,13 +92,164 @@ typedef struct
 	/** Number of blocks in device */
 	u32 BlockCount;
 
+	/** Device specific data, passed to every operation */
+	void *Context;
+
 	/** Multi-block read operation */
-	DeviceStatus (*Read)(u32 offset, u32 count, u8 *buffer);
+	DeviceStatus (*Read)(void *ctx, u32 offset, u32 count, u8 *buffer);
 
 	/** Multi-block write operation */
-	DeviceStatus (*Write)(u32 offset, u32 count, const u8 *buffer);
+	DeviceStatus (*Write)(void *ctx, u32 offset, u32 count, const u8 *buffer);
+
+	/** Write back buffered data (optional, may be NULL) */
+	DeviceStatus (*Flush)(void *ctx);
+
+	/** Get a read-only pointer to blocks in device memory (optional) */
+	DeviceStatus (*Map)(void *ctx, u32 offset, u32 count, const u8 **ptr);
+
+	/** Release a pointer returned by Map (optional) */
+	void (*Unmap)(void *ctx, u32 offset, u32 count);
+
+	/** Scatter-gather read operation (optional) */
+	DeviceStatus (*ReadV)(void *ctx, const DeviceIOVec *vec, u32 n);
+
+	/** Scatter-gather write operation (optional) */
+	DeviceStatus (*WriteV)(void *ctx, const DeviceIOVec *vec, u32 n);
+
+	/** Fill blocks with zeros (optional) */
+	DeviceStatus (*Zero)(void *ctx, u32 offset, u32 count);
+
+	/** Tell the device that blocks are unused, contents become undefined
+		(optional) */
+	DeviceStatus (*Discard)(void *ctx, u32 offset, u32 count);
+
+	/** Start reading blocks that will be needed soon (optional, hint) */
+	DeviceStatus (*Prefetch)(void *ctx, u32 offset, u32 count);
+
+	/** Start an asynchronous request (optional, native async I/O) */
+	DeviceStatus (*Submit)(void *ctx, DeviceRequest *req);
+
+	/** Wait for the next asynchronous request to complete (optional) */
+	DeviceStatus (*Complete)(void *ctx, DeviceRequest **req);
 } BlockDevice;
 
+/**
+ * @brief Read blocks from a device
+ *
+ * @param dev Block device
+ * @param offset First block to read
+ * @param count Number of blocks to read
+ * @param buffer Output buffer
+ * @return Status code
+ */
+DeviceStatus dev_read(BlockDevice *dev, u32 offset, u32 count, u8 *buffer);
+
+/**
+ * @brief Write blocks to a device
+ *
+ * @param dev Block device
+ * @param offset First block to write
+ * @param count Number of blocks to write
+ * @param buffer Data to write
+ * @return Status code
+ */
+DeviceStatus dev_write(BlockDevice *dev, u32 offset, u32 count,
+	const u8 *buffer);
+
+/**
+ * @brief Read a list of block ranges, each into its own buffer.
+ *        Falls back to one read per element if the device has no ReadV.
+ *
+ * @param dev Block device
+ * @param vec Array of block ranges and buffers
+ * @param n Number of array elements
+ * @return Status code
+ */
+DeviceStatus dev_readv(BlockDevice *dev, const DeviceIOVec *vec, u32 n);
+
+/**
+ * @brief Write a list of block ranges, each from its own buffer.
+ *        Falls back to one write per element if the device has no WriteV.
+ *
+ * @param dev Block device
+ * @param vec Array of block ranges and buffers
+ * @param n Number of array elements
+ * @return Status code
+ */
+DeviceStatus dev_writev(BlockDevice *dev, const DeviceIOVec *vec, u32 n);
+
+/**
+ * @brief Fill blocks with zeros. Falls back to writing a zero buffer
+ *        if the device has no Zero operation.
+ *
+ * @param dev Block device
+ * @param offset First block
+ * @param count Number of blocks
+ * @return Status code
+ */
+DeviceStatus dev_zero(BlockDevice *dev, u32 offset, u32 count);
+
+/**
+ * @brief Tell the device that blocks are no longer used, so it can release
+ *        the backing storage. Does nothing if the device has no Discard.
+ *
+ * @param dev Block device
+ * @param offset First block
+ * @param count Number of blocks
+ * @return Status code
+ */
+DeviceStatus dev_discard(BlockDevice *dev, u32 offset, u32 count);
+
+/**
+ * @brief Tell the device that blocks will be read soon, so it can fetch
+ *        them in advance. Does nothing if the device has no Prefetch.
+ *
+ * @param dev Block device
+ * @param offset First block
+ * @param count Number of blocks
+ * @return Status code
+ */
+DeviceStatus dev_prefetch(BlockDevice *dev, u32 offset, u32 count);
+
+/**
+ * @brief Write back buffered data, does nothing for unbuffered devices
+ *
+ * @param dev Block device
+ * @return Status code
+ */
+DeviceStatus dev_flush(BlockDevice *dev);
+
+/**
+ * @brief Get a read-only pointer to the contents of a block.
+ *        If the device supports mapping, the pointer points directly into
+ *        device memory, otherwise the block is read into `buf`.
+ *        Every successful call must be paired with dev_unmap.
+ *
+ * @param dev Block device
+ * @param block Block number
+ * @param buf Fallback buffer of one block size
+ * @param ptr Output parameter pointer to block contents
+ * @return Status code
+ */
+DeviceStatus dev_map(BlockDevice *dev, u32 block, u8 *buf, const u8 **ptr);
+
+/**
+ * @brief Release a block pointer returned by dev_map
+ *
+ * @param dev Block device
+ * @param block Block number
+ */
+void dev_unmap(BlockDevice *dev, u32 block);
+
+/**
+ * @brief Calculate the base 2 logarithm of a block size
+ *
+ * @param block_size Block size in bytes
+ * @param pot Output parameter power of two
+ * @return DEVICE_STATUS_FAILURE if the block size is not a power of two
+ */
+DeviceStatus dev_block_size_pot(u32 block_size, u32 *pot);
+
 /**
  * @brief Returns a human-readable status string for a status code
  *
@@ -0,0 +1,180 @@
+/**
+ * @file    devqueue.c
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ */
+
+#include "devqueue.h"
+
+static void _list_push(DeviceRequest ***tail, DeviceRequest *req)
+{
+	req->Next = NULL;
+	**tail = req;
+	*tail = &req->Next;
+}
+
+static DeviceRequest *_list_pop(DeviceRequest **head, DeviceRequest ***tail)
+{
+	DeviceRequest *req = *head;
+	if((*head = req->Next) == NULL)
+	{
+		*tail = head;
+	}
+
+	return req;
+}
+
+static void _request_run(BlockDevice *dev, DeviceRequest *req)
+{
+	/* The I/O is accounted to the operation that submitted it */
+	dev_io_tag = req->Tag;
+	req->Status = (req->Op == DEVICE_REQUEST_WRITE) ?
+		dev_write(dev, req->Offset, req->Count, req->Buffer) :
+		dev_read(dev, req->Offset, req->Count, req->Buffer);
+}
+
+static void *_worker(void *arg)
+{
+	DeviceQueue *q = arg;
+	DeviceRequest *req;
+
+	pthread_mutex_lock(&q->Lock);
+	for(;;)
+	{
+		while(!q->Pending && !q->Stop)
+		{
+			pthread_cond_wait(&q->WorkCond, &q->Lock);
+		}
+
+		if(!q->Pending)
+		{
+			break;
+		}
+
+		req = _list_pop(&q->Pending, &q->PendingTail);
+		pthread_mutex_unlock(&q->Lock);
+
+		_request_run(q->Device, req);
+
+		pthread_mutex_lock(&q->Lock);
+		_list_push(&q->CompletedTail, req);
+		pthread_cond_signal(&q->DoneCond);
+	}
+
+	pthread_mutex_unlock(&q->Lock);
+	return NULL;
+}
+
+DeviceStatus devqueue_create(DeviceQueue *q, BlockDevice *dev, u32 depth)
+{
+	u32 i;
+
+	q->Device = dev;
+	q->Depth = depth ? depth : 1;
+	q->InFlight = 0;
+	q->NumWorkers = 0;
+	q->Pending = NULL;
+	q->PendingTail = &q->Pending;
+	q->Completed = NULL;
+	q->CompletedTail = &q->Completed;
+	q->Stop = 0;
+	if(dev->Submit && dev->Complete)
+	{
+		return DEVICE_STATUS_OK;
+	}
+
+	pthread_mutex_init(&q->Lock, NULL);
+	pthread_cond_init(&q->WorkCond, NULL);
+	pthread_cond_init(&q->DoneCond, NULL);
+	for(i = 0; i < q->Depth && i < DEVQUEUE_MAX_WORKERS; ++i)
+	{
+		if(pthread_create(&q->Workers[i], NULL, _worker, q))
+		{
+			break;
+		}
+	}
+
+	q->NumWorkers = i;
+	if(!i)
+	{
+		devqueue_destroy(q);
+		return DEVICE_STATUS_FAILURE;
+	}
+
+	return DEVICE_STATUS_OK;
+}
+
+DeviceStatus devqueue_submit(DeviceQueue *q, DeviceRequest *req)
+{
+	if(q->InFlight >= q->Depth)
+	{
+		return DEVICE_STATUS_QUEUE_FULL;
+	}
+
+	req->Tag = dev_io_tag;
+	if(!q->NumWorkers)
+	{
+		PROPAGATE(q->Device->Submit(q->Device->Context, req));
+		++q->InFlight;
+		return DEVICE_STATUS_OK;
+	}
+
+	++q->InFlight;
+	pthread_mutex_lock(&q->Lock);
+	_list_push(&q->PendingTail, req);
+	pthread_cond_signal(&q->WorkCond);
+	pthread_mutex_unlock(&q->Lock);
+	return DEVICE_STATUS_OK;
+}
+
+DeviceStatus devqueue_wait(DeviceQueue *q, DeviceRequest **req)
+{
+	if(!q->InFlight)
+	{
+		return DEVICE_STATUS_FAILURE;
+	}
+
+	if(!q->NumWorkers)
+	{
+		PROPAGATE(q->Device->Complete(q->Device->Context, req));
+		--q->InFlight;
+		return DEVICE_STATUS_OK;
+	}
+
+	pthread_mutex_lock(&q->Lock);
+	while(!q->Completed)
+	{
+		pthread_cond_wait(&q->DoneCond, &q->Lock);
+	}
+
+	*req = _list_pop(&q->Completed, &q->CompletedTail);
+	pthread_mutex_unlock(&q->Lock);
+	--q->InFlight;
+	return DEVICE_STATUS_OK;
+}
+
+void devqueue_destroy(DeviceQueue *q)
+{
+	DeviceRequest *req;
+	u32 i;
+
+	while(q->InFlight && !devqueue_wait(q, &req)) ;
+	if(!q->NumWorkers && q->Device->Submit && q->Device->Complete)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&q->Lock);
+	q->Stop = 1;
+	pthread_cond_broadcast(&q->WorkCond);
+	pthread_mutex_unlock(&q->Lock);
+	for(i = 0; i < q->NumWorkers; ++i)
+	{
+		pthread_join(q->Workers[i], NULL);
+	}
+
+	pthread_mutex_destroy(&q->Lock);
+	pthread_cond_destroy(&q->WorkCond);
+	pthread_cond_destroy(&q->DoneCond);
+}
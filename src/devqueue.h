@@ -0,0 +1,98 @@
+/**
+ * @file    devqueue.h
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ * @brief   Asynchronous submission/completion queue for block devices
+ *
+ * Devices with native asynchronous I/O (image files with io_uring)
+ * implement Submit/Complete, for all other devices a pool of worker
+ * threads calls the normal Read/Write operations. The thread pool calls
+ * the device from several threads at once, which the RAM disk and image
+ * files allow, but the block cache does not.
+ */
+
+#ifndef __DEVQUEUE_H__
+#define __DEVQUEUE_H__
+
+#include "dev.h"
+#include <pthread.h>
+
+/** Maximum number of worker threads */
+#define DEVQUEUE_MAX_WORKERS  16
+
+/** Asynchronous request queue */
+typedef struct
+{
+	/** Device the requests are for */
+	BlockDevice *Device;
+
+	/** Maximum number of requests in flight */
+	u32 Depth;
+
+	/** Submitted requests not yet returned by devqueue_wait */
+	u32 InFlight;
+
+	/** Number of worker threads, 0 if the device has native async I/O */
+	u32 NumWorkers;
+
+	/** Worker threads */
+	pthread_t Workers[DEVQUEUE_MAX_WORKERS];
+
+	/** Protects the lists below */
+	pthread_mutex_t Lock;
+
+	/** Signaled when a request is added to the pending list */
+	pthread_cond_t WorkCond;
+
+	/** Signaled when a request is added to the completed list */
+	pthread_cond_t DoneCond;
+
+	/** Requests waiting for a worker */
+	DeviceRequest *Pending, **PendingTail;
+
+	/** Requests waiting for devqueue_wait */
+	DeviceRequest *Completed, **CompletedTail;
+
+	/** Tells the workers to exit */
+	int Stop;
+} DeviceQueue;
+
+/**
+ * @brief Create a request queue for a device
+ *
+ * @param q Output parameter queue
+ * @param dev Block device
+ * @param depth Maximum number of requests in flight
+ * @return Status code
+ */
+DeviceStatus devqueue_create(DeviceQueue *q, BlockDevice *dev, u32 depth);
+
+/**
+ * @brief Start a request. The request and its buffer must stay valid
+ *        until it is returned by devqueue_wait.
+ *
+ * @param q Queue
+ * @param req Request
+ * @return DEVICE_STATUS_QUEUE_FULL if `depth` requests are in flight
+ */
+DeviceStatus devqueue_submit(DeviceQueue *q, DeviceRequest *req);
+
+/**
+ * @brief Wait for the next completed request. The result of the request
+ *        itself is in its Status field.
+ *
+ * @param q Queue
+ * @param req Output parameter completed request
+ * @return Status code, DEVICE_STATUS_FAILURE if nothing is in flight
+ */
+DeviceStatus devqueue_wait(DeviceQueue *q, DeviceRequest **req);
+
+/**
+ * @brief Wait for all requests in flight and destroy the queue
+ *
+ * @param q Queue
+ */
+void devqueue_destroy(DeviceQueue *q);
+
+#endif /* __DEVQUEUE_H__ */
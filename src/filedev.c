@@ -0,0 +1,766 @@
+/**
+ * @file    filedev.c
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ */
+
+#define _GNU_SOURCE
+
+#include "filedev.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <linux/falloc.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define FILEDEV_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+/** Maximum number of buffers passed to one preadv/pwritev call */
+#define FILEDEV_IOV_MAX  64
+
+/** Number of io_uring submission queue entries */
+#define FILEDEV_URING_ENTRIES  128
+
+#ifdef FILEDEV_URING
+
+/** io_uring instance used for asynchronous requests */
+typedef struct
+{
+	/** Ring file descriptor */
+	int Fd;
+
+	/** Submission queue */
+	u32 *SqHead, *SqTail, SqMask, SqEntries, *SqArray;
+	struct io_uring_sqe *Sqes;
+
+	/** Completion queue */
+	u32 *CqHead, *CqTail, CqMask;
+	struct io_uring_cqe *Cqes;
+
+	/** Mappings of the rings */
+	void *SqRing, *CqRing;
+	size_t SqRingSize, CqRingSize, SqesSize;
+} FileDevRing;
+
+#endif /* FILEDEV_URING */
+
+/** Image file instance data */
+typedef struct
+{
+	/** File descriptor */
+	int Fd;
+
+	/** FILEDEV_* flags */
+	int Flags;
+
+	/** Block size as power of two */
+	u32 BlockSizePOT;
+
+	/** Number of blocks */
+	u32 BlockCount;
+
+	/** Aligned bounce buffer for O_DIRECT transfers */
+	u8 *Bounce;
+
+	/** Size of the bounce buffer in bytes */
+	size_t BounceSize;
+
+	/** File contents if mapped, else NULL */
+	u8 *Map;
+
+	/** Asynchronous requests that were completed synchronously */
+	DeviceRequest *Done;
+
+#ifdef FILEDEV_URING
+	/** io_uring, Fd is -1 if not available */
+	FileDevRing Ring;
+#endif
+} FileDev;
+
+static DeviceStatus _check_range(FileDev *fd, u32 offset, u32 count)
+{
+	return (offset > fd->BlockCount) ||
+		(count > fd->BlockCount - offset);
+}
+
+static int _needs_bounce(FileDev *fd, const void *buffer)
+{
+	return (fd->Flags & FILEDEV_DIRECT) &&
+		((uintptr_t)buffer & (FILEDEV_DIRECT_ALIGN - 1));
+}
+
+static DeviceStatus _bounce_reserve(FileDev *fd, size_t size)
+{
+	void *p;
+	if(size <= fd->BounceSize)
+	{
+		return DEVICE_STATUS_OK;
+	}
+
+	if(posix_memalign(&p, FILEDEV_DIRECT_ALIGN, size))
+	{
+		return DEVICE_STATUS_FAILURE;
+	}
+
+	free(fd->Bounce);
+	fd->Bounce = p;
+	fd->BounceSize = size;
+	return DEVICE_STATUS_OK;
+}
+
+static DeviceStatus _pread_all(int fd, u8 *buffer, size_t size, off_t pos)
+{
+	ssize_t ret;
+	while(size)
+	{
+		if((ret = pread(fd, buffer, size, pos)) <= 0)
+		{
+			if(ret < 0 && errno == EINTR)
+			{
+				continue;
+			}
+
+			return DEVICE_STATUS_FAILURE;
+		}
+
+		buffer += ret;
+		size -= ret;
+		pos += ret;
+	}
+
+	return DEVICE_STATUS_OK;
+}
+
+static DeviceStatus _pwrite_all(int fd, const u8 *buffer, size_t size,
+	off_t pos)
+{
+	ssize_t ret;
+	while(size)
+	{
+		if((ret = pwrite(fd, buffer, size, pos)) <= 0)
+		{
+			if(ret < 0 && errno == EINTR)
+			{
+				continue;
+			}
+
+			return DEVICE_STATUS_FAILURE;
+		}
+
+		buffer += ret;
+		size -= ret;
+		pos += ret;
+	}
+
+	return DEVICE_STATUS_OK;
+}
+
+static DeviceStatus _filedev_read(void *ctx, u32 offset, u32 count,
+	u8 *buffer)
+{
+	FileDev *fd = ctx;
+	size_t size;
+	off_t pos;
+
+	if(_check_range(fd, offset, count))
+	{
+		return DEVICE_STATUS_OUT_OF_BOUNDS;
+	}
+
+	size = (size_t)count << fd->BlockSizePOT;
+	pos = (off_t)offset << fd->BlockSizePOT;
+	if(fd->Map)
+	{
+		memcpy(buffer, fd->Map + pos, size);
+		return DEVICE_STATUS_OK;
+	}
+
+	if(!_needs_bounce(fd, buffer))
+	{
+		return _pread_all(fd->Fd, buffer, size, pos);
+	}
+
+	PROPAGATE(_bounce_reserve(fd, size));
+	PROPAGATE(_pread_all(fd->Fd, fd->Bounce, size, pos));
+	memcpy(buffer, fd->Bounce, size);
+	return DEVICE_STATUS_OK;
+}
+
+static DeviceStatus _filedev_write(void *ctx, u32 offset, u32 count,
+	const u8 *buffer)
+{
+	FileDev *fd = ctx;
+	size_t size;
+	off_t pos;
+
+	if(_check_range(fd, offset, count))
+	{
+		return DEVICE_STATUS_OUT_OF_BOUNDS;
+	}
+
+	size = (size_t)count << fd->BlockSizePOT;
+	pos = (off_t)offset << fd->BlockSizePOT;
+	if(fd->Map)
+	{
+		memcpy(fd->Map + pos, buffer, size);
+		return DEVICE_STATUS_OK;
+	}
+
+	if(!_needs_bounce(fd, buffer))
+	{
+		return _pwrite_all(fd->Fd, buffer, size, pos);
+	}
+
+	PROPAGATE(_bounce_reserve(fd, size));
+	memcpy(fd->Bounce, buffer, size);
+	return _pwrite_all(fd->Fd, fd->Bounce, size, pos);
+}
+
+/* Transfer all iovecs, continuing after short reads or writes */
+static DeviceStatus _iov_all(int fd, struct iovec *iov, int cnt, off_t pos,
+	int write)
+{
+	ssize_t ret;
+	while(cnt)
+	{
+		ret = write ? pwritev(fd, iov, cnt, pos) : preadv(fd, iov, cnt, pos);
+		if(ret <= 0)
+		{
+			if(ret < 0 && errno == EINTR)
+			{
+				continue;
+			}
+
+			return DEVICE_STATUS_FAILURE;
+		}
+
+		pos += ret;
+		while(cnt && (size_t)ret >= iov->iov_len)
+		{
+			ret -= iov->iov_len;
+			++iov;
+			--cnt;
+		}
+
+		if(cnt)
+		{
+			iov->iov_base = (u8 *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+
+	return DEVICE_STATUS_OK;
+}
+
+static DeviceStatus _filedev_rwv(FileDev *fd, const DeviceIOVec *vec, u32 n,
+	int write)
+{
+	struct iovec iov[FILEDEV_IOV_MAX];
+	u32 i, cnt;
+
+	for(i = 0; i < n; ++i)
+	{
+		if(_check_range(fd, vec[i].Offset, vec[i].Count))
+		{
+			return DEVICE_STATUS_OUT_OF_BOUNDS;
+		}
+
+		if(fd->Map || _needs_bounce(fd, vec[i].Buffer))
+		{
+			/* Copy element by element */
+			for(i = 0; i < n; ++i)
+			{
+				PROPAGATE(write ?
+					_filedev_write(fd, vec[i].Offset, vec[i].Count,
+						vec[i].Buffer) :
+					_filedev_read(fd, vec[i].Offset, vec[i].Count,
+						vec[i].Buffer));
+			}
+
+			return DEVICE_STATUS_OK;
+		}
+	}
+
+	/* Each run of elements where one continues the previous one
+		on the device is transferred with a single system call */
+	for(i = 0; i < n; i += cnt)
+	{
+		cnt = 0;
+		do
+		{
+			iov[cnt].iov_base = vec[i + cnt].Buffer;
+			iov[cnt].iov_len = (size_t)vec[i + cnt].Count << fd->BlockSizePOT;
+			++cnt;
+		}
+		while(i + cnt < n && cnt < FILEDEV_IOV_MAX &&
+			vec[i + cnt].Offset ==
+				vec[i + cnt - 1].Offset + vec[i + cnt - 1].Count);
+
+		PROPAGATE(_iov_all(fd->Fd, iov, cnt,
+			(off_t)vec[i].Offset << fd->BlockSizePOT, write));
+	}
+
+	return DEVICE_STATUS_OK;
+}
+
+static DeviceStatus _filedev_readv(void *ctx, const DeviceIOVec *vec, u32 n)
+{
+	return _filedev_rwv(ctx, vec, n, 0);
+}
+
+static DeviceStatus _filedev_writev(void *ctx, const DeviceIOVec *vec, u32 n)
+{
+	return _filedev_rwv(ctx, vec, n, 1);
+}
+
+static int _fallocate(FileDev *fd, int mode, u32 offset, u32 count)
+{
+	return fallocate(fd->Fd, mode, (off_t)offset << fd->BlockSizePOT,
+		(off_t)count << fd->BlockSizePOT);
+}
+
+static DeviceStatus _filedev_zero(void *ctx, u32 offset, u32 count)
+{
+	FileDev *fd = ctx;
+	u8 buf[1 << fd->BlockSizePOT];
+	u32 i;
+
+	if(_check_range(fd, offset, count))
+	{
+		return DEVICE_STATUS_OUT_OF_BOUNDS;
+	}
+
+	/* Zero range keeps the blocks allocated, punching a hole frees them,
+		both read back as zeros */
+	if(!_fallocate(fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE,
+			offset, count) ||
+		!_fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			offset, count))
+	{
+		return DEVICE_STATUS_OK;
+	}
+
+	/* File system supports neither */
+	memset(buf, 0, sizeof(buf));
+	for(i = 0; i < count; ++i)
+	{
+		PROPAGATE(_filedev_write(fd, offset + i, 1, buf));
+	}
+
+	return DEVICE_STATUS_OK;
+}
+
+static DeviceStatus _filedev_discard(void *ctx, u32 offset, u32 count)
+{
+	FileDev *fd = ctx;
+	if(_check_range(fd, offset, count))
+	{
+		return DEVICE_STATUS_OUT_OF_BOUNDS;
+	}
+
+	/* Only a hint, ignore file systems without hole punching */
+	_fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, count);
+	return DEVICE_STATUS_OK;
+}
+
+static DeviceStatus _filedev_prefetch(void *ctx, u32 offset, u32 count)
+{
+	FileDev *fd = ctx;
+	size_t start, len, page;
+
+	if(_check_range(fd, offset, count))
+	{
+		return DEVICE_STATUS_OUT_OF_BOUNDS;
+	}
+
+	/* Only a hint, the kernel starts reading in the background */
+	start = (size_t)offset << fd->BlockSizePOT;
+	len = (size_t)count << fd->BlockSizePOT;
+	if(fd->Map)
+	{
+		/* madvise needs a page aligned start */
+		page = sysconf(_SC_PAGESIZE);
+		len += start & (page - 1);
+		start &= ~(page - 1);
+		madvise(fd->Map + start, len, MADV_WILLNEED);
+	}
+	else
+	{
+		posix_fadvise(fd->Fd, start, len, POSIX_FADV_WILLNEED);
+	}
+
+	return DEVICE_STATUS_OK;
+}
+
+static DeviceStatus _filedev_flush(void *ctx)
+{
+	FileDev *fd = ctx;
+	if(fd->Map)
+	{
+		return msync(fd->Map, (size_t)fd->BlockCount << fd->BlockSizePOT,
+			MS_SYNC) ? DEVICE_STATUS_FAILURE : DEVICE_STATUS_OK;
+	}
+
+	return fdatasync(fd->Fd) ? DEVICE_STATUS_FAILURE : DEVICE_STATUS_OK;
+}
+
+static DeviceStatus _filedev_map(void *ctx, u32 offset, u32 count,
+	const u8 **ptr)
+{
+	FileDev *fd = ctx;
+	if(_check_range(fd, offset, count))
+	{
+		return DEVICE_STATUS_OUT_OF_BOUNDS;
+	}
+
+	*ptr = fd->Map + ((size_t)offset << fd->BlockSizePOT);
+	return DEVICE_STATUS_OK;
+}
+
+static DeviceStatus _map_file(FileDev *fd)
+{
+	void *p;
+	size_t size = (size_t)fd->BlockCount << fd->BlockSizePOT;
+	if(!size)
+	{
+		return DEVICE_STATUS_FAILURE;
+	}
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd->Fd, 0);
+	if(p == MAP_FAILED)
+	{
+		return DEVICE_STATUS_FAILURE;
+	}
+
+	fd->Map = p;
+	return DEVICE_STATUS_OK;
+}
+
+/* Use the file size if no size is given, otherwise grow the file */
+static DeviceStatus _image_size(int fd, u32 pot, u32 *block_count)
+{
+	struct stat st;
+	off_t size;
+
+	if(fstat(fd, &st))
+	{
+		return DEVICE_STATUS_FAILURE;
+	}
+
+	if(!*block_count)
+	{
+		*block_count = st.st_size >> pot;
+		return DEVICE_STATUS_OK;
+	}
+
+	size = (off_t)*block_count << pot;
+	if(st.st_size < size && ftruncate(fd, size))
+	{
+		return DEVICE_STATUS_FAILURE;
+	}
+
+	return DEVICE_STATUS_OK;
+}
+
+#ifdef FILEDEV_URING
+
+static void _ring_destroy(FileDevRing *r)
+{
+	if(r->Fd < 0)
+	{
+		return;
+	}
+
+	if(r->Sqes != MAP_FAILED)
+	{
+		munmap(r->Sqes, r->SqesSize);
+	}
+
+	if(r->CqRing != MAP_FAILED && r->CqRing != r->SqRing)
+	{
+		munmap(r->CqRing, r->CqRingSize);
+	}
+
+	if(r->SqRing != MAP_FAILED)
+	{
+		munmap(r->SqRing, r->SqRingSize);
+	}
+
+	close(r->Fd);
+	r->Fd = -1;
+}
+
+static DeviceStatus _ring_setup(FileDevRing *r)
+{
+	struct io_uring_params p;
+	u8 *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	if((r->Fd = syscall(__NR_io_uring_setup, FILEDEV_URING_ENTRIES, &p)) < 0)
+	{
+		return DEVICE_STATUS_FAILURE;
+	}
+
+	r->SqRingSize = p.sq_off.array + p.sq_entries * sizeof(u32);
+	r->CqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if(r->CqRingSize > r->SqRingSize)
+		{
+			r->SqRingSize = r->CqRingSize;
+		}
+
+		r->CqRingSize = r->SqRingSize;
+	}
+
+	r->SqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->SqRing = mmap(NULL, r->SqRingSize, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, r->Fd, IORING_OFF_SQ_RING);
+	r->CqRing = (p.features & IORING_FEAT_SINGLE_MMAP) ? r->SqRing :
+		mmap(NULL, r->CqRingSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->Fd, IORING_OFF_CQ_RING);
+	r->Sqes = mmap(NULL, r->SqesSize, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, r->Fd, IORING_OFF_SQES);
+	if(r->SqRing == MAP_FAILED || r->CqRing == MAP_FAILED ||
+		r->Sqes == MAP_FAILED)
+	{
+		_ring_destroy(r);
+		return DEVICE_STATUS_FAILURE;
+	}
+
+	sq = r->SqRing;
+	cq = r->CqRing;
+	r->SqHead = (u32 *)(sq + p.sq_off.head);
+	r->SqTail = (u32 *)(sq + p.sq_off.tail);
+	r->SqMask = *(u32 *)(sq + p.sq_off.ring_mask);
+	r->SqEntries = p.sq_entries;
+	r->SqArray = (u32 *)(sq + p.sq_off.array);
+	r->CqHead = (u32 *)(cq + p.cq_off.head);
+	r->CqTail = (u32 *)(cq + p.cq_off.tail);
+	r->CqMask = *(u32 *)(cq + p.cq_off.ring_mask);
+	r->Cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return DEVICE_STATUS_OK;
+}
+
+static DeviceStatus _filedev_submit(void *ctx, DeviceRequest *req)
+{
+	FileDev *fd = ctx;
+	FileDevRing *r = &fd->Ring;
+	struct io_uring_sqe *sqe;
+	size_t size;
+	u32 tail, index;
+	long ret;
+
+	if(_check_range(fd, req->Offset, req->Count))
+	{
+		return DEVICE_STATUS_OUT_OF_BOUNDS;
+	}
+
+	size = (size_t)req->Count << fd->BlockSizePOT;
+	if(_needs_bounce(fd, req->Buffer) || size > UINT32_MAX)
+	{
+		/* The bounce buffer can only be used synchronously */
+		req->Status = (req->Op == DEVICE_REQUEST_WRITE) ?
+			_filedev_write(fd, req->Offset, req->Count, req->Buffer) :
+			_filedev_read(fd, req->Offset, req->Count, req->Buffer);
+		req->Next = fd->Done;
+		fd->Done = req;
+		return DEVICE_STATUS_OK;
+	}
+
+	tail = *r->SqTail;
+	if(tail - __atomic_load_n(r->SqHead, __ATOMIC_ACQUIRE) >= r->SqEntries)
+	{
+		return DEVICE_STATUS_QUEUE_FULL;
+	}
+
+	index = tail & r->SqMask;
+	sqe = &r->Sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = (req->Op == DEVICE_REQUEST_WRITE) ?
+		IORING_OP_WRITE : IORING_OP_READ;
+	sqe->fd = fd->Fd;
+	sqe->addr = (uintptr_t)req->Buffer;
+	sqe->len = size;
+	sqe->off = (u64)req->Offset << fd->BlockSizePOT;
+	sqe->user_data = (uintptr_t)req;
+	r->SqArray[index] = index;
+	__atomic_store_n(r->SqTail, tail + 1, __ATOMIC_RELEASE);
+
+	while((ret = syscall(__NR_io_uring_enter, r->Fd, 1, 0, 0, NULL, 0)) < 0 &&
+		errno == EINTR) ;
+
+	/* Once the kernel has consumed the entry the request is in flight and
+		completes normally, even if the call failed. Without SQPOLL the kernel
+		only looks at the ring during the call, so an entry it did not
+		consume is taken back and can not run later. */
+	if(ret != 1 && __atomic_load_n(r->SqHead, __ATOMIC_ACQUIRE) == tail)
+	{
+		__atomic_store_n(r->SqTail, tail, __ATOMIC_RELEASE);
+		return DEVICE_STATUS_FAILURE;
+	}
+
+	return DEVICE_STATUS_OK;
+}
+
+static DeviceStatus _filedev_complete(void *ctx, DeviceRequest **req)
+{
+	FileDev *fd = ctx;
+	FileDevRing *r = &fd->Ring;
+	struct io_uring_cqe *cqe;
+	DeviceRequest *done;
+	u32 head;
+
+	if(fd->Done)
+	{
+		*req = fd->Done;
+		fd->Done = fd->Done->Next;
+		return DEVICE_STATUS_OK;
+	}
+
+	head = *r->CqHead;
+	while(head == __atomic_load_n(r->CqTail, __ATOMIC_ACQUIRE))
+	{
+		if(syscall(__NR_io_uring_enter, r->Fd, 0, 1,
+			IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+		{
+			return DEVICE_STATUS_FAILURE;
+		}
+	}
+
+	cqe = &r->Cqes[head & r->CqMask];
+	done = (DeviceRequest *)(uintptr_t)cqe->user_data;
+	done->Status = (cqe->res >= 0 &&
+		(size_t)cqe->res == (size_t)done->Count << fd->BlockSizePOT) ?
+		DEVICE_STATUS_OK : DEVICE_STATUS_FAILURE;
+
+	__atomic_store_n(r->CqHead, head + 1, __ATOMIC_RELEASE);
+	*req = done;
+	return DEVICE_STATUS_OK;
+}
+
+#endif /* FILEDEV_URING */
+
+DeviceStatus filedev_open(BlockDevice *dev, const char *path,
+	u32 block_size, u32 block_count, int flags)
+{
+	FileDev *fd;
+	int oflags;
+	u32 pot;
+
+	PROPAGATE(dev_block_size_pot(block_size, &pot));
+	if((flags & FILEDEV_DIRECT) &&
+		(block_size < 512 || (flags & FILEDEV_MMAP)))
+	{
+		/* O_DIRECT transfers must be multiples of the sector size,
+			and a mapped file always goes through the page cache */
+		return DEVICE_STATUS_FAILURE;
+	}
+
+	oflags = O_RDWR;
+	if(flags & FILEDEV_CREATE)
+	{
+		oflags |= O_CREAT;
+	}
+
+	if(flags & FILEDEV_DIRECT)
+	{
+		oflags |= O_DIRECT;
+	}
+
+	if(!(fd = calloc(1, sizeof(*fd))))
+	{
+		return DEVICE_STATUS_FAILURE;
+	}
+
+#ifdef FILEDEV_URING
+	fd->Ring.Fd = -1;
+#endif
+
+	if((fd->Fd = open(path, oflags, 0644)) < 0)
+	{
+		free(fd);
+		return DEVICE_STATUS_FAILURE;
+	}
+
+	if(_image_size(fd->Fd, pot, &block_count))
+	{
+		close(fd->Fd);
+		free(fd);
+		return DEVICE_STATUS_FAILURE;
+	}
+
+	fd->Flags = flags;
+	fd->BlockSizePOT = pot;
+	fd->BlockCount = block_count;
+	if((flags & FILEDEV_MMAP) && _map_file(fd))
+	{
+		close(fd->Fd);
+		free(fd);
+		return DEVICE_STATUS_FAILURE;
+	}
+
+	memset(dev, 0, sizeof(*dev));
+	dev->BlockSize = block_size;
+	dev->BlockSizePOT = pot;
+	dev->BlockCount = block_count;
+	dev->Context = fd;
+	dev->Read = _filedev_read;
+	dev->Write = _filedev_write;
+	dev->Flush = _filedev_flush;
+	dev->ReadV = _filedev_readv;
+	dev->WriteV = _filedev_writev;
+	dev->Zero = _filedev_zero;
+	dev->Discard = _filedev_discard;
+
+	/* O_DIRECT bypasses the page cache, there is nothing to fill */
+	if(!(flags & FILEDEV_DIRECT))
+	{
+		dev->Prefetch = _filedev_prefetch;
+	}
+
+	if(fd->Map)
+	{
+		dev->Map = _filedev_map;
+	}
+
+#ifdef FILEDEV_URING
+	/* Without io_uring, async requests use the generic thread pool */
+	if(!fd->Map && !_ring_setup(&fd->Ring))
+	{
+		dev->Submit = _filedev_submit;
+		dev->Complete = _filedev_complete;
+	}
+#endif
+
+	return DEVICE_STATUS_OK;
+}
+
+void filedev_close(BlockDevice *dev)
+{
+	FileDev *fd = dev->Context;
+	if(fd->Map)
+	{
+		munmap(fd->Map, (size_t)fd->BlockCount << fd->BlockSizePOT);
+	}
+
+#ifdef FILEDEV_URING
+	_ring_destroy(&fd->Ring);
+#endif
+
+	close(fd->Fd);
+	free(fd->Bounce);
+	free(fd);
+	dev->Context = NULL;
+}
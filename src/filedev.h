@@ -0,0 +1,49 @@
+/**
+ * @file    filedev.h
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ * @brief   Block device backed by an image file (Linux)
+ */
+
+#ifndef __FILEDEV_H__
+#define __FILEDEV_H__
+
+#include "dev.h"
+
+/** Create the image file if it does not exist */
+#define FILEDEV_CREATE  (1 << 0)
+
+/** Bypass the page cache (O_DIRECT), unaligned buffers are bounced */
+#define FILEDEV_DIRECT  (1 << 1)
+
+/** Map the whole file into memory, enables zero-copy Map operation */
+#define FILEDEV_MMAP    (1 << 2)
+
+/** Buffer and offset alignment required for O_DIRECT */
+#define FILEDEV_DIRECT_ALIGN  4096
+
+/**
+ * @brief Open an image file as a block device. All I/O is done with
+ *        positional reads and writes (pread/pwrite), or with memcpy
+ *        if the file is mapped (FILEDEV_MMAP).
+ *
+ * @param dev Output parameter block device
+ * @param path Path of the image file
+ * @param block_size Size of a block in bytes, must be a power of two
+ * @param block_count Number of blocks, the file is extended to this size
+ *                    if it is smaller. If 0, the size of the file is used.
+ * @param flags FILEDEV_CREATE, FILEDEV_DIRECT or FILEDEV_MMAP
+ * @return Status code
+ */
+DeviceStatus filedev_open(BlockDevice *dev, const char *path,
+	u32 block_size, u32 block_count, int flags);
+
+/**
+ * @brief Close an image file block device
+ *
+ * @param dev Block device opened with filedev_open
+ */
+void filedev_close(BlockDevice *dev);
+
+#endif /* __FILEDEV_H__ */
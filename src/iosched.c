@@ -0,0 +1,312 @@
+/**
+ * @file    iosched.c
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ */
+
+#include "iosched.h"
+#include <stdlib.h>
+#include <string.h>
+
+/** Scheduler instance data */
+typedef struct
+{
+	/** Underlying device */
+	BlockDevice *Lower;
+
+	/** Block numbers of the pending writes, sorted ascending */
+	u32 *Blocks;
+
+	/** Data slot of each pending write, parallel to Blocks */
+	u32 *Slots;
+
+	/** Stack of unused data slots */
+	u32 *Free;
+
+	/** Memory for the data of all slots */
+	u8 *Data;
+
+	/** Pending blocks copied into block order for dispatch */
+	u8 *Staging;
+
+	/** One entry per run of adjacent blocks */
+	DeviceIOVec *Vec;
+
+	/** Number of pending writes */
+	u32 Count;
+
+	/** Maximum number of pending writes */
+	u32 Depth;
+} IOSched;
+
+static u8 *_slot_data(IOSched *s, u32 i)
+{
+	return s->Data + ((size_t)s->Slots[i] << s->Lower->BlockSizePOT);
+}
+
+/* Index of the first pending write with a block number >= block */
+static u32 _lower_bound(IOSched *s, u32 block)
+{
+	u32 lo = 0, hi = s->Count, mid;
+	while(lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		if(s->Blocks[mid] < block)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+/* Forget pending writes in a range, they are superseded */
+static void _drop(IOSched *s, u32 offset, u32 count)
+{
+	u32 lo, hi, i;
+
+	/* Push the slots on the free stack, which grows upwards from
+		Depth - Count */
+	lo = _lower_bound(s, offset);
+	for(hi = lo; hi < s->Count && s->Blocks[hi] - offset < count; ++hi)
+	{
+		s->Free[s->Depth - s->Count + (hi - lo)] = s->Slots[hi];
+	}
+
+	if(hi == lo)
+	{
+		return;
+	}
+
+	for(i = hi; i < s->Count; ++i)
+	{
+		s->Blocks[i - (hi - lo)] = s->Blocks[i];
+		s->Slots[i - (hi - lo)] = s->Slots[i];
+	}
+
+	s->Count -= hi - lo;
+}
+
+static DeviceStatus _dispatch(IOSched *s)
+{
+	u32 i, n, bs;
+
+	if(!s->Count)
+	{
+		return DEVICE_STATUS_OK;
+	}
+
+	/* Blocks are already sorted, copy them next to each other so that
+		every run of adjacent blocks becomes one request */
+	bs = s->Lower->BlockSize;
+	for(i = 0, n = 0; i < s->Count; ++i)
+	{
+		memcpy(s->Staging + (size_t)i * bs, _slot_data(s, i), bs);
+		if(n && s->Blocks[i] == s->Blocks[i - 1] + 1)
+		{
+			++s->Vec[n - 1].Count;
+		}
+		else
+		{
+			s->Vec[n].Offset = s->Blocks[i];
+			s->Vec[n].Count = 1;
+			s->Vec[n].Buffer = s->Staging + (size_t)i * bs;
+			++n;
+		}
+	}
+
+	PROPAGATE(dev_writev(s->Lower, s->Vec, n));
+	for(i = 0; i < s->Depth; ++i)
+	{
+		s->Free[i] = i;
+	}
+
+	s->Count = 0;
+	return DEVICE_STATUS_OK;
+}
+
+/* Add or replace the pending write of one block */
+static DeviceStatus _insert(IOSched *s, u32 block, const u8 *data)
+{
+	u32 pos, i;
+
+	pos = _lower_bound(s, block);
+	if(pos == s->Count || s->Blocks[pos] != block)
+	{
+		if(s->Count == s->Depth)
+		{
+			PROPAGATE(_dispatch(s));
+			pos = 0;
+		}
+
+		for(i = s->Count; i > pos; --i)
+		{
+			s->Blocks[i] = s->Blocks[i - 1];
+			s->Slots[i] = s->Slots[i - 1];
+		}
+
+		/* Pop a slot from the free stack */
+		s->Blocks[pos] = block;
+		s->Slots[pos] = s->Free[s->Depth - s->Count - 1];
+		++s->Count;
+	}
+
+	memcpy(_slot_data(s, pos), data, s->Lower->BlockSize);
+	return DEVICE_STATUS_OK;
+}
+
+static DeviceStatus _iosched_read(void *ctx, u32 offset, u32 count,
+	u8 *buffer)
+{
+	IOSched *s = ctx;
+	u32 lo, hi, i, bs;
+
+	lo = _lower_bound(s, offset);
+	for(hi = lo; hi < s->Count && s->Blocks[hi] - offset < count; ++hi) ;
+
+	/* Skip the device if every block is pending */
+	if(hi - lo < count)
+	{
+		PROPAGATE(dev_read(s->Lower, offset, count, buffer));
+	}
+
+	bs = s->Lower->BlockSize;
+	for(i = lo; i < hi; ++i)
+	{
+		memcpy(buffer + (size_t)(s->Blocks[i] - offset) * bs,
+			_slot_data(s, i), bs);
+	}
+
+	return DEVICE_STATUS_OK;
+}
+
+static DeviceStatus _iosched_write(void *ctx, u32 offset, u32 count,
+	const u8 *buffer)
+{
+	IOSched *s = ctx;
+	u32 i, bs;
+
+	/* Large writes are already efficient */
+	if(count > s->Depth / 2)
+	{
+		_drop(s, offset, count);
+		return dev_write(s->Lower, offset, count, buffer);
+	}
+
+	bs = s->Lower->BlockSize;
+	for(i = 0; i < count; ++i)
+	{
+		PROPAGATE(_insert(s, offset + i, buffer + (size_t)i * bs));
+	}
+
+	return DEVICE_STATUS_OK;
+}
+
+static DeviceStatus _iosched_zero(void *ctx, u32 offset, u32 count)
+{
+	IOSched *s = ctx;
+	_drop(s, offset, count);
+	return dev_zero(s->Lower, offset, count);
+}
+
+static DeviceStatus _iosched_discard(void *ctx, u32 offset, u32 count)
+{
+	IOSched *s = ctx;
+	_drop(s, offset, count);
+	return dev_discard(s->Lower, offset, count);
+}
+
+/* Pending blocks are overlaid on the read later, prefetch them anyway */
+static DeviceStatus _iosched_prefetch(void *ctx, u32 offset, u32 count)
+{
+	IOSched *s = ctx;
+	return dev_prefetch(s->Lower, offset, count);
+}
+
+static DeviceStatus _iosched_flush(void *ctx)
+{
+	IOSched *s = ctx;
+	PROPAGATE(_dispatch(s));
+	return dev_flush(s->Lower);
+}
+
+static void _iosched_free(IOSched *s)
+{
+	free(s->Blocks);
+	free(s->Slots);
+	free(s->Free);
+	free(s->Data);
+	free(s->Staging);
+	free(s->Vec);
+	free(s);
+}
+
+DeviceStatus iosched_create(BlockDevice *sched, BlockDevice *dev, u32 depth)
+{
+	IOSched *s;
+	u32 i;
+
+	if(!depth)
+	{
+		depth = IOSCHED_DEFAULT_DEPTH;
+	}
+
+	if(!(s = calloc(1, sizeof(*s))))
+	{
+		return DEVICE_STATUS_FAILURE;
+	}
+
+	s->Blocks = malloc(depth * sizeof(*s->Blocks));
+	s->Slots = malloc(depth * sizeof(*s->Slots));
+	s->Free = malloc(depth * sizeof(*s->Free));
+	s->Data = malloc((size_t)depth * dev->BlockSize);
+	s->Staging = malloc((size_t)depth * dev->BlockSize);
+	s->Vec = malloc(depth * sizeof(*s->Vec));
+	if(!s->Blocks || !s->Slots || !s->Free ||
+		!s->Data || !s->Staging || !s->Vec)
+	{
+		_iosched_free(s);
+		return DEVICE_STATUS_FAILURE;
+	}
+
+	for(i = 0; i < depth; ++i)
+	{
+		s->Free[i] = i;
+	}
+
+	s->Lower = dev;
+	s->Depth = depth;
+	s->Count = 0;
+
+	memset(sched, 0, sizeof(*sched));
+	sched->BlockSize = dev->BlockSize;
+	sched->BlockSizePOT = dev->BlockSizePOT;
+	sched->BlockCount = dev->BlockCount;
+	sched->Context = s;
+	sched->Read = _iosched_read;
+	sched->Write = _iosched_write;
+	sched->Flush = _iosched_flush;
+	sched->Zero = _iosched_zero;
+	sched->Discard = _iosched_discard;
+	sched->Prefetch = dev->Prefetch ? _iosched_prefetch : NULL;
+	return DEVICE_STATUS_OK;
+}
+
+DeviceStatus iosched_dispatch(BlockDevice *sched)
+{
+	return _dispatch(sched->Context);
+}
+
+DeviceStatus iosched_destroy(BlockDevice *sched)
+{
+	IOSched *s = sched->Context;
+	DeviceStatus status = _dispatch(s);
+	_iosched_free(s);
+	sched->Context = NULL;
+	return status;
+}
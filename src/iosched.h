@@ -0,0 +1,50 @@
+/**
+ * @file    iosched.h
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ * @brief   Write-coalescing I/O scheduler
+ *
+ * Stacking block device that holds back small writes. A write to a
+ * block that is already pending replaces the pending data, so only the
+ * last write to a block reaches the device. When the queue is full or
+ * on flush, the pending blocks are dispatched in ascending order and
+ * runs of adjacent blocks are merged into one multi-block request.
+ * Reads see pending writes.
+ */
+
+#ifndef __IOSCHED_H__
+#define __IOSCHED_H__
+
+#include "dev.h"
+
+/** Default number of blocks that can be pending */
+#define IOSCHED_DEFAULT_DEPTH  64
+
+/**
+ * @brief Create a write-coalescing scheduler on top of a device
+ *
+ * @param sched Output parameter scheduled block device
+ * @param dev Underlying block device
+ * @param depth Maximum number of pending blocks, 0 for the default
+ * @return Status code
+ */
+DeviceStatus iosched_create(BlockDevice *sched, BlockDevice *dev, u32 depth);
+
+/**
+ * @brief Dispatch all pending writes
+ *
+ * @param sched Scheduled block device
+ * @return Status code
+ */
+DeviceStatus iosched_dispatch(BlockDevice *sched);
+
+/**
+ * @brief Dispatch pending writes and free a scheduler
+ *
+ * @param sched Scheduled block device
+ * @return Status code of the final dispatch
+ */
+DeviceStatus iosched_destroy(BlockDevice *sched);
+
+#endif /* __IOSCHED_H__ */
@@ -0,0 +1,296 @@
+/**
+ * @file    iostat.c
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ */
+
+#include "iostat.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+/** Accounting device instance data */
+typedef struct
+{
+	/** Underlying device */
+	BlockDevice *Lower;
+
+	/** Counters per tag and operation */
+	IOStatCounter Counters[DEV_IO_TAG_COUNT][IOSTAT_OP_COUNT];
+} IOStat;
+
+static u64 _now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static u32 _bucket(u64 ns)
+{
+	u32 i;
+	for(i = 0; i < IOSTAT_BUCKETS - 1 && ns >= ((u64)1 << i); ++i) ;
+	return i;
+}
+
+/* Counters are updated atomically, the thread pool of the request queue
+	calls the device from several threads */
+static void _account(IOStat *st, u32 op, u64 blocks, u64 bytes, u64 start)
+{
+	u64 ns = _now_ns() - start;
+	u32 tag = dev_io_tag < DEV_IO_TAG_COUNT ? dev_io_tag : 0;
+	IOStatCounter *c = &st->Counters[tag][op];
+
+	__atomic_fetch_add(&c->Calls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&c->Blocks, blocks, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&c->Bytes, bytes, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&c->TotalNs, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&c->Histogram[_bucket(ns)], 1, __ATOMIC_RELAXED);
+}
+
+static u64 _vec_blocks(const DeviceIOVec *vec, u32 n)
+{
+	u64 blocks = 0;
+	u32 i;
+	for(i = 0; i < n; ++i)
+	{
+		blocks += vec[i].Count;
+	}
+
+	return blocks;
+}
+
+static DeviceStatus _iostat_read(void *ctx, u32 offset, u32 count,
+	u8 *buffer)
+{
+	IOStat *st = ctx;
+	u64 start = _now_ns();
+	DeviceStatus status = dev_read(st->Lower, offset, count, buffer);
+	_account(st, IOSTAT_READ, count,
+		(u64)count << st->Lower->BlockSizePOT, start);
+	return status;
+}
+
+static DeviceStatus _iostat_write(void *ctx, u32 offset, u32 count,
+	const u8 *buffer)
+{
+	IOStat *st = ctx;
+	u64 start = _now_ns();
+	DeviceStatus status = dev_write(st->Lower, offset, count, buffer);
+	_account(st, IOSTAT_WRITE, count,
+		(u64)count << st->Lower->BlockSizePOT, start);
+	return status;
+}
+
+static DeviceStatus _iostat_readv(void *ctx, const DeviceIOVec *vec, u32 n)
+{
+	IOStat *st = ctx;
+	u64 start = _now_ns();
+	u64 blocks = _vec_blocks(vec, n);
+	DeviceStatus status = dev_readv(st->Lower, vec, n);
+	_account(st, IOSTAT_READV, blocks,
+		blocks << st->Lower->BlockSizePOT, start);
+	return status;
+}
+
+static DeviceStatus _iostat_writev(void *ctx, const DeviceIOVec *vec, u32 n)
+{
+	IOStat *st = ctx;
+	u64 start = _now_ns();
+	u64 blocks = _vec_blocks(vec, n);
+	DeviceStatus status = dev_writev(st->Lower, vec, n);
+	_account(st, IOSTAT_WRITEV, blocks,
+		blocks << st->Lower->BlockSizePOT, start);
+	return status;
+}
+
+static DeviceStatus _iostat_map(void *ctx, u32 offset, u32 count,
+	const u8 **ptr)
+{
+	IOStat *st = ctx;
+	u64 start = _now_ns();
+	DeviceStatus status = st->Lower->Map(st->Lower->Context,
+		offset, count, ptr);
+	_account(st, IOSTAT_MAP, count, 0, start);
+	return status;
+}
+
+static void _iostat_unmap(void *ctx, u32 offset, u32 count)
+{
+	IOStat *st = ctx;
+	st->Lower->Unmap(st->Lower->Context, offset, count);
+}
+
+static DeviceStatus _iostat_zero(void *ctx, u32 offset, u32 count)
+{
+	IOStat *st = ctx;
+	u64 start = _now_ns();
+	DeviceStatus status = dev_zero(st->Lower, offset, count);
+	_account(st, IOSTAT_ZERO, count, 0, start);
+	return status;
+}
+
+static DeviceStatus _iostat_discard(void *ctx, u32 offset, u32 count)
+{
+	IOStat *st = ctx;
+	u64 start = _now_ns();
+	DeviceStatus status = dev_discard(st->Lower, offset, count);
+	_account(st, IOSTAT_DISCARD, count, 0, start);
+	return status;
+}
+
+static DeviceStatus _iostat_prefetch(void *ctx, u32 offset, u32 count)
+{
+	IOStat *st = ctx;
+	u64 start = _now_ns();
+	DeviceStatus status = dev_prefetch(st->Lower, offset, count);
+	_account(st, IOSTAT_PREFETCH, count, 0, start);
+	return status;
+}
+
+static DeviceStatus _iostat_flush(void *ctx)
+{
+	IOStat *st = ctx;
+	u64 start = _now_ns();
+	DeviceStatus status = dev_flush(st->Lower);
+	_account(st, IOSTAT_FLUSH, 0, 0, start);
+	return status;
+}
+
+/* Only the submission is counted, the device does the work later */
+static DeviceStatus _iostat_submit(void *ctx, DeviceRequest *req)
+{
+	IOStat *st = ctx;
+	u64 start = _now_ns();
+	DeviceStatus status = st->Lower->Submit(st->Lower->Context, req);
+	_account(st, IOSTAT_SUBMIT, req->Count,
+		(u64)req->Count << st->Lower->BlockSizePOT, start);
+	return status;
+}
+
+static DeviceStatus _iostat_complete(void *ctx, DeviceRequest **req)
+{
+	IOStat *st = ctx;
+	return st->Lower->Complete(st->Lower->Context, req);
+}
+
+DeviceStatus iostat_create(BlockDevice *stats, BlockDevice *dev)
+{
+	IOStat *st;
+
+	if(!(st = calloc(1, sizeof(*st))))
+	{
+		return DEVICE_STATUS_FAILURE;
+	}
+
+	st->Lower = dev;
+
+	/* Optional operations are only offered if the device has them,
+		so the fallbacks of the dev_* functions still apply */
+	memset(stats, 0, sizeof(*stats));
+	stats->BlockSize = dev->BlockSize;
+	stats->BlockSizePOT = dev->BlockSizePOT;
+	stats->BlockCount = dev->BlockCount;
+	stats->Context = st;
+	stats->Read = _iostat_read;
+	stats->Write = _iostat_write;
+	stats->Flush = _iostat_flush;
+	stats->Map = dev->Map ? _iostat_map : NULL;
+	stats->Unmap = dev->Unmap ? _iostat_unmap : NULL;
+	stats->ReadV = dev->ReadV ? _iostat_readv : NULL;
+	stats->WriteV = dev->WriteV ? _iostat_writev : NULL;
+	stats->Zero = dev->Zero ? _iostat_zero : NULL;
+	stats->Discard = dev->Discard ? _iostat_discard : NULL;
+	stats->Prefetch = dev->Prefetch ? _iostat_prefetch : NULL;
+	if(dev->Submit && dev->Complete)
+	{
+		stats->Submit = _iostat_submit;
+		stats->Complete = _iostat_complete;
+	}
+
+	return DEVICE_STATUS_OK;
+}
+
+const IOStatCounter *iostat_get(BlockDevice *stats, u32 tag, u32 op)
+{
+	IOStat *st = stats->Context;
+	return &st->Counters[tag][op];
+}
+
+/* Upper bound of the latency below which `permille` of the calls are */
+static u64 _percentile_ns(const IOStatCounter *c, u32 permille)
+{
+	u64 sum, limit;
+	u32 i;
+
+	limit = (c->Calls * permille + 999) / 1000;
+	for(i = 0, sum = 0; i < IOSTAT_BUCKETS; ++i)
+	{
+		if((sum += c->Histogram[i]) >= limit)
+		{
+			break;
+		}
+	}
+
+	return (u64)1 << i;
+}
+
+void iostat_print(BlockDevice *stats, const char *(*tag_name)(u32))
+{
+	static const char *op_str[] =
+	{
+		"read",
+		"write",
+		"readv",
+		"writev",
+		"map",
+		"zero",
+		"discard",
+		"flush",
+		"submit",
+		"prefetch",
+	};
+
+	IOStat *st = stats->Context;
+	const IOStatCounter *c;
+	u32 tag, op, header;
+
+	printf("%-10s %-8s %8s %10s %12s %10s %10s %10s\n",
+		"tag", "op", "calls", "blocks", "bytes",
+		"avg-ns", "p50-ns<", "p99-ns<");
+
+	for(tag = 0; tag < DEV_IO_TAG_COUNT; ++tag)
+	{
+		header = 0;
+		for(op = 0; op < IOSTAT_OP_COUNT; ++op)
+		{
+			c = &st->Counters[tag][op];
+			if(!c->Calls)
+			{
+				continue;
+			}
+
+			printf("%-10s %-8s %8"PRIu64" %10"PRIu64" %12"PRIu64
+				" %10"PRIu64" %10"PRIu64" %10"PRIu64"\n",
+				header ? "" : tag_name(tag), op_str[op],
+				c->Calls, c->Blocks, c->Bytes, c->TotalNs / c->Calls,
+				_percentile_ns(c, 500), _percentile_ns(c, 990));
+			header = 1;
+		}
+	}
+}
+
+void iostat_reset(BlockDevice *stats)
+{
+	IOStat *st = stats->Context;
+	memset(st->Counters, 0, sizeof(st->Counters));
+}
+
+void iostat_destroy(BlockDevice *stats)
+{
+	free(stats->Context);
+	stats->Context = NULL;
+}
@@ -0,0 +1,99 @@
+/**
+ * @file    iostat.h
+ * @author  Tim Gabrikowski, Anton Tchekov
+ * @version 0.1
+ * @date    18.10.2026
+ * @brief   I/O accounting block device
+ *
+ * Stacking block device that counts calls, blocks and bytes of every
+ * operation and records a latency histogram for it. Everything is
+ * accounted to the tag in `dev_io_tag` at the time of the call, which
+ * the file system sets to the API operation that is running.
+ */
+
+#ifndef __IOSTAT_H__
+#define __IOSTAT_H__
+
+#include "dev.h"
+
+/** Accounted device operations */
+enum
+{
+	IOSTAT_READ,
+	IOSTAT_WRITE,
+	IOSTAT_READV,
+	IOSTAT_WRITEV,
+	IOSTAT_MAP,
+	IOSTAT_ZERO,
+	IOSTAT_DISCARD,
+	IOSTAT_FLUSH,
+	IOSTAT_SUBMIT,
+	IOSTAT_PREFETCH,
+	IOSTAT_OP_COUNT,
+};
+
+/** Number of latency histogram buckets, bucket i counts calls that took
+	less than 2^i nanoseconds */
+#define IOSTAT_BUCKETS  32
+
+/** Counters of one operation */
+typedef struct
+{
+	/** Number of calls */
+	u64 Calls;
+
+	/** Number of blocks transferred */
+	u64 Blocks;
+
+	/** Number of bytes transferred */
+	u64 Bytes;
+
+	/** Sum of the latencies in nanoseconds */
+	u64 TotalNs;
+
+	/** Latency histogram */
+	u64 Histogram[IOSTAT_BUCKETS];
+} IOStatCounter;
+
+/**
+ * @brief Create an accounting device on top of a device
+ *
+ * @param stats Output parameter accounting block device
+ * @param dev Underlying block device
+ * @return Status code
+ */
+DeviceStatus iostat_create(BlockDevice *stats, BlockDevice *dev);
+
+/**
+ * @brief Get the counters of a tag and operation
+ *
+ * @param stats Accounting block device
+ * @param tag I/O tag
+ * @param op IOSTAT_* operation
+ * @return Pointer to counters
+ */
+const IOStatCounter *iostat_get(BlockDevice *stats, u32 tag, u32 op);
+
+/**
+ * @brief Print all non-zero counters to stdout
+ *
+ * @param stats Accounting block device
+ * @param tag_name Function that returns the name of a tag
+ */
+void iostat_print(BlockDevice *stats, const char *(*tag_name)(u32));
+
+/**
+ * @brief Reset all counters to zero
+ *
+ * @param stats Accounting block device
+ */
+void iostat_reset(BlockDevice *stats);
+
+/**
+ * @brief Free an accounting device
+ *
+ * @param stats Accounting block device
+ */
+void iostat_destroy(BlockDevice *stats);
+
+#endif /* __IOSTAT_H__ */
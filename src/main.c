@@ -8,18 +8,36 @@
 
 #include <stdio.h>
 #include "ramdisk.h"
+#include "filedev.h"
+#include "bcache.h"
+#include "iostat.h"
+#include "iosched.h"
 #include "atfs_dir.h"
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
 #include "atfs.h"
 #include "atfs_format.h"
 #include "atfs_alloc.h"
+#include "atfs_file.h"
+#include "atfs_mount.h"
+#include "atfs_defrag.h"
+#include "bench.h"
+#include "check.h"
 
 ATFS_Status atfs_ls(BlockDevice *dev, const char *path, int detailed);
 ATFS_Status atfs_tree(BlockDevice *dev, const char *path);
 
 #define WHITESPACE " \n\t\v\f\r"
 
+/** RAM disk or image file, write scheduler, block cache and I/O accounting
+	on top of it, which sees every request of the file system */
+static BlockDevice _disk, _sched, _cache, _stats;
+
+/** Device used by the shell commands */
+static BlockDevice *_dev = &_stats;
+
 typedef void (*ShellCommandFunction)(int, char **);
 
 typedef struct
@@ -36,6 +54,19 @@ static void _cmd_rm(int count, char **args);
 static void _cmd_mkdir(int count, char **args);
 static void _cmd_move(int count, char **args);
 static void _cmd_copy(int count, char **args);
+static void _cmd_sync(int count, char **args);
+static void _cmd_stats(int count, char **args);
+static void _cmd_policy(int count, char **args);
+static void _cmd_fragbench(int count, char **args);
+static void _cmd_dirbench(int count, char **args);
+static void _cmd_asyncbench(int count, char **args);
+static void _cmd_check(int count, char **args);
+static void _cmd_defrag(int count, char **args);
+static void _cmd_statfs(int count, char **args);
+static void _cmd_delalloc(int count, char **args);
+static void _cmd_resize(int count, char **args);
+static void _cmd_populate(int count, char **args);
+static void _cmd_dcache(int count, char **args);
 
 static const ShellCommand _cmds[] =
 {
@@ -47,6 +78,20 @@ static const ShellCommand _cmds[] =
 	{ _cmd_mkdir, "mkdir", "Create directory" },
 	{ _cmd_move,  "move",  "Move/Rename" },
 	{ _cmd_copy,  "copy",  "Copy" },
+	{ _cmd_sync,  "sync",  "Write back cached blocks" },
+	{ _cmd_stats, "stats", "Print and reset I/O statistics" },
+	{ _cmd_policy, "policy", "Select the allocation policy" },
+	{ _cmd_fragbench, "fragbench", "Compare allocation policies on an aged volume" },
+	{ _cmd_dirbench, "dirbench", "Compare directory scans with and without name tags" },
+	{ _cmd_asyncbench, "asyncbench", "Write and read a file with queued requests" },
+	{ _cmd_check, "check", "Run self checks on scratch volumes" },
+	{ _cmd_defrag, "defrag", "Move files together to merge free space" },
+	{ _cmd_statfs, "statfs", "Print free space" },
+	{ _cmd_delalloc, "delalloc", "Allocate blocks of new files when written" },
+	{ _cmd_resize, "grow", "Add blocks to the end of a file" },
+	{ _cmd_resize, "resize", "Change the capacity of a file" },
+	{ _cmd_populate, "populate", "Create many files in a directory at once" },
+	{ _cmd_dcache, "dcache", "Print name lookup cache statistics or set its size" },
 	{ NULL,       "exit",  "Exit program" },
 	{ NULL,       "quit",  "Alias for exit" },
 };
@@ -71,7 +116,7 @@ static void _cmd_ls(int count, char **args)
 		return;
 	}
 
-	printf("%s\n", atfs_status_string(atfs_ls(&ramdisk, args[1], 0)));
+	printf("%s\n", atfs_status_string(atfs_ls(_dev, args[1], 0)));
 }
 
 static void _cmd_dir(int count, char **args)
@@ -82,7 +127,7 @@ static void _cmd_dir(int count, char **args)
 		return;
 	}
 
-	printf("%s\n", atfs_status_string(atfs_ls(&ramdisk, args[1], 1)));
+	printf("%s\n", atfs_status_string(atfs_ls(_dev, args[1], 1)));
 }
 
 static void _cmd_tree(int count, char **args)
@@ -93,7 +138,7 @@ static void _cmd_tree(int count, char **args)
 		return;
 	}
 
-	printf("%s\n", atfs_status_string(atfs_tree(&ramdisk, args[1])));
+	printf("%s\n", atfs_status_string(atfs_tree(_dev, args[1])));
 }
 
 static void _cmd_rm(int count, char **args)
@@ -104,7 +149,7 @@ static void _cmd_rm(int count, char **args)
 		return;
 	}
 
-	printf("%s\n", atfs_status_string(atfs_delete(&ramdisk, args[1])));
+	printf("%s\n", atfs_status_string(atfs_delete(_dev, args[1])));
 }
 
 static void _cmd_mkdir(int count, char **args)
@@ -116,7 +161,7 @@ static void _cmd_mkdir(int count, char **args)
 	}
 
 	printf("%s\n", atfs_status_string(atfs_fcreate(
-		&ramdisk, args[1], ATFS_TYPE_DIR, 4)));
+		_dev, args[1], ATFS_TYPE_DIR, 4)));
 }
 
 static void _cmd_move(int count, char **args)
@@ -127,7 +172,7 @@ static void _cmd_move(int count, char **args)
 		return;
 	}
 
-	printf("%s\n", atfs_status_string(atfs_move(&ramdisk, args[2], args[1])));
+	printf("%s\n", atfs_status_string(atfs_move(_dev, args[2], args[1])));
 }
 
 static void _cmd_copy(int count, char **args)
@@ -141,6 +186,276 @@ static void _cmd_copy(int count, char **args)
 	printf("%s\n", atfs_status_string(ATFS_STATUS_NOT_IMPLEMENTED));
 }
 
+static void _cmd_sync(int count, char **args)
+{
+	if(count != 1)
+	{
+		printf("Usage: sync\n");
+		return;
+	}
+
+	printf("%s\n", dev_status_string(dev_flush(_dev)));
+	(void)args;
+}
+
+static void _cmd_stats(int count, char **args)
+{
+	u32 i;
+
+	if(count != 1)
+	{
+		printf("Usage: stats\n");
+		return;
+	}
+
+	for(i = 0; i < ATFS_OP_COUNT; ++i)
+	{
+		if(atfs_op_calls[i])
+		{
+			printf("%-10s %8"PRIu64" calls\n",
+				atfs_op_string(i), atfs_op_calls[i]);
+		}
+	}
+
+	printf("\n");
+	iostat_print(&_stats, atfs_op_string);
+	memset(atfs_op_calls, 0, sizeof(atfs_op_calls));
+	iostat_reset(&_stats);
+	(void)args;
+}
+
+static void _cmd_policy(int count, char **args)
+{
+	u32 i;
+
+	if(count == 2)
+	{
+		for(i = 0; i < ATFS_POLICY_COUNT; ++i)
+		{
+			if(!strcmp(args[1], atfs_policy_string(i)))
+			{
+				printf("%s\n", atfs_status_string(
+					atfs_mount_policy(_dev, i)));
+				return;
+			}
+		}
+	}
+
+	printf("Usage: policy first-fit|best-fit|segregated\n");
+}
+
+static void _cmd_fragbench(int count, char **args)
+{
+	u32 blocks, ops;
+
+	if(count > 3)
+	{
+		printf("Usage: fragbench [block-count [operations]]\n");
+		return;
+	}
+
+	blocks = count > 1 ? strtoul(args[1], NULL, 0) : BENCH_DEFAULT_BLOCKS;
+	ops = count > 2 ? strtoul(args[2], NULL, 0) : BENCH_DEFAULT_OPS;
+	bench_alloc(blocks, ops);
+}
+
+static void _cmd_dirbench(int count, char **args)
+{
+	u32 blocks, lookups;
+
+	if(count > 3)
+	{
+		printf("Usage: dirbench [blocks [lookups]]\n");
+		return;
+	}
+
+	blocks = count > 1 ? strtoul(args[1], NULL, 0) : BENCH_DEFAULT_DIR_BLOCKS;
+	lookups = count > 2 ? strtoul(args[2], NULL, 0) :
+		BENCH_DEFAULT_LOOKUPS;
+	bench_dscan(_dev->BlockSize, blocks, lookups);
+}
+
+static void _cmd_asyncbench(int count, char **args)
+{
+	u32 blocks, depth;
+
+	if(count > 3)
+	{
+		printf("Usage: asyncbench [blocks [max-depth]]\n");
+		return;
+	}
+
+	blocks = count > 1 ? strtoul(args[1], NULL, 0) :
+		BENCH_DEFAULT_ASYNC_BLOCKS;
+	depth = count > 2 ? strtoul(args[2], NULL, 0) : BENCH_DEFAULT_ASYNC_DEPTH;
+	bench_async(blocks, depth);
+}
+
+static void _cmd_check(int count, char **args)
+{
+	check_run();
+	(void)count, (void)args;
+}
+
+static void _cmd_statfs(int count, char **args)
+{
+	ATFS_StatFS st;
+	ATFS_Status status;
+
+	if((status = atfs_statfs(_dev, &st)))
+	{
+		printf("%s\n", atfs_status_string(status));
+		return;
+	}
+
+	printf("Block size:  %"PRIu32"\n"
+		"Blocks:      %"PRIu32"\n"
+		"Groups:      %"PRIu32"\n"
+		"Free blocks: %"PRIu32"\n"
+		"Free areas:  %"PRIu32"\n"
+		"Largest:     %"PRIu32"\n"
+		"Reserved:    %"PRIu32"\n",
+		st.BlockSize, st.BlockCount, st.Groups,
+		st.FreeBlocks, st.FreeAreas, st.Largest, st.Reserved);
+
+	(void)count, (void)args;
+}
+
+static void _cmd_delalloc(int count, char **args)
+{
+	if(count == 2 && (!strcmp(args[1], "on") || !strcmp(args[1], "off")))
+	{
+		printf("%s\n", atfs_status_string(
+			atfs_mount_delalloc(_dev, !strcmp(args[1], "on"))));
+		return;
+	}
+
+	printf("Usage: delalloc on|off\n");
+}
+
+static void _cmd_dcache(int count, char **args)
+{
+	ATFS_DCacheStats stats;
+	ATFS_Status status;
+
+	if(count == 2)
+	{
+		printf("%s\n", atfs_status_string(
+			atfs_mount_dcache(_dev, strtoul(args[1], NULL, 0))));
+		return;
+	}
+
+	if(count != 1)
+	{
+		printf("Usage: dcache [size]\n");
+		return;
+	}
+
+	if((status = atfs_dcache_stats(_dev, &stats)))
+	{
+		printf("%s\n", atfs_status_string(status));
+		return;
+	}
+
+	printf("Names:  %"PRIu32" of %"PRIu32"\n"
+		"Hits:   %"PRIu32"\n"
+		"Misses: %"PRIu32"\n",
+		stats.Count, stats.Size, stats.Hits, stats.Misses);
+}
+
+static void _cmd_resize(int count, char **args)
+{
+	ATFS_File file;
+	ATFS_Status status;
+	u32 blocks;
+	int grow;
+
+	grow = !strcmp(args[0], "grow");
+	if(count != 3)
+	{
+		printf("Usage: %s `path` `blocks`\n", args[0]);
+		return;
+	}
+
+	if(!(status = atfs_fopen(_dev, args[1], &file)))
+	{
+		blocks = strtoul(args[2], NULL, 0);
+		if(!(status = grow ? atfs_fgrow(&file, blocks) :
+			atfs_fresize(&file, blocks)))
+		{
+			printf("%"PRIu32" blocks in %"PRIu32" extents\n", file.SizeBlocks,
+				file.Extents ? file.ExtentCount : 1);
+		}
+
+		atfs_fclose(&file);
+	}
+
+	printf("%s\n", atfs_status_string(status));
+}
+
+static void _cmd_populate(int count, char **args)
+{
+	char *storage, **names;
+	u32 i, n, *capacities;
+	ATFS_Status status;
+
+	if(count != 4 || !(n = strtoul(args[2], NULL, 0)))
+	{
+		printf("Usage: populate `dir` `count` `capacity`\n");
+		return;
+	}
+
+	/* Files f0, f1, ... */
+	storage = malloc((size_t)n * 16);
+	names = malloc(n * sizeof(*names));
+	capacities = malloc(n * sizeof(*capacities));
+	if(!storage || !names || !capacities)
+	{
+		status = ATFS_STATUS_OUT_OF_MEMORY;
+	}
+	else
+	{
+		for(i = 0; i < n; ++i)
+		{
+			names[i] = storage + (size_t)i * 16;
+			sprintf(names[i], "f%"PRIu32, i);
+			capacities[i] = strtoul(args[3], NULL, 0);
+		}
+
+		status = atfs_fcreate_many(_dev, args[1],
+			(const char *const *)names, capacities, n);
+	}
+
+	printf("%s\n", atfs_status_string(status));
+	free(storage);
+	free(names);
+	free(capacities);
+}
+
+static void _cmd_defrag(int count, char **args)
+{
+	u32 budget, moved, total;
+	ATFS_Status status;
+
+	if(count > 2)
+	{
+		printf("Usage: defrag [max-blocks]\n");
+		return;
+	}
+
+	/* Without a limit, run until everything is compacted */
+	budget = count > 1 ? strtoul(args[1], NULL, 0) : 0;
+	total = 0;
+	do
+	{
+		status = atfs_defrag(_dev, budget, &moved);
+		total += moved;
+	}
+	while(!status && !budget && moved);
+
+	printf("%"PRIu32" blocks moved\n%s\n", total, atfs_status_string(status));
+}
+
 static const char *dirslash(ATFS_FileType type)
 {
 	return type == ATFS_TYPE_DIR ? "/" : "";
@@ -178,6 +493,7 @@ ATFS_Status atfs_ls(BlockDevice *dev, const char *path, int detailed)
 		}
 	}
 
+	atfs_dclose(&dir);
 	if(status != ATFS_STATUS_DIR_END)
 	{
 		return status;
@@ -207,17 +523,27 @@ ATFS_Status atfs_tree(BlockDevice *dev, const char *path)
 			printf("- %s%s\n", entry.Name, dirslash(entry.Type));
 			if(entry.Type == ATFS_TYPE_DIR)
 			{
-				++nesting;
 				atfs_path_join(buf, entry.Name);
-				PROPAGATE(atfs_dopen(dev, buf, &dir[nesting]));
+				if((status = atfs_dopen(dev, buf, &dir[nesting + 1])))
+				{
+					break;
+				}
+
+				++nesting;
 			}
 		}
 
 		if(status != ATFS_STATUS_DIR_END)
 		{
+			while(nesting >= 0)
+			{
+				atfs_dclose(&dir[nesting--]);
+			}
+
 			return status;
 		}
 
+		atfs_dclose(&dir[nesting]);
 		--nesting;
 		atfs_path_parent(buf);
 	}
@@ -225,13 +551,102 @@ ATFS_Status atfs_tree(BlockDevice *dev, const char *path)
 	return ATFS_STATUS_OK;
 }
 
-int main(void)
+static void _usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-i image] [-c] [-d] [-m] [-F] [-g groups] "
+		"[-b] [-x] [-s] [block-size block-count]\n"
+		"  -i image  Use an image file instead of a RAM disk\n"
+		"  -c        Create the image file if it does not exist\n"
+		"  -d        Open the image file with O_DIRECT\n"
+		"  -m        Map the image file into memory\n"
+		"  -F        Format the image file\n"
+		"  -g groups Number of allocation groups when formatting\n"
+		"  -b        Track free space with a bitmap when formatting\n"
+		"  -x        Use hashed directories when formatting\n"
+		"  -s        Use sorted directories when formatting\n", name);
+}
+
+int main(int argc, char **argv)
 {
-	BlockDevice *dev = &ramdisk;
-	int i, count;
+	int i, count, opt, flags, format;
 	char *pch, buf[256], *args[16];
+	const char *image;
+	u32 block_size, block_count;
+	ATFS_FormatOptions fmt;
+	DeviceStatus status;
+
+	image = NULL;
+	flags = 0;
+	format = 0;
+	fmt.Groups = 1;
+	fmt.Allocator = ATFS_ALLOCATOR_LIST;
+	fmt.Directories = ATFS_DIR_LINEAR;
+	while((opt = getopt(argc, argv, "i:cdmFg:bxs")) != -1)
+	{
+		switch(opt)
+		{
+		case 'i': image = optarg; break;
+		case 'c': flags |= FILEDEV_CREATE; break;
+		case 'd': flags |= FILEDEV_DIRECT; break;
+		case 'm': flags |= FILEDEV_MMAP; break;
+		case 'F': format = 1; break;
+		case 'g': fmt.Groups = strtoul(optarg, NULL, 0); break;
+		case 'b': fmt.Allocator = ATFS_ALLOCATOR_BITMAP; break;
+		case 'x': fmt.Directories = ATFS_DIR_HASHED; break;
+		case 's': fmt.Directories = ATFS_DIR_SORTED; break;
+		default: _usage(argv[0]); return 1;
+		}
+	}
+
+	if(argc - optind != 0 && argc - optind != 2)
+	{
+		_usage(argv[0]);
+		return 1;
+	}
+
+	block_size = RAMDISK_DEFAULT_BLOCK_SIZE;
+	block_count = image ? 0 : RAMDISK_DEFAULT_BLOCK_COUNT;
+	if(argc - optind == 2)
+	{
+		block_size = strtoul(argv[optind], NULL, 0);
+		block_count = strtoul(argv[optind + 1], NULL, 0);
+	}
+
+	if(image)
+	{
+		status = filedev_open(&_disk, image, block_size, block_count, flags);
+	}
+	else
+	{
+		status = ramdisk_create(&_disk, block_size, block_count);
+		format = 1;
+	}
+
+	if(status)
+	{
+		fprintf(stderr, "Failed to open device: %s\n",
+			dev_status_string(status));
+		return 1;
+	}
+
+	if(iosched_create(&_sched, &_disk, IOSCHED_DEFAULT_DEPTH) ||
+		bcache_create(&_cache, &_sched, BCACHE_DEFAULT_SLOTS) ||
+		iostat_create(&_stats, &_cache))
+	{
+		fprintf(stderr, "Failed to allocate device stack\n");
+		return 1;
+	}
+
+	if(format)
+	{
+		printf("Format: %s\n", atfs_status_string(atfs_format_opts(_dev, &fmt)));
+	}
+
+	if((status = atfs_mount(_dev)))
+	{
+		printf("Mount: %s\n", atfs_status_string(status));
+	}
 
-	printf("RAMDISK Format: %s\n", atfs_status_string(atfs_format(dev)));
 	for(;;)
 	{
 		printf("> ");
@@ -267,6 +682,20 @@ int main(void)
 		}
 	}
 
+	atfs_unmount(_dev);
+	iostat_destroy(&_stats);
+	bcache_destroy(&_cache);
+	iosched_destroy(&_sched);
+	if(image)
+	{
+		dev_flush(&_disk);
+		filedev_close(&_disk);
+	}
+	else
+	{
+		ramdisk_destroy(&_disk);
+	}
+
 	return 0;
 }
 
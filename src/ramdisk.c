@@ -6,47 +6,165 @@
  */
 
 #include "ramdisk.h"
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
-#define RAMFS_BLOCK_SIZE   512
-#define RAMFS_BLOCK_COUNT  512
+/** Huge pages are only used for mappings aligned to their size */
+#define RAMDISK_HUGE_PAGE_SIZE  (2UL << 20)
 
-static u8 _data[RAMFS_BLOCK_SIZE * RAMFS_BLOCK_COUNT];
+/** RAM disk instance data */
+typedef struct
+{
+	/** Start of the disk contents (huge page aligned) */
+	u8 *Data;
+
+	/** Start of the whole mapping */
+	void *Map;
+
+	/** Length of the whole mapping in bytes */
+	size_t MapSize;
 
-static DeviceStatus _check_range(u32 offset, u32 count)
+	/** Block size as power of two */
+	u32 BlockSizePOT;
+
+	/** Number of blocks */
+	u32 BlockCount;
+} RamDisk;
+
+static DeviceStatus _check_range(RamDisk *rd, u32 offset, u32 count)
 {
-	return (offset >= RAMFS_BLOCK_COUNT) ||
-		(count >= RAMFS_BLOCK_COUNT) ||
-		(offset + count >= RAMFS_BLOCK_COUNT);
+	return (offset > rd->BlockCount) ||
+		(count > rd->BlockCount - offset);
+}
+
+static DeviceStatus _ramdisk_read(void *ctx, u32 offset, u32 count,
+	u8 *buffer)
+{
+	RamDisk *rd = ctx;
+	if(_check_range(rd, offset, count))
+	{
+		return DEVICE_STATUS_OUT_OF_BOUNDS;
+	}
+
+	memcpy(buffer, rd->Data + ((size_t)offset << rd->BlockSizePOT),
+		(size_t)count << rd->BlockSizePOT);
+	return DEVICE_STATUS_OK;
 }
 
-static DeviceStatus _ramdisk_read(u32 offset, u32 count, u8 *buffer)
+static DeviceStatus _ramdisk_write(void *ctx, u32 offset, u32 count,
+	const u8 *buffer)
 {
-	if(_check_range(offset, count))
+	RamDisk *rd = ctx;
+	if(_check_range(rd, offset, count))
 	{
 		return DEVICE_STATUS_OUT_OF_BOUNDS;
 	}
 
-	memcpy(buffer, _data + offset * RAMFS_BLOCK_SIZE, count * RAMFS_BLOCK_SIZE);
+	memcpy(rd->Data + ((size_t)offset << rd->BlockSizePOT), buffer,
+		(size_t)count << rd->BlockSizePOT);
 	return DEVICE_STATUS_OK;
 }
 
-static DeviceStatus _ramdisk_write(u32 offset, u32 count, const u8 *buffer)
+static DeviceStatus _ramdisk_map(void *ctx, u32 offset, u32 count,
+	const u8 **ptr)
 {
-	if(_check_range(offset, count))
+	RamDisk *rd = ctx;
+	if(_check_range(rd, offset, count))
 	{
 		return DEVICE_STATUS_OUT_OF_BOUNDS;
 	}
 
-	memcpy(_data + offset * RAMFS_BLOCK_SIZE, buffer, count * RAMFS_BLOCK_SIZE);
+	*ptr = rd->Data + ((size_t)offset << rd->BlockSizePOT);
 	return DEVICE_STATUS_OK;
 }
 
-BlockDevice ramdisk =
+/* Whole pages are given back to the kernel, they read as zero afterwards */
+static DeviceStatus _ramdisk_zero(void *ctx, u32 offset, u32 count)
 {
-	.BlockSize = RAMFS_BLOCK_SIZE,
-	.BlockSizePOT = 9,
-	.BlockCount = RAMFS_BLOCK_COUNT,
-	.Read = _ramdisk_read,
-	.Write = _ramdisk_write,
-};
+	RamDisk *rd = ctx;
+	uintptr_t start, end, page_start, page_end, page_size;
+
+	if(_check_range(rd, offset, count))
+	{
+		return DEVICE_STATUS_OUT_OF_BOUNDS;
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+	start = (uintptr_t)rd->Data + ((size_t)offset << rd->BlockSizePOT);
+	end = start + ((size_t)count << rd->BlockSizePOT);
+	page_start = (start + page_size - 1) & ~(page_size - 1);
+	page_end = end & ~(page_size - 1);
+	if(page_start >= page_end)
+	{
+		memset((void *)start, 0, end - start);
+		return DEVICE_STATUS_OK;
+	}
+
+	memset((void *)start, 0, page_start - start);
+	memset((void *)page_end, 0, end - page_end);
+	if(madvise((void *)page_start, page_end - page_start, MADV_DONTNEED))
+	{
+		memset((void *)page_start, 0, page_end - page_start);
+	}
+
+	return DEVICE_STATUS_OK;
+}
+
+DeviceStatus ramdisk_create(BlockDevice *dev, u32 block_size, u32 block_count)
+{
+	RamDisk *rd;
+	u32 pot;
+	size_t size;
+	uintptr_t aligned;
+
+	PROPAGATE(dev_block_size_pot(block_size, &pot));
+	if(!(rd = malloc(sizeof(*rd))))
+	{
+		return DEVICE_STATUS_FAILURE;
+	}
+
+	/* Map one huge page more than needed, so the start can be aligned */
+	size = (size_t)block_count << pot;
+	rd->MapSize = size + RAMDISK_HUGE_PAGE_SIZE;
+	rd->Map = mmap(NULL, rd->MapSize, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(rd->Map == MAP_FAILED)
+	{
+		free(rd);
+		return DEVICE_STATUS_FAILURE;
+	}
+
+	aligned = ((uintptr_t)rd->Map + RAMDISK_HUGE_PAGE_SIZE - 1) &
+		~(RAMDISK_HUGE_PAGE_SIZE - 1);
+
+	rd->Data = (u8 *)aligned;
+	rd->BlockSizePOT = pot;
+	rd->BlockCount = block_count;
+
+#ifdef MADV_HUGEPAGE
+	/* Only a hint, fails harmlessly if THP is disabled */
+	madvise(rd->Data, size, MADV_HUGEPAGE);
+#endif
+
+	memset(dev, 0, sizeof(*dev));
+	dev->BlockSize = block_size;
+	dev->BlockSizePOT = pot;
+	dev->BlockCount = block_count;
+	dev->Context = rd;
+	dev->Read = _ramdisk_read;
+	dev->Write = _ramdisk_write;
+	dev->Map = _ramdisk_map;
+	dev->Zero = _ramdisk_zero;
+	dev->Discard = _ramdisk_zero;
+	return DEVICE_STATUS_OK;
+}
+
+void ramdisk_destroy(BlockDevice *dev)
+{
+	RamDisk *rd = dev->Context;
+	munmap(rd->Map, rd->MapSize);
+	free(rd);
+	dev->Context = NULL;
+}
@@ -11,6 +11,29 @@
 
 #include "dev.h"
 
-extern BlockDevice ramdisk;
+/** Default block size of the test RAM disk */
+#define RAMDISK_DEFAULT_BLOCK_SIZE   512
+
+/** Default block count of the test RAM disk */
+#define RAMDISK_DEFAULT_BLOCK_COUNT  512
+
+/**
+ * @brief Create a zero filled RAM disk. The memory is mapped with mmap
+ *        and transparent huge pages are requested, so multi-GiB disks
+ *        are cheap to create and only use memory for touched pages.
+ *
+ * @param dev Output parameter block device
+ * @param block_size Size of a block in bytes, must be a power of two
+ * @param block_count Number of blocks
+ * @return Status code
+ */
+DeviceStatus ramdisk_create(BlockDevice *dev, u32 block_size, u32 block_count);
+
+/**
+ * @brief Free the memory of a RAM disk
+ *
+ * @param dev Block device created with ramdisk_create
+ */
+void ramdisk_destroy(BlockDevice *dev);
 
 #endif /* __RAMDISK_H__ */